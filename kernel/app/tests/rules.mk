@@ -18,10 +18,13 @@ MODULE_SRCS += \
     $(LOCAL_DIR)/printf_tests.c \
     $(LOCAL_DIR)/sync_ipi_tests.c \
     $(LOCAL_DIR)/sleep_tests.c \
+    $(LOCAL_DIR)/spinlock_tests.c \
     $(LOCAL_DIR)/tests.c \
     $(LOCAL_DIR)/thread_tests.c \
     $(LOCAL_DIR)/alloc_checker_tests.cpp \
     $(LOCAL_DIR)/timer_tests.c \
+    $(LOCAL_DIR)/user_copy_tests.cpp \
+    $(LOCAL_DIR)/vm_bench.cpp \
 
 
 MODULE_DEPS += \
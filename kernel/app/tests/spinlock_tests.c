@@ -0,0 +1,193 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include "tests.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <err.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <arch/ops.h>
+#include <kernel/mp.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
+#include <platform.h>
+
+#define CONTEND_TIME LK_MSEC(500)
+
+struct spin_stats {
+    uint64_t acquires;
+    uint64_t holder_errors;
+    lk_time_t total_wait;
+    lk_time_t max_wait;
+} __CPU_MAX_ALIGN;
+
+static spin_lock_t contended_lock = SPIN_LOCK_INITIAL_VALUE;
+static uint64_t contended_counter;
+
+static struct spin_stats spin_stats[SMP_MAX_CPUS];
+static thread_t spin_threads[SMP_MAX_CPUS];
+
+static volatile int spin_ready;
+static volatile int spin_go;
+static lk_time_t spin_deadline;
+
+// every cpu takes the lock as fast as it can for CONTEND_TIME, timing
+// how long each acquire waits and checking the holder is recorded
+static int spin_contend_thread(void* arg)
+{
+    struct spin_stats* stats = (struct spin_stats*)arg;
+    uint cpu = arch_curr_cpu_num();
+
+    atomic_add(&spin_ready, 1);
+    while (!spin_go)
+        arch_spinloop_pause();
+
+    while (TIME_LT(current_time(), spin_deadline)) {
+        spin_lock_saved_state_t state;
+        arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+        lk_time_t t = current_time();
+        spin_lock(&contended_lock);
+        lk_time_t wait = current_time() - t;
+
+        if (spin_lock_holder_cpu(&contended_lock) != cpu)
+            stats->holder_errors++;
+        contended_counter++;
+
+        spin_unlock(&contended_lock);
+        arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+        stats->acquires++;
+        stats->total_wait += wait;
+        if (wait > stats->max_wait)
+            stats->max_wait = wait;
+    }
+
+    return 0;
+}
+
+static bool spinlock_basic(void)
+{
+    spin_lock_t lock = SPIN_LOCK_INITIAL_VALUE;
+    spin_lock_saved_state_t state;
+    bool ok = true;
+
+    spin_lock_irqsave(&lock, state);
+    if (!spin_lock_held(&lock) || spin_lock_holder_cpu(&lock) != arch_curr_cpu_num()) {
+        printf("lock not held by cpu %u after acquire\n", arch_curr_cpu_num());
+        ok = false;
+    }
+    if (spin_trylock(&lock) == 0) {
+        printf("trylock took a held lock\n");
+        ok = false;
+    }
+    spin_unlock_irqrestore(&lock, state);
+
+    if (spin_lock_held(&lock) || spin_lock_holder_cpu(&lock) != UINT_MAX) {
+        printf("lock still held after release\n");
+        ok = false;
+    }
+
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    if (spin_trylock(&lock) != 0) {
+        printf("trylock failed on a free lock\n");
+        ok = false;
+    } else {
+        spin_unlock(&lock);
+    }
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    return ok;
+}
+
+static int spinlock_tests(int argc, const cmd_args* argv, uint32_t flags)
+{
+    if (!spinlock_basic()) {
+        printf("spinlock tests failed\n");
+        return -1;
+    }
+
+    uint max = arch_max_num_cpus();
+    int threads = 0;
+
+    memset(spin_stats, 0, sizeof(spin_stats));
+    contended_counter = 0;
+    spin_ready = 0;
+    spin_go = 0;
+
+    for (uint i = 0; i < max; i++) {
+        if (!mp_is_cpu_online(i))
+            continue;
+
+        thread_t* t = thread_create_etc(&spin_threads[i], "spin contend", spin_contend_thread,
+                                        &spin_stats[i], DEFAULT_PRIORITY, NULL, NULL,
+                                        DEFAULT_STACK_SIZE, NULL);
+        if (t == NULL) {
+            printf("failed to create thread for cpu %u\n", i);
+            return -1;
+        }
+        thread_set_pinned_cpu(t, i);
+        thread_resume(t);
+        threads++;
+    }
+
+    while (spin_ready != threads)
+        thread_yield();
+    spin_deadline = current_time() + CONTEND_TIME;
+    smp_mb();
+    spin_go = 1;
+
+    for (uint i = 0; i < max; i++) {
+        if (mp_is_cpu_online(i))
+            thread_join(&spin_threads[i], NULL, INFINITE_TIME);
+    }
+
+    uint64_t total = 0, total_sq = 0, min = UINT64_MAX, max_acquires = 0;
+    uint64_t holder_errors = 0;
+
+    printf("%4s %10s %12s %12s\n", "cpu", "acquires", "avg wait ns", "max wait ns");
+    for (uint i = 0; i < max; i++) {
+        if (!mp_is_cpu_online(i))
+            continue;
+
+        const struct spin_stats* s = &spin_stats[i];
+        printf("%4u %10" PRIu64 " %12" PRIu64 " %12" PRIu64 "\n", i, s->acquires,
+               s->acquires ? s->total_wait / s->acquires : 0, s->max_wait);
+
+        total += s->acquires;
+        total_sq += s->acquires * s->acquires;
+        holder_errors += s->holder_errors;
+        if (s->acquires < min)
+            min = s->acquires;
+        if (s->acquires > max_acquires)
+            max_acquires = s->acquires;
+    }
+
+    // Jain's index, 1000 when every cpu got the lock equally often
+    uint64_t fairness = total_sq ? (total * total * 1000) / (threads * total_sq) : 0;
+    printf("%" PRIu64 " acquires, min/max %" PRIu64 "/%" PRIu64 ", fairness %" PRIu64 "/1000\n",
+           total, min, max_acquires, fairness);
+
+    bool ok = true;
+    if (contended_counter != total) {
+        printf("counter %" PRIu64 " does not match %" PRIu64 " acquires\n",
+               contended_counter, total);
+        ok = false;
+    }
+    if (holder_errors) {
+        printf("%" PRIu64 " acquires did not record the holder cpu\n", holder_errors);
+        ok = false;
+    }
+
+    printf("spinlock tests %s\n", ok ? "passed" : "failed");
+    return ok ? 0 : -1;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("spinlock_tests", "test spin lock fairness and latency under contention", &spinlock_tests)
+STATIC_COMMAND_END(spinlock_tests);
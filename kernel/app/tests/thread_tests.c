@@ -16,7 +16,9 @@
 #include <string.h>
 #include <kernel/thread.h>
 #include <kernel/mutex.h>
+#include <kernel/rwlock.h>
 #include <kernel/event.h>
+#include <kernel/mp.h>
 #include <platform.h>
 
 static int sleep_thread(void *arg)
@@ -100,6 +102,140 @@ static int mutex_test(void)
     return 0;
 }
 
+static rwlock_t rw_lock;
+static volatile int rw_readers;
+static volatile int rw_writers;
+static volatile int rw_stop;
+
+#define RWLOCK_TEST_THREADS 4
+
+/* spin until *v reaches value, giving up after a few seconds */
+static bool rwlock_wait_for(volatile int *v, int value)
+{
+    lk_time_t deadline = current_time() + LK_SEC(5);
+    while (atomic_load((int *)v) != value) {
+        if (current_time() > deadline)
+            return false;
+        thread_yield();
+    }
+    return true;
+}
+
+/* holds the lock for reading until every reader is inside at once */
+static int rwlock_concurrent_reader(void *arg)
+{
+    rwlock_acquire_read(&rw_lock);
+    atomic_add(&rw_readers, 1);
+    ASSERT(rwlock_wait_for(&rw_readers, RWLOCK_TEST_THREADS));
+    rwlock_release_read(&rw_lock);
+    return 0;
+}
+
+static int rwlock_mixed_thread(void *arg)
+{
+    for (int i = 0; i < 100000; i++) {
+        if ((rand() % 4) == 0) {
+            rwlock_acquire_write(&rw_lock);
+            ASSERT(atomic_add(&rw_writers, 1) == 0);
+            ASSERT(atomic_load((int *)&rw_readers) == 0);
+            if ((rand() % 5) == 0)
+                thread_yield();
+            atomic_add(&rw_writers, -1);
+            rwlock_release_write(&rw_lock);
+        } else {
+            rwlock_acquire_read(&rw_lock);
+            atomic_add(&rw_readers, 1);
+            ASSERT(atomic_load((int *)&rw_writers) == 0);
+            if ((rand() % 5) == 0)
+                thread_yield();
+            atomic_add(&rw_readers, -1);
+            rwlock_release_read(&rw_lock);
+        }
+    }
+    return 0;
+}
+
+/* keeps the lock read held, overlapping with the other readers */
+static int rwlock_busy_reader(void *arg)
+{
+    while (!atomic_load((int *)&rw_stop)) {
+        rwlock_acquire_read(&rw_lock);
+        atomic_add(&rw_readers, 1);
+        thread_yield();
+        atomic_add(&rw_readers, -1);
+        rwlock_release_read(&rw_lock);
+    }
+    return 0;
+}
+
+static void rwlock_run_threads(const char *name, thread_start_routine entry)
+{
+    thread_t *threads[RWLOCK_TEST_THREADS];
+
+    for (uint i = 0; i < countof(threads); i++) {
+        threads[i] = thread_create(name, entry, NULL, DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+        thread_resume(threads[i]);
+    }
+    for (uint i = 0; i < countof(threads); i++)
+        thread_join(threads[i], NULL, INFINITE_TIME);
+}
+
+static void rwlock_test(void)
+{
+    thread_t *threads[RWLOCK_TEST_THREADS];
+
+    printf("testing rwlocks\n");
+    rwlock_init(&rw_lock);
+
+    /* readers share the lock */
+    rw_readers = 0;
+    rwlock_run_threads("rwlock reader", &rwlock_concurrent_reader);
+
+    /* a writer excludes readers and other writers */
+    rw_readers = 0;
+    rw_writers = 0;
+    rwlock_run_threads("rwlock mixed", &rwlock_mixed_thread);
+
+    /* a writer gets in while readers keep the lock busy */
+    rw_stop = 0;
+    for (uint i = 0; i < countof(threads); i++) {
+        threads[i] = thread_create("rwlock busy reader", &rwlock_busy_reader, NULL,
+                                   DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+        thread_resume(threads[i]);
+    }
+    thread_sleep_relative(LK_MSEC(10));
+    lk_time_t start = current_time();
+    for (int i = 0; i < 100; i++) {
+        rwlock_acquire_write(&rw_lock);
+        ASSERT(atomic_load((int *)&rw_readers) == 0);
+        rwlock_release_write(&rw_lock);
+    }
+    ASSERT(current_time() - start < LK_SEC(5));
+    rw_stop = 1;
+    for (uint i = 0; i < countof(threads); i++)
+        thread_join(threads[i], NULL, INFINITE_TIME);
+
+    /* releasing the write lock hands it to every blocked reader at once */
+    rw_readers = 0;
+    rwlock_acquire_write(&rw_lock);
+    for (uint i = 0; i < countof(threads); i++) {
+        threads[i] = thread_create("rwlock blocked reader", &rwlock_concurrent_reader, NULL,
+                                   DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+        thread_resume(threads[i]);
+    }
+    while (atomic_load((int *)&rw_lock.read_wait.count) != RWLOCK_TEST_THREADS)
+        thread_sleep_relative(LK_MSEC(1));
+    rwlock_release_write(&rw_lock);
+    THREAD_LOCK(state);
+    ASSERT(rw_lock.read_wait.count == 0);
+    THREAD_UNLOCK(state);
+    for (uint i = 0; i < countof(threads); i++)
+        thread_join(threads[i], NULL, INFINITE_TIME);
+
+    rwlock_destroy(&rw_lock);
+    printf("done with rwlock tests\n");
+}
+
 static event_t e;
 
 static int event_signaler(void *arg)
@@ -445,6 +581,61 @@ static void join_test(void)
     printf("thread_join returns err %d, retval %d (should be 0 and 55)\n", err, ret);
 }
 
+static int pinned_tester(void *arg)
+{
+    return (int)arch_curr_cpu_num();
+}
+
+static int pinned_migrator(void *arg)
+{
+    mp_cpu_mask_t online = *(mp_cpu_mask_t *)arg;
+
+    /* repin ourself to every cpu in turn, yielding must land us on it */
+    for (int pass = 0; pass < 4; pass++) {
+        for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+            if ((online & (1u << cpu)) == 0)
+                continue;
+
+            THREAD_LOCK(state);
+            thread_set_pinned_cpu(get_current_thread(), cpu);
+            THREAD_UNLOCK(state);
+
+            thread_yield();
+            ASSERT(arch_curr_cpu_num() == cpu);
+        }
+    }
+
+    return 0;
+}
+
+static void pinned_test(void)
+{
+    mp_cpu_mask_t online = mp_get_online_mask();
+
+    printf("testing pinned threads\n");
+
+    /* wake a thread pinned to each cpu from here, each has to run where it is pinned */
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if ((online & (1u << cpu)) == 0)
+            continue;
+
+        thread_t *t = thread_create("pinned tester", &pinned_tester, NULL, DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+        thread_set_pinned_cpu(t, cpu);
+        thread_resume(t);
+
+        int ret;
+        thread_join(t, &ret, INFINITE_TIME);
+        ASSERT(ret == (int)cpu);
+    }
+
+    /* move a running pinned thread from cpu to cpu */
+    thread_t *t = thread_create("pinned migrator", &pinned_migrator, &online, DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+    thread_resume(t);
+    thread_join(t, NULL, INFINITE_TIME);
+
+    printf("pinned threads ran on their cpus\n");
+}
+
 static void spinlock_test(void)
 {
     spin_lock_saved_state_t state;
@@ -595,6 +786,7 @@ int thread_tests(void)
     kill_tests();
 
     mutex_test();
+    rwlock_test();
     event_test();
 
     spinlock_test();
@@ -607,6 +799,8 @@ int thread_tests(void)
 
     join_test();
 
+    pinned_test();
+
     return 0;
 }
 
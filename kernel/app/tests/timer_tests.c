@@ -7,6 +7,7 @@
 #include "tests.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <err.h>
 #include <inttypes.h>
 #include <kernel/timer.h>
@@ -70,8 +71,118 @@ static void timer_test_all_cpus(void)
     printf("%u threads created, %u threads joined\n", max, joined);
 }
 
+#define BENCH_TIMERS 100000
+
+struct timer_bench_state {
+    event_t event;
+    int remaining;
+    int early;
+    lk_time_t total_late;
+    lk_time_t max_late;
+};
+
+static enum handler_return timer_bench_cb(struct timer* timer, lk_time_t now, void* arg)
+{
+    struct timer_bench_state* state = (struct timer_bench_state*)arg;
+
+    lk_time_t t = current_time();
+    if (TIME_LT(t, timer->scheduled_time)) {
+        state->early++;
+    } else {
+        lk_time_t late = t - timer->scheduled_time;
+        state->total_late += late;
+        if (late > state->max_late)
+            state->max_late = late;
+    }
+
+    if (--state->remaining == 0) {
+        event_signal(&state->event, false);
+        return INT_RESCHEDULE;
+    }
+    return INT_NO_RESCHEDULE;
+}
+
+static lk_time_t timer_bench_rand(uint64_t* seed, lk_time_t range)
+{
+    *seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (*seed >> 16) % range;
+}
+
+// arms BENCH_TIMERS timers on one cpu, cancels them in random deadline
+// order and then lets them all fire, reporting the cost per timer
+static int timer_bench_thread(void* arg)
+{
+    timer_t* timers = calloc(BENCH_TIMERS, sizeof(timer_t));
+    if (!timers) {
+        printf("failed to allocate timers\n");
+        return -1;
+    }
+
+    struct timer_bench_state state = {};
+    event_init(&state.event, false, 0);
+
+    uint64_t seed = 1;
+    for (int i = 0; i < BENCH_TIMERS; i++)
+        timer_initialize(&timers[i]);
+
+    // far enough out for none to fire while measuring
+    lk_time_t base = current_time() + LK_SEC(10);
+    lk_time_t t = current_time();
+    for (int i = 0; i < BENCH_TIMERS; i++)
+        timer_set_oneshot(&timers[i], base + timer_bench_rand(&seed, LK_SEC(10)),
+                          timer_bench_cb, &state);
+    lk_time_t insert = current_time() - t;
+
+    t = current_time();
+    int canceled = 0;
+    for (int i = 0; i < BENCH_TIMERS; i++) {
+        if (timer_cancel(&timers[i]))
+            canceled++;
+    }
+    lk_time_t cancel = current_time() - t;
+
+    state.remaining = BENCH_TIMERS;
+    base = current_time() + LK_MSEC(10);
+    for (int i = 0; i < BENCH_TIMERS; i++)
+        timer_set_oneshot(&timers[i], base + timer_bench_rand(&seed, LK_MSEC(100)),
+                          timer_bench_cb, &state);
+    event_wait(&state.event);
+
+    printf("%d timers: insert %" PRIu64 " ns, cancel %" PRIu64 " ns per timer, %d canceled\n",
+           BENCH_TIMERS, insert / BENCH_TIMERS, cancel / BENCH_TIMERS, canceled);
+    printf("fire latency: avg %" PRIu64 " ns, max %" PRIu64 " ns, %d fired early\n",
+           state.total_late / BENCH_TIMERS, state.max_late, state.early);
+
+    event_destroy(&state.event);
+    free(timers);
+
+    return (canceled == BENCH_TIMERS && state.early == 0) ? 0 : -1;
+}
+
+// opt-in, arming 100k timers takes a while
+static int timer_bench(int argc, const cmd_args* argv, uint32_t flags)
+{
+    thread_t* t = thread_create("timer bench", timer_bench_thread, NULL,
+                                DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+    if (t == NULL) {
+        printf("failed to create the timer bench thread\n");
+        return MX_ERR_NO_MEMORY;
+    }
+    thread_set_pinned_cpu(t, 0);
+    thread_resume(t);
+
+    int ret;
+    thread_join(t, &ret, INFINITE_TIME);
+    printf("timer bench %s\n", ret == 0 ? "passed" : "failed");
+    return ret;
+}
+
 void timer_tests(void)
 {
     // timer fires on all cpus
     timer_test_all_cpus();
 }
+
+STATIC_COMMAND_START
+STATIC_COMMAND("timer_bench", "benchmark setting, canceling and firing many timers", &timer_bench)
+STATIC_COMMAND_END(timer_bench);
@@ -0,0 +1,188 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include "tests.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <inttypes.h>
+#include <arch/user_copy.h>
+#include <kernel/thread.h>
+#include <kernel/vm.h>
+#include <kernel/vm/vm_aspace.h>
+#include <lib/console.h>
+#include <mxtl/ref_ptr.h>
+#include <platform.h>
+
+static const size_t kMaxCopySize = 1024 * 1024;
+static const size_t kBenchBytes = 16 * 1024 * 1024;
+static const uint kMaxBenchIter = 65536;
+static const uint kArchUserRwFlags =
+    ARCH_MMU_FLAG_PERM_USER | ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE;
+
+// copies every combination of a short length and src/dst misalignment
+// to the user buffer and back, checking the bytes around the copied
+// range are not touched
+static bool verify_user_copy(uint8_t* ubuf, uint8_t* src, uint8_t* dst)
+{
+    static const size_t kGuard = 16;
+    static const size_t kMaxLen = 3 * 64 + 17;
+
+    for (size_t i = 0; i < kMaxLen + 2 * kGuard; i++)
+        src[i] = static_cast<uint8_t>(i * 7 + 1);
+
+    for (size_t len = 0; len <= kMaxLen; len++) {
+        for (size_t soff = 0; soff < 8; soff++) {
+            for (size_t doff = 0; doff < 8; doff++) {
+                memset(ubuf, 0xa5, kMaxLen + 2 * kGuard);
+                memset(dst, 0x5a, kMaxLen + 2 * kGuard);
+
+                status_t err = arch_copy_to_user(ubuf + kGuard + doff, src + soff, len);
+                if (err != MX_OK) {
+                    printf("copy_to_user len %zu soff %zu doff %zu failed %d\n",
+                           len, soff, doff, err);
+                    return false;
+                }
+                err = arch_copy_from_user(dst + kGuard + soff, ubuf + kGuard + doff, len);
+                if (err != MX_OK) {
+                    printf("copy_from_user len %zu soff %zu doff %zu failed %d\n",
+                           len, soff, doff, err);
+                    return false;
+                }
+
+                for (size_t i = 0; i < kMaxLen + 2 * kGuard; i++) {
+                    bool in_range = i >= kGuard + doff && i < kGuard + doff + len;
+                    uint8_t expected = in_range ? src[soff + i - kGuard - doff] : 0xa5;
+                    if (ubuf[i] != expected) {
+                        printf("user byte %zu is 0x%x, expected 0x%x (len %zu soff %zu doff %zu)\n",
+                               i, ubuf[i], expected, len, soff, doff);
+                        return false;
+                    }
+                }
+                for (size_t i = 0; i < kMaxLen + 2 * kGuard; i++) {
+                    bool in_range = i >= kGuard + soff && i < kGuard + soff + len;
+                    uint8_t expected = in_range ? src[i - kGuard] : 0x5a;
+                    if (dst[i] != expected) {
+                        printf("kernel byte %zu is 0x%x, expected 0x%x (len %zu soff %zu doff %zu)\n",
+                               i, dst[i], expected, len, soff, doff);
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+static void bench_user_copy(uint8_t* ubuf, uint8_t* kbuf, size_t offset)
+{
+    printf("%10s %10s %16s %16s\n", "size", "iter", "to user MB/s", "from user MB/s");
+
+    for (size_t size = 16; size <= kMaxCopySize; size <<= 1) {
+        uint iter = static_cast<uint>(kBenchBytes / size);
+        if (iter > kMaxBenchIter)
+            iter = kMaxBenchIter;
+        if (iter < 16)
+            iter = 16;
+
+        lk_time_t t = current_time();
+        for (uint i = 0; i < iter; i++)
+            arch_copy_to_user(ubuf, kbuf + offset, size);
+        lk_time_t to_user = current_time() - t;
+
+        t = current_time();
+        for (uint i = 0; i < iter; i++)
+            arch_copy_from_user(kbuf + offset, ubuf, size);
+        lk_time_t from_user = current_time() - t;
+
+        uint64_t bytes = static_cast<uint64_t>(size) * iter;
+        printf("%10zu %10u %16" PRIu64 " %16" PRIu64 "\n", size, iter,
+               to_user ? bytes * 1000 / to_user : 0,
+               from_user ? bytes * 1000 / from_user : 0);
+    }
+}
+
+// runs |fn| with a committed user buffer of kMaxCopySize + PAGE_SIZE bytes
+// mapped in a temporary aspace, and kernel buffers of the same size and
+// of one page
+static int with_user_buffer(const char* name,
+                            bool (*fn)(uint8_t* ubuf, uint8_t* kbuf, uint8_t* kbuf2))
+{
+    int ret = -1;
+    void* ptr = nullptr;
+    size_t ksize = kMaxCopySize + PAGE_SIZE;
+
+    uint8_t* kbuf = static_cast<uint8_t*>(memalign(PAGE_SIZE, ksize));
+    uint8_t* kbuf2 = static_cast<uint8_t*>(memalign(PAGE_SIZE, PAGE_SIZE));
+    if (!kbuf || !kbuf2) {
+        printf("error allocating kernel buffers\n");
+        free(kbuf);
+        free(kbuf2);
+        return -1;
+    }
+
+    mxtl::RefPtr<VmAspace> aspace = VmAspace::Create(0, name);
+    if (!aspace) {
+        printf("error creating the user aspace\n");
+        free(kbuf);
+        free(kbuf2);
+        return -1;
+    }
+
+    vmm_aspace_t* old_aspace = get_current_thread()->aspace;
+    vmm_set_active_aspace(reinterpret_cast<vmm_aspace_t*>(aspace.get()));
+
+    status_t err = aspace->Alloc("user_copy", ksize, &ptr, 0, VmAspace::VMM_FLAG_COMMIT,
+                                 kArchUserRwFlags);
+    if (err < 0) {
+        printf("error %d allocating the user buffer\n", err);
+    } else if (fn(static_cast<uint8_t*>(ptr), kbuf, kbuf2)) {
+        ret = 0;
+    }
+
+    vmm_set_active_aspace(old_aspace);
+    aspace->Destroy();
+    free(kbuf);
+    free(kbuf2);
+    return ret;
+}
+
+static bool run_verify(uint8_t* ubuf, uint8_t* kbuf, uint8_t* kbuf2)
+{
+    printf("verifying user copies\n");
+    return verify_user_copy(ubuf, kbuf, kbuf2);
+}
+
+static bool run_bench(uint8_t* ubuf, uint8_t* kbuf, uint8_t* kbuf2)
+{
+    memset(kbuf, 0x55, kMaxCopySize + PAGE_SIZE);
+
+    printf("user copy bandwidth, co-aligned buffers\n");
+    bench_user_copy(ubuf, kbuf, 0);
+    printf("user copy bandwidth, misaligned buffers\n");
+    bench_user_copy(ubuf, kbuf, 3);
+    return true;
+}
+
+static int user_copy_tests(int argc, const cmd_args* argv, uint32_t flags)
+{
+    int ret = with_user_buffer("user_copy_tests", run_verify);
+    printf("user copy tests %s\n", ret == 0 ? "passed" : "failed");
+    return ret;
+}
+
+static int user_copy_bench(int argc, const cmd_args* argv, uint32_t flags)
+{
+    return with_user_buffer("user_copy_bench", run_bench);
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("user_copy_tests", "test user copies", &user_copy_tests)
+STATIC_COMMAND("user_copy_bench", "benchmark user copies", &user_copy_bench)
+STATIC_COMMAND_END(user_copy_tests);
@@ -0,0 +1,223 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include "tests.h"
+
+#include <stdio.h>
+#include <err.h>
+#include <inttypes.h>
+#include <kernel/event.h>
+#include <kernel/mp.h>
+#include <kernel/thread.h>
+#include <kernel/vm.h>
+#include <kernel/vm/vm_address_region.h>
+#include <kernel/vm/vm_aspace.h>
+#include <kernel/vm/vm_object_paged.h>
+#include <lib/console.h>
+#include <mxalloc/new.h>
+#include <mxtl/array.h>
+#include <platform.h>
+
+static const uint kArchRwFlags = ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE;
+
+static const size_t kFaultBenchPages = 256;
+static const uint kFaultBenchRounds = 16;
+
+struct fault_bench_worker {
+    event_t* start;
+    bool ok;
+};
+
+// Demand faults a mapping in a page at a time and tears it down, so every
+// page goes through pmm_alloc_page and back out through pmm_free.
+static int fault_bench_thread(void* arg)
+{
+    auto worker = static_cast<fault_bench_worker*>(arg);
+    auto ka = VmAspace::kernel_aspace();
+
+    event_wait(worker->start);
+
+    for (uint round = 0; round < kFaultBenchRounds; round++) {
+        auto vmo = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, kFaultBenchPages * PAGE_SIZE);
+        if (!vmo)
+            return -1;
+
+        void* ptr;
+        auto ret = ka->MapObjectInternal(mxtl::move(vmo), "fault bench", 0,
+                                         kFaultBenchPages * PAGE_SIZE, &ptr, 0, 0, kArchRwFlags);
+        if (ret != MX_OK)
+            return -1;
+
+        volatile uint8_t* p = static_cast<volatile uint8_t*>(ptr);
+        for (size_t i = 0; i < kFaultBenchPages; i++)
+            p[i * PAGE_SIZE] = static_cast<uint8_t>(i);
+
+        if (ka->FreeRegion(reinterpret_cast<vaddr_t>(ptr)) != MX_OK)
+            return -1;
+    }
+
+    worker->ok = true;
+    return 0;
+}
+
+// Faults pages in from one thread per cpu, for an increasing number of
+// cpus, to show how page allocation scales.
+static int vm_fault_bench(int argc, const cmd_args* argv, uint32_t flags)
+{
+    uint cpus = 0;
+    for (mp_cpu_mask_t mask = mp_get_online_mask(); mask; mask &= mask - 1)
+        cpus++;
+
+    printf("%6s %12s %14s\n", "cpus", "time (us)", "faults/ms");
+
+    for (uint n = 1; n <= cpus; n++) {
+        event_t start = EVENT_INITIAL_VALUE(start, false, 0);
+        fault_bench_worker workers[SMP_MAX_CPUS] = {};
+        thread_t* threads[SMP_MAX_CPUS];
+        uint started = 0;
+
+        for (uint i = 0; i < n; i++) {
+            workers[i].start = &start;
+            threads[i] = thread_create("fault bench", &fault_bench_thread, &workers[i],
+                                       DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+            if (!threads[i])
+                break;
+            thread_resume(threads[i]);
+            started++;
+        }
+
+        lk_time_t t = current_time();
+        event_signal(&start, true);
+
+        bool ok = (started == n);
+        for (uint i = 0; i < started; i++) {
+            thread_join(threads[i], nullptr, INFINITE_TIME);
+            ok = ok && workers[i].ok;
+        }
+        t = current_time() - t;
+        event_destroy(&start);
+
+        if (!ok) {
+            printf("fault bench failed with %u cpus\n", n);
+            return -1;
+        }
+
+        uint64_t faults = static_cast<uint64_t>(n) * kFaultBenchRounds * kFaultBenchPages;
+        printf("%6u %12" PRIu64 " %14" PRIu64 "\n", n, t / LK_USEC(1),
+               t ? faults * LK_MSEC(1) / t : 0);
+    }
+
+    return 0;
+}
+
+static const size_t kVmarStressRegions = 100000;
+
+static void vmar_stress_report(const char* op, size_t ops, lk_time_t t)
+{
+    printf("%10s %8zu ops %10" PRIu64 " us %8" PRIu64 " ns/op\n", op, ops,
+           t / LK_USEC(1), ops ? t / ops : 0);
+}
+
+// Fills |vmar| with single page mappings, punches out every other one and
+// maps into the holes again, reporting the cost of each operation.
+static bool vmar_stress_run(mxtl::RefPtr<VmAddressRegion> vmar)
+{
+    auto vmo = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, PAGE_SIZE);
+    if (!vmo) {
+        printf("error creating vmo\n");
+        return false;
+    }
+
+    AllocChecker ac;
+    mxtl::Array<mxtl::RefPtr<VmMapping>> maps(
+        new (&ac) mxtl::RefPtr<VmMapping>[kVmarStressRegions], kVmarStressRegions);
+    if (!ac.check()) {
+        printf("error allocating mapping array\n");
+        return false;
+    }
+
+    lk_time_t t = current_time();
+    for (size_t i = 0; i < kVmarStressRegions; i++) {
+        status_t status = vmar->CreateVmMapping(0, PAGE_SIZE, 0, 0, vmo, 0, kArchRwFlags,
+                                                "stress", &maps[i]);
+        if (status != MX_OK) {
+            printf("error %d mapping region %zu\n", status, i);
+            return false;
+        }
+    }
+    vmar_stress_report("map", kVmarStressRegions, current_time() - t);
+
+    t = current_time();
+    for (size_t i = 0; i < kVmarStressRegions; i += 2) {
+        status_t status = maps[i]->Unmap(maps[i]->base(), PAGE_SIZE);
+        if (status != MX_OK) {
+            printf("error %d unmapping region %zu\n", status, i);
+            return false;
+        }
+        maps[i].reset();
+    }
+    vmar_stress_report("unmap", kVmarStressRegions / 2, current_time() - t);
+
+    t = current_time();
+    for (size_t i = 0; i < kVmarStressRegions; i += 2) {
+        status_t status = vmar->CreateVmMapping(0, PAGE_SIZE, 0, 0, vmo, 0, kArchRwFlags,
+                                                "stress", &maps[i]);
+        if (status != MX_OK) {
+            printf("error %d remapping region %zu\n", status, i);
+            return false;
+        }
+    }
+    vmar_stress_report("remap", kVmarStressRegions / 2, current_time() - t);
+
+    t = current_time();
+    status_t status = vmar->Destroy();
+    vmar_stress_report("destroy", kVmarStressRegions, current_time() - t);
+    return status == MX_OK;
+}
+
+// Maps and unmaps many regions through both the randomized allocator of a
+// user aspace and the linear allocator of the kernel aspace.
+static int vmar_stress_bench(int argc, const cmd_args* argv, uint32_t flags)
+{
+    auto aspace = VmAspace::Create(0, "vmar stress");
+    if (!aspace) {
+        printf("error creating aspace\n");
+        return -1;
+    }
+    mxtl::RefPtr<VmAddressRegion> vmar;
+    status_t status = aspace->RootVmar()->CreateSubVmar(
+        0, 4 * kVmarStressRegions * PAGE_SIZE, 0, VMAR_CAN_RWX_FLAGS, "stress", &vmar);
+    if (status != MX_OK) {
+        printf("error %d creating user vmar\n", status);
+        aspace->Destroy();
+        return -1;
+    }
+    printf("randomized allocator, %s\n",
+           aspace->is_aslr_enabled() ? "aslr enabled" : "aslr disabled");
+    bool ok = vmar_stress_run(mxtl::move(vmar));
+    aspace->Destroy();
+    if (!ok)
+        return -1;
+
+    status = VmAspace::kernel_aspace()->RootVmar()->CreateSubVmar(
+        0, 2 * kVmarStressRegions * PAGE_SIZE, 0, VMAR_CAN_RWX_FLAGS, "stress", &vmar);
+    if (status != MX_OK) {
+        printf("error %d creating kernel vmar\n", status);
+        return -1;
+    }
+    printf("linear allocator\n");
+    if (!vmar_stress_run(vmar)) {
+        vmar->Destroy();
+        return -1;
+    }
+
+    return 0;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("vm_fault_bench", "benchmark demand faults on 1..n cpus", &vm_fault_bench)
+STATIC_COMMAND("vmar_stress_bench", "benchmark mapping and unmapping 100k regions", &vmar_stress_bench)
+STATIC_COMMAND_END(vm_bench);
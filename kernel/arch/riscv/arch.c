@@ -14,6 +14,16 @@
 
 #include <arch/current_thread.h>
 
+#include <arch/mp.h>
+#include <arch/riscv/mp.h>
+#include <arch/riscv/sbi.h>
+
+#include <kernel/cmdline.h>
+#include <kernel/mp.h>
+#include <kernel/thread.h>
+#include <lk/init.h>
+#include <lk/main.h>
+
 #include <debug.h>
 #include <trace.h>
 #include <err.h>
@@ -23,13 +33,87 @@
 __SECTION(".data") union thread_union init_thread_union __ALIGNED(16);
 __SECTION(".data") char asm_panic_string[] = {'A','S','M'};
 
+#if WITH_SMP
+/* early stacks, thread_info and bootstrap threads for the secondary harts */
+static union thread_union secondary_init_stack[SMP_MAX_CPUS - 1] __ALIGNED(16);
+static thread_info_t secondary_init_ti[SMP_MAX_CPUS - 1];
+static thread_t _init_thread[SMP_MAX_CPUS - 1];
+
+/* a secondary hart spins in _riscv_start until its
+   stack pointer is published by arch_init */
+volatile unsigned long riscv_secondary_sp[SMP_MAX_CPUS];
+thread_info_t* volatile riscv_secondary_ti[SMP_MAX_CPUS];
+#endif
+
 void arch_early_init(void)
 {
+#if WITH_SMP
+    unsigned long num_harts = sbi_num_harts();
+
+    riscv_num_cpus = (num_harts < SMP_MAX_CPUS) ? (uint)num_harts : SMP_MAX_CPUS;
+    if (riscv_num_cpus == 0)
+        riscv_num_cpus = 1;
+#endif
 }
 
 void arch_init(void)
 {
+    arch_mp_init_percpu();
+
+#if WITH_SMP
+    uint32_t max_cpus = arch_max_num_cpus();
+    uint32_t cmdline_max_cpus = cmdline_get_uint32("smp.maxcpus", max_cpus);
+    if (cmdline_max_cpus > max_cpus || cmdline_max_cpus <= 0) {
+        printf("invalid smp.maxcpus value, defaulting to %u\n", max_cpus);
+        cmdline_max_cpus = max_cpus;
+    }
+
+    uint secondaries_to_init = cmdline_max_cpus - 1;
+
+    lk_init_secondary_cpus(secondaries_to_init);
+
+    dprintf(INFO, "releasing %u secondary harts\n", secondaries_to_init);
+
+    for (uint cpu = 1; cpu <= secondaries_to_init; ++cpu) {
+
+        thread_info_t* ti = &secondary_init_ti[cpu - 1];
+        ti->cpu = cpu;
+        riscv_secondary_ti[cpu] = ti;
+
+        /* the hart reads the stack first, see _riscv_start */
+        smp_wmb();
+        riscv_secondary_sp[cpu] = (unsigned long)&secondary_init_stack[cpu - 1] +
+                                  sizeof(secondary_init_stack[cpu - 1]);
+    }
+
+    smp_mb();
+#endif
+}
+
+#if WITH_SMP
+/* called from assembly */
+void riscv_secondary_entry(void)
+{
+    uint cpu = arch_curr_cpu_num();
+
+    DEBUG_ASSERT(cpu > 0 && cpu < riscv_num_cpus);
+
+    thread_secondary_cpu_init_early(&_init_thread[cpu - 1]);
+    /* run early secondary cpu init routines up to the threading level */
+    lk_init_level(LK_INIT_FLAG_SECONDARY_CPUS, LK_INIT_LEVEL_EARLIEST, LK_INIT_LEVEL_THREADING - 1);
+
+    arch_mp_init_percpu();
+
+    dprintf(INFO, "RISC-V hart %u is up\n", cpu);
+
+    lk_secondary_cpu_entry();
+
+    /* lk_secondary_cpu_entry returns only for an unexpected cpu */
+    for (;;) {
+        wait_for_interrupt();
+    }
 }
+#endif
 
 __BEGIN_CDECLS
 extern void riscv64_uspace_entry(
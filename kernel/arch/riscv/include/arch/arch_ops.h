@@ -77,8 +77,7 @@ static inline uint arch_curr_cpu_num(void)
 
 static inline uint arch_max_num_cpus(void)
 {
-    // TO_DO_RISCV , return the actual number when mp is implemented
-    return 1;
+    return riscv_num_cpus;
 }
 
 static inline void arch_spinloop_pause(void)
@@ -28,6 +28,23 @@ struct arch_aspace {
 
     uint flags;
 
+    /* address space identifier, valid while asid_gen
+       matches the ASID allocator's current generation */
+    uint32_t asid;
+    uint64_t asid_gen;
+
+    /* mask of cpus this address space is active on */
+    uint32_t active_cpus;
+
+    /* cpus that may hold TLB entries tagged with the ASID, and the cpus
+       that must flush them before they activate the address space again */
+    uint32_t asid_cpus;
+    uint32_t asid_stale_cpus;
+
+    /* number of pages allocated for the page table, updated atomically
+       as it is read without the locks that serialize page table changes */
+    uint64_t pt_pages;
+
     /* range of address space */
     vaddr_t base;
     size_t size;
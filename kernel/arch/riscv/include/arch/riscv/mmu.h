@@ -20,4 +20,20 @@
 
 #ifndef GB
     #define GB                (1024UL*1024UL*1024UL)
-#endif
\ No newline at end of file
+#endif
+
+/*
+ * RV64 sptbr layout, privileged spec v1.9.1
+ * | 63      38 | 37    0 |
+ *      ASID       PPN
+ * an implementation may hardwire any number of the ASID
+ * bits to zero, the actual width is probed at boot
+ */
+#define SPTBR_PPN_BITS      38
+#define SPTBR_PPN_MASK      ((1UL << SPTBR_PPN_BITS) - 1)
+#define SPTBR_ASID_SHIFT    SPTBR_PPN_BITS
+#define SPTBR_ASID_BITS     26
+#define SPTBR_ASID_MASK     (((1UL << SPTBR_ASID_BITS) - 1) << SPTBR_ASID_SHIFT)
+
+/* ASID 0 is used by the kernel address space */
+#define MMU_RISCV_KERNEL_ASID   0
@@ -7,3 +7,30 @@
 // https://opensource.org/licenses/MIT
 
 #pragma once
+
+#include <magenta/compiler.h>
+#include <sys/types.h>
+#include <arch/riscv/irqreturn.h>
+
+__BEGIN_CDECLS
+
+//
+// the number of harts the kernel can use, a hart id is
+// used as a cpu number so the boot hart is always cpu 0
+//
+extern uint riscv_num_cpus;
+
+//
+// dispatches IPIs pending for the current cpu, called from
+// the software interrupt handler, sets *resched if the
+// scheduler has to be invoked on the interrupt return
+//
+irqreturn_t riscv_handle_ipi(enum handler_return* resched);
+
+//
+// called from _riscv_start on a secondary hart
+// with its boot stack and thread_info set
+//
+void riscv_secondary_entry(void) __NO_RETURN;
+
+__END_CDECLS
@@ -33,4 +33,17 @@ static inline void pte_populate(arch_aspace_t* aspace,
 	set_pte(pte, __pte((pfn << _PAGE_PFN_SHIFT) | prot.pgprot | _PAGE_PRESENT));
 }
 
+//
+// megapage and gigapage leaves, pfn must be aligned to the leaf size
+//
+static inline void pud_populate_leaf(arch_aspace_t* aspace,
+	pud_t *pud, unsigned long pfn, pgprot_t prot)
+{
+	set_pud(pud, __pud((pfn << _PAGE_PFN_SHIFT) | prot.pgprot | _PAGE_PRESENT));
+}
 
+static inline void pmd_populate_leaf(arch_aspace_t* aspace,
+	pmd_t *pmd, unsigned long pfn, pgprot_t prot)
+{
+	set_pmd(pmd, __pmd((pfn << _PAGE_PFN_SHIFT) | prot.pgprot | _PAGE_PRESENT));
+}
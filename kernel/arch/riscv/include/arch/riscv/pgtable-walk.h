@@ -12,6 +12,13 @@
 
 __BEGIN_CDECLS
 
+static inline paddr_t follow_huge_pud_to_phys(pud_t pud, vaddr_t vaddr)
+{
+    assert(pud_present(pud));
+	assert(pud_huge(pud));
+	return pud_to_phys(pud) + ((vaddr & ~PUD_MASK));
+}
+
 static inline paddr_t follow_huge_pmd_to_phys(pmd_t pmd, vaddr_t vaddr)
 {
     assert(pmd_present(pmd));
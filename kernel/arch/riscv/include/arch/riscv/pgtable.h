@@ -170,6 +170,13 @@ static inline bool pmd_huge(pmd_t pmd)
 		&& pmd_any_flags(pmd, (_PAGE_READ | _PAGE_WRITE | _PAGE_EXEC));
 }
 
+/* a leaf in the top level table maps a gigapage, the pud is folded into the pgd */
+static inline bool pud_huge(pud_t pud)
+{
+	return pud_present(pud)
+		&& pud_any_flags(pud, (_PAGE_READ | _PAGE_WRITE | _PAGE_EXEC));
+}
+
 #define pgd_index(addr) (((addr) >> PGDIR_SHIFT) & (PTRS_PER_PGD - 1))
 
 /* Locate an entry in the page global directory */
@@ -390,6 +397,13 @@ static_assert(USER_ASPACE_SIZE <= USER_TASK_SIZE, "USER_ASPACE_SIZE <= USER_TASK
 //
 pgd_t* get_current_sptbr_va(void);
 
+//
+// probes the number of implemented ASID bits in sptbr,
+// must be called on the boot hart before any user
+// address space is activated
+//
+void riscv64_mmu_init_asid(void);
+
 extern pgd_t* kernel_init_pgd;
 
 #endif /* !__ASSEMBLY__ */
@@ -12,7 +12,11 @@ Some code has been borrowed from the Linux kernel which is under GPLv2 license.
 __BEGIN_CDECLS
 
 /*
- * Simple spin lock operations.  These provide no fairness guarantees.
+ * Ticket spin lock operations. A cpu takes the next ticket with one AMO
+ * and spins until the ticket being served reaches it, so the lock is
+ * granted in arrival order and waiters only read the lock word until the
+ * releasing store. Only the holder writes the ticket being served, so
+ * the release is a plain halfword store.
  * Use the ‘&’ constraint modifier (see Modifiers) on all output operands
  * that must not overlap an input. Otherwise, GCC may allocate the output
  * operand in the same register as an unrelated input operand, on the
@@ -21,40 +25,75 @@ __BEGIN_CDECLS
  * consists of more than one instruction.
  */
 
+#define TICKET_SHIFT 16
+
+typedef volatile unsigned int __attribute__((__may_alias__)) arch_spin_tickets_t;
+typedef volatile unsigned short __attribute__((__may_alias__)) arch_spin_ticket_t;
+
+static inline arch_spin_tickets_t *arch_spin_tickets(arch_spinlock_t *lock)
+{
+	return (arch_spin_tickets_t *)lock;
+}
+
+static inline int arch_spin_is_locked_raw(arch_spinlock_t *lock)
+{
+	unsigned int tickets = *arch_spin_tickets(lock);
+
+	return (unsigned short)(tickets >> TICKET_SHIFT) != (unsigned short)tickets;
+}
+
 #define arch_spin_lock_flags_raw(lock, flags) arch_spin_lock(lock)
-#define arch_spin_is_locked_raw(x)	(*(x) != 0)
 #define arch_spin_unlock_wait_raw(x) \
-		do { cpu_relax(); } while (*(x))
+		do { cpu_relax(); } while (arch_spin_is_locked_raw(x))
 
 static inline void arch_spin_unlock_raw(arch_spinlock_t *lock)
 {
+	arch_spin_ticket_t *owner = (arch_spin_ticket_t *)lock;
+
 	__asm__ __volatile__ (
-		"amoswap.w.rl x0, x0, %0"
-		: "+A" (*lock)
-		:: "memory");
+		"fence	rw, w\n"
+		"sh	%1, %0"
+		: "=A" (*owner)
+		: "r" ((unsigned short)(*owner + 1))
+		: "memory");
 }
 
+/* returns 0 if the lock was taken */
 static inline int arch_spin_trylock_raw(arch_spinlock_t *lock)
 {
-	int tmp = 1, busy;
+	unsigned long tickets, busy;
 
 	__asm__ __volatile__ (
-		"amoswap.w.aq %0, %2, %1"
-		: "=&r" (busy), "+A" (*lock)
-		: "r" (tmp)
+		"1:	lr.w.aq	%0, %2\n"
+		"	srliw	%1, %0, 16\n"
+		"	xor	%1, %1, %0\n"
+		"	slli	%1, %1, 48\n"
+		"	bnez	%1, 2f\n"
+		"	addw	%1, %0, %3\n"
+		"	sc.w	%1, %1, %2\n"
+		"	bnez	%1, 1b\n"
+		"2:\n"
+		: "=&r" (tickets), "=&r" (busy), "+A" (*arch_spin_tickets(lock))
+		: "r" (1u << TICKET_SHIFT)
 		: "memory");
 
-	return !busy;
+	return busy != 0;
 }
 
 static inline void arch_spin_lock_raw(arch_spinlock_t *lock)
 {
-	while (1) {
-		if (arch_spin_is_locked_raw(lock))
-			continue;
+	unsigned int tickets;
+
+	__asm__ __volatile__ (
+		"amoadd.w.aq	%0, %2, %1"
+		: "=&r" (tickets), "+A" (*arch_spin_tickets(lock))
+		: "r" (1u << TICKET_SHIFT)
+		: "memory");
 
-		if (arch_spin_trylock_raw(lock))
-			break;
+	unsigned short ticket = (unsigned short)(tickets >> TICKET_SHIFT);
+	while ((unsigned short)tickets != ticket) {
+		cpu_relax();
+		tickets = __atomic_load_n(arch_spin_tickets(lock), __ATOMIC_ACQUIRE);
 	}
 }
 
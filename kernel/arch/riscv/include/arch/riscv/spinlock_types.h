@@ -5,7 +5,12 @@ Some code has been borrowed from the Linux kernel which is under GPLv2 license.
 
 #pragma once
 
-typedef volatile unsigned int arch_spinlock_t;
+/*
+ * A ticket lock, the low word holds the ticket being served in its low
+ * half and the next ticket to hand out in its high half, the high word
+ * holds the cpu number + 1 of the holder.
+ */
+typedef volatile unsigned long arch_spinlock_t;
 
 #define __ARCH_SPIN_LOCK_UNLOCKED	0
 
@@ -6,6 +6,7 @@ The code has been borrowed from the Linux kernel which is under GPLv2 license.
 
 #include <debug.h>
 #include <arch/riscv/asm/csr.h>
+#include <arch/riscv/asm/page.h>
 
 /* Flush entire local TLB */
 static inline void local_flush_tlb_all(void)
@@ -19,6 +20,21 @@ static inline void local_flush_tlb_page(unsigned long addr)
 	__asm__ __volatile__ ("sfence.vm %0" : : "r" (addr));
 }
 
+/* Flush a range of pages from local TLB, the ASID is taken from sptbr */
+static inline void local_flush_tlb_range(unsigned long start, unsigned long size)
+{
+	unsigned long end = start + size;
+
+	/* large ranges are cheaper to drop altogether */
+	if (size > (PAGE_SIZE << 6)) {
+		local_flush_tlb_all();
+		return;
+	}
+
+	for (; start < end; start += PAGE_SIZE)
+		local_flush_tlb_page(start);
+}
+
 #if !WITH_SMP
 
 #define flush_tlb_all() local_flush_tlb_all()
@@ -36,6 +52,20 @@ static inline void local_flush_tlb_page(unsigned long addr)
 
 #endif /* CONFIG_SMP */
 
+/*
+ * Flush a range of user pages tagged with the asid on all harts,
+ * without SMP the asid must be the one currently loaded in sptbr
+ */
+static inline void flush_tlb_asid_range(unsigned long asid,
+	unsigned long start, unsigned long size)
+{
+#if WITH_SMP
+	sbi_remote_sfence_vm_range(0, asid, start, size);
+#else
+	local_flush_tlb_range(start, size);
+#endif
+}
+
 /* Flush the TLB entries of the specified mm context */
 static inline void flush_tlb_mm(struct mm_struct *mm)
 {
@@ -28,30 +28,24 @@ static inline void arch_spin_lock_init(spin_lock_t *lock)
     *(arch_spinlock_t*)lock = __ARCH_SPIN_LOCK_UNLOCKED;
 }
 
-static inline bool arch_spin_lock_held(spin_lock_t *lock)
-{
-    //return *(arch_spinlock_t*)lock != 0;
-    return __atomic_load_n(lock, __ATOMIC_RELAXED) != 0;
-}
+void arch_spin_lock(spin_lock_t *lock);
+int arch_spin_trylock(spin_lock_t *lock);
+void arch_spin_unlock(spin_lock_t *lock);
 
-static inline uint arch_spin_lock_holder_cpu(spin_lock_t *lock)
+/* the word of the lock recording the holder cpu + 1 */
+static inline arch_spin_tickets_t *arch_spin_lock_holder(spin_lock_t *lock)
 {
-    return (uint)__atomic_load_n(lock, __ATOMIC_RELAXED) - 1;
+    return arch_spin_tickets(lock) + 1;
 }
 
-static inline void arch_spin_lock(spin_lock_t *lock)
-{
-    arch_spin_lock_raw((arch_spinlock_t*)lock);
-}
-
-static inline int arch_spin_trylock(spin_lock_t *lock)
+static inline bool arch_spin_lock_held(spin_lock_t *lock)
 {
-    return arch_spin_trylock_raw((arch_spinlock_t*)lock);
+    return arch_spin_is_locked_raw((arch_spinlock_t*)lock);
 }
 
-static inline void arch_spin_unlock(spin_lock_t *lock)
+static inline uint arch_spin_lock_holder_cpu(spin_lock_t *lock)
 {
-    arch_spin_unlock_raw((arch_spinlock_t*)lock);
+    return (uint)__atomic_load_n(arch_spin_lock_holder(lock), __ATOMIC_RELAXED) - 1;
 }
 
 /* flags are unused on risc-v */
@@ -13,6 +13,7 @@
 #include <kernel/thread.h>
 #include <platform.h>
 #include <arch/riscv/irq.h>
+#include <arch/riscv/mp.h>
 #include <arch/riscv/asm/linkage.h>
 #include <arch/riscv/asm/asm-offsets.h>
 #include <arch/riscv/pt_regs.h>
@@ -46,20 +47,20 @@ static void arch_set_in_int_handler(bool in_irq)
     cpu_in_int_handler[cpu] += in_irq ? 1 : -1;
 }
 
-static void riscv_software_interrupt(void)
+static enum handler_return riscv_software_interrupt(void)
 {
 	irqreturn_t ret;
-/*
-TO_DO_RISV
+	enum handler_return resched = INT_NO_RESCHEDULE;
+
 #if WITH_SMP
-	ret = handle_ipi();
+	ret = riscv_handle_ipi(&resched);
 	if (ret != IRQ_NONE)
-		return;
+		return resched;
 #endif
-*/
+
 	ret = sbi_console_isr();
 	if (ret != IRQ_NONE)
-		return;
+		return resched;
 
 	panic("%s: software interrupt has not been processed\n", __PRETTY_FUNCTION__);
 }
@@ -96,7 +97,7 @@ asmlinkage void do_IRQ(unsigned int cause, struct pt_regs *regs)
 			ret = riscv_timer_interrupt();
 			break;
 		case INTERRUPT_CAUSE_SOFTWARE:
-			riscv_software_interrupt();
+			ret = riscv_software_interrupt();
 			break;
 		case INTERRUPT_CAUSE_EXTERNAL:
 			plic_interrupt();
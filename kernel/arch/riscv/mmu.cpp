@@ -5,7 +5,7 @@
 // license that can be found in the LICENSE file or at
 // https://opensource.org/licenses/MIT
 
-#include <string.h> // for memset
+#include <string.h> // for memcpy
 #include <magenta/errors.h>
 #include <arch/mmu.h>
 #include <kernel/vm.h>
@@ -17,7 +17,10 @@
 #include <arch/riscv/pgalloc.h>
 #include <arch/riscv/pgtable-walk.h>
 #include <arch/riscv/tlbflush.h>
+#include <arch/riscv/mmu.h>
 #include <arch/ops.h>
+#include <kernel/spinlock.h>
+#include <kernel/stats.h>
 
 #define min(a, b)   (a) < (b) ? a : b
 
@@ -28,15 +31,16 @@
 pgprot_t TABLE_PROT = {.pgprot = 0};
 
 //
-// allocates a page table of any level - pgd, pud, pmt, pte
-// a counterpart is free_pt
+// allocates a zeroed page table of any level - pgd, pud, pmt, pte
+// and accounts it to the address space, a counterpart is free_pt
 //
 static
 inline
-void* allocate_pt(paddr_t* _pa)
+void* allocate_pt(arch_aspace_t* aspace, paddr_t* _pa)
 {
-    void* va;
-    va = pmm_alloc_kpage(_pa, NULL);
+    void* va = NULL;
+    if (pmm_alloc_page(PMM_ALLOC_FLAG_KMAP | PMM_ALLOC_FLAG_ZEROED, _pa))
+        va = paddr_to_kvaddr(*_pa);
     //
     // check that the allocationn has been 
     // made from the direct mapped region
@@ -47,14 +51,210 @@ void* allocate_pt(paddr_t* _pa)
     DEBUG_ASSERT(va && vaddr_to_paddr(va) == (paddr_t)__pa(va));
     DEBUG_ASSERT(va && paddr_to_kvaddr(*_pa) == __va(*_pa));
 
+    if (va)
+        atomic_add_u64(&aspace->pt_pages, 1);
+
     return va;
 }
 
+//
+// queues a page table for freeing, the tables are returned
+// to the PMM in a batch after the TLB invalidation as
+// a hart might still be walking a table until then
+//
 static
 inline
-void free_pt(void* va)
+void free_pt(arch_aspace_t* aspace, void* va, list_node* free_list)
+{
+    vm_page_t* page = paddr_to_vm_page(__pa(va));
+    DEBUG_ASSERT(page);
+
+    list_add_tail(free_list, &page->free.node);
+
+    __UNUSED uint64_t pt_pages = atomic_add_u64(&aspace->pt_pages, (uint64_t)-1);
+    DEBUG_ASSERT(pt_pages > 0);
+}
+
+//
+// ASID allocator
+//
+// An address space gets an ASID from the current generation when
+// it is switched in and keeps it while the generation stays the
+// same, so switching between tagged address spaces doesn't require
+// a TLB flush. ASIDs are handed out sequentially and are never
+// reused within a generation. When they are exhausted the generation
+// is bumped and every CPU flushes its local TLB before it activates
+// an ASID of the new generation. ASID 0 is reserved for the kernel.
+//
+static spin_lock_t asid_lock = SPIN_LOCK_INITIAL_VALUE;
+
+//
+// the number of implemented ASID bits, 0 if the CPU doesn't tag
+// TLB entries, in that case every switch flushes the TLB
+//
+static uint asid_bits;
+
+static uint64_t asid_generation = 1;
+static uint32_t asid_next = MMU_RISCV_KERNEL_ASID + 1;
+
+//
+// a mask of CPUs that must flush the local TLB before
+// activating an ASID from the current generation
+//
+static uint32_t asid_flush_pending;
+
+void riscv64_mmu_init_asid(void)
+{
+    unsigned long sptbr_val = csr_read(sptbr);
+
+    //
+    // unimplemented ASID bits are hardwired to zero
+    //
+    csr_write(sptbr, sptbr_val | SPTBR_ASID_MASK);
+    unsigned long asid_mask = (csr_read(sptbr) & SPTBR_ASID_MASK) >> SPTBR_ASID_SHIFT;
+    csr_write(sptbr, sptbr_val);
+    local_flush_tlb_all();
+
+    asid_bits = 0;
+    while (asid_mask & 0x1) {
+        ++asid_bits;
+        asid_mask >>= 1;
+    }
+
+    dprintf(INFO, "mmu: %u ASID bits\n", asid_bits);
+}
+
+static inline uint32_t asid_max(void)
+{
+    return (1u << asid_bits) - 1;
+}
+
+//
+// makes sure the aspace owns an ASID of the current generation,
+// called on the context switch path with interrupts disabled,
+// returns true if the local TLB must be flushed before the
+// ASID is used on this CPU
+//
+static bool riscv64_asid_activate(arch_aspace_t* aspace, uint cpu)
+{
+    const uint32_t cpu_mask = 1u << cpu;
+
+    if (!asid_bits)
+        return true;
+
+    //
+    // the fast path, the caller has already marked the aspace as active
+    // so riscv64_asid_defer_flush either sees this CPU in active_cpus or
+    // this CPU sees itself in asid_stale_cpus and takes the slow path
+    //
+    if (likely(__atomic_load_n(&aspace->asid_gen, __ATOMIC_SEQ_CST) ==
+               __atomic_load_n(&asid_generation, __ATOMIC_RELAXED) &&
+               !(__atomic_load_n(&aspace->asid_stale_cpus, __ATOMIC_SEQ_CST) & cpu_mask) &&
+               !(__atomic_load_n(&asid_flush_pending, __ATOMIC_RELAXED) & cpu_mask))) {
+        if (unlikely(!(__atomic_load_n(&aspace->asid_cpus, __ATOMIC_RELAXED) & cpu_mask)))
+            __atomic_fetch_or(&aspace->asid_cpus, cpu_mask, __ATOMIC_SEQ_CST);
+        return false;
+    }
+
+    spin_lock(&asid_lock);
+
+    if (aspace->asid_gen != asid_generation) {
+
+        if (asid_next > asid_max()) {
+
+            //
+            // roll over, the TLBs might contain entries
+            // tagged with the ASIDs that are going to be
+            // handed out again
+            //
+            ++asid_generation;
+            asid_next = MMU_RISCV_KERNEL_ASID + 1;
+            asid_flush_pending = ~0u;
+        }
+
+        aspace->asid = asid_next++;
+        __atomic_store_n(&aspace->asid_cpus, 0, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&aspace->asid_stale_cpus, 0, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&aspace->asid_gen, asid_generation, __ATOMIC_SEQ_CST);
+    }
+
+    bool flush = !!((asid_flush_pending | aspace->asid_stale_cpus) & cpu_mask);
+    asid_flush_pending &= ~cpu_mask;
+    __atomic_fetch_and(&aspace->asid_stale_cpus, ~cpu_mask, __ATOMIC_SEQ_CST);
+    __atomic_fetch_or(&aspace->asid_cpus, cpu_mask, __ATOMIC_SEQ_CST);
+
+    spin_unlock(&asid_lock);
+
+    return flush;
+}
+
+//
+// if the aspace is not active on any CPU, keeps its ASID and leaves the
+// stale TLB entries to be flushed locally by each CPU that may hold
+// them the next time it activates the aspace, returns false if the
+// aspace is active and the TLB must be flushed now, called with
+// asid_lock held
+//
+static bool riscv64_asid_defer_flush(arch_aspace_t* aspace)
 {
-    pmm_free_kpages(va, 1);
+    if (aspace->asid_gen != asid_generation)
+        return __atomic_load_n(&aspace->active_cpus, __ATOMIC_SEQ_CST) == 0;
+
+    //
+    // mark the CPUs stale before checking active_cpus, a CPU activating
+    // the aspace concurrently either is seen here or sees its stale bit
+    //
+    uint32_t cpus = __atomic_exchange_n(&aspace->asid_cpus, 0, __ATOMIC_SEQ_CST);
+    __atomic_fetch_or(&aspace->asid_stale_cpus, cpus, __ATOMIC_SEQ_CST);
+
+    return __atomic_load_n(&aspace->active_cpus, __ATOMIC_SEQ_CST) == 0;
+}
+
+//
+// invalidates TLB entries for the range after the page table has been
+// modified, user ranges are flushed by ASID only where it is needed
+//
+static void riscv64_tlb_invalidate(arch_aspace_t* aspace, vaddr_t vaddr, size_t size)
+{
+    if (aspace->flags & ARCH_ASPACE_FLAG_KERNEL) {
+        flush_tlb_kernel_range(vaddr, vaddr + size);
+        CPU_STATS_INC(tlb_flushes);
+        return;
+    }
+
+    //
+    // make the page table update visible before checking
+    // which CPUs might be using the aspace
+    //
+    smp_mb();
+
+    if (!asid_bits) {
+
+        //
+        // without ASIDs the TLB is flushed on each switch
+        // so only CPUs running the aspace need a flush
+        //
+        if (__atomic_load_n(&aspace->active_cpus, __ATOMIC_SEQ_CST) == 0) {
+            CPU_STATS_INC(tlb_flushes_avoided);
+            return;
+        }
+
+        flush_tlb_range(NULL, vaddr, vaddr + size);
+        CPU_STATS_INC(tlb_flushes);
+        return;
+    }
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&asid_lock, state);
+
+    if (riscv64_asid_defer_flush(aspace)) {
+        CPU_STATS_INC(tlb_flushes_avoided);
+    } else {
+        flush_tlb_asid_range(aspace->asid, vaddr, size);
+        CPU_STATS_INC(tlb_flushes);
+    }
+
+    spin_unlock_irqrestore(&asid_lock, state);
 }
 
 /* initialize per address space */
@@ -70,6 +270,12 @@ status_t arch_mmu_init_aspace(arch_aspace_t* aspace, vaddr_t base, size_t size,
 
     aspace->magic = ARCH_ASPACE_MAGIC;
     aspace->flags = flags;
+    aspace->asid = MMU_RISCV_KERNEL_ASID;
+    aspace->asid_gen = 0;
+    aspace->active_cpus = 0;
+    aspace->asid_cpus = 0;
+    aspace->asid_stale_cpus = 0;
+    aspace->pt_pages = 0;
     if (flags & ARCH_ASPACE_FLAG_KERNEL) {
 
         aspace->base = base;
@@ -82,17 +288,10 @@ status_t arch_mmu_init_aspace(arch_aspace_t* aspace, vaddr_t base, size_t size,
         aspace->base = base;
         aspace->size = size;
 
-        aspace->pt_virt = static_cast<pgd_t*>(allocate_pt(&aspace->pt_phys));
+        aspace->pt_virt = static_cast<pgd_t*>(allocate_pt(aspace, &aspace->pt_phys));
         if (!aspace->pt_virt)
             return MX_ERR_NO_MEMORY;
 
-        /* zero the top level translation table */
-        /* XXX remove when PMM starts returning pre-zeroed pages */
-        arch_zero_page(aspace->pt_virt);
-
-        /* zero out the user space portion of it */
-        memset(aspace->pt_virt, 0, sizeof(pgd_t) * USER_PTRS_PER_PGD);
-
         /* copy the kernel portion of it from the master kernel pt */
         memcpy(aspace->pt_virt + USER_PTRS_PER_PGD, &kernel_init_pgd[USER_PTRS_PER_PGD],
                sizeof(pgd_t) * KERNEL_PTRS_PER_PGD);
@@ -103,8 +302,55 @@ status_t arch_mmu_init_aspace(arch_aspace_t* aspace, vaddr_t base, size_t size,
 
 status_t arch_mmu_destroy_aspace(arch_aspace_t* aspace)
 {
-    PANIC_UNIMPLEMENTED;
-    return MX_ERR_NOT_SUPPORTED;
+    DEBUG_ASSERT(aspace);
+    DEBUG_ASSERT(aspace->magic == ARCH_ASPACE_MAGIC);
+    DEBUG_ASSERT((aspace->flags & ARCH_ASPACE_FLAG_KERNEL) == 0);
+    DEBUG_ASSERT(__atomic_load_n(&aspace->active_cpus, __ATOMIC_SEQ_CST) == 0);
+
+    list_node free_list = LIST_INITIAL_VALUE(free_list);
+
+    //
+    // free the user half of the page table, the leaves left
+    // are dropped as the pages belong to the VM objects,
+    // the kernel half is shared with kernel_init_pgd
+    //
+    for (size_t i = 0; i < USER_PTRS_PER_PGD; ++i) {
+
+        pud_t* pud = pud_offset(aspace->pt_virt + i, 0);
+        if (!pud_present(*pud) || pud_huge(*pud))
+            continue;
+
+        pmd_t* pmd_table = reinterpret_cast<pmd_t*>(pud_page_vaddr(*pud));
+        for (size_t j = 0; j < PTRS_PER_PMD; ++j) {
+
+            if (pmd_present(pmd_table[j]) && !pmd_huge(pmd_table[j]))
+                free_pt(aspace, reinterpret_cast<void*>(pmd_page_vaddr(pmd_table[j])), &free_list);
+        }
+
+        free_pt(aspace, pmd_table, &free_list);
+    }
+
+    free_pt(aspace, aspace->pt_virt, &free_list);
+    DEBUG_ASSERT(aspace->pt_pages == 0);
+
+    //
+    // the aspace is not active anywhere and its ASID is not
+    // handed out again before the next generation flushes
+    // all TLBs, so there is nothing to invalidate
+    //
+    pmm_free(&free_list);
+
+    aspace->pt_virt = NULL;
+    aspace->pt_phys = 0;
+    aspace->asid_gen = 0;
+    aspace->magic = 0;
+
+    return MX_OK;
+}
+
+size_t arch_mmu_page_table_pages(const arch_aspace_t* aspace)
+{
+    return atomic_load_u64(const_cast<volatile uint64_t*>(&aspace->pt_pages));
 }
 
 /* test the vaddr against the address space's range */
@@ -157,22 +403,117 @@ mmu_flags_to_pte_attr(uint flags) {
     return prot;
 }
 
+//
+// returns the size from vaddr to the end of the naturally
+// aligned block_size block containing vaddr, limited by size
+//
+static inline size_t size_to_boundary(vaddr_t vaddr, size_t size, size_t block_size)
+{
+    size_t chunk_size = block_size - (vaddr & (block_size - 1));
+    return (size < chunk_size) ? size : chunk_size;
+}
+
+//
+// checks whether a range covers the whole block_size block
+// starting at vaddr
+//
+static inline bool covers_block(vaddr_t vaddr, size_t size, size_t block_size)
+{
+    return !(vaddr & (block_size - 1)) && size >= block_size;
+}
+
+//
+// checks whether a range can be mapped with a block_size leaf
+//
+static inline bool can_map_block(vaddr_t vaddr, paddr_t paddr, size_t size, size_t block_size)
+{
+    return covers_block(vaddr, size, block_size) && !(paddr & (block_size - 1));
+}
+
+//
+// replaces a megapage leaf with a table of 4 KiB leaves mapping
+// the same physical range with the same attributes, the translation
+// doesn't change so stale TLB entries for the megapage stay valid
+// until the caller modifies the new entries and flushes the range
+//
+static status_t riscv64_mmu_split_pmd(arch_aspace_t* aspace, pmd_t* pmd)
+{
+    DEBUG_ASSERT(pmd_huge(*pmd));
+
+    unsigned long pte_p;
+    pte_t* pte_v = static_cast<pte_t*>(allocate_pt(aspace, &pte_p));
+    if (unlikely(!pte_v))
+        return MX_ERR_NO_MEMORY;
+
+    unsigned long pfn = pmd_val(*pmd) >> _PAGE_PFN_SHIFT;
+    unsigned long attr = pmd_val(*pmd) & ((1UL << _PAGE_PFN_SHIFT) - 1);
+
+    for (size_t i = 0; i < PTRS_PER_PTE; ++i)
+        set_pte(&pte_v[i], __pte(((pfn + i) << _PAGE_PFN_SHIFT) | attr));
+
+    //
+    // the page table walker must see the filled table
+    //
+    smp_wmb();
+    pmd_populate(aspace, pmd, phys_to_pfn(pte_p), TABLE_PROT);
+
+    return MX_OK;
+}
+
+//
+// replaces a gigapage leaf with a table of megapage leaves,
+// the kernel top level entries are copied to every user page
+// table so a kernel gigapage can't be split
+//
+static status_t riscv64_mmu_split_pud(arch_aspace_t* aspace, pud_t* pud)
+{
+    DEBUG_ASSERT(pud_huge(*pud));
+
+    if (aspace->flags & ARCH_ASPACE_FLAG_KERNEL)
+        return MX_ERR_NOT_SUPPORTED;
+
+    unsigned long pmd_p;
+    pmd_t* pmd_v = static_cast<pmd_t*>(allocate_pt(aspace, &pmd_p));
+    if (unlikely(!pmd_v))
+        return MX_ERR_NO_MEMORY;
+
+    unsigned long pfn = pud_val(*pud) >> _PAGE_PFN_SHIFT;
+    unsigned long attr = pud_val(*pud) & ((1UL << _PAGE_PFN_SHIFT) - 1);
+    const unsigned long pfn_step = PMD_PAGE_SIZE >> PAGE_SHIFT;
+
+    for (size_t i = 0; i < PTRS_PER_PMD; ++i)
+        set_pmd(&pmd_v[i], __pmd(((pfn + i * pfn_step) << _PAGE_PFN_SHIFT) | attr));
+
+    smp_wmb();
+    pud_populate(aspace, pud, phys_to_pfn(pmd_p), TABLE_PROT);
+
+    return MX_OK;
+}
+
+//
+// Maps [vaddr_in, vaddr_in + size_in), stopping at the first entry that is
+// already mapped or the first page table that can't be allocated. The size
+// mapped before that is returned in mapped_size_out either way.
+//
 static
-ssize_t
+status_t
 riscv64_mmu_map(
     arch_aspace_t* aspace,
     vaddr_t        vaddr_in,
     paddr_t        paddr_in,
     size_t         size_in,
     pgprot_t       page_prot,
-    pgd_t*         top_table
+    pgd_t*         top_table,
+    size_t*        mapped_size_out
     )
 {
     vaddr_t  vaddr = vaddr_in;
     paddr_t  paddr = paddr_in;
     size_t   size  = size_in;
     size_t   chunk_size;
-    size_t   mapped_size;
+    status_t status = MX_OK;
+
+    *mapped_size_out = 0;
 
     if ((vaddr & PAGE_MASK_LOW) ||
         (paddr & PAGE_MASK_LOW) ||
@@ -180,9 +521,6 @@ riscv64_mmu_map(
         return MX_ERR_INVALID_ARGS;
     }
 
-    mapped_size = 0;
-    chunk_size = PAGE_SIZE;
-
     while (size) {
 
         //
@@ -190,8 +528,10 @@ riscv64_mmu_map(
         //
         pgd_t *pgd = pgd_offset(top_table, vaddr);
         DEBUG_ASSERT(!pgd_bad(*pgd));
-        if (unlikely(pgd_bad(*pgd)))
+        if (unlikely(pgd_bad(*pgd))) {
+            status = MX_ERR_BAD_STATE;
             break;
+        }
         
         DEBUG_ASSERT(pgd_none(*pgd) || pgd_present(*pgd));
         if (pgd_none(*pgd)) {
@@ -199,66 +539,93 @@ riscv64_mmu_map(
             DEBUG_ASSERT(!"we should not be here as pud == pgd, see pgtable-nopud.h");
 
             unsigned long pud_p;
-            pud_t* pud_v = static_cast<pud_t*>(allocate_pt(&pud_p));
-            if (unlikely(!pud_v))
+            pud_t* pud_v = static_cast<pud_t*>(allocate_pt(aspace, &pud_p));
+            if (unlikely(!pud_v)) {
+                status = MX_ERR_NO_MEMORY;
                 break;
+            }
 
-            arch_zero_page(pud_v);
             pgd_populate(aspace, pgd, phys_to_pfn(pud_p), TABLE_PROT);
         }
 
         //
-        // get a PUD entry
+        // get a PUD entry, map a gigapage if the range allows,
+        // gigapages are not used for the kernel as they can't
+        // be split, see riscv64_mmu_split_pud
         //
         pud_t *pud = pud_offset(pgd, vaddr);
-        DEBUG_ASSERT(!pud_huge(*pud));
-        if (pud_huge(*pud))
-            panic("pdu_huge(*pud) in riscv64_mmu_map");
+        if (pud_huge(*pud)) {
+            status = MX_ERR_ALREADY_EXISTS;
+            break;
+        }
 
-        DEBUG_ASSERT(pud_none(*pud) || pud_present(*pud));
-        if (pud_none(*pud)) {
+        if (pud_none(*pud) &&
+            !(aspace->flags & ARCH_ASPACE_FLAG_KERNEL) &&
+            can_map_block(vaddr, paddr, size, PUD_PAGE_SIZE)) {
 
-            unsigned long  pmd_p;
-            pmd_t* pmd_v = static_cast<pmd_t*>(allocate_pt(&pmd_p));
-            if (unlikely(!pmd_v))
-                break;
+            pud_populate_leaf(aspace, pud, phys_to_pfn(paddr), page_prot);
+            chunk_size = PUD_PAGE_SIZE;
 
-            arch_zero_page(pmd_v);
-            pud_populate(aspace, pud, phys_to_pfn(pmd_p), TABLE_PROT);
-        }
+        } else {
 
-        //
-        // get a PMD entry
-        //
-        pmd_t *pmd = pmd_offset(pud, vaddr);
-        DEBUG_ASSERT(!pmd_huge(*pmd));
-        if (pmd_huge(*pmd))
-            panic("pmd_huge(*pmd) in riscv64_mmu_map");
+            DEBUG_ASSERT(pud_none(*pud) || pud_present(*pud));
+            if (pud_none(*pud)) {
 
-        DEBUG_ASSERT(pmd_none(*pmd) || pmd_present(*pmd));
-        if (pmd_none(*pmd)) {
+                unsigned long  pmd_p;
+                pmd_t* pmd_v = static_cast<pmd_t*>(allocate_pt(aspace, &pmd_p));
+                if (unlikely(!pmd_v)) {
+                    status = MX_ERR_NO_MEMORY;
+                    break;
+                }
+
+                pud_populate(aspace, pud, phys_to_pfn(pmd_p), TABLE_PROT);
+            }
 
-            unsigned long  pte_p;
-            pte_t* pte_v = static_cast<pte_t*>(allocate_pt(&pte_p));
-            if (unlikely(!pte_v))
+            //
+            // get a PMD entry, map a megapage if the range allows
+            //
+            pmd_t *pmd = pmd_offset(pud, vaddr);
+            if (pmd_huge(*pmd)) {
+                status = MX_ERR_ALREADY_EXISTS;
                 break;
+            }
 
-            arch_zero_page(pte_v);
-            pmd_populate(aspace, pmd, phys_to_pfn(pte_p), TABLE_PROT);
-        }
+            if (pmd_none(*pmd) && can_map_block(vaddr, paddr, size, PMD_PAGE_SIZE)) {
 
-        //
-        // get a PTE entry
-        //
-        pte_t *pte = pte_offset(pmd, vaddr);
-        DEBUG_ASSERT(pte_none(*pte));
-        if (!pte_none(*pte) || pte_present(*pte))
-            break; // oops the entry is mapped
+                pmd_populate_leaf(aspace, pmd, phys_to_pfn(paddr), page_prot);
+                chunk_size = PMD_PAGE_SIZE;
 
-        //
-        // set the pte to finalize vaddr to paddr mapping
-        //
-        pte_populate(aspace, pte, phys_to_pfn(paddr), page_prot);
+            } else {
+
+                DEBUG_ASSERT(pmd_none(*pmd) || pmd_present(*pmd));
+                if (pmd_none(*pmd)) {
+
+                    unsigned long  pte_p;
+                    pte_t* pte_v = static_cast<pte_t*>(allocate_pt(aspace, &pte_p));
+                    if (unlikely(!pte_v)) {
+                        status = MX_ERR_NO_MEMORY;
+                        break;
+                    }
+
+                    pmd_populate(aspace, pmd, phys_to_pfn(pte_p), TABLE_PROT);
+                }
+
+                //
+                // get a PTE entry
+                //
+                pte_t *pte = pte_offset(pmd, vaddr);
+                if (!pte_none(*pte) || pte_present(*pte)) {
+                    status = MX_ERR_ALREADY_EXISTS;
+                    break;
+                }
+
+                //
+                // set the pte to finalize vaddr to paddr mapping
+                //
+                pte_populate(aspace, pte, phys_to_pfn(paddr), page_prot);
+                chunk_size = PAGE_SIZE;
+            }
+        }
 
         //
         // move to the next page
@@ -266,10 +633,10 @@ riscv64_mmu_map(
         vaddr += chunk_size;
         paddr += chunk_size;
         size  -= chunk_size;
-        mapped_size += chunk_size;
+        *mapped_size_out += chunk_size;
     } // end while
 
-    return mapped_size;
+    return status;
 }
 
 /* routines to map/unmap/update permissions/query mappings per address space */
@@ -303,43 +670,58 @@ arch_mmu_map(
     if (count == 0)
         return MX_OK;
 
-    ssize_t  bmp; // stands for BytesMaPped
+    size_t mapped_size;
+    status_t status;
     if (aspace->flags & ARCH_ASPACE_FLAG_KERNEL) {
 
-        bmp = riscv64_mmu_map(aspace,
-                              vaddr,
-                              paddr,
-                              count * PAGE_SIZE,
-                              mmu_flags_to_pte_attr(mmu_flags),
-                              kernel_init_pgd);
+        status = riscv64_mmu_map(aspace,
+                                 vaddr,
+                                 paddr,
+                                 count * PAGE_SIZE,
+                                 mmu_flags_to_pte_attr(mmu_flags),
+                                 kernel_init_pgd,
+                                 &mapped_size);
     } else {
         DEBUG_ASSERT(aspace->pt_virt != kernel_init_pgd);
         DEBUG_ASSERT((vaddr + count * PAGE_SIZE) <= USER_ASPACE_MAXADDR);
 
-        bmp = riscv64_mmu_map(aspace,
-                              vaddr,
-                              paddr,
-                              count * PAGE_SIZE,
-                              mmu_flags_to_pte_attr(mmu_flags),
-                              aspace->pt_virt);
+        status = riscv64_mmu_map(aspace,
+                                 vaddr,
+                                 paddr,
+                                 count * PAGE_SIZE,
+                                 mmu_flags_to_pte_attr(mmu_flags),
+                                 aspace->pt_virt,
+                                 &mapped_size);
     }
 
-    DEBUG_ASSERT(0 == (bmp % PAGE_SIZE));
+    DEBUG_ASSERT(0 == (mapped_size % PAGE_SIZE));
+
+    //
+    // a range is mapped entirely or not at all, undo the part
+    // mapped before hitting an existing entry or running out
+    // of page tables
+    //
+    if (status != MX_OK && mapped_size > 0) {
+        arch_mmu_unmap(aspace, vaddr, mapped_size / PAGE_SIZE, nullptr);
+        mapped_size = 0;
+    }
 
     if (mapped) {
-        *mapped = (bmp > 0) ? (bmp / PAGE_SIZE) : 0u;
+        *mapped = mapped_size / PAGE_SIZE;
         DEBUG_ASSERT(*mapped <= count);
     }
 
-    return (bmp < 0) ? (status_t)bmp : MX_OK;
+    return status;
 }
 
 static
 void
 riscv64_mmu_pte_gc(
+    arch_aspace_t* aspace,
     vaddr_t vaddr_in,
     size_t  size_in,
-    pgd_t*  top_table
+    pgd_t*  top_table,
+    list_node* free_list
 )
 {
     vaddr_t  vaddr = vaddr_in;
@@ -368,8 +750,6 @@ riscv64_mmu_pte_gc(
 
     while (size) {
 
-        size_t   chunk_size;
-
         //
         // get a PGD entry
         //
@@ -377,60 +757,42 @@ riscv64_mmu_pte_gc(
         if (pgd_present(*pgd)) {
 
             //
-            // get a PUD entry
+            // get a PUD entry, a gigapage has no PMD table
             //
             pud_t *pud = pud_offset(pgd, vaddr);
-            DEBUG_ASSERT(!pud_huge(*pud));
-            if (pud_huge(*pud))
-                panic("pdu_huge(*pud) in riscv64_mmu_map");
-
-            if (pud_present(*pud)) {
+            if (pud_present(*pud) && !pud_huge(*pud)) {
 
                 //
-                // get a PMD entry
+                // get a PMD entry, a megapage has no PTE table
                 //
                 pmd_t *pmd = pmd_offset(pud, vaddr);
-                DEBUG_ASSERT(!pmd_huge(*pmd));
-                if (pmd_huge(*pmd))
-                    panic("pmd_huge(*pmd) in riscv64_mmu_map");
-
-                if (pmd_present(*pmd)) {
-
-                    uint none_count = 0;
-                    uint max_entries = PMD_PAGE_SIZE / PTE_PAGE_SIZE;
-
-                    assert(max_entries >= 1);
+                if (pmd_present(*pmd) && !pmd_huge(*pmd)) {
 
-                    for (; none_count<max_entries; ++none_count) {
+                    pte_t* pte_table = reinterpret_cast<pte_t*>(pmd_page_vaddr(*pmd));
+                    size_t i = 0;
 
-                        pte_t *pte = pte_offset(pmd, vaddr + none_count * PTE_PAGE_SIZE);
-                        if (!pte_none(*pte))
+                    for (; i < PTRS_PER_PTE; ++i) {
+                        if (!pte_none(pte_table[i]))
                             break;
                     }
 
-                    if (none_count == max_entries) {
+                    if (i == PTRS_PER_PTE) {
 
-                        free_pt(paddr_to_kvaddr(pmd_to_phys(*pmd)));
+                        free_pt(aspace, pte_table, free_list);
 
                         //
                         // invalidate the PMD entry
                         //
-                        pte_set_none(reinterpret_cast<pte_t*>(pmd));
+                        pmd_clear(pmd);
                     }
-                } // end if (pmd_present(*pmd)) 
-
-                chunk_size = min(size, PMD_PAGE_SIZE);
-
-            } else {
-                 chunk_size = min(size, PUD_PAGE_SIZE);
+                } // end if (pmd_present(*pmd))
             }
-        } else {
-            chunk_size = min(size, PGD_PAGE_SIZE);
         }
 
         //
-        // move to the next page
+        // move to the next PTE table
         //
+        size_t chunk_size = size_to_boundary(vaddr, size, PMD_PAGE_SIZE);
         vaddr += chunk_size;
         size  -= chunk_size;
     } // end while
@@ -439,9 +801,11 @@ riscv64_mmu_pte_gc(
 static
 void
 riscv64_mmu_pmd_gc(
+    arch_aspace_t* aspace,
     vaddr_t vaddr_in,
     size_t  size_in,
-    pgd_t*  top_table
+    pgd_t*  top_table,
+    list_node* free_list
 )
 {
     vaddr_t  vaddr = vaddr_in;
@@ -462,16 +826,8 @@ riscv64_mmu_pmd_gc(
         return;
     }
 
-    //
-    // an exhaustive search is a very ugly solution,
-    // the better one is to keep the number of valid PTEs
-    // in the corresponding vm_page_t , TO_DO_RISCV
-    //
-
     while (size) {
 
-        size_t   chunk_size;
-
         //
         // get a PGD entry
         //
@@ -479,47 +835,35 @@ riscv64_mmu_pmd_gc(
         if (pgd_present(*pgd)) {
 
             //
-            // get a PUD entry
+            // get a PUD entry, a gigapage has no PMD table
             //
             pud_t *pud = pud_offset(pgd, vaddr);
-            DEBUG_ASSERT(!pud_huge(*pud));
-            if (pud_huge(*pud))
-                panic("pdu_huge(*pud) in riscv64_mmu_map");
-
-            if (pud_present(*pud)) {
-
-                uint none_count = 0;
-                uint max_entries = PUD_PAGE_SIZE / PMD_PAGE_SIZE;
+            if (pud_present(*pud) && !pud_huge(*pud)) {
 
-                assert(max_entries >= 1);
+                pmd_t* pmd_table = reinterpret_cast<pmd_t*>(pud_page_vaddr(*pud));
+                size_t i = 0;
 
-                for (; none_count < max_entries; ++none_count) {
-
-                    pmd_t* pmd = pmd_offset(pud, vaddr + none_count * PUD_PAGE_SIZE);
-                    if (!pte_none(*reinterpret_cast<pte_t*>(pmd)))
+                for (; i < PTRS_PER_PMD; ++i) {
+                    if (!pmd_none(pmd_table[i]))
                         break;
                 }
 
-                if (none_count == max_entries) {
+                if (i == PTRS_PER_PMD) {
 
-                    free_pt(paddr_to_kvaddr(pud_to_phys(*pud)));
+                    free_pt(aspace, pmd_table, free_list);
 
                     //
                     // invalidate the PUD entry
                     //
-                    pte_set_none(reinterpret_cast<pte_t*>(pud));
+                    pud_clear(pud);
                 }
             } // end if (pud_present(*pud))
-
-            chunk_size = min(size, PUD_PAGE_SIZE);
-
-        } else {
-            chunk_size = min(size, PGD_PAGE_SIZE);
         }
 
         //
-        // move to the next area
+        // move to the next PMD table
         //
+        size_t chunk_size = size_to_boundary(vaddr, size, PUD_PAGE_SIZE);
         vaddr += chunk_size;
         size  -= chunk_size;
     } // end while
@@ -528,11 +872,21 @@ riscv64_mmu_pmd_gc(
 static
 void
 riscv64_mmu_pud_gc(
+    arch_aspace_t* aspace,
     vaddr_t vaddr_in,
     size_t  size_in,
-    pgd_t*  top_table
+    pgd_t*  top_table,
+    list_node* free_list
 )
 {
+#ifdef __PAGETABLE_PUD_FOLDED
+    //
+    // the PUD is folded into the PGD so there
+    // are no PUD tables to free, the top level
+    // table is freed with the address space
+    //
+    return;
+#else
     vaddr_t  vaddr = vaddr_in;
     size_t   size  = size_in;
 
@@ -551,61 +905,51 @@ riscv64_mmu_pud_gc(
         return;
     }
 
-    //
-    // an exhaustive search is a very ugly solution,
-    // the better one is to keep the number of valid PTEs
-    // in the corresponding vm_page_t , TO_DO_RISCV
-    //
-
     while (size) {
 
-        size_t   chunk_size;
-
         //
         // get a PGD entry
         //
         pgd_t* pgd = pgd_offset(top_table, vaddr);
         if (pgd_present(*pgd)) {
 
-            uint none_count = 0;
-            uint max_entries = PGD_PAGE_SIZE / PUD_PAGE_SIZE;
-
-            assert(max_entries >= 1);
-
-            for (; none_count < max_entries; ++none_count) {
+            pud_t* pud_table = reinterpret_cast<pud_t*>(pgd_page_vaddr(*pgd));
+            size_t i = 0;
 
-                pud_t* pud = pud_offset(pgd, vaddr + none_count * PUD_PAGE_SIZE);
-                if (!pte_none(*reinterpret_cast<pte_t*>(pud)))
+            for (; i < PTRS_PER_PUD; ++i) {
+                if (!pud_none(pud_table[i]))
                     break;
             }
 
-            if (none_count == max_entries) {
+            if (i == PTRS_PER_PUD) {
 
-                free_pt(paddr_to_kvaddr(pgd_to_phys(*pgd)));
+                free_pt(aspace, pud_table, free_list);
 
                 //
                 // invalidate the PGD entry
                 //
-                pte_set_none(reinterpret_cast<pte_t*>(pgd));
+                pgd_clear(pgd);
             }
         }
 
-        chunk_size = min(size, PGD_PAGE_SIZE);
-
         //
         // move to the next area
         //
+        size_t chunk_size = size_to_boundary(vaddr, size, PGD_PAGE_SIZE);
         vaddr += chunk_size;
         size -= chunk_size;
     } // end while
+#endif // __PAGETABLE_PUD_FOLDED
 }
 
 static
 void
 riscv64_mmu_pt_gc(
+    arch_aspace_t* aspace,
     vaddr_t vaddr_in,
     size_t  size_in,
-    pgd_t*  top_table
+    pgd_t*  top_table,
+    list_node* free_list
 )
 {    
     if ((vaddr_in & PAGE_MASK_LOW) ||
@@ -614,22 +958,35 @@ riscv64_mmu_pt_gc(
         return;
     }
 
-    riscv64_mmu_pte_gc(vaddr_in, size_in, top_table);
-    riscv64_mmu_pmd_gc(vaddr_in, size_in, top_table);
-    riscv64_mmu_pud_gc(vaddr_in, size_in, top_table);
+    riscv64_mmu_pte_gc(aspace, vaddr_in, size_in, top_table, free_list);
+    riscv64_mmu_pmd_gc(aspace, vaddr_in, size_in, top_table, free_list);
+    riscv64_mmu_pud_gc(aspace, vaddr_in, size_in, top_table, free_list);
 }
 
+//
+// unmaps the range, megapages and gigapages partially covered
+// by the range are split first, returns the size of the range
+// processed in *unmapped_size which is less than size_in if
+// splitting a large page failed, the page tables left empty
+// are queued on free_list
+//
 static
-ssize_t
+status_t
 riscv64_mmu_unmap(
+    arch_aspace_t* aspace,
     vaddr_t vaddr_in,
     size_t  size_in,
-    pgd_t*  top_table
+    pgd_t*  top_table,
+    list_node* free_list,
+    size_t* unmapped_size_out
 )
 {
     vaddr_t  vaddr = vaddr_in;
     size_t   size  = size_in;
     size_t   unmapped_size = 0;
+    status_t status = MX_OK;
+
+    *unmapped_size_out = 0;
 
     if ((vaddr & PAGE_MASK_LOW) ||
         (size & PAGE_MASK_LOW)) {
@@ -655,9 +1012,22 @@ riscv64_mmu_unmap(
             // get a PUD entry
             //
             pud_t *pud = pud_offset(pgd, vaddr);
-            DEBUG_ASSERT(!pud_huge(*pud));
-            if (pud_huge(*pud))
-                panic("pdu_huge(*pud) in riscv64_mmu_map");
+            if (pud_huge(*pud)) {
+
+                if (covers_block(vaddr, size, PUD_PAGE_SIZE)) {
+
+                    //
+                    // the range covers the whole gigapage
+                    //
+                    pud_clear(pud);
+                    chunk_size = PUD_PAGE_SIZE;
+                    goto next;
+                }
+
+                status = riscv64_mmu_split_pud(aspace, pud);
+                if (status != MX_OK)
+                    break;
+            }
 
             if (pud_present(*pud)) {
 
@@ -665,9 +1035,22 @@ riscv64_mmu_unmap(
                 // get a PMD entry
                 //
                 pmd_t *pmd = pmd_offset(pud, vaddr);
-                DEBUG_ASSERT(!pmd_huge(*pmd));
-                if (pmd_huge(*pmd))
-                    panic("pmd_huge(*pmd) in riscv64_mmu_map");
+                if (pmd_huge(*pmd)) {
+
+                    if (covers_block(vaddr, size, PMD_PAGE_SIZE)) {
+
+                        //
+                        // the range covers the whole megapage
+                        //
+                        pmd_clear(pmd);
+                        chunk_size = PMD_PAGE_SIZE;
+                        goto next;
+                    }
+
+                    status = riscv64_mmu_split_pmd(aspace, pmd);
+                    if (status != MX_OK)
+                        break;
+                }
 
                 if (pmd_present(*pmd)) {
 
@@ -685,15 +1068,16 @@ riscv64_mmu_unmap(
                     chunk_size = PAGE_SIZE;
 
                 } else {
-                     chunk_size = min(size, PMD_PAGE_SIZE);
+                     chunk_size = size_to_boundary(vaddr, size, PMD_PAGE_SIZE);
                 }
             } else {
-                 chunk_size = min(size, PUD_PAGE_SIZE);
+                 chunk_size = size_to_boundary(vaddr, size, PUD_PAGE_SIZE);
             }
         } else {
-            chunk_size = min(size, PGD_PAGE_SIZE);
+            chunk_size = size_to_boundary(vaddr, size, PGD_PAGE_SIZE);
         }
 
+next:
         //
         // move to the next page
         //
@@ -706,10 +1090,11 @@ riscv64_mmu_unmap(
         //
         // invoke garbage collection for the page table
         //
-        riscv64_mmu_pt_gc(vaddr_in, unmapped_size, top_table);
+        riscv64_mmu_pt_gc(aspace, vaddr_in, unmapped_size, top_table, free_list);
     }
 
-    return unmapped_size;
+    *unmapped_size_out = unmapped_size;
+    return status;
 }
 
 status_t
@@ -733,26 +1118,44 @@ arch_mmu_unmap(
     if (!IS_PAGE_ALIGNED(vaddr))
         return MX_ERR_INVALID_ARGS;
 
-    ssize_t ret;
+    list_node free_list = LIST_INITIAL_VALUE(free_list);
+    size_t unmapped_size;
+    status_t status;
     if (aspace->flags & ARCH_ASPACE_FLAG_KERNEL) {
-        ret = riscv64_mmu_unmap(vaddr,
-                                count * PAGE_SIZE,
-                                kernel_init_pgd);
+        status = riscv64_mmu_unmap(aspace,
+                                   vaddr,
+                                   count * PAGE_SIZE,
+                                   kernel_init_pgd,
+                                   &free_list,
+                                   &unmapped_size);
     } else {
-        ret = riscv64_mmu_unmap(vaddr,
-                                count * PAGE_SIZE,
-                                aspace->pt_virt);
+        status = riscv64_mmu_unmap(aspace,
+                                   vaddr,
+                                   count * PAGE_SIZE,
+                                   aspace->pt_virt,
+                                   &free_list,
+                                   &unmapped_size);
     }
 
+    if (unmapped_size > 0)
+        riscv64_tlb_invalidate(aspace, vaddr, unmapped_size);
+
+    //
+    // no hart can walk the unlinked page tables after
+    // the invalidation, free them in one batch
+    //
+    if (!list_is_empty(&free_list))
+        pmm_free(&free_list);
+
     if (unmapped) {
-        *unmapped = (ret > 0) ? (ret / PAGE_SIZE) : 0u;
+        *unmapped = unmapped_size / PAGE_SIZE;
         DEBUG_ASSERT(*unmapped <= count);
     }
 
-    return (ret < 0) ? (status_t)ret : 0;
+    return status;
 }
 
-static inline void set_pte_mmu_flags(pte_t pte, uint mmu_flags)
+static inline pte_t set_pte_mmu_flags(pte_t pte, uint mmu_flags)
 {
     unsigned long pgprot = 0;
 
@@ -768,7 +1171,7 @@ static inline void set_pte_mmu_flags(pte_t pte, uint mmu_flags)
     if (mmu_flags & ARCH_MMU_FLAG_PERM_USER)
         pgprot |= _PAGE_USER;
 
-    pte_modify_access(pte, __pgprot(pgprot));
+    return pte_modify_access(pte, __pgprot(pgprot));
 }
 
 static inline uint get_pte_mmu_flags(pte_t pte)
@@ -855,64 +1258,95 @@ status_t arch_mmu_protect(arch_aspace_t* aspace, vaddr_t vaddr, size_t count, ui
         pt_virt = kernel_init_pgd;
     else
         pt_virt = aspace->pt_virt;
-    
-    for (size_t i = 0; i < count; ++i) {
 
-        vaddr_t  pva = start + (i * PAGE_SIZE);
+    vaddr_t  pva = start;
+    size_t   size = count * PAGE_SIZE;
+    status_t status = MX_OK;
+
+    while (size) {
+
+        size_t chunk_size;
 
         pgd_t *pgd = pgd_offset(pt_virt, pva);
-        if (pgd_none(*pgd) || unlikely(pgd_bad(*pgd)))
-            continue;
+        if (pgd_none(*pgd) || unlikely(pgd_bad(*pgd))) {
+            chunk_size = size_to_boundary(pva, size, PGD_PAGE_SIZE);
+            goto next;
+        }
 
-        //
-        // no pud in the current release so pud == pgd ,
-        // nevertehless the pud code is present
-        //
-        pud_t *pud = pud_offset(pgd, pva);
-        if (pud_none(*pud) || unlikely(pud_bad(*pud)))
-            continue;
+        {
+            //
+            // no pud in the current release so pud == pgd ,
+            // nevertehless the pud code is present
+            //
+            pud_t *pud = pud_offset(pgd, pva);
+            if (pud_none(*pud) || unlikely(pud_bad(*pud))) {
+                chunk_size = size_to_boundary(pva, size, PUD_PAGE_SIZE);
+                goto next;
+            }
 
-        if (pud_huge(*pud)) {
+            if (pud_huge(*pud)) {
 
-            panic("huge pud, we should not be here as pud is not used");
-            continue;
-        }
+                if (covers_block(pva, size, PUD_PAGE_SIZE)) {
 
-        pmd_t *pmd = pmd_offset(pud, pva);
-        if (pmd_none(*pmd) || unlikely(pmd_bad(*pmd)))
-            continue;
+                    //
+                    // the range covers the whole gigapage
+                    //
+                    pte_t pte = {.pte = pud_val(*pud)};
+                    set_pud(pud, __pud(pte_val(set_pte_mmu_flags(pte, mmu_flags))));
+                    chunk_size = PUD_PAGE_SIZE;
+                    goto next;
+                }
+
+                status = riscv64_mmu_split_pud(aspace, pud);
+                if (status != MX_OK)
+                    break;
+            }
 
-        if (pmd_huge(*pmd)) {
+            pmd_t *pmd = pmd_offset(pud, pva);
+            if (pmd_none(*pmd) || unlikely(pmd_bad(*pmd))) {
+                chunk_size = size_to_boundary(pva, size, PMD_PAGE_SIZE);
+                goto next;
+            }
 
-            //
-            // in case of a kernel space carry on,
-            // we need to divide huge pmd on ptes and
-            // apply new flags to each pte individually
-            // TO_DO_RISCV
-            //
-            if (vaddr >= KERNEL_ASPACE_BASE)
-                continue;
+            if (pmd_huge(*pmd)) {
+
+                if (covers_block(pva, size, PMD_PAGE_SIZE)) {
+
+                    //
+                    // the range covers the whole megapage
+                    //
+                    pte_t pte = {.pte = pmd_val(*pmd)};
+                    set_pmd(pmd, __pmd(pte_val(set_pte_mmu_flags(pte, mmu_flags))));
+                    chunk_size = PMD_PAGE_SIZE;
+                    goto next;
+                }
+
+                status = riscv64_mmu_split_pmd(aspace, pmd);
+                if (status != MX_OK)
+                    break;
+            }
+
+            chunk_size = PAGE_SIZE;
+
+            pte_t *pte = pte_offset(pmd, pva);
+            if (pte_none(*pte) || !pte_present(*pte))
+                goto next;
 
             //
-            // huge pmd is not used for user space range
-            // 
-            panic("huge pmd for user space");
-            continue;
+            // modify the pte
+            //
+            *pte = set_pte_mmu_flags(*pte, mmu_flags);
         }
 
-        pte_t *pte = pte_offset(pmd, pva);
-        if (pte_none(*pte) || !pte_present(*pte))
-            continue;
+next:
+        pva  += chunk_size;
+        size -= chunk_size;
+    } // end while
 
-        //
-        // modify the pte
-        //
-        pte_t new_pte = *pte;
-        set_pte_mmu_flags(new_pte, mmu_flags);
-        *pte = new_pte;
-    } // end for
+    if (pva != start)
+        riscv64_tlb_invalidate(aspace, start, pva - start);
 
-    return MX_OK;
+    return status;
 }
 
 status_t arch_mmu_query(arch_aspace_t *aspace, vaddr_t vaddr, paddr_t *p_paddr, uint *p_mmu_flags)
@@ -930,7 +1364,6 @@ status_t arch_mmu_query(arch_aspace_t *aspace, vaddr_t vaddr, paddr_t *p_paddr,
 
     if (pud_huge(*pud)) {
 
-        assert(!"we should not be here as PUD is not used");
         paddr_t paddr = follow_huge_pud_to_phys(*pud, vaddr);
         if (paddr) {
 
@@ -998,16 +1431,41 @@ vaddr_t arch_mmu_pick_spot(const arch_aspace_t* aspace,
  */
 void arch_mmu_context_switch(arch_aspace_t* old_aspace, arch_aspace_t* aspace)
 {
-    if (likely(old_aspace != aspace)) {
+    if (unlikely(old_aspace == aspace))
+        return;
 
-        if (aspace) {
-		    csr_write(sptbr, virt_to_pfn(aspace->pt_virt));
-        } else {
-            csr_write(sptbr, virt_to_pfn(kernel_init_pgd));
-        }
+    uint cpu = arch_curr_cpu_num();
+    const uint32_t cpu_mask = 1u << cpu;
+    unsigned long sptbr_val;
+    bool flush;
 
+    if (old_aspace)
+        __atomic_fetch_and(&old_aspace->active_cpus, ~cpu_mask, __ATOMIC_SEQ_CST);
+
+    if (aspace) {
+        __atomic_fetch_or(&aspace->active_cpus, cpu_mask, __ATOMIC_SEQ_CST);
+
+        flush = riscv64_asid_activate(aspace, cpu);
+        sptbr_val = virt_to_pfn(aspace->pt_virt) |
+                ((unsigned long)aspace->asid << SPTBR_ASID_SHIFT);
+    } else {
+        //
+        // the kernel page table doesn't map user space,
+        // so there is nothing to flush if the user
+        // entries are tagged
+        //
+        flush = !asid_bits;
+        sptbr_val = virt_to_pfn(kernel_init_pgd);
+    }
+
+    csr_write(sptbr, sptbr_val);
+
+    if (flush) {
         local_flush_tlb_all();
-	}
+        CPU_STATS_INC(tlb_flushes);
+    } else {
+        CPU_STATS_INC(tlb_flushes_avoided);
+    }
 }
 
 void arch_disable_mmu(void)
@@ -7,43 +7,110 @@
 
 #include <magenta/errors.h>
 #include <arch/mp.h>
+#include <arch/ops.h>
+#include <arch/riscv/mp.h>
+#include <arch/riscv/sbi.h>
+#include <arch/riscv/asm/csr.h>
+#include <kernel/mp.h>
 #include <debug.h>
+#include <trace.h>
+
+#define LOCAL_TRACE 0
+
+uint riscv_num_cpus = 1;
+
+//
+// a bitmap of mp_ipi_t values pending for each cpu, there
+// is only one software interrupt per hart so the IPI types
+// are multiplexed over it
+//
+static volatile unsigned long ipi_pending[SMP_MAX_CPUS];
 
 /* send inter processor interrupt, if supported */
 status_t arch_mp_send_ipi(mp_cpu_mask_t target, mp_ipi_t ipi)
 {
-    PANIC_UNIMPLEMENTED;
-    return MX_ERR_NOT_SUPPORTED;
-}
+    LTRACEF("target 0x%x, ipi %u\n", target, (uint)ipi);
 
-/* Bring a CPU up and enter it into the scheduler */
-status_t platform_mp_cpu_hotplug(uint cpu_id)
-{
-    PANIC_UNIMPLEMENTED;
-    return MX_ERR_NOT_SUPPORTED;
+    DEBUG_ASSERT((uint)ipi < MAX_IPI);
+
+    mp_cpu_mask_t all_cpus = (1u << riscv_num_cpus) - 1;
+
+    if (target == MP_CPU_ALL_BUT_LOCAL) {
+        target = all_cpus & ~(1u << arch_curr_cpu_num());
+    } else if (target == MP_CPU_ALL) {
+        target = all_cpus;
+    }
+
+    target &= all_cpus;
+
+    for (uint cpu = 0; target; ++cpu, target >>= 1) {
+        if (!(target & 0x1))
+            continue;
+
+        //
+        // order the IPI payload and the pending bit before
+        // the interrupt, see riscv_handle_ipi
+        //
+        __atomic_fetch_or(&ipi_pending[cpu], 1ul << ipi, __ATOMIC_SEQ_CST);
+
+        //
+        // a hart id is used as a cpu number
+        //
+        sbi_send_ipi(cpu);
+    }
+
+    return MX_OK;
 }
 
-/* Prepare for CPU unplug.  The platform may want to shift
- * around external interrupts at this time. */
-status_t platform_mp_prep_cpu_unplug(uint cpu_id)
+static void riscv_halt_cpu(void)
 {
-    PANIC_UNIMPLEMENTED;
-    return MX_ERR_NOT_SUPPORTED;
+    dprintf(INFO, "halting cpu %u\n", arch_curr_cpu_num());
+
+    arch_disable_ints();
+    for (;;) {
+        wait_for_interrupt();
+    }
 }
 
-/* shutdown the specified CPU.  called after it is no longer
- * being scheduled on.  */
-status_t platform_mp_cpu_unplug(uint cpu_id)
+irqreturn_t riscv_handle_ipi(enum handler_return* resched)
 {
-    PANIC_UNIMPLEMENTED;
-    return MX_ERR_NOT_SUPPORTED;
+    volatile unsigned long* pending = &ipi_pending[arch_curr_cpu_num()];
+
+    //
+    // clear the pending software interrupt, it is
+    // shared with the SBI console notification
+    //
+    if (!sbi_clear_ipi())
+        return IRQ_NONE;
+
+    mb();
+
+    for (;;) {
+        unsigned long ops = __atomic_exchange_n(pending, 0, __ATOMIC_SEQ_CST);
+        if (ops == 0)
+            return IRQ_HANDLED;
+
+        if (ops & (1ul << MP_IPI_GENERIC))
+            mp_mbx_generic_irq();
+
+        if (ops & (1ul << MP_IPI_RESCHEDULE)) {
+            if (mp_mbx_reschedule_irq() == INT_RESCHEDULE)
+                *resched = INT_RESCHEDULE;
+        }
+
+        if (ops & (1ul << MP_IPI_HALT))
+            riscv_halt_cpu();
+    }
 }
 
 /* Should be invoked by platform_mp_cpu_hotplug to ask the arch
  * to bring a CPU up and enter it into the scheduler */
 status_t arch_mp_cpu_hotplug(uint cpu_id)
 {
-    PANIC_UNIMPLEMENTED;
+    //
+    // the SBI has no call to restart a hart that
+    // has been parked by arch_flush_state_and_halt
+    //
     return MX_ERR_NOT_SUPPORTED;
 }
 
@@ -51,19 +118,31 @@ status_t arch_mp_cpu_hotplug(uint cpu_id)
  * arch to do whatever it needs to do to stop the CPU */
 status_t arch_mp_prep_cpu_unplug(uint cpu_id)
 {
-    PANIC_UNIMPLEMENTED;
-    return MX_ERR_NOT_SUPPORTED;
+    if (cpu_id == 0 || cpu_id >= riscv_num_cpus)
+        return MX_ERR_INVALID_ARGS;
+
+    //
+    // there are no external interrupts routed to harts
+    //
+    return MX_OK;
 }
 
 /* Should be invoked by platform_mp_cpu_unplug to ask the
  * arch to do whatever it needs to do to stop the CPU */
 status_t arch_mp_cpu_unplug(uint cpu_id)
 {
-    PANIC_UNIMPLEMENTED;
-    return MX_ERR_NOT_SUPPORTED;
+    //
+    // the hart has parked itself in arch_flush_state_and_halt
+    //
+    return MX_OK;
 }
 
 void arch_mp_init_percpu(void)
 {
-    PANIC_UNIMPLEMENTED;
+    //
+    // IPIs are delivered as software interrupts
+    //
+    csr_set(sie, SIE_SSIE);
+
+    mp_set_curr_cpu_online(true);
 }
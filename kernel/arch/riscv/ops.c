@@ -8,6 +8,7 @@
 #include <arch/ops.h>
 #include <debug.h>
 #include <lib/lib.h>
+#include <kernel/event.h>
 #include <arch/riscv/page.h>
 
 void arch_disable_cache(uint flags)
@@ -46,7 +47,18 @@ void arch_sync_cache_range(addr_t start, size_t len)
  * flush_done should be signaled after state is flushed. */
 void arch_flush_state_and_halt(event_t *flush_done)
 {
-    PANIC_UNIMPLEMENTED;
+    DEBUG_ASSERT(arch_ints_disabled());
+
+    //
+    // the caches are coherent, make the memory
+    // updates visible before the hart is parked
+    //
+    mb();
+    event_signal(flush_done, false);
+
+    for (;;) {
+        wait_for_interrupt();
+    }
 }
 
 void arch_idle(void)
@@ -16,6 +16,7 @@
 #include <arch/riscv/page.h>
 #include <arch/riscv/pgtable.h>
 #include <arch/riscv/pfn.h>
+#include <arch/riscv/mmu.h>
 #include <debug.h>
 
 //
@@ -50,7 +51,7 @@ pgd_t* kernel_init_pgd;
 
 pgd_t* get_current_sptbr_va(void)
 {
-    return pfn_to_virt(csr_read(sptbr));
+    return pfn_to_virt(csr_read(sptbr) & SPTBR_PPN_MASK);
 }
 
 
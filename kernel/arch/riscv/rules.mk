@@ -163,6 +163,7 @@ MODULE_SRCS += \
 	$(LOCAL_DIR)/mp.c \
 	$(LOCAL_DIR)/mexec.S \
 	$(LOCAL_DIR)/ops.c \
+	$(LOCAL_DIR)/spinlock.c \
 	$(LOCAL_DIR)/thread.c \
 	$(LOCAL_DIR)/user_copy.c \
 	$(LOCAL_DIR)/page.c \
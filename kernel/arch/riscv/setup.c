@@ -54,5 +54,7 @@ void setup_kernel_init_pgd(void)
     kernel_init_pgd = get_current_sptbr_va();
     if (!kernel_init_pgd)
         panic("get_current_sptbr_va");
+
+    riscv64_mmu_init_asid();
 }
 
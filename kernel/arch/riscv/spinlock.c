@@ -0,0 +1,35 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <arch/spinlock.h>
+#include <arch/ops.h>
+
+//
+// The ticket lock hands the lock out in arrival order, the holder
+// is recorded once the lock is taken and cleared before the ticket
+// being served is advanced
+//
+
+void arch_spin_lock(spin_lock_t *lock)
+{
+    arch_spin_lock_raw((arch_spinlock_t*)lock);
+    __atomic_store_n(arch_spin_lock_holder(lock), arch_curr_cpu_num() + 1, __ATOMIC_RELAXED);
+}
+
+int arch_spin_trylock(spin_lock_t *lock)
+{
+    int busy = arch_spin_trylock_raw((arch_spinlock_t*)lock);
+    if (!busy)
+        __atomic_store_n(arch_spin_lock_holder(lock), arch_curr_cpu_num() + 1, __ATOMIC_RELAXED);
+
+    return busy;
+}
+
+void arch_spin_unlock(spin_lock_t *lock)
+{
+    __atomic_store_n(arch_spin_lock_holder(lock), 0, __ATOMIC_RELAXED);
+    arch_spin_unlock_raw((arch_spinlock_t*)lock);
+}
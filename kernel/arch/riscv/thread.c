@@ -72,9 +72,11 @@ void arch_thread_construct_first(thread_t *t)
     init_thread_info(t, ti);
 
     //
-    // we always start at 0 heart
+    // the boot hart starts with tp set to NULL and is
+    // always cpu 0, a secondary hart starts with tp
+    // set to its boot thread_info, see _riscv_start
     //
-    ti->cpu = 0;
+    ti->cpu = arch_curr_cpu_num();
     assert( (uint)sbi_hart_id() == ti->cpu );
 
     //
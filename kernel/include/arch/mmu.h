@@ -48,6 +48,9 @@ vaddr_t arch_mmu_pick_spot(const arch_aspace_t* aspace,
                            vaddr_t end, uint next_region_mmu_flags,
                            vaddr_t align, size_t size, uint mmu_flags) __NONNULL((1));
 
+/* number of pages used by the page table of the address space, 0 if not tracked */
+size_t arch_mmu_page_table_pages(const arch_aspace_t* aspace) __NONNULL((1));
+
 /* load a new user address space context.
  * aspace argument NULL should unload user space.
  */
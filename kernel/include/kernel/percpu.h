@@ -17,7 +17,15 @@ __BEGIN_CDECLS
 
 struct percpu {
     /* per cpu timer queue */
-    struct list_node timer_queue;
+    struct timer_queue timer_queue;
+
+    /* per cpu run queues and a bitmap of the non empty ones,
+     * protected by the thread lock */
+    struct list_node run_queue[NUM_PRIORITIES];
+    uint32_t run_queue_bitmap;
+
+    /* number of threads in the run queues */
+    uint run_queue_count;
 
     /* per cpu preemption timer */
     timer_t preempt_timer;
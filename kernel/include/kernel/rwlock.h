@@ -0,0 +1,127 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#ifndef __KERNEL_RWLOCK_H
+#define __KERNEL_RWLOCK_H
+
+#include <magenta/atomic.h>
+#include <magenta/compiler.h>
+#include <magenta/thread_annotations.h>
+#include <assert.h>
+#include <debug.h>
+#include <stdint.h>
+#include <kernel/thread.h>
+
+__BEGIN_CDECLS
+
+#define RWLOCK_MAGIC (0x72776C6B)  // 'rwlk'
+
+/* Body of the reader/writer lock.
+ * The val field holds the number of readers in the upper bits, and
+ * RWLOCK_FLAG_WRITER while a writer holds the lock.  If one or more threads
+ * are blocking and queued up, RWLOCK_FLAG_QUEUED is ORed in as well.  Once a
+ * thread is queued, new readers queue up behind it so writers do not starve.
+ * NOTE: RWLOCK_FLAG_QUEUED and the wait queues are only manipulated under the
+ * THREAD_LOCK.  A blocked thread is handed the lock by the thread that wakes it.
+ */
+typedef struct TA_CAP("mutex") rwlock {
+    uint32_t magic;
+    uint64_t val;
+    thread_t *writer;
+    wait_queue_t read_wait;
+    wait_queue_t write_wait;
+} rwlock_t;
+
+#define RWLOCK_FLAG_WRITER ((uint64_t)1)
+#define RWLOCK_FLAG_QUEUED ((uint64_t)2)
+#define RWLOCK_READER      ((uint64_t)4)
+
+#define RWLOCK_INITIAL_VALUE(l) \
+{ \
+    .magic = RWLOCK_MAGIC, \
+    .val = 0, \
+    .writer = NULL, \
+    .read_wait = WAIT_QUEUE_INITIAL_VALUE((l).read_wait), \
+    .write_wait = WAIT_QUEUE_INITIAL_VALUE((l).write_wait), \
+}
+
+/* Rules for reader/writer locks:
+ * - They are only safe to use from thread context.
+ * - They are non-recursive, in either mode.
+ * - A reader cannot upgrade to a writer.
+ */
+void rwlock_init(rwlock_t *l);
+void rwlock_destroy(rwlock_t *l);
+void rwlock_acquire_write(rwlock_t *l) TA_ACQ(l);
+void rwlock_release_write(rwlock_t *l) TA_REL(l);
+void rwlock_acquire_read(rwlock_t *l) TA_ACQ_SHARED(l);
+void rwlock_release_read(rwlock_t *l) TA_REL_SHARED(l);
+
+/* does the current thread hold the lock for writing? */
+static inline bool is_rwlock_write_held(const rwlock_t *l)
+{
+    return (l->writer == get_current_thread());
+}
+
+/* is the lock held for writing by the current thread, or for reading by anyone?
+ * Readers are not tracked individually, so this is as close as assertions in
+ * code that may run in either mode can get. */
+static inline bool is_rwlock_held(const rwlock_t *l)
+{
+    return is_rwlock_write_held(l) ||
+           (atomic_load_u64_relaxed((uint64_t *)&l->val) >= RWLOCK_READER);
+}
+
+__END_CDECLS
+
+#ifdef __cplusplus
+
+#include <mxtl/macros.h>
+
+// Scoped guards for rwlock_t, in the style of AutoLock.
+class TA_SCOPED_CAP AutoWriteLock {
+public:
+    explicit AutoWriteLock(rwlock_t* lock) TA_ACQ(lock) : lock_(lock) {
+        rwlock_acquire_write(lock_);
+    }
+    ~AutoWriteLock() TA_REL() { release(); }
+
+    void release() TA_REL() {
+        if (lock_) {
+            rwlock_release_write(lock_);
+            lock_ = nullptr;
+        }
+    }
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(AutoWriteLock);
+
+private:
+    rwlock_t* lock_;
+};
+
+class TA_SCOPED_CAP AutoReadLock {
+public:
+    explicit AutoReadLock(rwlock_t* lock) TA_ACQ_SHARED(lock) : lock_(lock) {
+        rwlock_acquire_read(lock_);
+    }
+    ~AutoReadLock() TA_REL() { release(); }
+
+    void release() TA_REL() {
+        if (lock_) {
+            rwlock_release_read(lock_);
+            lock_ = nullptr;
+        }
+    }
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(AutoReadLock);
+
+private:
+    rwlock_t* lock_;
+};
+
+#endif // __cplusplus
+
+#endif
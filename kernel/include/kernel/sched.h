@@ -21,6 +21,10 @@ void sched_yield(void);
 void sched_preempt(void);
 void sched_reschedule(void);
 
+/* move the threads queued on a cpu going offline to the cpus they can run on,
+ * leaving the ones pinned to it queued */
+void sched_transition_off_cpu(uint old_cpu);
+
 /* the low level reschedule routine, called from the scheduler */
 void _thread_resched_internal(void);
 
@@ -18,6 +18,7 @@ struct cpu_stats {
     ulong irq_preempts;
     ulong preempts;
     ulong yields;
+    ulong steals; /* threads taken from another cpu's run queue */
 
     /* cpu level interrupts and exceptions */
     ulong interrupts; /* hardware interrupts, minus timer interrupts or inter-processor interrupts */
@@ -30,6 +31,10 @@ struct cpu_stats {
     /* inter-processor interrupts */
     ulong reschedule_ipis;
     ulong generic_ipis;
+
+    /* tlb maintenance */
+    ulong tlb_flushes; /* flushes performed on context switch or unmap */
+    ulong tlb_flushes_avoided; /* flushes skipped thanks to tagged address spaces */
 };
 
 __END_CDECLS
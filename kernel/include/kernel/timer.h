@@ -22,10 +22,23 @@ typedef enum handler_return (*timer_callback)(struct timer *, lk_time_t now, voi
 
 #define TIMER_MAGIC (0x74696D72)  //'timr'
 
+struct timer_queue;
+
 typedef struct timer {
     int magic;
+
+    /* linkage in a wheel slot */
     struct list_node node;
 
+    /* linkage in the near heap, prev is the parent for a first child */
+    struct timer *heap_child;
+    struct timer *heap_sibling;
+    struct timer *heap_prev;
+
+    /* queue the timer is on and where, NULL if not queued */
+    struct timer_queue *queue;
+    uint slot;
+
     lk_time_t scheduled_time;
 
     timer_callback callback;
@@ -39,6 +52,11 @@ typedef struct timer {
 { \
     .magic = TIMER_MAGIC, \
     .node = LIST_INITIAL_CLEARED_VALUE, \
+    .heap_child = NULL, \
+    .heap_sibling = NULL, \
+    .heap_prev = NULL, \
+    .queue = NULL, \
+    .slot = 0, \
     .scheduled_time = 0, \
     .callback = NULL, \
     .arg = NULL, \
@@ -46,6 +64,34 @@ typedef struct timer {
     .cancel = false, \
 }
 
+/* The per cpu timer queue is a hierarchical timing wheel keyed on the
+ * deadline in units of TIMER_WHEEL_GRANULE_SHIFT nanoseconds. A timer due
+ * past the granule the wheel is at goes in the level of the highest digit
+ * its granule differs from the wheel's, so setting and canceling it are O(1)
+ * and each level orders before the next. Timers due in the wheel's granule
+ * or earlier are kept exactly ordered in a pairing heap, which the lowest
+ * non empty slot is cascaded into when it runs dry.
+ */
+#define TIMER_WHEEL_GRANULE_SHIFT 20
+#define TIMER_WHEEL_SLOT_BITS 5
+#define TIMER_WHEEL_SLOTS (1u << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_LEVELS \
+    ((64 - TIMER_WHEEL_GRANULE_SHIFT + TIMER_WHEEL_SLOT_BITS - 1) / TIMER_WHEEL_SLOT_BITS)
+
+struct timer_queue {
+    /* granule the wheel is at */
+    uint64_t base;
+
+    /* heap of the timers due up to the end of the base granule */
+    timer_t *near;
+
+    /* bitmaps of the non empty levels and slots */
+    uint32_t level_map;
+    uint32_t slot_map[TIMER_WHEEL_LEVELS];
+
+    struct list_node slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+};
+
 /* Rules for Timers:
  * - Timer callbacks occur from interrupt context
  * - Timers may be programmed or canceled from interrupt or thread context
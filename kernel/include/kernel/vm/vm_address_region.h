@@ -10,6 +10,7 @@
 #include <kernel/vm/vm_object.h>
 #include <kernel/vm/vm_page_list.h>
 #include <magenta/thread_annotations.h>
+#include <mxtl/algorithm.h>
 #include <mxtl/canary.h>
 #include <mxtl/intrusive_double_list.h>
 #include <mxtl/intrusive_wavl_tree.h>
@@ -58,7 +59,7 @@ class VmEnumerator {
 public:
     // VmAspace::EnumerateChildren() will call the On* methods in depth-first
     // pre-order. If any call returns false, the traversal will stop. The root
-    // VmAspace's lock will be held during the entire traversal.
+    // VmAspace's lock will be held for reading during the entire traversal.
     // |depth| will be 0 for the root VmAddressRegion.
     virtual bool OnVmAddressRegion(const VmAddressRegion* vmar, uint depth) {
         return true;
@@ -89,6 +90,8 @@ protected:
 // DEAD, then the VmAddressRegion is invalid and has no meaning.
 //
 // All VmAddressRegion and VmMapping state is protected by the aspace lock.
+// Changes to the layout need it held for writing; page faults and walks only
+// read the tree and hold it for reading, serializing per VmObject instead.
 class VmAddressRegionOrMapping : public mxtl::RefCounted<VmAddressRegionOrMapping> {
 public:
     // If a VMO-mapping, unmap all pages and remove dependency on vm object it has a ref to.
@@ -196,6 +199,64 @@ protected:
 
     // node for element in list of parent's children.
     mxtl::WAVLTreeNodeState<mxtl::RefPtr<VmAddressRegionOrMapping>, bool> subregion_list_node_;
+
+    // Bookkeeping for the subtree of the parent's children tree rooted at
+    // this node: the first and last bytes it spans, and the largest gap
+    // between two neighbouring regions inside it.  Lets the allocators skip
+    // whole subtrees that have no gap large enough.
+    vaddr_t subtree_first_byte_ = 0;
+    vaddr_t subtree_last_byte_ = 0;
+    size_t subtree_max_gap_ = 0;
+
+    // Keeps the subtree bookkeeping up to date as the children tree changes
+    // shape.
+    struct WAVLTreeObserver : public mxtl::DefaultWAVLTreeObserver {
+        template <typename Iter>
+        static void RecordInsertLinked(Iter node) { Propagate(node); }
+
+        template <typename Iter>
+        static void RecordRotation(Iter lowered, Iter raised) {
+            Update(lowered);
+            Update(raised);
+        }
+
+        template <typename Iter>
+        static void RecordEraseUnlinked(Iter node) { Propagate(node); }
+
+        // Recompute the bookkeeping of |node| from its children.
+        template <typename Iter>
+        static void Update(Iter node) {
+            VmAddressRegionOrMapping& region = *node;
+            const vaddr_t last_byte = region.base_ + region.size_ - 1;
+
+            region.subtree_first_byte_ = region.base_;
+            region.subtree_last_byte_ = last_byte;
+            region.subtree_max_gap_ = 0;
+
+            auto left = node.left();
+            if (left.IsValid()) {
+                const size_t gap = region.base_ - left->subtree_last_byte_ - 1;
+                region.subtree_first_byte_ = left->subtree_first_byte_;
+                region.subtree_max_gap_ = mxtl::max(left->subtree_max_gap_, gap);
+            }
+
+            auto right = node.right();
+            if (right.IsValid()) {
+                const size_t gap = right->subtree_first_byte_ - last_byte - 1;
+                region.subtree_last_byte_ = right->subtree_last_byte_;
+                region.subtree_max_gap_ = mxtl::max(region.subtree_max_gap_,
+                                                    mxtl::max(right->subtree_max_gap_, gap));
+            }
+        }
+
+        // Recompute the bookkeeping of |node| and each of its ancestors.
+        template <typename Iter>
+        static void Propagate(Iter node) {
+            for (; node.IsValid(); node = node.parent()) {
+                Update(node);
+            }
+        }
+    };
 };
 
 // A representation of a contiguous range of virtual address space
@@ -236,6 +297,10 @@ public:
     void Dump(uint depth, bool verbose) const override;
     status_t PageFault(vaddr_t va, uint pf_flags) override;
 
+    // Recomputes the gap bookkeeping of every child from scratch and
+    // compares it against the cached values.  For tests.
+    bool DebugValidateGaps();
+
 protected:
     // constructor for use in creating a VmAddressRegionDummy
     explicit VmAddressRegion();
@@ -258,7 +323,7 @@ protected:
 private:
     using ChildList = mxtl::WAVLTree<vaddr_t, mxtl::RefPtr<VmAddressRegionOrMapping>,
                                      mxtl::DefaultKeyedObjectTraits<vaddr_t, VmAddressRegionOrMapping>,
-                                     WAVLTreeTraits>;
+                                     WAVLTreeTraits, WAVLTreeObserver>;
 
     DISALLOW_COPY_ASSIGN_AND_MOVE(VmAddressRegion);
 
@@ -321,9 +386,30 @@ private:
     // Utility for allocators for iterating over gaps between allocations
     // F should have a signature of bool func(vaddr_t gap_base, size_t gap_size).
     // If func returns false, the iteration stops.  gap_base will be aligned in
-    // accordance with align_pow2.
+    // accordance with align_pow2.  Gaps shorter than min_size before alignment
+    // are skipped without being visited.
     template <typename F>
-    void ForEachGap(F func, uint8_t align_pow2);
+    void ForEachGap(F func, uint8_t align_pow2, size_t min_size);
+
+    // Calls func(prev, next) in address order for each gap of at least
+    // min_size (> 0) bytes between children, where prev and next are the
+    // children around the gap, or end() at the edges of this region.  If
+    // func returns false, the iteration stops.  Runs in O(log n) per gap
+    // visited.
+    template <typename F>
+    void ForEachGapAtLeastLocked(size_t min_size, F func);
+
+    // Helper for ForEachGapAtLeastLocked that visits the gaps between the
+    // children in the subtree rooted at |node|.  Returns false if func
+    // stopped the iteration.
+    template <typename F>
+    bool ForEachGapInSubtreeLocked(ChildList::iterator node, size_t min_size, F& func);
+
+    // Helper for DebugValidateGaps that recomputes the bookkeeping of the
+    // subtree rooted at |node|, returning it through the out parameters.
+    // Returns false if any node's cached values differ.
+    static bool ValidateGapsInSubtreeLocked(ChildList::iterator node, vaddr_t* first_byte,
+                                            vaddr_t* last_byte, size_t* max_gap);
 
     // list of subregions, indexed by base address
     ChildList subregions_;
@@ -466,6 +552,14 @@ private:
     // Implementation for Protect().  This does not acquire the aspace lock.
     status_t ProtectLocked(vaddr_t base, size_t size, uint new_arch_mmu_flags);
 
+    // Resize the mapping in place, keeping the parent's gap bookkeeping
+    // up to date.
+    void SetSizeLocked(size_t size);
+
+    // Maps the already resident pages of the object around a faulting
+    // address, returning the number of pages mapped.
+    size_t FaultAroundLocked(vaddr_t va);
+
     // Version of AllocatedPages() that does not acquire the aspace lock
     size_t AllocatedPagesLocked() const override;
 
@@ -9,9 +9,11 @@
 #include <arch/mmu.h>
 #include <assert.h>
 #include <kernel/mutex.h>
+#include <kernel/rwlock.h>
 #include <kernel/vm.h>
 #include <kernel/vm/vm_address_region.h>
 #include <lib/crypto/prng.h>
+#include <mxtl/atomic.h>
 #include <mxtl/canary.h>
 #include <mxtl/intrusive_double_list.h>
 #include <mxtl/intrusive_wavl_tree.h>
@@ -144,11 +146,21 @@ public:
 
 protected:
     // Share the aspace lock with VmAddressRegion/VmMapping so they can serialize
-    // changes to the aspace.
+    // changes to the aspace.  Changes to the layout of the aspace hold it for
+    // writing; page faults and walks of the layout hold it for reading.
     friend class VmAddressRegionOrMapping;
     friend class VmAddressRegion;
     friend class VmMapping;
-    mutex_t* lock() { return &lock_; }
+    rwlock_t* lock() { return &lock_; }
+
+    // Page faults only hold lock() for reading, so faults in different
+    // mappings serialize their page table updates on this lock instead.
+    // Nests inside the VmObject lock.
+    mutex_t* page_table_lock() { return &page_table_lock_; }
+
+    // Counts the pages a page fault mapped, including any mapped around it.
+    // Faults run concurrently, so this only needs the lock held for reading.
+    void AccountFaultMappedPagesLocked(size_t count) { fault_mapped_pages_.fetch_add(count); }
 
     // Expose the PRNG for ASLR to VmAddressRegion
     crypto::PRNG& AslrPrng() {
@@ -183,7 +195,8 @@ private:
     bool aspace_destroyed_ = false;
     bool aslr_enabled_ = false;
 
-    mutable mutex_t lock_ = MUTEX_INITIAL_VALUE(lock_);
+    mutable rwlock_t lock_ = RWLOCK_INITIAL_VALUE(lock_);
+    mutex_t page_table_lock_ = MUTEX_INITIAL_VALUE(page_table_lock_);
 
     // root of virtual address space
     // Access to this reference is guarded by lock_.
@@ -197,6 +210,11 @@ private:
     // architecturally specific part of the aspace
     arch_aspace_t arch_aspace_ = {};
 
+    // page faults taken and the pages they mapped, updated atomically by
+    // faults holding lock_ for reading
+    mxtl::atomic<uint64_t> faults_{0};
+    mxtl::atomic<uint64_t> fault_mapped_pages_{0};
+
 #if WITH_LIB_VDSO
     mxtl::RefPtr<VmMapping> vdso_code_mapping_;
 #endif
@@ -93,9 +93,12 @@ static int cmd_threadstats(int argc, const cmd_args *argv, uint32_t flags)
         printf("\tcontext_switches: %lu\n", percpu[i].stats.context_switches);
         printf("\tpreempts: %lu\n", percpu[i].stats.preempts);
         printf("\tyields: %lu\n", percpu[i].stats.yields);
+        printf("\tsteals: %lu\n", percpu[i].stats.steals);
         printf("\tinterrupts: %lu\n", percpu[i].stats.interrupts);
         printf("\ttimer interrupts: %lu\n", percpu[i].stats.timer_ints);
         printf("\ttimers: %lu\n", percpu[i].stats.timers);
+        printf("\ttlb flushes: %lu\n", percpu[i].stats.tlb_flushes);
+        printf("\ttlb flushes avoided: %lu\n", percpu[i].stats.tlb_flushes_avoided);
     }
 
     return 0;
@@ -0,0 +1,243 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+
+/**
+ * @file
+ * @brief  Reader/writer lock functions
+ *
+ * @defgroup rwlock Reader/writer lock
+ * @{
+ */
+
+#include <kernel/rwlock.h>
+
+#include <debug.h>
+#include <assert.h>
+#include <err.h>
+#include <inttypes.h>
+#include <kernel/thread.h>
+#include <kernel/sched.h>
+#include <trace.h>
+
+#define LOCAL_TRACE 0
+
+/**
+ * @brief  Initialize a rwlock_t
+ */
+void rwlock_init(rwlock_t *l)
+{
+    *l = (rwlock_t)RWLOCK_INITIAL_VALUE(*l);
+}
+
+/**
+ * @brief  Destroy a rwlock_t
+ */
+void rwlock_destroy(rwlock_t *l)
+{
+    DEBUG_ASSERT(l->magic == RWLOCK_MAGIC);
+    DEBUG_ASSERT(!arch_in_int_handler());
+
+    THREAD_LOCK(state);
+#if LK_DEBUGLEVEL > 0
+    if (unlikely(atomic_load_u64_relaxed(&l->val) != 0))
+        panic("rwlock_destroy: thread %p (%s) tried to destroy locked rwlock %p\n",
+              get_current_thread(), get_current_thread()->name, l);
+#endif
+    l->magic = 0;
+    l->val = 0;
+    wait_queue_destroy(&l->read_wait);
+    wait_queue_destroy(&l->write_wait);
+    THREAD_UNLOCK(state);
+}
+
+// Hand the lock, which no one holds any more, to the threads waiting for it.
+// One waiting writer is preferred over waiting readers unless |prefer_readers|,
+// which a releasing writer passes so that readers cannot starve either.
+// Returns true if any thread was woken.  Called with the THREAD_LOCK held.
+static bool rwlock_wake_locked(rwlock_t *l, bool prefer_readers)
+{
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    uint64_t newval;
+    bool woke = false;
+
+    if (!wait_queue_is_empty(&l->write_wait) &&
+        (!prefer_readers || wait_queue_is_empty(&l->read_wait))) {
+        // hand the lock to one writer
+        thread_t *t = wait_queue_dequeue_one(&l->write_wait, MX_OK);
+        DEBUG_ASSERT(t);
+        l->writer = t;
+        newval = RWLOCK_FLAG_WRITER;
+        sched_unblock(t);
+        woke = true;
+    } else {
+        // hand the lock to every reader, waking them as one batch
+        int readers = wait_queue_wake_all(&l->read_wait, false, MX_OK);
+        newval = (uint64_t)readers * RWLOCK_READER;
+        woke = (readers > 0);
+    }
+
+    if (!wait_queue_is_empty(&l->read_wait) || !wait_queue_is_empty(&l->write_wait))
+        newval |= RWLOCK_FLAG_QUEUED;
+
+    atomic_store_u64(&l->val, newval);
+    return woke;
+}
+
+/**
+ * @brief  Acquire the lock for writing
+ */
+void rwlock_acquire_write(rwlock_t *l) TA_NO_THREAD_SAFETY_ANALYSIS
+{
+    DEBUG_ASSERT(l->magic == RWLOCK_MAGIC);
+    DEBUG_ASSERT(!arch_in_int_handler());
+
+    thread_t *ct = get_current_thread();
+    uint64_t oldval;
+
+retry:
+    // fast path: assume its unheld, try to grab it
+    oldval = 0;
+    if (likely(atomic_cmpxchg_u64(&l->val, &oldval, RWLOCK_FLAG_WRITER))) {
+        l->writer = ct;
+        return;
+    }
+
+#if LK_DEBUGLEVEL > 0
+    if (unlikely(ct == l->writer))
+        panic("rwlock_acquire_write: thread %p (%s) tried to acquire rwlock %p it already owns.\n",
+              ct, ct->name, l);
+#endif
+
+    // we contended with someone else, will probably need to block
+    THREAD_LOCK(state);
+
+    // check to see if it wasn't released in the interim
+    oldval = atomic_load_u64_relaxed(&l->val);
+    if (unlikely(oldval == 0)) {
+        THREAD_UNLOCK(state);
+        goto retry;
+    }
+
+    // flag that we're blocking; fast path readers may race with us
+    if (unlikely(!atomic_cmpxchg_u64(&l->val, &oldval, oldval | RWLOCK_FLAG_QUEUED))) {
+        THREAD_UNLOCK(state);
+        goto retry;
+    }
+
+    status_t ret = wait_queue_block(&l->write_wait, INFINITE_TIME);
+    if (unlikely(ret < MX_OK)) {
+        panic("rwlock_acquire_write: wait_queue_block returns with error %d l %p, thr %p\n",
+              ret, l, ct);
+    }
+
+    // whoever woke us handed us the lock
+    DEBUG_ASSERT(l->writer == ct);
+
+    THREAD_UNLOCK(state);
+}
+
+/**
+ * @brief  Release the lock held for writing
+ */
+void rwlock_release_write(rwlock_t *l) TA_NO_THREAD_SAFETY_ANALYSIS
+{
+    DEBUG_ASSERT(l->magic == RWLOCK_MAGIC);
+    DEBUG_ASSERT(!arch_in_int_handler());
+    DEBUG_ASSERT(is_rwlock_write_held(l));
+
+    l->writer = NULL;
+
+    // in case there's no contention, try the fast path
+    uint64_t oldval = RWLOCK_FLAG_WRITER;
+    if (likely(atomic_cmpxchg_u64(&l->val, &oldval, 0)))
+        return;
+
+    // there are waiters, hand the lock over under the thread lock
+    THREAD_LOCK(state);
+    DEBUG_ASSERT(atomic_load_u64_relaxed(&l->val) == (RWLOCK_FLAG_WRITER | RWLOCK_FLAG_QUEUED));
+    if (rwlock_wake_locked(l, true))
+        sched_reschedule();
+    THREAD_UNLOCK(state);
+}
+
+/**
+ * @brief  Acquire the lock for reading
+ */
+void rwlock_acquire_read(rwlock_t *l) TA_NO_THREAD_SAFETY_ANALYSIS
+{
+    DEBUG_ASSERT(l->magic == RWLOCK_MAGIC);
+    DEBUG_ASSERT(!arch_in_int_handler());
+
+    // fast path: no writer holds or waits for the lock, join the readers
+    uint64_t oldval = atomic_load_u64_relaxed(&l->val);
+    while (likely(!(oldval & (RWLOCK_FLAG_WRITER | RWLOCK_FLAG_QUEUED)))) {
+        if (atomic_cmpxchg_u64(&l->val, &oldval, oldval + RWLOCK_READER))
+            return;
+    }
+
+#if LK_DEBUGLEVEL > 0
+    if (unlikely(get_current_thread() == l->writer))
+        panic("rwlock_acquire_read: thread %p (%s) tried to read rwlock %p it writes.\n",
+              get_current_thread(), get_current_thread()->name, l);
+#endif
+
+    THREAD_LOCK(state);
+
+    for (;;) {
+        oldval = atomic_load_u64_relaxed(&l->val);
+        if (!(oldval & (RWLOCK_FLAG_WRITER | RWLOCK_FLAG_QUEUED))) {
+            // released in the interim
+            if (atomic_cmpxchg_u64(&l->val, &oldval, oldval + RWLOCK_READER))
+                break;
+            continue;
+        }
+
+        // flag that we're blocking; fast path readers may race with us
+        if (!atomic_cmpxchg_u64(&l->val, &oldval, oldval | RWLOCK_FLAG_QUEUED))
+            continue;
+
+        status_t ret = wait_queue_block(&l->read_wait, INFINITE_TIME);
+        if (unlikely(ret < MX_OK)) {
+            panic("rwlock_acquire_read: wait_queue_block returns with error %d l %p, thr %p\n",
+                  ret, l, get_current_thread());
+        }
+
+        // whoever woke us counted us in as a reader
+        break;
+    }
+
+    THREAD_UNLOCK(state);
+}
+
+/**
+ * @brief  Release the lock held for reading
+ */
+void rwlock_release_read(rwlock_t *l) TA_NO_THREAD_SAFETY_ANALYSIS
+{
+    DEBUG_ASSERT(l->magic == RWLOCK_MAGIC);
+    DEBUG_ASSERT(!arch_in_int_handler());
+
+    // fast path: other readers remain, or no one is waiting
+    uint64_t oldval = atomic_load_u64_relaxed(&l->val);
+    for (;;) {
+        DEBUG_ASSERT(oldval >= RWLOCK_READER);
+        DEBUG_ASSERT(!(oldval & RWLOCK_FLAG_WRITER));
+        if ((oldval & RWLOCK_FLAG_QUEUED) && (oldval >> 2) == 1)
+            break;
+        if (atomic_cmpxchg_u64(&l->val, &oldval, oldval - RWLOCK_READER))
+            return;
+    }
+
+    // we are the last reader and someone is waiting, hand the lock over.
+    // The queued flag keeps new readers out, so we stay the last reader.
+    THREAD_LOCK(state);
+    DEBUG_ASSERT(atomic_load_u64_relaxed(&l->val) == (RWLOCK_READER | RWLOCK_FLAG_QUEUED));
+    if (rwlock_wake_locked(l, false))
+        sched_reschedule();
+    THREAD_UNLOCK(state);
+}
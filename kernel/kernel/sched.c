@@ -16,6 +16,7 @@
 #include <lib/ktrace.h>
 #include <kernel/mp.h>
 #include <kernel/percpu.h>
+#include <kernel/stats.h>
 #include <kernel/thread.h>
 
 /* legacy implementation that just broadcast ipis for every reschedule */
@@ -37,12 +38,12 @@
 #define LOCAL_KTRACE2(probe, x, y)
 #endif
 
-/* the run queue */
-static struct list_node run_queue[NUM_PRIORITIES];
-static uint32_t run_queue_bitmap;
+/* a thread stays on the cpu it last ran on unless that cpu has this many
+ * more threads queued than the least loaded one */
+#define AFFINITY_SLACK 2
 
 /* make sure the bitmap is large enough to cover our number of priorities */
-static_assert(NUM_PRIORITIES <= sizeof(run_queue_bitmap) * CHAR_BIT, "");
+static_assert(NUM_PRIORITIES <= sizeof(percpu[0].run_queue_bitmap) * CHAR_BIT, "");
 
 /* compute the effective priority of a thread */
 static int effec_priority(const thread_t *t)
@@ -102,15 +103,15 @@ static void deboost_thread(thread_t *t, bool quantum_expiration)
 }
 
 /* pick a 'random' cpu */
-static mp_cpu_mask_t rand_cpu(const mp_cpu_mask_t mask)
+static uint rand_cpu(const mp_cpu_mask_t mask)
 {
     if (unlikely(mask == 0))
-        return 0;
+        return arch_curr_cpu_num();
 
     /* check that the mask passed in has at least one bit set in the online mask */
     mp_cpu_mask_t online = mp_get_online_mask();
     if (unlikely((mask & online) == 0))
-        return 0;
+        return arch_curr_cpu_num();
 
     /* compute the highest online cpu */
     uint highest_cpu = (sizeof(mp_cpu_mask_t) * CHAR_BIT - 1) - __builtin_clz(online);
@@ -124,96 +125,183 @@ static mp_cpu_mask_t rand_cpu(const mp_cpu_mask_t mask)
             rot = 0;
 
         if ((1u << rot) & mask)
-            return (1u << rot);
+            return rot;
     }
 }
 
-/* find a cpu to wake up */
-static mp_cpu_mask_t find_cpu(thread_t *t)
+/* find a cpu to queue a thread on */
+static uint find_cpu(thread_t *t)
 {
+    uint curr_cpu = arch_curr_cpu_num();
+
+    if (t->pinned_cpu >= 0)
+        return t->pinned_cpu;
+
+    /* queue it locally, the broadcast makes an idle cpu steal it */
     if (BROADCAST_RESCHEDULE)
-        return MP_CPU_ALL_BUT_LOCAL;
+        return curr_cpu;
 
-    /* get the last cpu the thread ran on */
-    mp_cpu_mask_t last_ran_cpu_mask = (1u << thread_last_cpu(t));
+    mp_cpu_mask_t active = mp_get_active_mask();
 
-    /* the current cpu */
-    mp_cpu_mask_t curr_cpu_mask = (1u << arch_curr_cpu_num());
+    /* get the last cpu the thread ran on, its cache is likely still warm */
+    uint last_cpu = thread_last_cpu(t);
+    if (unlikely((active & (1u << last_cpu)) == 0))
+        last_cpu = curr_cpu;
 
     /* get a list of idle cpus */
-    mp_cpu_mask_t idle_cpu_mask = mp_get_idle_mask();
+    mp_cpu_mask_t idle_cpu_mask = mp_get_idle_mask() & active;
     if (idle_cpu_mask != 0) {
-        if (idle_cpu_mask & curr_cpu_mask) {
-            /* the current cpu is idle, so run it here */
-            return 0;
+        if (idle_cpu_mask & (1u << last_cpu)) {
+            /* the last cpu it ran on is idle */
+            return last_cpu;
         }
 
-        if (last_ran_cpu_mask & idle_cpu_mask) {
-            /* the last core it ran on is idle and isn't the current cpu */
-            return last_ran_cpu_mask;
+        if (idle_cpu_mask & (1u << curr_cpu)) {
+            /* the current cpu is idle, so run it here */
+            return curr_cpu;
         }
 
         /* pick an idle_cpu */
         return rand_cpu(idle_cpu_mask);
     }
 
-    /* no idle cpus */
-    if (last_ran_cpu_mask == curr_cpu_mask) {
-        /* the last cpu it ran on is us */
-        /* pick a random cpu that isn't the current one */
-        return rand_cpu(mp_get_online_mask() & ~(curr_cpu_mask));
-    } else {
-        /* pick the last cpu it ran on */
-        return last_ran_cpu_mask;
+    /* no idle cpus, stay on the last cpu it ran on unless it is
+     * noticeably busier than the least loaded cpu */
+    uint cpu = last_cpu;
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        if ((active & (1u << i)) && percpu[i].run_queue_count < percpu[cpu].run_queue_count)
+            cpu = i;
     }
+
+    if (percpu[cpu].run_queue_count + AFFINITY_SLACK < percpu[last_cpu].run_queue_count)
+        return cpu;
+
+    return last_cpu;
+}
+
+/* the cpu the current thread goes back in the run queue of */
+static uint local_cpu(const thread_t *t)
+{
+    return (t->pinned_cpu >= 0) ? (uint)t->pinned_cpu : arch_curr_cpu_num();
+}
+
+/* highest priority with a thread in the run queues of the bitmap */
+static uint highest_run_queue(uint32_t bitmap)
+{
+    return HIGHEST_PRIORITY - __builtin_clz(bitmap)
+           - (sizeof(bitmap) * CHAR_BIT - NUM_PRIORITIES);
 }
 
 /* run queue manipulation */
-static void insert_in_run_queue_head(thread_t *t)
+static void insert_in_run_queue_head(uint cpu, thread_t *t)
 {
     DEBUG_ASSERT(!list_in_list(&t->queue_node));
 
+    struct percpu *c = &percpu[cpu];
     int ep = effec_priority(t);
 
-    list_add_head(&run_queue[ep], &t->queue_node);
-    run_queue_bitmap |= (1u << ep);
+    list_add_head(&c->run_queue[ep], &t->queue_node);
+    c->run_queue_bitmap |= (1u << ep);
+    c->run_queue_count++;
 }
 
-static void insert_in_run_queue_tail(thread_t *t)
+static void insert_in_run_queue_tail(uint cpu, thread_t *t)
 {
     DEBUG_ASSERT(!list_in_list(&t->queue_node));
 
+    struct percpu *c = &percpu[cpu];
     int ep = effec_priority(t);
 
-    list_add_tail(&run_queue[ep], &t->queue_node);
-    run_queue_bitmap |= (1u << ep);
+    list_add_tail(&c->run_queue[ep], &t->queue_node);
+    c->run_queue_bitmap |= (1u << ep);
+    c->run_queue_count++;
 }
 
-thread_t *sched_get_top_thread(uint cpu)
+static void remove_from_run_queue(uint cpu, thread_t *t, uint queue)
+{
+    struct percpu *c = &percpu[cpu];
+
+    list_delete(&t->queue_node);
+    if (list_is_empty(&c->run_queue[queue]))
+        c->run_queue_bitmap &= ~(1u << queue);
+    c->run_queue_count--;
+}
+
+/* requeue the current thread, kicking its pinned cpu if that is not this one */
+static void requeue_current(thread_t *t, bool head)
 {
-    thread_t *newthread;
-    uint32_t local_run_queue_bitmap = run_queue_bitmap;
+    uint cpu = local_cpu(t);
+
+    if (head)
+        insert_in_run_queue_head(cpu, t);
+    else
+        insert_in_run_queue_tail(cpu, t);
+
+    if (cpu != arch_curr_cpu_num())
+        mp_reschedule(1u << cpu, 0);
+}
+
+/* take the highest priority thread in the run queues of victim that can run
+ * on cpu and outranks min_priority */
+static thread_t *take_from_run_queue(uint victim, uint cpu, int min_priority)
+{
+    struct percpu *c = &percpu[victim];
+    uint32_t local_run_queue_bitmap = c->run_queue_bitmap;
 
     while (local_run_queue_bitmap) {
         /* find the first (remaining) queue with a thread in it */
-        uint next_queue = HIGHEST_PRIORITY - __builtin_clz(local_run_queue_bitmap)
-                          - (sizeof(run_queue_bitmap) * CHAR_BIT - NUM_PRIORITIES);
+        uint next_queue = highest_run_queue(local_run_queue_bitmap);
+        if ((int)next_queue <= min_priority)
+            break;
+
+        thread_t *t;
+        list_for_every_entry(&c->run_queue[next_queue], t, thread_t, queue_node) {
+            if (likely(t->pinned_cpu < 0) || (uint)t->pinned_cpu == cpu) {
+                remove_from_run_queue(victim, t, next_queue);
+                return t;
+            }
+        }
 
-        list_for_every_entry(&run_queue[next_queue], newthread, thread_t, queue_node) {
-            if (likely(newthread->pinned_cpu < 0) || (uint)newthread->pinned_cpu == cpu) {
-                list_delete(&newthread->queue_node);
+        local_run_queue_bitmap &= ~(1u << next_queue);
+    }
 
-                if (list_is_empty(&run_queue[next_queue]))
-                    run_queue_bitmap &= ~(1<<next_queue);
+    return NULL;
+}
 
-                LOCAL_KTRACE2("sched_get_top", newthread->priority_boost, newthread->base_priority);
+thread_t *sched_get_top_thread(uint cpu)
+{
+    /* run the highest priority local thread, only looking at other cpus'
+     * run queues when there is nothing queued here */
+    thread_t *newthread = take_from_run_queue(cpu, cpu, -1);
+    if (newthread) {
+        LOCAL_KTRACE2("sched_get_top", newthread->priority_boost, newthread->base_priority);
+        return newthread;
+    }
 
-                return newthread;
-            }
+    /* steal the highest priority thread queued on another cpu */
+    uint victim = cpu;
+    int victim_priority = -1;
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        uint32_t bitmap = percpu[i].run_queue_bitmap;
+        if (i == cpu || bitmap == 0)
+            continue;
+
+        int priority = highest_run_queue(bitmap);
+        if (priority > victim_priority) {
+            victim = i;
+            victim_priority = priority;
         }
+    }
 
-        local_run_queue_bitmap &= ~(1<<next_queue);
+    if (victim != cpu) {
+        newthread = take_from_run_queue(victim, cpu, -1);
+        if (newthread) {
+            LOCAL_KTRACE2("sched_steal", victim, newthread->base_priority);
+            CPU_STATS_INC(steals);
+            return newthread;
+        }
     }
+
     /* no threads to run, select the idle thread for this cpu */
     return &percpu[cpu].idle_thread;
 }
@@ -246,9 +334,10 @@ void sched_unblock(thread_t *t)
 
     /* stuff the new thread in the run queue */
     t->state = THREAD_READY;
-    insert_in_run_queue_head(t);
+    uint cpu = find_cpu(t);
+    insert_in_run_queue_head(cpu, t);
 
-    mp_reschedule(find_cpu(t), 0);
+    mp_reschedule(BROADCAST_RESCHEDULE ? MP_CPU_ALL_BUT_LOCAL : (1u << cpu), 0);
 }
 
 void sched_unblock_list(struct list_node *list)
@@ -269,9 +358,10 @@ void sched_unblock_list(struct list_node *list)
 
         /* stuff the new thread in the run queue */
         t->state = THREAD_READY;
-        insert_in_run_queue_head(t);
+        uint cpu = find_cpu(t);
+        insert_in_run_queue_head(cpu, t);
 
-        mp_reschedule(find_cpu(t), 0);
+        mp_reschedule(BROADCAST_RESCHEDULE ? MP_CPU_ALL_BUT_LOCAL : (1u << cpu), 0);
     }
 }
 
@@ -289,7 +379,7 @@ void sched_yield(void)
     /* consume the rest of the time slice, deboost ourself, and go to the end of the queue */
     current_thread->remaining_time_slice = 0;
     deboost_thread(current_thread, false);
-    insert_in_run_queue_tail(current_thread);
+    requeue_current(current_thread, false);
 
     _thread_resched_internal();
 }
@@ -308,11 +398,11 @@ void sched_preempt(void)
     /* idle thread doesn't go in the run queue */
     if (likely(!thread_is_idle(current_thread))) {
         if (current_thread->remaining_time_slice > 0) {
-            insert_in_run_queue_head(current_thread);
+            requeue_current(current_thread, true);
         } else {
             /* if we're out of quantum, deboost the thread and put it at the tail of the queue */
             deboost_thread(current_thread, true);
-            insert_in_run_queue_tail(current_thread);
+            requeue_current(current_thread, false);
         }
     }
 
@@ -337,19 +427,56 @@ void sched_reschedule(void)
         deboost_thread(current_thread, false);
 
         if (current_thread->remaining_time_slice > 0) {
-            insert_in_run_queue_head(current_thread);
+            requeue_current(current_thread, true);
         } else {
-            insert_in_run_queue_tail(current_thread);
+            requeue_current(current_thread, false);
         }
     }
 
     _thread_resched_internal();
 }
 
+/* move the threads queued on a cpu going offline to the cpus they can run on,
+ * leaving the ones pinned to it queued */
+void sched_transition_off_cpu(uint old_cpu)
+{
+    THREAD_LOCK(state);
+
+    struct percpu *c = &percpu[old_cpu];
+    mp_cpu_mask_t active = mp_get_active_mask();
+    mp_cpu_mask_t reschedule_mask = 0;
+
+    DEBUG_ASSERT((active & (1u << old_cpu)) == 0);
+
+    for (uint i = 0; i < NUM_PRIORITIES; i++) {
+        thread_t *t;
+        thread_t *temp;
+        list_for_every_entry_safe(&c->run_queue[i], t, temp, thread_t, queue_node) {
+            /* a thread pinned here stays queued until the cpu comes back */
+            if (t->pinned_cpu == (int)old_cpu)
+                continue;
+
+            remove_from_run_queue(old_cpu, t, i);
+
+            uint cpu = find_cpu(t);
+            insert_in_run_queue_tail(cpu, t);
+            reschedule_mask |= (1u << cpu);
+        }
+    }
+
+    if (reschedule_mask != 0)
+        mp_reschedule(BROADCAST_RESCHEDULE ? MP_CPU_ALL_BUT_LOCAL : reschedule_mask, 0);
+
+    THREAD_UNLOCK(state);
+}
+
 void sched_init_early(void)
 {
     /* initialize the run queues */
-    for (unsigned int i=0; i < NUM_PRIORITIES; i++)
-        list_initialize(&run_queue[i]);
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        for (unsigned int i=0; i < NUM_PRIORITIES; i++)
+            list_initialize(&percpu[cpu].run_queue[i]);
+        percpu[cpu].run_queue_bitmap = 0;
+        percpu[cpu].run_queue_count = 0;
+    }
 }
-
@@ -46,23 +46,179 @@ void timer_initialize(timer_t *timer)
     *timer = (timer_t)TIMER_INITIAL_VALUE(*timer);
 }
 
-static void insert_timer_in_queue(uint cpu, timer_t *timer)
+/* slot of a timer in the near heap */
+#define NEAR_SLOT (~0u)
+
+static inline uint64_t deadline_granule(lk_time_t deadline)
 {
-    timer_t *entry;
+    return deadline >> TIMER_WHEEL_GRANULE_SHIFT;
+}
+
+static void timer_queue_init(struct timer_queue *q)
+{
+    q->base = 0;
+    q->near = NULL;
+    q->level_map = 0;
+    for (uint level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        q->slot_map[level] = 0;
+        for (uint i = 0; i < TIMER_WHEEL_SLOTS; i++)
+            list_initialize(&q->slots[level][i]);
+    }
+}
+
+/* make the root b a child of the root a or the other way around,
+ * returning the new root */
+static timer_t *heap_meld(timer_t *a, timer_t *b)
+{
+    if (!a)
+        return b;
+    if (!b)
+        return a;
+
+    if (TIME_LT(b->scheduled_time, a->scheduled_time)) {
+        timer_t *t = a;
+        a = b;
+        b = t;
+    }
+
+    b->heap_prev = a;
+    b->heap_sibling = a->heap_child;
+    if (a->heap_child)
+        a->heap_child->heap_prev = b;
+    a->heap_child = b;
+
+    return a;
+}
+
+/* meld a list of siblings into one heap, pairwise left to right and
+ * then the pairs right to left */
+static timer_t *heap_merge_pairs(timer_t *first)
+{
+    timer_t *pairs = NULL;
+
+    while (first) {
+        timer_t *a = first;
+        timer_t *b = a->heap_sibling;
+        first = b ? b->heap_sibling : NULL;
+
+        a->heap_sibling = a->heap_prev = NULL;
+        if (b) {
+            b->heap_sibling = b->heap_prev = NULL;
+            a = heap_meld(a, b);
+        }
+
+        a->heap_sibling = pairs;
+        pairs = a;
+    }
+
+    timer_t *root = NULL;
+    while (pairs) {
+        timer_t *next = pairs->heap_sibling;
+        pairs->heap_sibling = NULL;
+        root = heap_meld(root, pairs);
+        pairs = next;
+    }
+
+    return root;
+}
+
+static void heap_remove(struct timer_queue *q, timer_t *timer)
+{
+    timer_t *children = heap_merge_pairs(timer->heap_child);
+
+    if (timer == q->near) {
+        q->near = children;
+    } else {
+        /* unlink the subtree from its parent or previous sibling */
+        if (timer->heap_prev->heap_child == timer)
+            timer->heap_prev->heap_child = timer->heap_sibling;
+        else
+            timer->heap_prev->heap_sibling = timer->heap_sibling;
+        if (timer->heap_sibling)
+            timer->heap_sibling->heap_prev = timer->heap_prev;
+
+        q->near = heap_meld(q->near, children);
+    }
+
+    timer->heap_child = timer->heap_sibling = timer->heap_prev = NULL;
+}
+
+/* put the timer in the near heap or the wheel slot for its deadline */
+static void timer_queue_place(struct timer_queue *q, timer_t *timer)
+{
+    uint64_t granule = deadline_granule(timer->scheduled_time);
+
+    if (granule <= q->base) {
+        timer->slot = NEAR_SLOT;
+        timer->heap_child = timer->heap_sibling = timer->heap_prev = NULL;
+        q->near = heap_meld(q->near, timer);
+        return;
+    }
+
+    /* the level of the highest digit the deadline differs from the base in */
+    uint level = (63 - __builtin_clzll(granule ^ q->base)) / TIMER_WHEEL_SLOT_BITS;
+    uint i = (granule >> (level * TIMER_WHEEL_SLOT_BITS)) & (TIMER_WHEEL_SLOTS - 1);
 
+    list_add_tail(&q->slots[level][i], &timer->node);
+    q->slot_map[level] |= 1u << i;
+    q->level_map |= 1u << level;
+    timer->slot = level * TIMER_WHEEL_SLOTS + i;
+}
+
+static void timer_queue_insert(struct timer_queue *q, timer_t *timer)
+{
     DEBUG_ASSERT(arch_ints_disabled());
 
-    LTRACEF("timer %p, cpu %u, scheduled %" PRIu64 "\n", timer, cpu, timer->scheduled_time);
+    LTRACEF("timer %p, queue %p, scheduled %" PRIu64 "\n", timer, q, timer->scheduled_time);
+
+    timer->queue = q;
+    timer_queue_place(q, timer);
+}
+
+static void timer_queue_remove(struct timer_queue *q, timer_t *timer)
+{
+    DEBUG_ASSERT(timer->queue == q);
+
+    if (timer->slot == NEAR_SLOT) {
+        heap_remove(q, timer);
+    } else {
+        uint level = timer->slot / TIMER_WHEEL_SLOTS;
+        uint i = timer->slot % TIMER_WHEEL_SLOTS;
 
-    list_for_every_entry(&percpu[cpu].timer_queue, entry, timer_t, node) {
-        if (TIME_GT(entry->scheduled_time, timer->scheduled_time)) {
-            list_add_before(&entry->node, &timer->node);
-            return;
+        list_delete(&timer->node);
+        if (list_is_empty(&q->slots[level][i])) {
+            q->slot_map[level] &= ~(1u << i);
+            if (q->slot_map[level] == 0)
+                q->level_map &= ~(1u << level);
         }
     }
 
-    /* walked off the end of the list */
-    list_add_tail(&percpu[cpu].timer_queue, &timer->node);
+    timer->queue = NULL;
+}
+
+/* return the earliest timer in the queue, when the near heap is empty
+ * the wheel is advanced to the start of the lowest non empty slot and
+ * the timers in it are spread over the heap and the levels below */
+static timer_t *timer_queue_peek(struct timer_queue *q)
+{
+    while (!q->near && q->level_map) {
+        uint level = __builtin_ctz(q->level_map);
+        uint i = __builtin_ctz(q->slot_map[level]);
+        uint shift = level * TIMER_WHEEL_SLOT_BITS;
+
+        q->base = (q->base >> (shift + TIMER_WHEEL_SLOT_BITS) << (shift + TIMER_WHEEL_SLOT_BITS)) |
+                  ((uint64_t)i << shift);
+
+        q->slot_map[level] &= ~(1u << i);
+        if (q->slot_map[level] == 0)
+            q->level_map &= ~(1u << level);
+
+        timer_t *timer;
+        while ((timer = list_remove_head_type(&q->slots[level][i], timer_t, node)) != NULL)
+            timer_queue_place(q, timer);
+    }
+
+    return q->near;
 }
 
 static void timer_set(timer_t *timer, lk_time_t deadline, timer_callback callback, void *arg)
@@ -71,8 +227,8 @@ static void timer_set(timer_t *timer, lk_time_t deadline, timer_callback callbac
 
     DEBUG_ASSERT(timer->magic == TIMER_MAGIC);
 
-    if (list_in_list(&timer->node)) {
-        panic("timer %p already in list\n", timer);
+    if (timer->queue) {
+        panic("timer %p already in a queue\n", timer);
     }
 
     spin_lock_saved_state_t state;
@@ -101,9 +257,10 @@ static void timer_set(timer_t *timer, lk_time_t deadline, timer_callback callbac
 
     LTRACEF("scheduled time %" PRIu64 "\n", timer->scheduled_time);
 
-    insert_timer_in_queue(cpu, timer);
+    struct timer_queue *q = &percpu[cpu].timer_queue;
+    timer_queue_insert(q, timer);
 
-    if (list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node) == timer) {
+    if (timer_queue_peek(q) == timer) {
         /* we just modified the head of the timer queue */
         LTRACEF("setting new timer for %" PRIu64 " nsecs\n", deadline);
         platform_set_oneshot_timer(deadline);
@@ -170,19 +327,19 @@ bool timer_cancel(timer_t *timer)
     bool callback_not_running;
 
     /* if the timer is in a queue, remove it and adjust hardware timers if needed */
-    if (list_in_list(&timer->node)) {
+    if (timer->queue) {
         callback_not_running = true;
 
-        /* save a copy of the old head of the queue */
-        timer_t *oldhead = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+        /* see if we're about to modify the head of this cpu's timer queue */
+        /* if we modify another cpu's queue, we'll just let it fire and sort itself out */
+        struct timer_queue *q = timer->queue;
+        bool was_head = (q == &percpu[cpu].timer_queue && q->near == timer);
 
         /* remove our timer from the queue */
-        list_delete(&timer->node);
+        timer_queue_remove(q, timer);
 
-        /* see if we've just modified the head of this cpu's timer queue */
-        /* if we modified another cpu's queue, we'll just let it fire and sort itself out */
-        if (unlikely(oldhead == timer)) {
-            timer_t *newhead = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+        if (unlikely(was_head)) {
+            timer_t *newhead = timer_queue_peek(q);
             if (newhead) {
                 LTRACEF("setting new timer to %" PRIu64 "\n", newhead->scheduled_time);
                 platform_set_oneshot_timer(newhead->scheduled_time);
@@ -220,6 +377,7 @@ enum handler_return timer_tick(lk_time_t now)
     CPU_STATS_INC(timer_ints);
 
     uint cpu = arch_curr_cpu_num();
+    struct timer_queue *q = &percpu[cpu].timer_queue;
 
     LTRACEF("cpu %u now %" PRIu64 ", sp %p\n", cpu, now, __GET_FRAME());
 
@@ -227,7 +385,7 @@ enum handler_return timer_tick(lk_time_t now)
 
     for (;;) {
         /* see if there's an event to process */
-        timer = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+        timer = timer_queue_peek(q);
         if (likely(timer == 0))
             break;
         LTRACEF("next item on timer queue %p at %" PRIu64 " now %" PRIu64 " (%p, arg %p)\n", timer, timer->scheduled_time, now, timer->callback, timer->arg);
@@ -239,7 +397,7 @@ enum handler_return timer_tick(lk_time_t now)
         DEBUG_ASSERT_MSG(timer && timer->magic == TIMER_MAGIC,
                 "ASSERT: timer failed magic check: timer %p, magic 0x%x\n",
                 timer, (uint)timer->magic);
-        list_delete(&timer->node);
+        timer_queue_remove(q, timer);
 
         /* mark the timer busy */
         timer->active_cpu = cpu;
@@ -269,7 +427,7 @@ enum handler_return timer_tick(lk_time_t now)
     }
 
     /* reset the timer to the next event */
-    timer = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+    timer = timer_queue_peek(q);
     if (timer) {
         /* has to be the case or it would have fired already */
         DEBUG_ASSERT(TIME_GT(timer->scheduled_time, now));
@@ -309,16 +467,19 @@ void timer_transition_off_cpu(uint old_cpu)
     spin_lock_irqsave(&timer_lock, state);
     uint cpu = arch_curr_cpu_num();
 
-    timer_t *old_head = list_peek_head_type(&percpu[old_cpu].timer_queue, timer_t, node);
-    
-    timer_t *entry = NULL, *tmp_entry = NULL;
+    struct timer_queue *old_q = &percpu[old_cpu].timer_queue;
+    struct timer_queue *q = &percpu[cpu].timer_queue;
+
+    timer_t *old_head = timer_queue_peek(q);
+
     /* Move all timers from old_cpu to this cpu */
-    list_for_every_entry_safe(&percpu[old_cpu].timer_queue, entry, tmp_entry, timer_t, node) {
-        list_delete(&entry->node);
-        insert_timer_in_queue(cpu, entry);
+    timer_t *entry;
+    while ((entry = timer_queue_peek(old_q)) != NULL) {
+        timer_queue_remove(old_q, entry);
+        timer_queue_insert(q, entry);
     }
 
-    timer_t *new_head = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+    timer_t *new_head = timer_queue_peek(q);
     if (new_head != NULL && new_head != old_head) {
         /* we just modified the head of the timer queue */
         LTRACEF("setting new timer for %" PRIu64 " nsecs\n", new_head->scheduled_time);
@@ -337,7 +498,7 @@ void timer_thaw_percpu(void)
 
     uint cpu = arch_curr_cpu_num();
 
-    timer_t *t = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+    timer_t *t = timer_queue_peek(&percpu[cpu].timer_queue);
     if (t) {
         LTRACEF("rescheduling timer for %" PRIu64 " nsecs\n", t->scheduled_time);
         platform_set_oneshot_timer(t->scheduled_time);
@@ -350,11 +511,28 @@ void timer_init(void)
 {
     timer_lock = SPIN_LOCK_INITIAL_VALUE;
     for (uint i = 0; i < SMP_MAX_CPUS; i++) {
-        list_initialize(&percpu[i].timer_queue);
+        timer_queue_init(&percpu[i].timer_queue);
     }
 }
 
-// print a timer queue dump into the passed in buffer
+static const timer_t *heap_parent(const timer_t *t)
+{
+    while (t->heap_prev && t->heap_prev->heap_child != t)
+        t = t->heap_prev;
+    return t->heap_prev;
+}
+
+static size_t dump_timer(char *buf, size_t len, const timer_t *t, lk_time_t now)
+{
+    lk_time_t delta_now = (t->scheduled_time > now) ? (t->scheduled_time - now) : 0;
+    int ret = snprintf(buf, len, "\ttime %" PRIu64 " delta_now %" PRIu64 " func %p arg %p\n",
+                       t->scheduled_time, delta_now, t->callback, t->arg);
+    return (ret < 0) ? 0 : (size_t)ret;
+}
+
+// print a timer queue dump into the passed in buffer, the near heap
+// first with the next timer to fire at its head and then the wheel
+// slots in deadline order
 static void dump_timer_queues(char *buf, size_t len)
 {
     size_t ptr = 0;
@@ -363,23 +541,39 @@ static void dump_timer_queues(char *buf, size_t len)
     spin_lock_saved_state_t state;
     spin_lock_irqsave(&timer_lock, state);
 
-    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
-        if (mp_is_cpu_online(i)) {
-            ptr += snprintf(buf + ptr, len - ptr, "cpu %u:\n", i);
-
-            timer_t *t;
-            lk_time_t last = now;
-            list_for_every_entry(&percpu[i].timer_queue, t, timer_t, node) {
-                lk_time_t delta_now = (t->scheduled_time > now) ? (t->scheduled_time - now) : 0;
-                lk_time_t delta_last = (t->scheduled_time > last) ? (t->scheduled_time - last) : 0;
-                ptr += snprintf(buf + ptr, len - ptr,
-                        "\ttime %" PRIu64 " delta_now %" PRIu64 " delta_last %" PRIu64 " func %p arg %p\n",
-                        t->scheduled_time, delta_now, delta_last, t->callback, t->arg);
-                last = t->scheduled_time;
+    for (uint i = 0; i < SMP_MAX_CPUS && ptr < len; i++) {
+        if (!mp_is_cpu_online(i))
+            continue;
+
+        ptr += snprintf(buf + ptr, len - ptr, "cpu %u:\n", i);
+
+        const struct timer_queue *q = &percpu[i].timer_queue;
+        const timer_t *t = q->near;
+        while (t && ptr < len) {
+            ptr += dump_timer(buf + ptr, len - ptr, t, now);
+
+            if (t->heap_child) {
+                t = t->heap_child;
+                continue;
+            }
+            while (t && !t->heap_sibling)
+                t = heap_parent(t);
+            if (t)
+                t = t->heap_sibling;
+        }
+
+        for (uint level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+            for (uint slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+                list_for_every_entry(&q->slots[level][slot], t, timer_t, node) {
+                    if (ptr >= len)
+                        goto done;
+                    ptr += dump_timer(buf + ptr, len - ptr, t, now);
+                }
             }
         }
     }
 
+done:
     spin_unlock_irqrestore(&timer_lock, state);
 }
 
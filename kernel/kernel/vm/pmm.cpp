@@ -11,8 +11,11 @@
 #include <err.h>
 #include <inttypes.h>
 #include <kernel/auto_lock.h>
+#include <kernel/event.h>
 #include <kernel/mp.h>
 #include <kernel/mutex.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
 #include <kernel/timer.h>
 #include <kernel/vm.h>
 #include <lib/console.h>
@@ -38,6 +41,55 @@ static Mutex arena_lock;
 static mxtl::DoublyLinkedList<PmmArena*> arena_list TA_GUARDED(arena_lock);
 static size_t arena_cumulative_size TA_GUARDED(arena_lock);
 
+// Per cpu caches of free pages in front of the arenas, so most single page
+// allocations and frees never touch the arena lock. Pages move between a
+// cache and the arenas in batches. Only pages from KMAP arenas are cached,
+// so a cache can satisfy any allocation flags.
+//
+// A cached page stays in the ALLOC state as far as the arenas are
+// concerned, so contiguous and specific range allocations never see it.
+// Those paths drain every cache before giving up.
+#define PMM_CACHE_MAX 64
+#define PMM_CACHE_BATCH 32
+
+struct pmm_cache {
+    spin_lock_t lock;
+    list_node free_list;
+    size_t count;
+
+    // statistics
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t drains;
+} __CPU_MAX_ALIGN;
+
+static pmm_cache pmm_caches[SMP_MAX_CPUS];
+
+static void pmm_cache_init(uint level) {
+    for (auto& c : pmm_caches) {
+        c.lock = SPIN_LOCK_INITIAL_VALUE;
+        list_initialize(&c.free_list);
+    }
+}
+LK_INIT_HOOK(pmm_cache, &pmm_cache_init, LK_INIT_LEVEL_EARLIEST);
+
+// Pool of pages zeroed ahead of time by a low priority thread, used by
+// PMM_ALLOC_FLAG_ZEROED allocations so faults don't zero pages inline.
+// The thread tops the pool up to the high watermark when an allocation
+// takes it below the low one, as long as enough free memory is left for
+// everything else. Like cached pages, pooled pages are in the ALLOC state.
+#define PMM_ZERO_POOL_LOW 256
+#define PMM_ZERO_POOL_HIGH 1024
+#define PMM_ZERO_POOL_BATCH 16
+#define PMM_ZERO_POOL_RESERVE 4096
+
+static spin_lock_t zero_pool_lock = SPIN_LOCK_INITIAL_VALUE;
+static list_node zero_pool = LIST_INITIAL_VALUE(zero_pool);
+static size_t zero_pool_count;
+static uint64_t zero_pool_hits;
+static uint64_t zero_pool_misses;
+static event_t zero_pool_event = EVENT_INITIAL_VALUE(zero_pool_event, true, EVENT_FLAG_AUTOUNSIGNAL);
+
 #if PMM_ENABLE_FREE_FILL
 static void pmm_enforce_fill(uint level) {
     for (auto& a : arena_list) {
@@ -108,38 +160,216 @@ done_add:
     return MX_OK;
 }
 
-vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
-    AutoLock al(&arena_lock);
+// Returns true if a freed page may go in a cache. Only looks at values
+// set once during system initialization, so needs no lock.
+static bool pmm_page_cacheable(const vm_page_t* page) TA_NO_THREAD_SAFETY_ANALYSIS {
+    for (const auto& a : arena_list) {
+        if (a.page_belongs_to_arena(page))
+            return (a.flags() & PMM_ARENA_FLAG_KMAP) != 0;
+    }
+    return false;
+}
 
-    /* walk the arenas in order until we find one with a free page */
-    for (auto& a : arena_list) {
-        /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
-        if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
-            if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
-                continue;
+// Moves up to |count| pages from the local cache to the tail of |list|,
+// counting a hit if any were taken and a miss otherwise.
+static size_t pmm_cache_alloc(size_t count, struct list_node* list) {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    pmm_cache* c = &pmm_caches[arch_curr_cpu_num()];
+    spin_lock(&c->lock);
+
+    size_t taken = 0;
+    while (taken < count && c->count > 0) {
+        vm_page_t* page = list_remove_head_type(&c->free_list, vm_page_t, free.node);
+        list_add_tail(list, &page->free.node);
+        c->count--;
+        taken++;
+    }
+
+    if (taken > 0) {
+        c->hits++;
+    } else {
+        c->misses++;
+    }
+
+    spin_unlock(&c->lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    return taken;
+}
+
+// Moves the pages on |list|, which must all be cacheable, into the local
+// cache. If the cache overflows, a batch of its pages is moved to
+// |overflow| so the caller can return them to the arenas. Returns the
+// number of pages cached.
+static size_t pmm_cache_free(struct list_node* list, struct list_node* overflow) {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    pmm_cache* c = &pmm_caches[arch_curr_cpu_num()];
+    spin_lock(&c->lock);
+
+    size_t cached = 0;
+    vm_page_t* page;
+    while ((page = list_remove_head_type(list, vm_page_t, free.node))) {
+        DEBUG_ASSERT(page->state != VM_PAGE_STATE_OBJECT || page->object.pin_count == 0);
+
+        if (c->count == PMM_CACHE_MAX) {
+            for (size_t i = 0; i < PMM_CACHE_BATCH; i++) {
+                vm_page_t* p = list_remove_tail_type(&c->free_list, vm_page_t, free.node);
+                list_add_tail(overflow, &p->free.node);
+            }
+            c->count -= PMM_CACHE_BATCH;
+            c->drains++;
         }
 
-        // try to allocate the page out of the arena
-        vm_page_t* page = a.AllocPage(pa);
-        if (page)
-            return page;
+        page->state = VM_PAGE_STATE_ALLOC;
+        list_add_head(&c->free_list, &page->free.node);
+        c->count++;
+        cached++;
     }
 
-    LTRACEF("failed to allocate page\n");
-    return nullptr;
+    spin_unlock(&c->lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    return cached;
 }
 
-size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
-    LTRACEF("count %zu\n", count);
+// Empties every cache and the zeroed pool onto |list|, returning the
+// number of pages moved.
+static size_t pmm_cache_drain_all(struct list_node* list) {
+    size_t drained = 0;
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&zero_pool_lock, state);
+    vm_page_t* page;
+    while ((page = list_remove_head_type(&zero_pool, vm_page_t, free.node)))
+        list_add_tail(list, &page->free.node);
+    bool refill = zero_pool_count >= PMM_ZERO_POOL_LOW;
+    drained += zero_pool_count;
+    zero_pool_count = 0;
+    spin_unlock_irqrestore(&zero_pool_lock, state);
+
+    if (refill)
+        event_signal(&zero_pool_event, false);
+
+    for (auto& c : pmm_caches) {
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&c.lock, state);
+
+        if (c.count > 0) {
+            while ((page = list_remove_head_type(&c.free_list, vm_page_t, free.node)))
+                list_add_tail(list, &page->free.node);
+            drained += c.count;
+            c.count = 0;
+            c.drains++;
+        }
 
-    /* list must be initialized prior to calling this */
-    DEBUG_ASSERT(list);
+        spin_unlock_irqrestore(&c.lock, state);
+    }
+    return drained;
+}
 
-    if (count == 0)
-        return 0;
+// Counts the pages in the caches and the zeroed pool.
+static size_t pmm_cache_count() {
+    size_t count = __atomic_load_n(&zero_pool_count, __ATOMIC_RELAXED);
+    for (const auto& c : pmm_caches) {
+        count += __atomic_load_n(&c.count, __ATOMIC_RELAXED);
+    }
+    return count;
+}
 
-    AutoLock al(&arena_lock);
+// Moves up to |count| pages from the zeroed pool to the tail of |list|.
+static size_t pmm_zero_pool_alloc(size_t count, struct list_node* list) {
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&zero_pool_lock, state);
+
+    size_t before = zero_pool_count;
+    size_t taken = 0;
+    while (taken < count && zero_pool_count > 0) {
+        vm_page_t* page = list_remove_head_type(&zero_pool, vm_page_t, free.node);
+        list_add_tail(list, &page->free.node);
+        zero_pool_count--;
+        taken++;
+    }
+
+    zero_pool_hits += taken;
+    zero_pool_misses += count - taken;
+    // wake the zeroing thread once, as the pool drops below the low mark
+    bool refill = before >= PMM_ZERO_POOL_LOW && zero_pool_count < PMM_ZERO_POOL_LOW;
+
+    spin_unlock_irqrestore(&zero_pool_lock, state);
+
+    if (refill)
+        event_signal(&zero_pool_event, false);
+
+    return taken;
+}
+
+static void pmm_zero_pages(struct list_node* list) {
+    vm_page_t* page;
+    list_for_every_entry (list, page, vm_page_t, free.node) {
+        void* ptr = paddr_to_kvaddr(vm_page_to_paddr(page));
+        DEBUG_ASSERT(ptr);
+        arch_zero_page(ptr);
+    }
+}
+
+static size_t pmm_free_locked(struct list_node* list) TA_REQ(arena_lock);
+static size_t pmm_count_free_pages_locked() TA_REQ(arena_lock);
+static size_t pmm_alloc_pages_locked(size_t count, uint alloc_flags, struct list_node* list)
+    TA_REQ(arena_lock);
+
+static int pmm_zero_thread(void*) {
+    lk_time_t deadline = INFINITE_TIME;
+    for (;;) {
+        // allocations only signal as the pool crosses the low mark, so a
+        // refill cut short by low memory is retried on a timer instead
+        event_wait_deadline(&zero_pool_event, deadline, false);
+        deadline = INFINITE_TIME;
+
+        while (__atomic_load_n(&zero_pool_count, __ATOMIC_RELAXED) < PMM_ZERO_POOL_HIGH) {
+            struct list_node batch = LIST_INITIAL_VALUE(batch);
+            {
+                AutoLock al(&arena_lock);
+                if (pmm_count_free_pages_locked() < PMM_ZERO_POOL_RESERVE) {
+                    deadline = current_time() + LK_SEC(1);
+                    break;
+                }
+                pmm_alloc_pages_locked(PMM_ZERO_POOL_BATCH, PMM_ALLOC_FLAG_KMAP, &batch);
+            }
+
+            if (list_is_empty(&batch))
+                break;
+
+            pmm_zero_pages(&batch);
+
+            spin_lock_saved_state_t state;
+            spin_lock_irqsave(&zero_pool_lock, state);
+            vm_page_t* page;
+            while ((page = list_remove_head_type(&batch, vm_page_t, free.node))) {
+                list_add_tail(&zero_pool, &page->free.node);
+                zero_pool_count++;
+            }
+            spin_unlock_irqrestore(&zero_pool_lock, state);
+        }
+    }
+
+    return 0;
+}
+
+static void pmm_zero_init(uint level) {
+    // just above idle, so the zeroing is done on otherwise idle cpus
+    thread_t* t = thread_create("pmm zero", &pmm_zero_thread, nullptr, LOWEST_PRIORITY + 1,
+                                DEFAULT_STACK_SIZE);
+    DEBUG_ASSERT(t);
+    thread_detach_and_resume(t);
+}
+LK_INIT_HOOK(pmm_zero, &pmm_zero_init, LK_INIT_LEVEL_THREADING);
 
+static size_t pmm_alloc_pages_locked(size_t count, uint alloc_flags, struct list_node* list)
+    TA_REQ(arena_lock) {
     /* walk the arenas in order, allocating as many pages as we can from each */
     size_t allocated = 0;
     for (auto& a : arena_list) {
@@ -161,6 +391,117 @@ size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
     return allocated;
 }
 
+vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
+    struct list_node list = LIST_INITIAL_VALUE(list);
+
+    if (alloc_flags & PMM_ALLOC_FLAG_ZEROED) {
+        if (pmm_zero_pool_alloc(1, &list) > 0) {
+            vm_page_t* page = list_remove_head_type(&list, vm_page_t, free.node);
+            if (pa)
+                *pa = vm_page_to_paddr(page);
+            return page;
+        }
+    }
+
+    // fast path, take a page out of the local cache
+    if (pmm_cache_alloc(1, &list) == 0) {
+        // refill the cache with a batch, keeping the first page for ourselves
+        {
+            AutoLock al(&arena_lock);
+            pmm_alloc_pages_locked(PMM_CACHE_BATCH, PMM_ALLOC_FLAG_KMAP, &list);
+            if (list_is_empty(&list) && !(alloc_flags & PMM_ALLOC_FLAG_KMAP))
+                pmm_alloc_pages_locked(1, alloc_flags, &list);
+        }
+
+        if (list_is_empty(&list)) {
+            // give the pages other cpus have cached a chance
+            pmm_cache_drain_all(&list);
+            AutoLock al(&arena_lock);
+            pmm_free_locked(&list);
+            pmm_alloc_pages_locked(1, alloc_flags, &list);
+        }
+    }
+
+    vm_page_t* page = list_remove_head_type(&list, vm_page_t, free.node);
+    if (!page) {
+        LTRACEF("failed to allocate page\n");
+        return nullptr;
+    }
+
+    if (!list_is_empty(&list)) {
+        struct list_node overflow = LIST_INITIAL_VALUE(overflow);
+        pmm_cache_free(&list, &overflow);
+        if (!list_is_empty(&overflow)) {
+            AutoLock al(&arena_lock);
+            pmm_free_locked(&overflow);
+        }
+    }
+
+    paddr_t page_pa = vm_page_to_paddr(page);
+    LTRACEF("pa %#" PRIxPTR ", page %p\n", page_pa, page);
+
+    if (alloc_flags & PMM_ALLOC_FLAG_ZEROED) {
+        void* ptr = paddr_to_kvaddr(page_pa);
+        DEBUG_ASSERT(ptr);
+        arch_zero_page(ptr);
+    }
+
+    if (pa)
+        *pa = page_pa;
+    return page;
+}
+
+static size_t pmm_alloc_pages_unzeroed(size_t count, uint alloc_flags, struct list_node* list) {
+    // take what we can from the local cache, then the rest in one go from the arenas
+    size_t allocated = pmm_cache_alloc(count, list);
+    if (allocated == count)
+        return allocated;
+
+    {
+        AutoLock al(&arena_lock);
+        allocated += pmm_alloc_pages_locked(count - allocated, alloc_flags, list);
+    }
+
+    if (allocated < count) {
+        struct list_node drained = LIST_INITIAL_VALUE(drained);
+        if (pmm_cache_drain_all(&drained) > 0) {
+            AutoLock al(&arena_lock);
+            pmm_free_locked(&drained);
+            allocated += pmm_alloc_pages_locked(count - allocated, alloc_flags, list);
+        }
+    }
+
+    return allocated;
+}
+
+size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
+    LTRACEF("count %zu\n", count);
+
+    /* list must be initialized prior to calling this */
+    DEBUG_ASSERT(list);
+
+    if (count == 0)
+        return 0;
+
+    if (!(alloc_flags & PMM_ALLOC_FLAG_ZEROED))
+        return pmm_alloc_pages_unzeroed(count, alloc_flags, list);
+
+    // use up the zeroed pool first, then zero the rest here
+    size_t allocated = pmm_zero_pool_alloc(count, list);
+    if (allocated == count)
+        return allocated;
+
+    struct list_node fresh = LIST_INITIAL_VALUE(fresh);
+    allocated += pmm_alloc_pages_unzeroed(count - allocated, alloc_flags, &fresh);
+    pmm_zero_pages(&fresh);
+
+    vm_page_t* page;
+    while ((page = list_remove_head_type(&fresh, vm_page_t, free.node)))
+        list_add_tail(list, &page->free.node);
+
+    return allocated;
+}
+
 size_t pmm_alloc_range(paddr_t address, size_t count, struct list_node* list) {
     LTRACEF("address %#" PRIxPTR ", count %zu\n", address, count);
 
@@ -170,7 +511,12 @@ size_t pmm_alloc_range(paddr_t address, size_t count, struct list_node* list) {
 
     address = ROUNDDOWN(address, PAGE_SIZE);
 
+    // cached pages look allocated to the arenas, so put them back first
+    struct list_node drained = LIST_INITIAL_VALUE(drained);
+    pmm_cache_drain_all(&drained);
+
     AutoLock al(&arena_lock);
+    pmm_free_locked(&drained);
 
     /* walk through the arenas, looking to see if the physical page belongs to it */
     for (auto& a : arena_list) {
@@ -202,19 +548,28 @@ size_t pmm_alloc_contiguous(size_t count, uint alloc_flags, uint8_t alignment_lo
     if (alignment_log2 < PAGE_SIZE_SHIFT)
         alignment_log2 = PAGE_SIZE_SHIFT;
 
-    AutoLock al(&arena_lock);
+    for (int pass = 0; pass < 2; pass++) {
+        // cached pages look allocated to the arenas and may break up a run,
+        // so put them back before trying again
+        struct list_node drained = LIST_INITIAL_VALUE(drained);
+        if (pass > 0 && pmm_cache_drain_all(&drained) == 0)
+            break;
 
-    for (auto& a : arena_list) {
-        /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
-        if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
-            if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
-                continue;
-        }
+        AutoLock al(&arena_lock);
+        pmm_free_locked(&drained);
+
+        for (auto& a : arena_list) {
+            /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
+            if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
+                if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
+                    continue;
+            }
 
-        size_t allocated = a.AllocContiguous(count, alignment_log2, pa, list);
-        if (allocated > 0) {
-            DEBUG_ASSERT(allocated == count);
-            return allocated;
+            size_t allocated = a.AllocContiguous(count, alignment_log2, pa, list);
+            if (allocated > 0) {
+                DEBUG_ASSERT(allocated == count);
+                return allocated;
+            }
         }
     }
 
@@ -291,13 +646,7 @@ size_t pmm_free_kpages(void* _ptr, size_t count) {
     return pmm_free(&list);
 }
 
-size_t pmm_free(struct list_node* list) {
-    LTRACEF("list %p\n", list);
-
-    DEBUG_ASSERT(list);
-
-    AutoLock al(&arena_lock);
-
+static size_t pmm_free_locked(struct list_node* list) TA_REQ(arena_lock) {
     uint count = 0;
     while (!list_is_empty(list)) {
         vm_page_t* page = list_remove_head_type(list, vm_page_t, free.node);
@@ -313,7 +662,38 @@ size_t pmm_free(struct list_node* list) {
         }
     }
 
-    LTRACEF("returning count %u\n", count);
+    return count;
+}
+
+size_t pmm_free(struct list_node* list) {
+    LTRACEF("list %p\n", list);
+
+    DEBUG_ASSERT(list);
+
+    // pages from arenas that aren't cached go straight back
+    struct list_node uncached = LIST_INITIAL_VALUE(uncached);
+    vm_page_t* page;
+    vm_page_t* temp;
+    list_for_every_entry_safe (list, page, temp, vm_page_t, free.node) {
+        DEBUG_ASSERT(!page_is_free(page));
+
+        if (!pmm_page_cacheable(page)) {
+            list_delete(&page->free.node);
+            list_add_tail(&uncached, &page->free.node);
+        }
+    }
+
+    // fill the local cache, whatever it sheds goes back to the arenas in one go
+    struct list_node overflow = LIST_INITIAL_VALUE(overflow);
+    size_t count = pmm_cache_free(list, &overflow);
+
+    if (!list_is_empty(&uncached) || !list_is_empty(&overflow)) {
+        AutoLock al(&arena_lock);
+        count += pmm_free_locked(&uncached);
+        pmm_free_locked(&overflow);
+    }
+
+    LTRACEF("returning count %zu\n", count);
 
     return count;
 }
@@ -337,11 +717,11 @@ static size_t pmm_count_free_pages_locked() TA_REQ(arena_lock) {
 
 size_t pmm_count_free_pages() {
     AutoLock al(&arena_lock);
-    return pmm_count_free_pages_locked();
+    return pmm_count_free_pages_locked() + pmm_cache_count();
 }
 
 static void pmm_dump_free() TA_REQ(arena_lock) {
-    auto megabytes_free = pmm_count_free_pages_locked() / 256u;
+    auto megabytes_free = (pmm_count_free_pages_locked() + pmm_cache_count()) / 256u;
     printf(" %zu free MBs\n", megabytes_free);
 }
 
@@ -361,6 +741,11 @@ void pmm_count_total_states(size_t state_count[_VM_PAGE_STATE_COUNT]) {
     for (auto& a : arena_list) {
         a.CountStates(state_count);
     }
+
+    // the arenas see cached pages as allocated
+    size_t cached = pmm_cache_count();
+    state_count[VM_PAGE_STATE_ALLOC] -= cached;
+    state_count[VM_PAGE_STATE_FREE] += cached;
 }
 
 extern "C" enum handler_return pmm_dump_timer(struct timer* t, lk_time_t now, void*) TA_REQ(arena_lock) {
@@ -382,6 +767,17 @@ static void arena_dump(bool is_panic) TA_NO_THREAD_SAFETY_ANALYSIS {
     }
 }
 
+static void pmm_cache_dump() {
+    printf("%4s %6s %12s %12s %10s\n", "cpu", "pages", "hits", "misses", "drains");
+    for (uint i = 0; i < arch_max_num_cpus(); i++) {
+        const pmm_cache& c = pmm_caches[i];
+        printf("%4u %6zu %12" PRIu64 " %12" PRIu64 " %10" PRIu64 "\n", i,
+               __atomic_load_n(&c.count, __ATOMIC_RELAXED), c.hits, c.misses, c.drains);
+    }
+    printf("zeroed pool %zu pages, %" PRIu64 " hits, %" PRIu64 " misses\n",
+           __atomic_load_n(&zero_pool_count, __ATOMIC_RELAXED), zero_pool_hits, zero_pool_misses);
+}
+
 static int cmd_pmm(int argc, const cmd_args* argv, uint32_t flags) {
     bool is_panic = flags & CMD_FLAG_PANIC;
 
@@ -391,6 +787,7 @@ static int cmd_pmm(int argc, const cmd_args* argv, uint32_t flags) {
     usage:
         printf("usage:\n");
         printf("%s arenas\n", argv[0].str);
+        printf("%s cache\n", argv[0].str);
         if (!is_panic) {
             printf("%s alloc <count>\n", argv[0].str);
             printf("%s alloc_range <address> <count>\n", argv[0].str);
@@ -407,9 +804,11 @@ static int cmd_pmm(int argc, const cmd_args* argv, uint32_t flags) {
 
     if (!strcmp(argv[1].str, "arenas")) {
         arena_dump(is_panic);
+    } else if (!strcmp(argv[1].str, "cache")) {
+        pmm_cache_dump();
     } else if (is_panic) {
         // No other operations will work during a panic.
-        printf("Only the \"arenas\" command is available during a panic.\n");
+        printf("Only the \"arenas\" and \"cache\" commands are available during a panic.\n");
         goto usage;
     } else if (!strcmp(argv[1].str, "free")) {
         static bool show_mem = false;
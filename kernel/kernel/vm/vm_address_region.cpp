@@ -82,7 +82,7 @@ status_t VmAddressRegion::CreateSubVmarInternal(size_t offset, size_t size, uint
                                                 mxtl::RefPtr<VmAddressRegionOrMapping>* out) {
     DEBUG_ASSERT(out);
 
-    AutoLock guard(aspace_->lock());
+    AutoWriteLock guard(aspace_->lock());
     if (state_ != LifeCycleState::ALIVE) {
         return MX_ERR_BAD_STATE;
     }
@@ -282,7 +282,7 @@ status_t VmAddressRegion::OverwriteVmMapping(
     uint arch_mmu_flags, mxtl::RefPtr<VmAddressRegionOrMapping>* out) {
 
     canary_.Assert();
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(is_rwlock_write_held(aspace_->lock()));
     DEBUG_ASSERT(vmo);
     DEBUG_ASSERT(vmar_flags & VMAR_FLAG_SPECIFIC_OVERWRITE);
 
@@ -307,7 +307,7 @@ status_t VmAddressRegion::OverwriteVmMapping(
 
 status_t VmAddressRegion::DestroyLocked() {
     canary_.Assert();
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(is_rwlock_write_held(aspace_->lock()));
     LTRACEF("%p '%s'\n", this, name_);
 
     // Take a reference to ourself, so that we do not get destructed after
@@ -342,7 +342,7 @@ void VmAddressRegion::RemoveSubregion(VmAddressRegionOrMapping* region) {
 }
 
 mxtl::RefPtr<VmAddressRegionOrMapping> VmAddressRegion::FindRegion(vaddr_t addr) {
-    AutoLock guard(aspace_->lock());
+    AutoReadLock guard(aspace_->lock());
     if (state_ != LifeCycleState::ALIVE) {
         return nullptr;
     }
@@ -364,7 +364,7 @@ mxtl::RefPtr<VmAddressRegionOrMapping> VmAddressRegion::FindRegionLocked(vaddr_t
 
 size_t VmAddressRegion::AllocatedPagesLocked() const {
     canary_.Assert();
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(is_rwlock_held(aspace_->lock()));
 
     if (state_ != LifeCycleState::ALIVE) {
         return 0;
@@ -379,7 +379,7 @@ size_t VmAddressRegion::AllocatedPagesLocked() const {
 
 status_t VmAddressRegion::PageFault(vaddr_t va, uint pf_flags) {
     canary_.Assert();
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(is_rwlock_held(aspace_->lock()));
 
     for (auto vmar = WrapRefPtr(this);
          auto next = vmar->FindRegionLocked(va);
@@ -392,7 +392,7 @@ status_t VmAddressRegion::PageFault(vaddr_t va, uint pf_flags) {
 }
 
 bool VmAddressRegion::IsRangeAvailableLocked(vaddr_t base, size_t size) {
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(is_rwlock_write_held(aspace_->lock()));
     DEBUG_ASSERT(size > 0);
 
     // Find the first region with base > *base*.  Since subregions_ has no
@@ -424,7 +424,7 @@ bool VmAddressRegion::CheckGapLocked(const ChildList::iterator& prev,
                                      const ChildList::iterator& next,
                                      vaddr_t* pva, vaddr_t search_base, vaddr_t align,
                                      size_t region_size, size_t min_gap, uint arch_mmu_flags) {
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(is_rwlock_write_held(aspace_->lock()));
 
     safeint::CheckedNumeric<vaddr_t> gap_beg; // first byte of a gap
     safeint::CheckedNumeric<vaddr_t> gap_end; // last byte of a gap
@@ -511,7 +511,7 @@ status_t VmAddressRegion::AllocSpotLocked(size_t size, uint8_t align_pow2, uint
                                           vaddr_t* spot) {
     canary_.Assert();
     DEBUG_ASSERT(size > 0 && IS_PAGE_ALIGNED(size));
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(is_rwlock_write_held(aspace_->lock()));
 
     LTRACEF_LEVEL(2, "aspace %p size 0x%zx align %hhu\n", this, size,
                   align_pow2);
@@ -530,7 +530,7 @@ status_t VmAddressRegion::AllocSpotLocked(size_t size, uint8_t align_pow2, uint
 bool VmAddressRegion::EnumerateChildrenLocked(VmEnumerator* ve, uint depth) {
     canary_.Assert();
     DEBUG_ASSERT(ve != nullptr);
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(is_rwlock_held(aspace_->lock()));
     for (auto& child : subregions_) {
         DEBUG_ASSERT(child.IsAliveLocked());
         if (child.is_mapping()) {
@@ -567,7 +567,7 @@ void VmAddressRegion::Dump(uint depth, bool verbose) const {
 
 void VmAddressRegion::Activate() {
     DEBUG_ASSERT(state_ == LifeCycleState::NOT_READY);
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(is_rwlock_write_held(aspace_->lock()));
 
     state_ = LifeCycleState::ALIVE;
     parent_->subregions_.insert(mxtl::RefPtr<VmAddressRegionOrMapping>(this));
@@ -581,7 +581,7 @@ status_t VmAddressRegion::Unmap(vaddr_t base, size_t size) {
         return MX_ERR_INVALID_ARGS;
     }
 
-    AutoLock guard(aspace_->lock());
+    AutoWriteLock guard(aspace_->lock());
     if (state_ != LifeCycleState::ALIVE) {
         return MX_ERR_BAD_STATE;
     }
@@ -590,7 +590,7 @@ status_t VmAddressRegion::Unmap(vaddr_t base, size_t size) {
 }
 
 status_t VmAddressRegion::UnmapInternalLocked(vaddr_t base, size_t size, bool can_destroy_regions) {
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(is_rwlock_write_held(aspace_->lock()));
 
     if (!is_in_range(base, size)) {
         return MX_ERR_INVALID_ARGS;
@@ -679,7 +679,7 @@ status_t VmAddressRegion::Protect(vaddr_t base, size_t size, uint new_arch_mmu_f
         return MX_ERR_INVALID_ARGS;
     }
 
-    AutoLock guard(aspace_->lock());
+    AutoWriteLock guard(aspace_->lock());
     if (state_ != LifeCycleState::ALIVE) {
         return MX_ERR_BAD_STATE;
     }
@@ -755,7 +755,7 @@ status_t VmAddressRegion::Protect(vaddr_t base, size_t size, uint new_arch_mmu_f
 
 status_t VmAddressRegion::LinearRegionAllocatorLocked(size_t size, uint8_t align_pow2,
                                                      uint arch_mmu_flags, vaddr_t* spot) {
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(is_rwlock_write_held(aspace_->lock()));
 
     const vaddr_t base = 0;
 
@@ -764,51 +764,159 @@ status_t VmAddressRegion::LinearRegionAllocatorLocked(size_t size, uint8_t align
     const vaddr_t align = 1UL << align_pow2;
 
     // Find the first gap in the address space which can contain a region of the
-    // requested size.
-    auto before_iter = subregions_.end();
-    auto after_iter = subregions_.begin();
+    // requested size.  Gaps too small to hold it are skipped without visiting
+    // them, using the subtree bookkeeping of the children tree.
+    status_t status = MX_ERR_NO_MEMORY;
+    ForEachGapAtLeastLocked(size, [&](const ChildList::iterator& prev,
+                                      const ChildList::iterator& next) -> bool {
+        if (!CheckGapLocked(prev, next, spot, base, align, size, 0, arch_mmu_flags)) {
+            return true;
+        }
+        if (*spot != static_cast<vaddr_t>(-1)) {
+            status = MX_OK;
+        }
+        return false;
+    });
 
-    do {
-        if (CheckGapLocked(before_iter, after_iter, spot, base, align, size, 0, arch_mmu_flags)) {
-            if (*spot != static_cast<vaddr_t>(-1)) {
-                return MX_OK;
-            } else {
-                return MX_ERR_NO_MEMORY;
+    return status;
+}
+
+template <typename F>
+bool VmAddressRegion::ForEachGapInSubtreeLocked(ChildList::iterator node, size_t min_size,
+                                                F& func) {
+    if (!node.IsValid() || node->subtree_max_gap_ < min_size) {
+        return true;
+    }
+
+    auto left = node.left();
+    if (left.IsValid()) {
+        if (!ForEachGapInSubtreeLocked(left, min_size, func)) {
+            return false;
+        }
+        if (node->base() - left->subtree_last_byte_ - 1 >= min_size) {
+            auto prev = node;
+            --prev;
+            if (!func(prev, node)) {
+                return false;
             }
         }
+    }
 
-        before_iter = after_iter++;
-    } while (before_iter.IsValid());
+    auto right = node.right();
+    if (right.IsValid()) {
+        const vaddr_t last_byte = node->base() + node->size() - 1;
+        if (right->subtree_first_byte_ - last_byte - 1 >= min_size) {
+            auto next = node;
+            ++next;
+            if (!func(node, next)) {
+                return false;
+            }
+        }
+        if (!ForEachGapInSubtreeLocked(right, min_size, func)) {
+            return false;
+        }
+    }
 
-    // couldn't find anything
-    return MX_ERR_NO_MEMORY;
+    return true;
+}
+
+template <typename F>
+void VmAddressRegion::ForEachGapAtLeastLocked(size_t min_size, F func) {
+    DEBUG_ASSERT(is_rwlock_write_held(aspace_->lock()));
+    DEBUG_ASSERT(min_size > 0);
+
+    auto root = subregions_.root();
+    if (!root.IsValid()) {
+        if (size_ >= min_size) {
+            func(subregions_.end(), subregions_.end());
+        }
+        return;
+    }
+
+    // The gap between our base and the first child.
+    if (root->subtree_first_byte_ - base_ >= min_size &&
+        !func(subregions_.end(), subregions_.begin())) {
+        return;
+    }
+
+    if (!ForEachGapInSubtreeLocked(root, min_size, func)) {
+        return;
+    }
+
+    // The gap between the last child and our end.
+    const vaddr_t last_byte = base_ + size_ - 1;
+    if (last_byte - root->subtree_last_byte_ >= min_size) {
+        func(--subregions_.end(), subregions_.end());
+    }
 }
 
 template <typename F>
-void VmAddressRegion::ForEachGap(F func, uint8_t align_pow2) {
+void VmAddressRegion::ForEachGap(F func, uint8_t align_pow2, size_t min_size) {
     const vaddr_t align = 1UL << align_pow2;
 
-    // Scan the regions list to find the gap to the left of each region.  We
-    // round up the end of the previous region to the requested alignment, so
-    // all gaps reported will be for aligned ranges.
-    vaddr_t prev_region_end = ROUNDUP(base_, align);
-    for (const auto& region : subregions_) {
-        if (region.base() > prev_region_end) {
-            const size_t gap = region.base() - prev_region_end;
-            if (!func(prev_region_end, gap)) {
-                return;
-            }
+    // Visit the gaps large enough to matter.  We round up the end of the
+    // region before each gap to the requested alignment, so all gaps reported
+    // will be for aligned ranges.
+    ForEachGapAtLeastLocked(min_size, [this, align, &func](const ChildList::iterator& prev,
+                                                           const ChildList::iterator& next) -> bool {
+        const vaddr_t gap_base = ROUNDUP(prev.IsValid() ? prev->base() + prev->size() : base_,
+                                         align);
+        const vaddr_t gap_end = next.IsValid() ? next->base() : base_ + size_;
+        if (gap_end > gap_base) {
+            return func(gap_base, gap_end - gap_base);
         }
-        prev_region_end = ROUNDUP(region.base() + region.size(), align);
-    }
+        return true;
+    });
+}
 
-    // Grab the gap to the right of the last region (note that if there are no
-    // regions, this handles reporting the VMAR's whole span as a gap).
-    const vaddr_t end = base_ + size_;
-    if (end > prev_region_end) {
-        const size_t gap = end - prev_region_end;
-        func(prev_region_end, gap);
+bool VmAddressRegion::ValidateGapsInSubtreeLocked(ChildList::iterator node, vaddr_t* first_byte,
+                                                  vaddr_t* last_byte, size_t* max_gap) {
+    *first_byte = node->base();
+    *last_byte = node->base() + node->size() - 1;
+    *max_gap = 0;
+    bool ok = true;
+
+    auto left = node.left();
+    if (left.IsValid()) {
+        vaddr_t left_first, left_last;
+        size_t left_gap;
+        ok = ValidateGapsInSubtreeLocked(left, &left_first, &left_last, &left_gap) && ok;
+        *first_byte = left_first;
+        *max_gap = mxtl::max(left_gap, node->base() - left_last - 1);
+    }
+
+    auto right = node.right();
+    if (right.IsValid()) {
+        vaddr_t right_first, right_last;
+        size_t right_gap;
+        ok = ValidateGapsInSubtreeLocked(right, &right_first, &right_last, &right_gap) && ok;
+        *max_gap = mxtl::max(*max_gap,
+                             mxtl::max(right_gap, right_first - (node->base() + node->size())));
+        *last_byte = right_last;
+    }
+
+    if (node->subtree_first_byte_ != *first_byte || node->subtree_last_byte_ != *last_byte ||
+        node->subtree_max_gap_ != *max_gap) {
+        printf("vmar child at %#" PRIxPTR " caches [%#" PRIxPTR " %#" PRIxPTR "] gap %#zx, "
+               "expected [%#" PRIxPTR " %#" PRIxPTR "] gap %#zx\n",
+               node->base(), node->subtree_first_byte_, node->subtree_last_byte_,
+               node->subtree_max_gap_, *first_byte, *last_byte, *max_gap);
+        ok = false;
+    }
+    return ok;
+}
+
+bool VmAddressRegion::DebugValidateGaps() {
+    canary_.Assert();
+    AutoReadLock guard(aspace_->lock());
+
+    auto root = subregions_.root();
+    if (!root.IsValid()) {
+        return true;
     }
+    vaddr_t first_byte, last_byte;
+    size_t max_gap;
+    return ValidateGapsInSubtreeLocked(root, &first_byte, &last_byte, &max_gap);
 }
 
 namespace {
@@ -819,6 +927,10 @@ constexpr size_t AllocationSpotsInRange(size_t range_size, size_t alloc_size, ui
     return ((range_size - alloc_size) >> align_pow2) + 1;
 }
 
+// Number of uniformly drawn spots the non-compact allocator tries before
+// counting every spot that fits.
+constexpr uint kRandomSpotAttempts = 4;
+
 } // namespace {}
 
 // Perform allocations for VMARs that aren't using the COMPACT policy.  This
@@ -827,12 +939,50 @@ constexpr size_t AllocationSpotsInRange(size_t range_size, size_t alloc_size, ui
 status_t VmAddressRegion::NonCompactRandomizedRegionAllocatorLocked(size_t size, uint8_t align_pow2,
                                                                    uint arch_mmu_flags,
                                                                    vaddr_t* spot) {
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(is_rwlock_write_held(aspace_->lock()));
     DEBUG_ASSERT(spot);
 
     align_pow2 = mxtl::max(align_pow2, static_cast<uint8_t>(PAGE_SIZE_SHIFT));
     const vaddr_t align = 1UL << align_pow2;
 
+    // Check that an aligned spot is free, and let the arch layer adjust it
+    // for its neighbours.
+    auto try_spot = [this, align, size, arch_mmu_flags, spot](vaddr_t alloc_spot) -> bool {
+        if (!IsRangeAvailableLocked(alloc_spot, size)) {
+            return false;
+        }
+
+        auto after_iter = subregions_.upper_bound(alloc_spot + size - 1);
+        auto before_iter = after_iter;
+
+        if (after_iter == subregions_.begin() || subregions_.size() == 0) {
+            before_iter = subregions_.end();
+        } else {
+            --before_iter;
+        }
+
+        ASSERT(before_iter == subregions_.end() || before_iter.IsValid());
+
+        return CheckGapLocked(before_iter, after_iter, spot, alloc_spot, align, size, 0,
+                              arch_mmu_flags) && *spot != static_cast<vaddr_t>(-1);
+    };
+
+    // Most of a region is usually free, so first draw spots uniformly from
+    // every aligned position in the region and take the first one that is
+    // free.  Conditioned on success this is the same distribution as the
+    // exact count below, but each draw only costs O(log n).
+    const vaddr_t first_spot = ROUNDUP(base_, align);
+    const vaddr_t end = base_ + size_;
+    if (end > first_spot && end - first_spot >= size) {
+        const size_t all_spots = AllocationSpotsInRange(end - first_spot, size, align_pow2);
+        for (uint i = 0; i < kRandomSpotAttempts; ++i) {
+            const size_t index = aspace_->AslrPrng().RandInt(all_spots);
+            if (try_spot(first_spot + (index << align_pow2))) {
+                return MX_OK;
+            }
+        }
+    }
+
     // Calculate the number of spaces that we can fit this allocation in.
     size_t candidate_spaces = 0;
     ForEachGap([align, align_pow2, size, &candidate_spaces](vaddr_t gap_base, size_t gap_len) -> bool {
@@ -842,7 +992,7 @@ status_t VmAddressRegion::NonCompactRandomizedRegionAllocatorLocked(size_t size,
         }
         return true;
     },
-               align_pow2);
+               align_pow2, size);
 
     if (candidate_spaces == 0) {
         return MX_ERR_NO_MEMORY;
@@ -868,24 +1018,12 @@ status_t VmAddressRegion::NonCompactRandomizedRegionAllocatorLocked(size_t size,
         selected_index -= spots;
         return true;
     },
-               align_pow2);
+               align_pow2, size);
     ASSERT(alloc_spot != static_cast<vaddr_t>(-1));
     ASSERT(IS_ALIGNED(alloc_spot, align));
 
     // Sanity check that the allocation fits.
-    auto after_iter = subregions_.upper_bound(alloc_spot + size - 1);
-    auto before_iter = after_iter;
-
-    if (after_iter == subregions_.begin() || subregions_.size() == 0) {
-        before_iter = subregions_.end();
-    } else {
-        --before_iter;
-    }
-
-    ASSERT(before_iter == subregions_.end() || before_iter.IsValid());
-
-    if (CheckGapLocked(before_iter, after_iter, spot, alloc_spot, align, size, 0,
-                       arch_mmu_flags) && *spot != static_cast<vaddr_t>(-1)) {
+    if (try_spot(alloc_spot)) {
         return MX_OK;
     }
     panic("Unexpected allocation failure\n");
@@ -897,7 +1035,7 @@ status_t VmAddressRegion::NonCompactRandomizedRegionAllocatorLocked(size_t size,
 status_t VmAddressRegion::CompactRandomizedRegionAllocatorLocked(size_t size, uint8_t align_pow2,
                                                                 uint arch_mmu_flags,
                                                                 vaddr_t* spot) {
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(is_rwlock_write_held(aspace_->lock()));
 
     align_pow2 = mxtl::max(align_pow2, static_cast<uint8_t>(PAGE_SIZE_SHIFT));
     const vaddr_t align = 1UL << align_pow2;
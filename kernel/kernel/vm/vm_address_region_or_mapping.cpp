@@ -30,7 +30,7 @@ VmAddressRegionOrMapping::VmAddressRegionOrMapping(
 status_t VmAddressRegionOrMapping::Destroy() {
     canary_.Assert();
 
-    AutoLock guard(aspace_->lock());
+    AutoWriteLock guard(aspace_->lock());
     if (state_ != LifeCycleState::ALIVE) {
         return MX_ERR_BAD_STATE;
     }
@@ -50,7 +50,7 @@ VmAddressRegionOrMapping::~VmAddressRegionOrMapping() {
 
 bool VmAddressRegionOrMapping::IsAliveLocked() const {
     canary_.Assert();
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(is_rwlock_held(aspace_->lock()));
     return state_ == LifeCycleState::ALIVE;
 }
 
@@ -84,7 +84,7 @@ bool VmAddressRegionOrMapping::is_valid_mapping_flags(uint arch_mmu_flags) {
 }
 
 size_t VmAddressRegionOrMapping::AllocatedPages() const {
-    AutoLock guard(aspace_->lock());
+    AutoReadLock guard(aspace_->lock());
     if (state_ != LifeCycleState::ALIVE) {
         return 0;
     }
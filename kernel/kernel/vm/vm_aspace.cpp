@@ -12,6 +12,7 @@
 #include <inttypes.h>
 #include <kernel/auto_lock.h>
 #include <kernel/cmdline.h>
+#include <kernel/rwlock.h>
 #include <kernel/thread.h>
 #include <kernel/vm.h>
 #include <kernel/vm/vm_address_region.h>
@@ -228,7 +229,7 @@ VmAspace::~VmAspace() {
 }
 
 mxtl::RefPtr<VmAddressRegion> VmAspace::RootVmar() {
-    AutoLock guard(&lock_);
+    AutoReadLock guard(&lock_);
     mxtl::RefPtr<VmAddressRegion> ref(root_vmar_);
     return mxtl::move(ref);
 }
@@ -237,7 +238,7 @@ status_t VmAspace::Destroy() {
     canary_.Assert();
     LTRACEF("%p '%s'\n", this, name_);
 
-    AutoLock guard(&lock_);
+    AutoWriteLock guard(&lock_);
 
 #if WITH_LIB_VDSO
     // Don't let a vDSO mapping prevent destroying a VMAR
@@ -259,7 +260,7 @@ status_t VmAspace::Destroy() {
 }
 
 bool VmAspace::is_destroyed() const {
-    AutoLock guard(&lock_);
+    AutoReadLock guard(&lock_);
     return aspace_destroyed_;
 }
 
@@ -276,6 +277,13 @@ __WEAK vaddr_t arch_mmu_pick_spot(const arch_aspace_t* aspace,
     return ALIGN(base, align);
 }
 
+//
+//  Arch can override this to report the page table overhead.
+
+__WEAK size_t arch_mmu_page_table_pages(const arch_aspace_t* aspace) {
+    return 0;
+}
+
 status_t VmAspace::MapObjectInternal(mxtl::RefPtr<VmObject> vmo, const char* name, uint64_t offset,
                                      size_t size, void** ptr, uint8_t align_pow2, uint vmm_flags,
                                      uint arch_mmu_flags) {
@@ -530,11 +538,13 @@ status_t VmAspace::PageFault(vaddr_t va, uint flags) {
     DEBUG_ASSERT(!aspace_destroyed_);
     LTRACEF("va %#" PRIxPTR ", flags %#x\n", va, flags);
 
-    // for now, hold the aspace lock across the page fault operation,
+    // hold the aspace lock for reading across the page fault operation,
     // which stops any other operations on the address space from moving
-    // the region out from underneath it
-    AutoLock a(&lock_);
+    // the region out from underneath it.  Faults on the same mapping
+    // serialize on the lock of its object instead.
+    AutoReadLock a(&lock_);
 
+    faults_.fetch_add(1);
     return root_vmar_->PageFault(va, flags);
 }
 
@@ -543,7 +553,16 @@ void VmAspace::Dump(bool verbose) const {
     printf("as %p [%#" PRIxPTR " %#" PRIxPTR "] sz %#zx fl %#x ref %d '%s'\n", this,
            base_, base_ + size_ - 1, size_, flags_, ref_count_debug(), name_);
 
-    AutoLock a(&lock_);
+    size_t pt_pages = arch_mmu_page_table_pages(&arch_aspace_);
+    if (pt_pages)
+        printf("  page tables %zu pages (%zu KB)\n", pt_pages, pt_pages * PAGE_SIZE / 1024);
+
+    AutoReadLock a(&lock_);
+
+    const uint64_t faults = faults_.load();
+    if (faults)
+        printf("  faults %" PRIu64 ", pages mapped by faults %" PRIu64 "\n", faults,
+               fault_mapped_pages_.load());
 
     if (verbose)
         root_vmar_->Dump(1, verbose);
@@ -552,7 +571,7 @@ void VmAspace::Dump(bool verbose) const {
 bool VmAspace::EnumerateChildren(VmEnumerator* ve) {
     canary_.Assert();
     DEBUG_ASSERT(ve != nullptr);
-    AutoLock a(&lock_);
+    AutoReadLock a(&lock_);
     if (root_vmar_ == nullptr || aspace_destroyed_) {
         // Aspace hasn't been initialized or has already been destroyed.
         return true;
@@ -585,7 +604,7 @@ VmAspace* VmAspace::vaddr_to_aspace(uintptr_t address) {
 size_t VmAspace::AllocatedPages() const {
     canary_.Assert();
 
-    AutoLock a(&lock_);
+    AutoReadLock a(&lock_);
     return root_vmar_->AllocatedPagesLocked();
 }
 
@@ -598,12 +617,12 @@ void VmAspace::InitializeAslr() {
 
 #if WITH_LIB_VDSO
 uintptr_t VmAspace::vdso_base_address() const {
-    AutoLock a(&lock_);
+    AutoReadLock a(&lock_);
     return VDso::base_address(vdso_code_mapping_);
 }
 
 uintptr_t VmAspace::vdso_code_address() const {
-    AutoLock a(&lock_);
+    AutoReadLock a(&lock_);
     return vdso_code_mapping_ ? vdso_code_mapping_->base() : 0;
 }
 #endif
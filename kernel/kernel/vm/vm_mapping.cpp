@@ -10,18 +10,38 @@
 #include <assert.h>
 #include <err.h>
 #include <inttypes.h>
+#include <kernel/cmdline.h>
 #include <kernel/vm.h>
 #include <kernel/vm/fault.h>
 #include <kernel/vm/vm_aspace.h>
 #include <kernel/vm/vm_object.h>
+#include <lk/init.h>
 #include <mxalloc/new.h>
 #include <mxtl/auto_call.h>
 #include <mxtl/auto_lock.h>
+#include <pow2.h>
 #include <safeint/safe_math.h>
 #include <trace.h>
 
 #define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
 
+// Number of pages in the aligned window around a faulting page that a
+// fault maps if they are already resident, set with vm.fault_around.
+// 0 or 1 maps only the faulting page.
+#define FAULT_AROUND_DEFAULT_PAGES 16
+#define FAULT_AROUND_MAX_PAGES 64
+
+static uint fault_around_pages = FAULT_AROUND_DEFAULT_PAGES;
+
+static void fault_around_init(uint level) {
+    uint32_t pages = cmdline_get_uint32("vm.fault_around", FAULT_AROUND_DEFAULT_PAGES);
+    pages = MIN(pages, FAULT_AROUND_MAX_PAGES);
+
+    // the window is aligned, so keep it a power of two
+    fault_around_pages = pages ? valpow2(log2_uint_floor(pages)) : 0;
+}
+LK_INIT_HOOK(fault_around, &fault_around_init, LK_INIT_LEVEL_VM);
+
 VmMapping::VmMapping(VmAddressRegion& parent, vaddr_t base, size_t size, uint32_t vmar_flags,
                      mxtl::RefPtr<VmObject> vmo, uint64_t vmo_offset, uint arch_mmu_flags)
     : VmAddressRegionOrMapping(base, size, vmar_flags,
@@ -40,7 +60,7 @@ VmMapping::~VmMapping() {
 
 size_t VmMapping::AllocatedPagesLocked() const {
     canary_.Assert();
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(is_rwlock_held(aspace_->lock()));
 
     if (state_ != LifeCycleState::ALIVE) {
         return 0;
@@ -79,7 +99,7 @@ status_t VmMapping::Protect(vaddr_t base, size_t size, uint new_arch_mmu_flags)
 
     size = ROUNDUP(size, PAGE_SIZE);
 
-    AutoLock guard(aspace_->lock());
+    AutoWriteLock guard(aspace_->lock());
     if (state_ != LifeCycleState::ALIVE) {
         return MX_ERR_BAD_STATE;
     }
@@ -92,7 +112,7 @@ status_t VmMapping::Protect(vaddr_t base, size_t size, uint new_arch_mmu_flags)
 }
 
 status_t VmMapping::ProtectLocked(vaddr_t base, size_t size, uint new_arch_mmu_flags) {
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(is_rwlock_write_held(aspace_->lock()));
     DEBUG_ASSERT(size != 0 && IS_PAGE_ALIGNED(base) && IS_PAGE_ALIGNED(size));
 
     // Do not allow changing caching
@@ -143,7 +163,7 @@ status_t VmMapping::ProtectLocked(vaddr_t base, size_t size, uint new_arch_mmu_f
         LTRACEF("arch_mmu_protect returns %d\n", status);
         arch_mmu_flags_ = new_arch_mmu_flags;
 
-        size_ = size;
+        SetSizeLocked(size);
         mapping->ActivateLocked();
         return MX_OK;
     }
@@ -165,7 +185,7 @@ status_t VmMapping::ProtectLocked(vaddr_t base, size_t size, uint new_arch_mmu_f
                                            new_arch_mmu_flags);
         LTRACEF("arch_mmu_protect returns %d\n", status);
 
-        size_ -= size;
+        SetSizeLocked(size_ - size);
         mapping->ActivateLocked();
         return MX_OK;
     }
@@ -195,7 +215,7 @@ status_t VmMapping::ProtectLocked(vaddr_t base, size_t size, uint new_arch_mmu_f
     LTRACEF("arch_mmu_protect returns %d\n", status);
 
     // Turn us into the left half
-    size_ = left_size;
+    SetSizeLocked(left_size);
 
     center_mapping->ActivateLocked();
     right_mapping->ActivateLocked();
@@ -216,7 +236,7 @@ status_t VmMapping::Unmap(vaddr_t base, size_t size) {
         return MX_ERR_BAD_STATE;
     }
 
-    AutoLock guard(aspace->lock());
+    AutoWriteLock guard(aspace->lock());
     if (state_ != LifeCycleState::ALIVE) {
         return MX_ERR_BAD_STATE;
     }
@@ -235,7 +255,7 @@ status_t VmMapping::Unmap(vaddr_t base, size_t size) {
 
 status_t VmMapping::UnmapLocked(vaddr_t base, size_t size) {
     canary_.Assert();
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(is_rwlock_write_held(aspace_->lock()));
     DEBUG_ASSERT(size != 0 && IS_PAGE_ALIGNED(size) && IS_PAGE_ALIGNED(base));
     DEBUG_ASSERT(base >= base_ && base - base_ < size_);
     DEBUG_ASSERT(size_ - (base - base_) >= size);
@@ -268,9 +288,11 @@ status_t VmMapping::UnmapLocked(vaddr_t base, size_t size) {
             mxtl::RefPtr<VmAddressRegionOrMapping> ref(parent_->subregions_.erase(*this));
             base_ += size;
             object_offset_ += size;
+            size_ -= size;
             parent_->subregions_.insert(mxtl::move(ref));
+        } else {
+            SetSizeLocked(size_ - size);
         }
-        size_ -= size;
 
         return MX_OK;
     }
@@ -298,11 +320,22 @@ status_t VmMapping::UnmapLocked(vaddr_t base, size_t size) {
     }
 
     // Turn us into the left half
-    size_ = base - base_;
+    SetSizeLocked(base - base_);
     mapping->ActivateLocked();
     return MX_OK;
 }
 
+void VmMapping::SetSizeLocked(size_t size) {
+    DEBUG_ASSERT(is_rwlock_write_held(aspace_->lock()));
+    DEBUG_ASSERT(subregion_list_node_.InContainer());
+
+    size_ = size;
+
+    // The parent's gap bookkeeping for us and our ancestors in its children
+    // tree depends on our size.
+    WAVLTreeObserver::Propagate(parent_->subregions_.make_iterator(*this));
+}
+
 status_t VmMapping::UnmapVmoRangeLocked(uint64_t offset, uint64_t len) const {
     canary_.Assert();
 
@@ -362,6 +395,7 @@ status_t VmMapping::UnmapVmoRangeLocked(uint64_t offset, uint64_t len) const {
     LTRACEF("going to unmap %#" PRIxPTR ", len %#" PRIx64 " aspace %p\n",
             unmap_base.ValueOrDie(), len_new, aspace_.get());
 
+    AutoLock pt_guard(aspace_->page_table_lock());
     status_t status = arch_mmu_unmap(&aspace_->arch_aspace(), unmap_base.ValueOrDie(),
                                      static_cast<size_t>(len_new) / PAGE_SIZE, nullptr);
     if (status < 0)
@@ -378,7 +412,7 @@ status_t VmMapping::MapRange(size_t offset, size_t len, bool commit) {
         return MX_ERR_INVALID_ARGS;
     }
 
-    AutoLock guard(aspace_->lock());
+    AutoWriteLock guard(aspace_->lock());
     if (state_ != LifeCycleState::ALIVE) {
         return MX_ERR_BAD_STATE;
     }
@@ -404,6 +438,48 @@ status_t VmMapping::MapRange(size_t offset, size_t len, bool commit) {
     currently_faulting_ = true;
     auto ac = mxtl::MakeAutoCall([&]() { currently_faulting_ = false; });
 
+    // physically contiguous runs of pages are mapped with a single call so
+    // the arch layer can use large pages where the alignment allows
+    vaddr_t run_va = 0;
+    paddr_t run_pa = 0;
+    size_t run_count = 0;
+    auto map_run = [&]() {
+        if (run_count == 0)
+            return;
+
+        LTRACEF_LEVEL(2, "mapping pa %#" PRIxPTR " to va %#" PRIxPTR " count %zu\n",
+                      run_pa, run_va, run_count);
+
+        size_t mapped;
+        auto ret = arch_mmu_map(&aspace_->arch_aspace(), run_va, run_pa, run_count,
+                                arch_mmu_flags_, &mapped);
+        if (ret == MX_OK && mapped == run_count) {
+            run_count = 0;
+            return;
+        }
+
+        // part of the run is mapped already, say by an earlier fault, and the
+        // arch layer either refused the whole call or stopped short.  map the
+        // rest a page at a time, leaving the pages that are already there alone.
+        LTRACEF("error %d mapping %zu pages at va %#" PRIxPTR " (%zu mapped), retrying by page\n",
+                ret, run_count, run_va, ret == MX_OK ? mapped : 0);
+        for (size_t i = 0; i < run_count; i++) {
+            vaddr_t va = run_va + i * PAGE_SIZE;
+            paddr_t pa;
+            uint page_flags;
+            if (arch_mmu_query(&aspace_->arch_aspace(), va, &pa, &page_flags) >= 0)
+                continue;
+
+            ret = arch_mmu_map(&aspace_->arch_aspace(), va, run_pa + i * PAGE_SIZE, 1,
+                               arch_mmu_flags_, &mapped);
+            if (ret < 0) {
+                TRACEF("error %d mapping page at va %#" PRIxPTR " pa %#" PRIxPTR "\n",
+                       ret, va, run_pa + i * PAGE_SIZE);
+            }
+        }
+        run_count = 0;
+    };
+
     // iterate through the range, grabbing a page from the underlying object and
     // mapping it in
     size_t o;
@@ -415,6 +491,7 @@ status_t VmMapping::MapRange(size_t offset, size_t len, bool commit) {
         status = object_->GetPageLocked(vmo_offset, pf_flags, nullptr, &pa);
         if (status < 0) {
             // no page to map
+            map_run();
             if (commit) {
                 // fail when we can't commit every requested page
                 return status;
@@ -425,17 +502,21 @@ status_t VmMapping::MapRange(size_t offset, size_t len, bool commit) {
         }
 
         vaddr_t va = base_ + o;
-        LTRACEF_LEVEL(2, "mapping pa %#" PRIxPTR " to va %#" PRIxPTR "\n", pa, va);
-
-        size_t mapped;
-        auto ret = arch_mmu_map(&aspace_->arch_aspace(), va, pa, 1, arch_mmu_flags_, &mapped);
-        if (ret < 0) {
-            TRACEF("error %d mapping page at va %#" PRIxPTR " pa %#" PRIxPTR "\n", ret, va, pa);
+        if (run_count > 0 &&
+            va == run_va + run_count * PAGE_SIZE &&
+            pa == run_pa + run_count * PAGE_SIZE) {
+            run_count++;
+            continue;
         }
 
-        DEBUG_ASSERT(mapped == 1);
+        map_run();
+        run_va = va;
+        run_pa = pa;
+        run_count = 1;
     }
 
+    map_run();
+
     return MX_OK;
 }
 
@@ -445,7 +526,7 @@ status_t VmMapping::DecommitRange(size_t offset, size_t len,
     LTRACEF("%p [%#zx+%#zx], offset %#zx, len %#zx\n",
             this, base_, size_, offset, len);
 
-    AutoLock guard(aspace_->lock());
+    AutoWriteLock guard(aspace_->lock());
     if (state_ != LifeCycleState::ALIVE) {
         return MX_ERR_BAD_STATE;
     }
@@ -459,7 +540,7 @@ status_t VmMapping::DecommitRange(size_t offset, size_t len,
 
 status_t VmMapping::DestroyLocked() {
     canary_.Assert();
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(is_rwlock_write_held(aspace_->lock()));
     LTRACEF("%p\n", this);
 
     // Take a reference to ourself, so that we do not get destructed after
@@ -509,7 +590,7 @@ status_t VmMapping::DestroyLocked() {
 
 status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
     canary_.Assert();
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(is_rwlock_held(aspace_->lock()));
 
     DEBUG_ASSERT(va >= base_ && va <= base_ + size_ - 1);
 
@@ -568,6 +649,9 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
         mmu_flags &= ~ARCH_MMU_FLAG_PERM_WRITE;
     }
 
+    // faults in other mappings of this aspace may be updating the page tables too
+    AutoLock pt_guard(aspace_->page_table_lock());
+
     // see if something is mapped here now
     // this may happen if we are one of multiple threads racing on a single address
     uint page_flags;
@@ -616,6 +700,7 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
             }
             DEBUG_ASSERT(mapped == 1);
 
+            aspace_->AccountFaultMappedPagesLocked(mapped);
             return MX_OK;
         }
     } else {
@@ -633,6 +718,8 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
             return MX_ERR_NO_MEMORY;
         }
         DEBUG_ASSERT(mapped == 1);
+
+        aspace_->AccountFaultMappedPagesLocked(mapped + FaultAroundLocked(va));
     }
 
 // TODO: figure out what to do with this
@@ -643,6 +730,79 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
     return MX_OK;
 }
 
+// Pages are only mapped if the object already has them, and without write
+// permission, so a write still faults and breaks copy-on-write with a parent.
+// Runs of physically contiguous pages are mapped with a single call.
+size_t VmMapping::FaultAroundLocked(vaddr_t va) {
+    DEBUG_ASSERT(is_rwlock_held(aspace_->lock()));
+    DEBUG_ASSERT(is_mutex_held(aspace_->page_table_lock()));
+
+    if (fault_around_pages <= 1 || !object_->is_paged())
+        return 0;
+
+    const size_t window = fault_around_pages * PAGE_SIZE;
+    vaddr_t start = MAX(ROUNDDOWN(va, window), base_);
+    vaddr_t last = MIN(ROUNDDOWN(va, window) + (window - 1), base_ + size_ - 1);
+    const uint mmu_flags = arch_mmu_flags_ & ~ARCH_MMU_FLAG_PERM_WRITE;
+
+    size_t total = 0;
+    vaddr_t run_va = 0;
+    paddr_t run_pa = 0;
+    size_t run_len = 0;
+
+    auto map_run = [&]() {
+        if (run_len == 0)
+            return;
+
+        size_t mapped;
+        if (arch_mmu_map(&aspace_->arch_aspace(), run_va, run_pa, run_len, mmu_flags,
+                         &mapped) == MX_OK) {
+            total += mapped;
+#if ARCH_ARM64
+            if (arch_mmu_flags_ & ARCH_MMU_FLAG_PERM_EXECUTE)
+                arch_sync_cache_range(run_va, mapped * PAGE_SIZE);
+#endif
+        }
+        run_len = 0;
+    };
+
+    for (vaddr_t v = start; v <= last && v >= start; v += PAGE_SIZE) {
+        if (v == va) {
+            map_run();
+            continue;
+        }
+
+        // leave anything already mapped alone
+        paddr_t pa;
+        uint page_flags;
+        if (arch_mmu_query(&aspace_->arch_aspace(), v, &pa, &page_flags) >= 0) {
+            map_run();
+            continue;
+        }
+
+        // no fault flags, so this only finds pages the object or its parents already have
+        vm_page_t* page;
+        if (object_->GetPageLocked(v - base_ + object_offset_, 0, &page, &pa) != MX_OK) {
+            map_run();
+            continue;
+        }
+
+        if (run_len > 0 && pa == run_pa + run_len * PAGE_SIZE) {
+            run_len++;
+        } else {
+            map_run();
+            run_va = v;
+            run_pa = pa;
+            run_len = 1;
+        }
+    }
+    map_run();
+
+    LTRACEF("mapped %zu pages around va %#" PRIxPTR "\n", total, va);
+
+    return total;
+}
+
 // We disable thread safety analysis here because one of the common uses of this
 // function is for splitting one mapping object into several that will be backed
 // by the same VmObject.  In that case, object_->lock() gets aliased across all
@@ -653,7 +813,7 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
 // function.
 void VmMapping::ActivateLocked() TA_NO_THREAD_SAFETY_ANALYSIS {
     DEBUG_ASSERT(state_ == LifeCycleState::NOT_READY);
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(is_rwlock_write_held(aspace_->lock()));
     DEBUG_ASSERT(object_->lock()->IsHeld());
     DEBUG_ASSERT(parent_);
 
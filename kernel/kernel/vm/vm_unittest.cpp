@@ -6,6 +6,9 @@
 
 #include <assert.h>
 #include <err.h>
+#include <kernel/event.h>
+#include <kernel/mp.h>
+#include <kernel/thread.h>
 #include <kernel/vm.h>
 #include <kernel/vm/vm_address_region.h>
 #include <kernel/vm/vm_aspace.h>
@@ -14,6 +17,7 @@
 #include <kernel/vm/vm_object_physical.h>
 #include <mxalloc/new.h>
 #include <mxtl/array.h>
+#include <rand.h>
 #include <unittest.h>
 
 static const uint kArchRwFlags = ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE;
@@ -71,6 +75,39 @@ static bool pmm_oversized_alloc_test(void* context) {
     END_TEST;
 }
 
+// Allocates zeroed pages, which mostly come out of the pre-zeroed pool,
+// and checks their contents. The pages are dirtied before being freed, so
+// later passes see recycled pages zeroed again by the pool's thread.
+static bool pmm_zeroed_alloc_test(void* context) {
+    BEGIN_TEST;
+    static const size_t alloc_count = 512;
+    list_node list = LIST_INITIAL_VALUE(list);
+
+    for (int pass = 0; pass < 3; pass++) {
+        for (size_t i = 0; i < alloc_count; i++) {
+            paddr_t pa;
+            vm_page_t* page = pmm_alloc_page(PMM_ALLOC_FLAG_ZEROED, &pa);
+            REQUIRE_NONNULL(page, "pmm_alloc_page zeroed");
+            list_add_tail(&list, &page->free.node);
+
+            const uint64_t* ptr = static_cast<const uint64_t*>(paddr_to_kvaddr(pa));
+            REQUIRE_NONNULL(ptr, "zeroed page is mapped");
+            bool zero = true;
+            for (size_t j = 0; j < PAGE_SIZE / sizeof(uint64_t); j++) {
+                zero = zero && (ptr[j] == 0);
+            }
+            EXPECT_TRUE(zero, "zeroed page has nonzero contents");
+            memset(paddr_to_kvaddr(pa), 0xa5, PAGE_SIZE);
+        }
+
+        EXPECT_EQ(alloc_count, pmm_free(&list), "pmm_free zeroed pages");
+
+        // let the zeroing thread refill the pool
+        thread_sleep_relative(LK_MSEC(100));
+    }
+    END_TEST;
+}
+
 static uint32_t test_rand(uint32_t seed) {
     return (seed = seed * 1664525 + 1013904223);
 }
@@ -520,6 +557,35 @@ static bool vmo_demand_paged_map_test(void* context) {
     END_TEST;
 }
 
+// Maps a physically contiguous object over a range in which one page has
+// already been faulted in, so the run mapped by MapRange overlaps it.
+static bool vmo_map_range_over_faulted_test(void* context) {
+    BEGIN_TEST;
+    static const size_t alloc_size = PAGE_SIZE * 16;
+    auto vmo = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size);
+    REQUIRE_NONNULL(vmo, "vmobject creation\n");
+    uint64_t committed;
+    auto ret = vmo->CommitRangeContiguous(0, alloc_size, &committed, 0);
+    REQUIRE_EQ(MX_OK, ret, "committing vm object contig\n");
+
+    mxtl::RefPtr<VmMapping> mapping;
+    ret = VmAspace::kernel_aspace()->RootVmar()->CreateVmMapping(
+        0, alloc_size, 0, 0, vmo, 0, kArchRwFlags, "test", &mapping);
+    REQUIRE_EQ(MX_OK, ret, "mapping object");
+
+    volatile uint8_t* p = reinterpret_cast<volatile uint8_t*>(mapping->base());
+    p[5 * PAGE_SIZE] = 0x99;
+
+    ret = mapping->MapRange(0, alloc_size, false);
+    EXPECT_EQ(MX_OK, ret, "mapping the rest of the range");
+    EXPECT_EQ(0x99, p[5 * PAGE_SIZE], "faulted page kept its contents");
+    EXPECT_TRUE(fill_and_test(reinterpret_cast<void*>(mapping->base()), alloc_size),
+                "filling mapping");
+
+    EXPECT_EQ(MX_OK, mapping->Destroy(), "unmapping object");
+    END_TEST;
+}
+
 // Creates a vm object, maps it, drops ref before unmapping.
 static bool vmo_dropped_ref_test(void* context) {
     BEGIN_TEST;
@@ -847,6 +913,236 @@ static bool vmo_lookup_test(void* context) {
     END_TEST;
 }
 
+struct parallel_fault_worker {
+    event_t* start;
+    bool ok;
+};
+
+static const size_t kParallelFaultPages = 64;
+static const uint kParallelFaultRounds = 4;
+
+// Demand faults a mapping in a page at a time, checks the pages read back
+// and tears the mapping down, so every page goes through pmm_alloc_page and
+// back out through pmm_free.
+static int parallel_fault_thread(void* arg) {
+    auto worker = static_cast<parallel_fault_worker*>(arg);
+    auto ka = VmAspace::kernel_aspace();
+
+    event_wait(worker->start);
+
+    for (uint round = 0; round < kParallelFaultRounds; round++) {
+        auto vmo = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, kParallelFaultPages * PAGE_SIZE);
+        if (!vmo)
+            return -1;
+
+        void* ptr;
+        auto ret = ka->MapObjectInternal(mxtl::move(vmo), "parallel fault", 0,
+                                         kParallelFaultPages * PAGE_SIZE, &ptr, 0, 0,
+                                         kArchRwFlags);
+        if (ret != MX_OK)
+            return -1;
+
+        volatile uint8_t* p = static_cast<volatile uint8_t*>(ptr);
+        for (size_t i = 0; i < kParallelFaultPages; i++)
+            p[i * PAGE_SIZE] = static_cast<uint8_t>(i + round);
+        for (size_t i = 0; i < kParallelFaultPages; i++) {
+            if (p[i * PAGE_SIZE] != static_cast<uint8_t>(i + round))
+                return -1;
+        }
+
+        if (ka->FreeRegion(reinterpret_cast<vaddr_t>(ptr)) != MX_OK)
+            return -1;
+    }
+
+    worker->ok = true;
+    return 0;
+}
+
+// Faults pages in from one thread per cpu at once, so that the per cpu
+// page caches are filled and drained concurrently.
+static bool vm_parallel_fault_test(void* context) {
+    BEGIN_TEST;
+
+    uint cpus = 0;
+    for (mp_cpu_mask_t mask = mp_get_online_mask(); mask; mask &= mask - 1)
+        cpus++;
+
+    event_t start = EVENT_INITIAL_VALUE(start, false, 0);
+    parallel_fault_worker workers[SMP_MAX_CPUS] = {};
+    thread_t* threads[SMP_MAX_CPUS];
+
+    for (uint i = 0; i < cpus; i++) {
+        workers[i].start = &start;
+        threads[i] = thread_create("parallel fault", &parallel_fault_thread, &workers[i],
+                                   DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+        REQUIRE_NONNULL(threads[i], "creating worker thread");
+        thread_resume(threads[i]);
+    }
+
+    event_signal(&start, true);
+
+    for (uint i = 0; i < cpus; i++) {
+        thread_join(threads[i], nullptr, INFINITE_TIME);
+        EXPECT_TRUE(workers[i].ok, "faulting pages in");
+    }
+    event_destroy(&start);
+
+    END_TEST;
+}
+
+static const size_t kVmarStressRegions = 1000;
+
+// Fills |vmar| with single page mappings, punches out every other one and
+// maps into the holes again.
+static bool vmar_stress_run(mxtl::RefPtr<VmAddressRegion> vmar) {
+    BEGIN_TEST;
+
+    auto vmo = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, PAGE_SIZE);
+    REQUIRE_NONNULL(vmo, "creating vmo");
+
+    AllocChecker ac;
+    mxtl::Array<mxtl::RefPtr<VmMapping>> maps(
+        new (&ac) mxtl::RefPtr<VmMapping>[kVmarStressRegions], kVmarStressRegions);
+    REQUIRE_TRUE(ac.check(), "allocating mapping array");
+
+    for (size_t i = 0; i < kVmarStressRegions; i++) {
+        status_t status = vmar->CreateVmMapping(0, PAGE_SIZE, 0, 0, vmo, 0, kArchRwFlags,
+                                                "stress", &maps[i]);
+        REQUIRE_EQ(MX_OK, status, "mapping region");
+    }
+
+    for (size_t i = 0; i < kVmarStressRegions; i += 2) {
+        REQUIRE_EQ(MX_OK, maps[i]->Unmap(maps[i]->base(), PAGE_SIZE), "unmapping region");
+        maps[i].reset();
+    }
+
+    for (size_t i = 0; i < kVmarStressRegions; i += 2) {
+        status_t status = vmar->CreateVmMapping(0, PAGE_SIZE, 0, 0, vmo, 0, kArchRwFlags,
+                                                "stress", &maps[i]);
+        REQUIRE_EQ(MX_OK, status, "remapping region");
+    }
+
+    // Every mapping must have landed on its own page.
+    for (size_t i = 0; i < kVmarStressRegions; i++) {
+        auto region = vmar->FindRegion(maps[i]->base());
+        EXPECT_TRUE(region.get() == maps[i].get(), "finding region");
+    }
+
+    EXPECT_EQ(MX_OK, vmar->Destroy(), "destroying vmar");
+
+    END_TEST;
+}
+
+// Maps and unmaps many regions through both the randomized allocator of a
+// user aspace and the linear allocator of the kernel aspace.
+static bool vmar_alloc_stress_test(void* context) {
+    BEGIN_TEST;
+
+    auto aspace = VmAspace::Create(0, "vmar stress");
+    REQUIRE_NONNULL(aspace, "creating aspace");
+    mxtl::RefPtr<VmAddressRegion> vmar;
+    status_t status = aspace->RootVmar()->CreateSubVmar(
+        0, 4 * kVmarStressRegions * PAGE_SIZE, 0, VMAR_CAN_RWX_FLAGS, "stress", &vmar);
+    REQUIRE_EQ(MX_OK, status, "creating user vmar");
+    EXPECT_TRUE(vmar_stress_run(mxtl::move(vmar)), "");
+    aspace->Destroy();
+
+    status = VmAspace::kernel_aspace()->RootVmar()->CreateSubVmar(
+        0, 2 * kVmarStressRegions * PAGE_SIZE, 0, VMAR_CAN_RWX_FLAGS, "stress", &vmar);
+    REQUIRE_EQ(MX_OK, status, "creating kernel vmar");
+    EXPECT_TRUE(vmar_stress_run(mxtl::move(vmar)), "");
+
+    END_TEST;
+}
+
+static const size_t kGapTestPages = 128;
+static const size_t kGapTestMaxRegionPages = 4;
+static const uint kGapTestOps = 2000;
+
+// Returns the first page of the lowest run of |pages| free pages in |used|,
+// or kGapTestPages if there is none.
+static size_t gap_test_first_fit(const bool* used, size_t pages) {
+    size_t run = 0;
+    for (size_t i = 0; i < kGapTestPages; i++) {
+        run = used[i] ? 0 : run + 1;
+        if (run == pages)
+            return i + 1 - pages;
+    }
+    return kGapTestPages;
+}
+
+// Maps and unmaps regions of random sizes in random order, checking after
+// each step that the children tree's gap bookkeeping matches a recomputation
+// from scratch, and that the gap guided linear allocator picks the same spot
+// as a scan of the page map.
+static bool vmar_gap_bookkeeping_test(void* context) {
+    BEGIN_TEST;
+
+    // The kernel aspace has no aslr, so it uses the linear allocator.
+    mxtl::RefPtr<VmAddressRegion> vmar;
+    status_t status = VmAspace::kernel_aspace()->RootVmar()->CreateSubVmar(
+        0, kGapTestPages * PAGE_SIZE, 0, VMAR_CAN_RWX_FLAGS, "gap test", &vmar);
+    REQUIRE_EQ(MX_OK, status, "creating vmar");
+
+    auto vmo = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, kGapTestMaxRegionPages * PAGE_SIZE);
+    REQUIRE_NONNULL(vmo, "creating vmo");
+
+    bool used[kGapTestPages] = {};
+    mxtl::RefPtr<VmMapping> maps[kGapTestPages];
+    size_t map_count = 0;
+
+    for (uint op = 0; op < kGapTestOps; op++) {
+        if (map_count > 0 && (rand() % 2 == 0)) {
+            // Unmap a random region.
+            size_t i = rand() % map_count;
+            size_t first = (maps[i]->base() - vmar->base()) / PAGE_SIZE;
+            for (size_t p = 0; p < maps[i]->size() / PAGE_SIZE; p++)
+                used[first + p] = false;
+            EXPECT_EQ(MX_OK, maps[i]->Destroy(), "unmapping region");
+            maps[i].reset();
+            if (i != --map_count)
+                maps[i] = mxtl::move(maps[map_count]);
+        } else {
+            size_t pages = 1 + rand() % kGapTestMaxRegionPages;
+            size_t first;
+            mxtl::RefPtr<VmMapping> map;
+            if (rand() % 2 == 0) {
+                // Map at a random spot, which fails if it is taken.
+                first = rand() % (kGapTestPages - pages + 1);
+                bool free = true;
+                for (size_t p = 0; p < pages; p++)
+                    free = free && !used[first + p];
+                status = vmar->CreateVmMapping(first * PAGE_SIZE, pages * PAGE_SIZE, 0,
+                                               VMAR_FLAG_SPECIFIC, vmo, 0, kArchRwFlags,
+                                               "gap test", &map);
+                EXPECT_EQ(free, status == MX_OK, "mapping at a specific spot");
+            } else {
+                // Let the allocator pick, which must take the first fit.
+                first = gap_test_first_fit(used, pages);
+                status = vmar->CreateVmMapping(0, pages * PAGE_SIZE, 0, 0, vmo, 0,
+                                               kArchRwFlags, "gap test", &map);
+                EXPECT_EQ(first < kGapTestPages, status == MX_OK, "allocating a spot");
+                if (status == MX_OK) {
+                    EXPECT_EQ(vmar->base() + first * PAGE_SIZE, map->base(),
+                              "allocated spot differs from the first fit");
+                    first = (map->base() - vmar->base()) / PAGE_SIZE;
+                }
+            }
+            if (status == MX_OK) {
+                for (size_t p = 0; p < pages; p++)
+                    used[first + p] = true;
+                maps[map_count++] = mxtl::move(map);
+            }
+        }
+
+        REQUIRE_TRUE(vmar->DebugValidateGaps(), "gap bookkeeping");
+    }
+
+    EXPECT_EQ(MX_OK, vmar->Destroy(), "destroying vmar");
+
+    END_TEST;
+}
+
 // Use the function name as the test name
 #define VM_UNITTEST(fname) UNITTEST(#fname, fname)
 
@@ -854,6 +1150,7 @@ UNITTEST_START_TESTCASE(vm_tests)
 VM_UNITTEST(pmm_smoke_test)
 VM_UNITTEST(pmm_large_alloc_test)
 VM_UNITTEST(pmm_oversized_alloc_test)
+VM_UNITTEST(pmm_zeroed_alloc_test)
 VM_UNITTEST(vmm_alloc_smoke_test)
 VM_UNITTEST(vmm_alloc_contiguous_smoke_test)
 VM_UNITTEST(multiple_regions_test)
@@ -871,12 +1168,16 @@ VM_UNITTEST(vmo_odd_size_commit_test)
 VM_UNITTEST(vmo_contiguous_commit_test)
 VM_UNITTEST(vmo_precommitted_map_test)
 VM_UNITTEST(vmo_demand_paged_map_test)
+VM_UNITTEST(vmo_map_range_over_faulted_test)
 VM_UNITTEST(vmo_dropped_ref_test)
 VM_UNITTEST(vmo_remap_test)
 VM_UNITTEST(vmo_double_remap_test)
 VM_UNITTEST(vmo_read_write_smoke_test)
 VM_UNITTEST(vmo_cache_test)
 VM_UNITTEST(vmo_lookup_test)
+VM_UNITTEST(vm_parallel_fault_test)
+VM_UNITTEST(vmar_alloc_stress_test)
+VM_UNITTEST(vmar_gap_bookkeeping_test)
 // Uncomment for debugging
 // VM_UNITTEST(dump_all_aspaces)  // Run last
 UNITTEST_END_TESTCASE(vm_tests, "vmtests", "Virtual memory tests", nullptr, nullptr);
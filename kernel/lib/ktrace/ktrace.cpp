@@ -21,6 +21,10 @@
 #if __x86_64__
 #define ktrace_timestamp() rdtsc();
 #define ktrace_ticks_per_ms() (ticks_per_second() / 1000)
+#elif __riscv
+#include <arch/riscv/timex.h>
+#define ktrace_timestamp() get_ticks()
+#define ktrace_ticks_per_ms() (ticks_per_second() / 1000)
 #else
 #define ktrace_timestamp() current_time()
 #define ktrace_ticks_per_ms() (1000000)
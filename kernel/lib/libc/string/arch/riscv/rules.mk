@@ -5,4 +5,15 @@
 # license that can be found in the LICENSE file or at
 # https://opensource.org/licenses/MIT
 
-LOCAL_DIR := $(GET_LOCAL_DIR)
\ No newline at end of file
+LOCAL_DIR := $(GET_LOCAL_DIR)
+
+ASM_STRING_OPS := memcmp memcpy memmove strlen
+
+MODULE_SRCS += \
+	$(LOCAL_DIR)/memcmp.S \
+	$(LOCAL_DIR)/memcpy.S \
+	$(LOCAL_DIR)/memmove.S \
+	$(LOCAL_DIR)/strlen.S
+
+# filter out the C implementation
+C_STRING_OPS := $(filter-out $(ASM_STRING_OPS),$(C_STRING_OPS))
@@ -160,6 +160,46 @@ status_t ChannelDispatcher::Read(uint32_t* msg_size,
     return rv;
 }
 
+status_t ChannelDispatcher::ReadMany(mx_channel_msg_t* descs, uint32_t count,
+                                     mxtl::unique_ptr<MessagePacket>* msgs, uint32_t* actual,
+                                     bool may_discard) {
+    canary_.Assert();
+
+    *actual = 0u;
+
+    AutoLock lock(&lock_);
+
+    if (messages_.is_empty())
+        return other_ ? MX_ERR_SHOULD_WAIT : MX_ERR_PEER_CLOSED;
+
+    uint32_t n = 0u;
+    while (n < count && !messages_.is_empty()) {
+        mx_channel_msg_t* desc = &descs[n];
+        uint32_t msg_size = messages_.front().data_size();
+        uint32_t msg_handle_count = messages_.front().num_handles();
+
+        desc->status = MX_OK;
+        if (msg_size > desc->num_bytes || msg_handle_count > desc->num_handles)
+            desc->status = MX_ERR_BUFFER_TOO_SMALL;
+        desc->num_bytes = msg_size;
+        desc->num_handles = msg_handle_count;
+
+        if (desc->status != MX_OK && !may_discard)
+            break;
+
+        msgs[n++] = messages_.pop_front();
+    }
+
+    if (messages_.is_empty())
+        state_tracker_.UpdateState(MX_CHANNEL_READABLE, 0u);
+
+    *actual = n;
+
+    // Like Read(), report a first message that does not fit as an error of
+    // the whole call.
+    return (n == 0u) ? descs[0].status : MX_OK;
+}
+
 status_t ChannelDispatcher::Write(mxtl::unique_ptr<MessagePacket> msg) {
     canary_.Assert();
 
@@ -181,6 +221,26 @@ status_t ChannelDispatcher::Write(mxtl::unique_ptr<MessagePacket> msg) {
     return MX_OK;
 }
 
+status_t ChannelDispatcher::WriteMany(mxtl::unique_ptr<MessagePacket>* msgs, uint32_t count) {
+    canary_.Assert();
+
+    mxtl::RefPtr<ChannelDispatcher> other;
+    {
+        AutoLock lock(&lock_);
+        if (!other_) {
+            for (uint32_t ix = 0; ix != count; ++ix)
+                msgs[ix]->set_owns_handles(false);
+            return MX_ERR_PEER_CLOSED;
+        }
+        other = other_;
+    }
+
+    if (other->WriteSelfMany(msgs, count) > 0)
+        thread_reschedule();
+
+    return MX_OK;
+}
+
 status_t ChannelDispatcher::Call(mxtl::unique_ptr<MessagePacket> msg,
                                  mx_time_t deadline, bool* return_handles,
                                  mxtl::unique_ptr<MessagePacket>* reply) {
@@ -262,6 +322,31 @@ int ChannelDispatcher::WriteSelf(mxtl::unique_ptr<MessagePacket> msg) {
 
     AutoLock lock(&lock_);
 
+    int woken = 0;
+    if (EnqueueLocked(mxtl::move(msg), &woken))
+        state_tracker_.UpdateState(0u, MX_CHANNEL_READABLE);
+    return woken;
+}
+
+int ChannelDispatcher::WriteSelfMany(mxtl::unique_ptr<MessagePacket>* msgs, uint32_t count) {
+    canary_.Assert();
+
+    AutoLock lock(&lock_);
+
+    int woken = 0;
+    bool queued = false;
+    for (uint32_t ix = 0; ix != count; ++ix) {
+        if (EnqueueLocked(mxtl::move(msgs[ix]), &woken))
+            queued = true;
+    }
+    if (queued)
+        state_tracker_.UpdateState(0u, MX_CHANNEL_READABLE);
+    return woken;
+}
+
+// Returns true if |msg| went onto the message queue, false if it was handed to
+// a waiting caller, in which case |*woken| is bumped by the threads woken up.
+bool ChannelDispatcher::EnqueueLocked(mxtl::unique_ptr<MessagePacket> msg, int* woken) {
     if (!waiters_.is_empty()) {
         // If the far side is waiting for replies to messages
         // send via "call", see if this message has a matching
@@ -272,15 +357,13 @@ int ChannelDispatcher::WriteSelf(mxtl::unique_ptr<MessagePacket> msg) {
             // Remove waiter from list.
             if (waiter.get_txid() == txid) {
                 waiters_.erase(waiter);
-                // we return how many threads have been woken up, or zero.
-                return waiter.Deliver(mxtl::move(msg));
+                *woken += waiter.Deliver(mxtl::move(msg));
+                return false;
             }
         }
     }
     messages_.push_back(mxtl::move(msg));
-
-    state_tracker_.UpdateState(0u, MX_CHANNEL_READABLE);
-    return 0;
+    return true;
 }
 
 status_t ChannelDispatcher::user_signal(uint32_t clear_mask, uint32_t set_mask, bool peer) {
@@ -11,6 +11,7 @@
 #include <magenta/futex_context.h>
 #include <magenta/user_copy.h>
 #include <magenta/user_thread.h>
+#include <mxtl/atomic.h>
 #include <trace.h>
 
 #define LOCAL_TRACE 0
@@ -24,16 +25,24 @@ FutexContext::~FutexContext() {
 
     // All of the threads should have removed themselves from wait queues
     // by the time the process has exited.
-    DEBUG_ASSERT(futex_table_.is_empty());
+#if LK_DEBUGLEVEL > 0
+    for (auto& shard : shards_) {
+        AutoLock lock(&shard.lock);
+        DEBUG_ASSERT(shard.table.is_empty());
+        DEBUG_ASSERT(shard.waiters.load() == 0u);
+    }
+#endif
 }
 
-status_t FutexContext::FutexWait(user_ptr<int> value_ptr, int current_value, mx_time_t deadline) {
+status_t FutexContext::FutexWait(user_ptr<int> value_ptr, int current_value, mx_time_t deadline)
+    TA_NO_THREAD_SAFETY_ANALYSIS {
     LTRACE_ENTRY;
 
     uintptr_t futex_key = reinterpret_cast<uintptr_t>(value_ptr.get());
     if (futex_key % sizeof(int))
         return MX_ERR_INVALID_ARGS;
 
+    Shard* shard = GetShard(futex_key);
     FutexNode* node;
 
     // FutexWait() checks that the address value_ptr still contains
@@ -42,16 +51,25 @@ status_t FutexContext::FutexWait(user_ptr<int> value_ptr, int current_value, mx_
     // If a FutexWake() operation could occur between them, a userland mutex
     // operation built on top of futexes would have a race condition that
     // could miss wakeups.
-    lock_.Acquire();
+    shard->lock.Acquire();
+
+    // Count ourselves as a waiter before looking at the value.  FutexWake()
+    // checks the count without the lock after the value was changed, so the
+    // fence pairs with the one there: either we see the new value, or the
+    // waker sees us and takes the lock.
+    shard->waiters.fetch_add(1u);
+    mxtl::atomic_thread_fence();
 
     int value;
     status_t result = value_ptr.copy_from_user(&value);
     if (result != MX_OK) {
-        lock_.Release();
+        shard->waiters.fetch_sub(1u);
+        shard->lock.Release();
         return result;
     }
     if (value != current_value) {
-        lock_.Release();
+        shard->waiters.fetch_sub(1u);
+        shard->lock.Release();
         return MX_ERR_BAD_STATE;
     }
 
@@ -60,18 +78,21 @@ status_t FutexContext::FutexWait(user_ptr<int> value_ptr, int current_value, mx_
     node->set_hash_key(futex_key);
     node->SetAsSingletonList();
 
-    QueueNodesLocked(node);
+    QueueNodesLocked(shard, node);
 
-    // Block current thread.  This releases lock_ and does not reacquire it.
-    result = node->BlockThread(&lock_, deadline);
+    // Block current thread.  This releases the shard lock and does not reacquire it.
+    result = node->BlockThread(&shard->lock, deadline);
     if (result == MX_OK) {
         // Fix/workaround for MG-624:
         // We must re-acquire the lock here to force this thread to wait until
         // the WakeThreads() marks this thread as not in the queue anymore.
         // Otherwise, this thread can exit before it does that, causing
-        // WakeThreads() to scribble on memory.
-        AutoLock lock(&lock_);
+        // WakeThreads() to scribble on memory.  We may have been requeued
+        // before being woken, so this is the lock of the shard we were woken
+        // from rather than the one we blocked in.
+        shard = LockNodeShard(node);
         DEBUG_ASSERT(!node->IsInQueue());
+        shard->lock.Release();
         // All the work necessary for removing us from the hash table was done by FutexWake()
         return MX_OK;
     }
@@ -82,8 +103,10 @@ status_t FutexContext::FutexWait(user_ptr<int> value_ptr, int current_value, mx_
     //
     // We need to ensure that the thread's node is removed from the wait
     // queue, because FutexWake() probably didn't do that.
-    AutoLock lock(&lock_);
-    if (UnqueueNodeLocked(node)) {
+    shard = LockNodeShard(node);
+    bool unqueued = UnqueueNodeLocked(shard, node);
+    shard->lock.Release();
+    if (unqueued) {
         return result;
     }
     // The current thread was not found on the wait queue.  This means
@@ -118,23 +141,35 @@ status_t FutexContext::FutexWake(user_ptr<const int> value_ptr,
     if (futex_key % sizeof(int))
         return MX_ERR_INVALID_ARGS;
 
-    AutoLock lock(&lock_);
+    Shard* shard = GetShard(futex_key);
+
+    // Unlocking an uncontended userland mutex usually finds no one waiting.
+    // See FutexWait() for the other half of this check.
+    mxtl::atomic_thread_fence();
+    if (shard->waiters.load(mxtl::memory_order_relaxed) == 0u)
+        return MX_OK;
+
+    AutoLock lock(&shard->lock);
 
-    FutexNode* node = futex_table_.erase(futex_key);
+    FutexNode* node = shard->table.erase(futex_key);
     if (!node) {
         // nothing blocked on this futex if we can't find it
         return MX_OK;
     }
     DEBUG_ASSERT(node->GetKey() == futex_key);
 
+    // The woken nodes keep their key so that FutexWait() can find this
+    // shard's lock again.
     FutexNode* wake_head = node;
-    node = FutexNode::RemoveFromHead(node, count, futex_key, 0u);
+    uint32_t num_woken;
+    node = FutexNode::RemoveFromHead(node, count, futex_key, futex_key, &num_woken);
     // node is now the new blocked thread list head
 
     if (node != nullptr) {
         DEBUG_ASSERT(node->GetKey() == futex_key);
-        futex_table_.insert(node);
+        shard->table.insert(node);
     }
+    shard->waiters.fetch_sub(num_woken);
 
     // Traversing this list of threads must be done while holding the
     // lock, because any of these threads might wake up from a timeout
@@ -146,32 +181,56 @@ status_t FutexContext::FutexWake(user_ptr<const int> value_ptr,
 }
 
 status_t FutexContext::FutexRequeue(user_ptr<int> wake_ptr, uint32_t wake_count, int current_value,
-                                    user_ptr<int> requeue_ptr, uint32_t requeue_count) {
+                                    user_ptr<int> requeue_ptr, uint32_t requeue_count)
+    TA_NO_THREAD_SAFETY_ANALYSIS {
     LTRACE_ENTRY;
 
     if ((requeue_ptr.get() == nullptr) && requeue_count)
         return MX_ERR_INVALID_ARGS;
 
-    AutoLock lock(&lock_);
-
-    int value;
-    status_t result = wake_ptr.copy_from_user(&value);
-    if (result != MX_OK) return result;
-    if (value != current_value) return MX_ERR_BAD_STATE;
-
     uintptr_t wake_key = reinterpret_cast<uintptr_t>(wake_ptr.get());
     uintptr_t requeue_key = reinterpret_cast<uintptr_t>(requeue_ptr.get());
     if (wake_key == requeue_key) return MX_ERR_INVALID_ARGS;
     if (wake_key % sizeof(int) || requeue_key % sizeof(int))
         return MX_ERR_INVALID_ARGS;
 
+    // Only the shards of the two futexes are locked, in address order so
+    // that two requeues going opposite ways cannot deadlock.
+    Shard* wake_shard = GetShard(wake_key);
+    Shard* requeue_shard = GetShard(requeue_key);
+    Shard* first = (wake_shard < requeue_shard) ? wake_shard : requeue_shard;
+    Shard* second = (wake_shard < requeue_shard) ? requeue_shard : wake_shard;
+
+    AutoLock lock(&first->lock);
+    if (second != first)
+        second->lock.Acquire();
+
+    int value;
+    status_t result = wake_ptr.copy_from_user(&value);
+    if (result == MX_OK) {
+        if (value != current_value) {
+            result = MX_ERR_BAD_STATE;
+        } else {
+            RequeueLocked(wake_shard, wake_key, wake_count,
+                          requeue_shard, requeue_key, requeue_count);
+        }
+    }
+
+    if (second != first)
+        second->lock.Release();
+    return result;
+}
+
+void FutexContext::RequeueLocked(Shard* wake_shard, uintptr_t wake_key, uint32_t wake_count,
+                                 Shard* requeue_shard, uintptr_t requeue_key,
+                                 uint32_t requeue_count) {
     // This must happen before RemoveFromHead() calls set_hash_key() on
-    // nodes below, because operations on futex_table_ look at the GetKey
+    // nodes below, because operations on the shard tables look at the GetKey
     // field of the list head nodes for wake_key and requeue_key.
-    FutexNode* node = futex_table_.erase(wake_key);
+    FutexNode* node = wake_shard->table.erase(wake_key);
     if (!node) {
         // nothing blocked on this futex if we can't find it
-        return MX_OK;
+        return;
     }
 
     FutexNode* wake_head;
@@ -179,7 +238,9 @@ status_t FutexContext::FutexRequeue(user_ptr<int> wake_ptr, uint32_t wake_count,
         wake_head = nullptr;
     } else {
         wake_head = node;
-        node = FutexNode::RemoveFromHead(node, wake_count, wake_key, 0u);
+        uint32_t num_woken;
+        node = FutexNode::RemoveFromHead(node, wake_count, wake_key, wake_key, &num_woken);
+        wake_shard->waiters.fetch_sub(num_woken);
     }
 
     // node is now the head of wake_ptr futex after possibly removing some threads to wake
@@ -187,27 +248,41 @@ status_t FutexContext::FutexRequeue(user_ptr<int> wake_ptr, uint32_t wake_count,
         if (requeue_count > 0) {
             // head and tail of list of nodes to requeue
             FutexNode* requeue_head = node;
+            uint32_t num_requeued;
             node = FutexNode::RemoveFromHead(node, requeue_count,
-                                             wake_key, requeue_key);
+                                             wake_key, requeue_key, &num_requeued);
 
             // now requeue our nodes to requeue_ptr mutex
             DEBUG_ASSERT(requeue_head->GetKey() == requeue_key);
-            QueueNodesLocked(requeue_head);
+            requeue_shard->waiters.fetch_add(num_requeued);
+            wake_shard->waiters.fetch_sub(num_requeued);
+            QueueNodesLocked(requeue_shard, requeue_head);
         }
     }
 
     // add any remaining nodes back to wake_key futex
     if (node != nullptr) {
         DEBUG_ASSERT(node->GetKey() == wake_key);
-        futex_table_.insert(node);
+        wake_shard->table.insert(node);
     }
 
     FutexNode::WakeThreads(wake_head);
-    return MX_OK;
 }
 
-void FutexContext::QueueNodesLocked(FutexNode* head) {
-    DEBUG_ASSERT(lock_.IsHeld());
+FutexContext::Shard* FutexContext::LockNodeShard(FutexNode* node) {
+    for (;;) {
+        Shard* shard = GetShard(node->GetKey());
+        shard->lock.Acquire();
+        // The key only changes with the lock of the shard it points into
+        // held, so once it agrees with the lock we hold it stays put.
+        if (GetShard(node->GetKey()) == shard)
+            return shard;
+        shard->lock.Release();
+    }
+}
+
+void FutexContext::QueueNodesLocked(Shard* shard, FutexNode* head) {
+    DEBUG_ASSERT(shard->lock.IsHeld());
 
     FutexNode::HashTable::iterator iter;
 
@@ -215,15 +290,15 @@ void FutexContext::QueueNodesLocked(FutexNode* head) {
     // succeeds, then the current thread is first to block on this futex and we
     // are finished.  If the insert fails, then there is already a thread
     // waiting on this futex.  Add ourselves to that thread's list.
-    if (!futex_table_.insert_or_find(head, &iter))
+    if (!shard->table.insert_or_find(head, &iter))
         iter->AppendList(head);
 }
 
 // This attempts to unqueue a thread (which may or may not be waiting on a
 // futex), given its FutexNode.  This returns whether the FutexNode was
 // found and removed from a futex wait queue.
-bool FutexContext::UnqueueNodeLocked(FutexNode* node) {
-    DEBUG_ASSERT(lock_.IsHeld());
+bool FutexContext::UnqueueNodeLocked(Shard* shard, FutexNode* node) {
+    DEBUG_ASSERT(shard->lock.IsHeld());
 
     if (!node->IsInQueue())
         return false;
@@ -233,11 +308,13 @@ bool FutexContext::UnqueueNodeLocked(FutexNode* node) {
     // However, that could be out of date if the thread was requeued by
     // FutexRequeue(), so we need to re-get the hash table key here.
     uintptr_t futex_key = node->GetKey();
+    DEBUG_ASSERT(GetShard(futex_key) == shard);
 
-    FutexNode* old_head = futex_table_.erase(futex_key);
+    FutexNode* old_head = shard->table.erase(futex_key);
     DEBUG_ASSERT(old_head);
     FutexNode* new_head = FutexNode::RemoveNodeFromList(old_head, node);
     if (new_head)
-        futex_table_.insert(new_head);
+        shard->table.insert(new_head);
+    shard->waiters.fetch_sub(1u);
     return true;
 }
@@ -71,13 +71,14 @@ FutexNode* FutexNode::RemoveNodeFromList(FutexNode* list_head,
 // This removes up to |count| nodes from |list_head|.  It returns the new
 // list head (i.e. the list of remaining nodes), which may be null (empty).
 // On return, |list_head| is the list of nodes that were removed --
-// |list_head| remains a valid list.
+// |list_head| remains a valid list -- and |*num_removed| is their count.
 //
 // This will always remove at least one node, because it requires that
 // |count| is non-zero and |list_head| is a non-empty list.
 FutexNode* FutexNode::RemoveFromHead(FutexNode* list_head, uint32_t count,
                                      uintptr_t old_hash_key,
-                                     uintptr_t new_hash_key) {
+                                     uintptr_t new_hash_key,
+                                     uint32_t* num_removed) {
     ASSERT(list_head);
     ASSERT(count != 0);
 
@@ -87,6 +88,7 @@ FutexNode* FutexNode::RemoveFromHead(FutexNode* list_head, uint32_t count,
         // For requeuing, update the key so that FutexWait() can remove the
         // thread from its current queue if the wait operation times out.
         node->set_hash_key(new_hash_key);
+        *num_removed = i + 1;
 
         node = node->queue_next_;
         if (node == list_head) {
@@ -43,8 +43,25 @@ public:
                   mxtl::unique_ptr<MessagePacket>* msg,
                   bool may_disard);
 
+    // Read up to |count| messages from this endpoint's message queue while
+    // holding the lock once.  The num_bytes and num_handles fields of |descs|
+    // give the limits for each message on input and its actual size on output,
+    // and each status field is set to the per-message result as for Read().
+    // Reading stops early when the queue runs dry or, unless |may_discard| is
+    // set, at a message too big for its limits; that message stays queued.
+    // The dequeued messages are returned in |msgs| and counted in |*actual|.
+    status_t ReadMany(mx_channel_msg_t* descs, uint32_t count,
+                      mxtl::unique_ptr<MessagePacket>* msgs, uint32_t* actual,
+                      bool may_discard);
+
     // Write to the opposing endpoint's message queue.
     status_t Write(mxtl::unique_ptr<MessagePacket> msg);
+
+    // Write |count| messages, in order, to the opposing endpoint's message
+    // queue while holding its lock once.  On MX_ERR_PEER_CLOSED the messages
+    // are left in |msgs| and no longer own their handles, so the caller can
+    // put them back.
+    status_t WriteMany(mxtl::unique_ptr<MessagePacket>* msgs, uint32_t count);
     status_t Call(mxtl::unique_ptr<MessagePacket> msg,
                   mx_time_t deadline, bool* return_handles,
                   mxtl::unique_ptr<MessagePacket>* reply);
@@ -137,6 +154,8 @@ private:
     ChannelDispatcher(uint32_t flags);
     void Init(mxtl::RefPtr<ChannelDispatcher> other);
     int WriteSelf(mxtl::unique_ptr<MessagePacket> msg);
+    int WriteSelfMany(mxtl::unique_ptr<MessagePacket>* msgs, uint32_t count);
+    bool EnqueueLocked(mxtl::unique_ptr<MessagePacket> msg, int* woken) TA_REQ(lock_);
     status_t UserSignalSelf(uint32_t clear_mask, uint32_t set_mask);
     void OnPeerZeroHandles();
 
@@ -14,6 +14,7 @@
 #include <magenta/syscalls/object.h>
 #include <magenta/types.h>
 
+#include <mxtl/atomic.h>
 #include <mxtl/ref_counted.h>
 #include <mxtl/ref_ptr.h>
 #include <mxtl/unique_ptr.h>
@@ -61,7 +62,7 @@ public:
     mx_koid_t get_koid() const { return koid_; }
 
     // Updating |handle_count_| is done at the magenta handle management layer.
-    uint32_t* get_handle_count_ptr() { return &handle_count_; }
+    mxtl::atomic<uint32_t>* get_handle_count_ptr() { return &handle_count_; }
 
     // Interface for derived classes.
 
@@ -94,7 +95,7 @@ protected:
 
 private:
     const mx_koid_t koid_;
-    uint32_t handle_count_;
+    mxtl::atomic<uint32_t> handle_count_;
 };
 
 // Checks if a RefPtr<Dispatcher> points to a dispatcher of a given dispatcher subclass T and, if
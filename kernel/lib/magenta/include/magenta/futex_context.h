@@ -10,6 +10,7 @@
 #include <lib/user_copy/user_ptr.h>
 #include <magenta/futex_node.h>
 #include <magenta/types.h>
+#include <mxtl/atomic.h>
 
 // FutexContext is a class that encapsulates support for futex operations.
 // FutexContext uses a hash table keyed on the futex address (a pointer to integer in userspace)
@@ -23,6 +24,8 @@
 // When the thread at the head of the futex's blocked thread list is resumed,
 // The FutexNode for the new head of the blocked thread list is set as the hash table value
 // for the futex.
+// The futexes are spread by address over a fixed number of shards, each with its own lock
+// and hash table, so threads blocking on unrelated futexes do not contend with each other.
 class FutexContext {
 public:
     FutexContext();
@@ -51,14 +54,40 @@ private:
     FutexContext(const FutexContext&) = delete;
     FutexContext& operator=(const FutexContext&) = delete;
 
-    void QueueNodesLocked(FutexNode* head) TA_REQ(lock_);
+    static constexpr size_t kNumShards = 16;
 
-    bool UnqueueNodeLocked(FutexNode* node) TA_REQ(lock_);
+    struct Shard {
+        // protects table
+        Mutex lock;
 
-    // protects futex_table_
-    Mutex lock_;
+        // Number of threads queued in |table| or about to be.  This is only
+        // changed with |lock| held, but FutexWake() reads it without the lock
+        // so that waking a futex no one waits on does not touch the lock.
+        mxtl::atomic<uint32_t> waiters{0u};
 
-    // Hash table for futexes in this context.
-    // Key is futex address, value is the FutexNode for the head of futex's blocked thread list.
-    FutexNode::HashTable futex_table_ TA_GUARDED(lock_);
+        // Key is futex address, value is the FutexNode for the head of futex's
+        // blocked thread list.
+        FutexNode::HashTable table TA_GUARDED(lock);
+    };
+
+    // Futexes in the same cache line share a shard.
+    Shard* GetShard(uintptr_t futex_key) {
+        return &shards_[(futex_key >> 6) % kNumShards];
+    }
+
+    // Locks the shard that |node| is currently queued in or was last woken
+    // from.  A concurrent FutexRequeue() may move the node while we wait
+    // for the lock, so this retries until the two agree.
+    Shard* LockNodeShard(FutexNode* node) TA_NO_THREAD_SAFETY_ANALYSIS;
+
+    // The part of FutexRequeue() that runs with both shards locked.
+    void RequeueLocked(Shard* wake_shard, uintptr_t wake_key, uint32_t wake_count,
+                       Shard* requeue_shard, uintptr_t requeue_key, uint32_t requeue_count)
+        TA_REQ(wake_shard->lock, requeue_shard->lock);
+
+    void QueueNodesLocked(Shard* shard, FutexNode* head) TA_REQ(shard->lock);
+
+    bool UnqueueNodeLocked(Shard* shard, FutexNode* node) TA_REQ(shard->lock);
+
+    Shard shards_[kNumShards];
 };
@@ -36,7 +36,8 @@ public:
     static FutexNode* RemoveFromHead(FutexNode* list_head,
                                      uint32_t count,
                                      uintptr_t old_hash_key,
-                                     uintptr_t new_hash_key);
+                                     uintptr_t new_hash_key,
+                                     uint32_t* num_removed);
 
     // This must be called with |mutex| held and returns without |mutex| held.
     status_t BlockThread(Mutex* mutex, mx_time_t deadline) TA_REL(mutex);
@@ -60,7 +61,8 @@ private:
 
     // hash_key_ contains the futex address.  This field has two roles:
     //  * It is used by FutexWait() to determine which queue to remove the
-    //    thread from when a wait operation times out.
+    //    thread from when a wait operation times out, and which shard's
+    //    lock the waking thread held when it was woken.
     //  * Additionally, when this FutexNode is the head of a futex wait
     //    queue, this field is used by the HashTable (because it uses
     //    intrusive SinglyLinkedLists).
@@ -15,10 +15,12 @@
 
 constexpr uint32_t kMaxMessageSize = 65536u;
 constexpr uint32_t kMaxMessageHandles = 64u;
+constexpr uint32_t kMaxMessagesPerCall = 64u;
 
 // ensure public constants are aligned
 static_assert(MX_CHANNEL_MAX_MSG_BYTES == kMaxMessageSize, "");
 static_assert(MX_CHANNEL_MAX_MSG_HANDLES == kMaxMessageHandles, "");
+static_assert(MX_CHANNEL_MAX_MSGS_PER_CALL == kMaxMessagesPerCall, "");
 
 class Handle;
 
@@ -59,7 +61,8 @@ public:
     }
 
 private:
-    MessagePacket(uint32_t data_size, uint32_t num_handles, Handle** handles);
+    MessagePacket(uint32_t data_size, uint32_t num_handles, Handle** handles,
+                  uint8_t size_class, uint8_t cpu);
     ~MessagePacket();
 
     // Allocates a new packet that can hold the specified amount of
@@ -67,10 +70,9 @@ private:
     static mx_status_t NewPacket(uint32_t data_size, uint32_t num_handles,
                                  mxtl::unique_ptr<MessagePacket>* msg);
 
-    // Create() uses malloc(), so we must delete using free().
-    static void operator delete(void* ptr) {
-        free(ptr);
-    }
+    // Create() allocates from the per-cpu packet caches or the heap, so
+    // storage must go back to wherever |size_class_| and |cpu_| say.
+    static void operator delete(void* ptr);
     friend class mxtl::unique_ptr<MessagePacket>;
 
     // Handles and data are stored in the same buffer: num_handles_ Handle*
@@ -81,4 +83,7 @@ private:
     const uint32_t data_size_;
     const uint16_t num_handles_;
     bool owns_handles_;
+    // Where the packet's storage came from, see NewPacket().
+    const uint8_t size_class_;
+    const uint8_t cpu_;
 };
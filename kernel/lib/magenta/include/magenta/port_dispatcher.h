@@ -164,6 +164,10 @@ private:
     PortDispatcher(uint32_t options);
     PortObserver* CopyLocked(PortPacket* port_packet, mx_port_packet_t* packet) TA_REQ(lock_);
 
+    // Adds |port_packet| to the queue, and posts |sema_| only if a thread is
+    // waiting for a packet. Returns the number of threads woken.
+    int QueueLocked(PortPacket* port_packet) TA_REQ(lock_);
+
     // Adopts a RefPtr to |eport|, and adds it to |eports_|.
     // Called by ExceptionPort.
     void LinkExceptionPort(ExceptionPort* eport);
@@ -178,5 +182,12 @@ private:
     Semaphore sema_;
     bool zero_handles_ TA_GUARDED(lock_);
     mxtl::DoublyLinkedList<PortPacket*> packets_ TA_GUARDED(lock_);
+    // Threads in DeQueue() that found the queue empty and are waiting on
+    // |sema_|. While there are none, queueing a packet does not touch it.
+    uint32_t waiters_ TA_GUARDED(lock_);
+    // Dequeued user packets kept for reuse by QueueUser(), so the common
+    // case does not go to the heap for every packet.
+    mxtl::DoublyLinkedList<PortPacket*> free_packets_ TA_GUARDED(lock_);
+    size_t free_count_ TA_GUARDED(lock_);
     mxtl::DoublyLinkedList<mxtl::RefPtr<ExceptionPort>> eports_ TA_GUARDED(lock_);
 };
@@ -6,12 +6,15 @@
 
 #include <magenta/magenta.h>
 
+#include <inttypes.h>
 #include <pow2.h>
 #include <trace.h>
 
+#include <arch/ops.h>
 #include <kernel/auto_lock.h>
 #include <kernel/cmdline.h>
 #include <kernel/mutex.h>
+#include <kernel/spinlock.h>
 
 #include <lk/init.h>
 
@@ -30,6 +33,7 @@
 #include <magenta/io_mapping_dispatcher.h>
 
 #include <mxtl/arena.h>
+#include <mxtl/atomic.h>
 #include <mxtl/intrusive_double_list.h>
 #include <mxtl/type_support.h>
 
@@ -44,14 +48,34 @@ constexpr size_t kMaxHandleCount = 256 * 1024u;
 // there are this many outstanding handles.
 constexpr size_t kHighHandleCount = (kMaxHandleCount * 7) / 8;
 
-// The handle arena and its mutex. It also guards Dispatcher::handle_count_.
+// The handle arena and its mutex.
 static Mutex handle_mutex;
 static mxtl::Arena TA_GUARDED(handle_mutex) handle_arena;
-static size_t outstanding_handles TA_GUARDED(handle_mutex) = 0u;
+static mxtl::atomic<size_t> outstanding_handles(0u);
+
+// Per cpu caches of free handle slots in front of |handle_arena|, so that
+// creating and destroying handles does not take |handle_mutex| in the
+// common case. Slots move between a cache and the arena in batches.
+// A cached slot has been torn down like any free slot, so it holds the
+// stashed base_value and does not look like a live handle to lookups.
+constexpr size_t kHandleCacheMax = 64u;
+constexpr size_t kHandleCacheBatch = 32u;
+
+struct HandleCache {
+    spin_lock_t lock;
+    size_t count;
+    void* slots[kHandleCacheMax];
+
+    // statistics
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t drains;
+} __CPU_MAX_ALIGN;
+
+static HandleCache handle_caches[SMP_MAX_CPUS];
 
 size_t internal::OutstandingHandles() {
-    AutoLock lock(&handle_mutex);
-    return outstanding_handles;
+    return outstanding_handles.load();
 }
 
 // The system exception port.
@@ -66,6 +90,9 @@ static mxtl::RefPtr<JobDispatcher> root_job;
 static PolicyManager* policy_manager;
 
 void magenta_init(uint level) TA_NO_THREAD_SAFETY_ANALYSIS {
+    for (auto& c : handle_caches) {
+        c.lock = SPIN_LOCK_INITIAL_VALUE;
+    }
     handle_arena.Init("handles", sizeof(Handle), kMaxHandleCount);
     root_job = JobDispatcher::CreateRootJob();
     policy_manager = PolicyManager::Create();
@@ -98,8 +125,9 @@ static_assert(((3 << 30) ^ kHandleGenerationMask ^ kHandleIndexMask) ==
 
 // Returns a new |base_value| based on the value stored in the free
 // |handle_arena| slot pointed to by |addr|. The new value will be different
-// from the last |base_value| used by this slot.
-static uint32_t GetNewHandleBaseValue(void* addr) TA_REQ(handle_mutex) {
+// from the last |base_value| used by this slot. The caller owns the slot,
+// and the arena's start never changes after init, so this needs no lock.
+static uint32_t GetNewHandleBaseValue(void* addr) TA_NO_THREAD_SAFETY_ANALYSIS {
     // Get the index of this slot within handle_arena.
     auto va = reinterpret_cast<Handle*>(addr) -
               reinterpret_cast<Handle*>(handle_arena.start());
@@ -148,35 +176,150 @@ void internal::TearDownHandle(Handle *handle) TA_EXCL(handle_mutex) {
 
 static void high_handle_count(size_t count) {
     // TODO: Avoid calling this for every handle after kHighHandleCount;
-    // printfs are slow and |handle_mutex| is held by our caller.
+    // printfs are slow.
     printf("WARNING: High handle count: %zu handles\n", count);
 }
 
-Handle* MakeHandle(mxtl::RefPtr<Dispatcher> dispatcher, mx_rights_t rights) {
-    uint32_t* handle_count = nullptr;
-    void* addr;
-    uint32_t base_value;
+// Puts up to |count| slots from |slots| in the local cache and returns how
+// many it took.
+static size_t HandleCacheFill(void** slots, size_t count) {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    HandleCache* c = &handle_caches[arch_curr_cpu_num()];
+    spin_lock(&c->lock);
+
+    size_t taken = 0;
+    while (taken < count && c->count < kHandleCacheMax) {
+        c->slots[c->count++] = slots[taken++];
+    }
+
+    spin_unlock(&c->lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    return taken;
+}
+
+// Takes a slot from any cpu's cache. Only used once the arena is exhausted,
+// when the free slots left are all sitting in the caches.
+static void* HandleCacheSteal() {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    void* addr = nullptr;
+    for (uint i = 0; i < arch_max_num_cpus() && addr == nullptr; i++) {
+        HandleCache* c = &handle_caches[i];
+        spin_lock(&c->lock);
+        if (c->count > 0)
+            addr = c->slots[--c->count];
+        spin_unlock(&c->lock);
+    }
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    return addr;
+}
 
+// Returns a free slot for a Handle, or nullptr if the arena and every cache
+// are empty.
+static void* AllocHandleSlot() {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    HandleCache* c = &handle_caches[arch_curr_cpu_num()];
+    spin_lock(&c->lock);
+
+    void* addr = nullptr;
+    if (c->count > 0) {
+        addr = c->slots[--c->count];
+        c->hits++;
+    } else {
+        c->misses++;
+    }
+
+    spin_unlock(&c->lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (addr != nullptr)
+        return addr;
+
+    // Refill from the arena: keep one slot and cache the rest.
+    void* slots[kHandleCacheBatch];
+    size_t count = 0;
     {
         AutoLock lock(&handle_mutex);
-        addr = handle_arena.Alloc();
-        if (addr == nullptr) {
-            const auto oh = outstanding_handles;
-            lock.release();
-            printf("WARNING: Could not allocate new handle (%zu outstanding)\n",
-                   oh);
-            return nullptr;
+        while (count < kHandleCacheBatch) {
+            void* slot = handle_arena.Alloc();
+            if (slot == nullptr)
+                break;
+            slots[count++] = slot;
+        }
+    }
+    if (count == 0)
+        return HandleCacheSteal();
+
+    addr = slots[--count];
+    size_t cached = HandleCacheFill(slots, count);
+    if (cached < count) {
+        // We moved to a cpu whose cache filled up in the meantime.
+        AutoLock lock(&handle_mutex);
+        for (size_t i = cached; i < count; i++) {
+            handle_arena.Free(slots[i]);
+        }
+    }
+    return addr;
+}
+
+// Returns a torn down Handle slot to the local cache, draining half of the
+// cache to the arena when it is full.
+static void FreeHandleSlot(void* addr) {
+    void* slots[kHandleCacheBatch];
+    size_t count = 0;
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    HandleCache* c = &handle_caches[arch_curr_cpu_num()];
+    spin_lock(&c->lock);
+
+    if (c->count == kHandleCacheMax) {
+        while (count < kHandleCacheBatch) {
+            slots[count++] = c->slots[--c->count];
+        }
+        c->drains++;
+    }
+    c->slots[c->count++] = addr;
+
+    spin_unlock(&c->lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (count > 0) {
+        AutoLock lock(&handle_mutex);
+        for (size_t i = 0; i < count; i++) {
+            handle_arena.Free(slots[i]);
         }
-        if (++outstanding_handles > kHighHandleCount)
-            high_handle_count(outstanding_handles);
+    }
+}
 
-        handle_count = dispatcher->get_handle_count_ptr();
-        (*handle_count)++;
-        if (*handle_count != 2u)
-            handle_count = nullptr;
+static void CountNewHandle() {
+    const size_t oh = outstanding_handles.fetch_add(1u) + 1u;
+    if (oh > kHighHandleCount)
+        high_handle_count(oh);
+}
 
-        base_value = GetNewHandleBaseValue(addr);
+Handle* MakeHandle(mxtl::RefPtr<Dispatcher> dispatcher, mx_rights_t rights) {
+    void* addr = AllocHandleSlot();
+    if (addr == nullptr) {
+        printf("WARNING: Could not allocate new handle (%zu outstanding)\n",
+               outstanding_handles.load());
+        return nullptr;
     }
+    CountNewHandle();
+
+    mxtl::atomic<uint32_t>* handle_count = dispatcher->get_handle_count_ptr();
+    if (handle_count->fetch_add(1u) + 1u != 2u)
+        handle_count = nullptr;
+
+    uint32_t base_value = GetNewHandleBaseValue(addr);
 
     auto state_tracker = dispatcher->get_state_tracker();
     if (state_tracker != nullptr)
@@ -187,30 +330,20 @@ Handle* MakeHandle(mxtl::RefPtr<Dispatcher> dispatcher, mx_rights_t rights) {
 
 Handle* DupHandle(Handle* source, mx_rights_t rights, bool is_replace) {
     mxtl::RefPtr<Dispatcher> dispatcher(source->dispatcher());
-    uint32_t* handle_count;
-    void* addr;
-    uint32_t base_value;
 
-    {
-        AutoLock lock(&handle_mutex);
-        addr = handle_arena.Alloc();
-        if (addr == nullptr) {
-            const auto oh = outstanding_handles;
-            lock.release();
-            printf(
-                "WARNING: Could not allocate duplicate handle (%zu outstanding)\n", oh);
-            return nullptr;
-        }
-        if (++outstanding_handles > kHighHandleCount)
-            high_handle_count(outstanding_handles);
+    void* addr = AllocHandleSlot();
+    if (addr == nullptr) {
+        printf("WARNING: Could not allocate duplicate handle (%zu outstanding)\n",
+               outstanding_handles.load());
+        return nullptr;
+    }
+    CountNewHandle();
 
-        handle_count = dispatcher->get_handle_count_ptr();
-        (*handle_count)++;
-        if (*handle_count != 2u)
-            handle_count = nullptr;
+    mxtl::atomic<uint32_t>* handle_count = dispatcher->get_handle_count_ptr();
+    if (handle_count->fetch_add(1u) + 1u != 2u)
+        handle_count = nullptr;
 
-        base_value = GetNewHandleBaseValue(addr);
-    }
+    uint32_t base_value = GetNewHandleBaseValue(addr);
 
     auto state_tracker = dispatcher->get_state_tracker();
     if (!is_replace && (state_tracker != nullptr))
@@ -249,21 +382,16 @@ void DeleteHandle(Handle* handle) {
     // base_value for reuse the next time this slot is allocated.
     internal::TearDownHandle(handle);
 
-    bool zero_handles = false;
-    uint32_t* handle_count;
-    {
-        AutoLock lock(&handle_mutex);
-        --outstanding_handles;
-
-        handle_count = dispatcher->get_handle_count_ptr();
-        (*handle_count)--;
-        if (*handle_count == 0u)
-            zero_handles = true;
-        else if (*handle_count != 1u)
-            handle_count = nullptr;
+    FreeHandleSlot(handle);
+    outstanding_handles.fetch_sub(1u);
 
-        handle_arena.Free(handle);
-    }
+    bool zero_handles = false;
+    mxtl::atomic<uint32_t>* handle_count = dispatcher->get_handle_count_ptr();
+    const uint32_t remaining = handle_count->fetch_sub(1u) - 1u;
+    if (remaining == 0u)
+        zero_handles = true;
+    else if (remaining != 1u)
+        handle_count = nullptr;
 
     if (zero_handles) {
         dispatcher->on_zero_handles();
@@ -277,8 +405,9 @@ void DeleteHandle(Handle* handle) {
     // gets destroyed here.
 }
 
-bool HandleInRange(void* addr) {
-    AutoLock lock(&handle_mutex);
+// The arena's data pool only grows, since freed slots go on its free list,
+// so a slot that was ever in range stays committed and this needs no lock.
+bool HandleInRange(void* addr) TA_NO_THREAD_SAFETY_ANALYSIS {
     return handle_arena.in_range(addr);
 }
 
@@ -292,8 +421,17 @@ Handle* MapU32ToHandle(uint32_t value) TA_NO_THREAD_SAFETY_ANALYSIS {
 }
 
 void internal::DumpHandleTableInfo() {
-    AutoLock lock(&handle_mutex);
-    handle_arena.Dump();
+    {
+        AutoLock lock(&handle_mutex);
+        handle_arena.Dump();
+    }
+
+    printf("handle slot caches:\n");
+    for (uint i = 0; i < arch_max_num_cpus(); i++) {
+        const HandleCache& c = handle_caches[i];
+        printf("  cpu %u: %zu slots, %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " drains\n",
+               i, c.count, c.hits, c.misses, c.drains);
+    }
 }
 
 mx_status_t SetSystemExceptionPort(mxtl::RefPtr<ExceptionPort> eport) {
@@ -6,6 +6,7 @@
 
 #include <magenta/message_packet.h>
 
+#include <arch/ops.h>
 #include <err.h>
 #include <stdint.h>
 #include <string.h>
@@ -13,6 +14,115 @@
 #include <magenta/handle_reaper.h>
 #include <magenta/magenta.h>
 #include <mxcpp/new.h>
+#include <mxtl/slab_allocator.h>
+
+namespace {
+
+// Packets are allocated from per-cpu slab caches in a few size classes.  The
+// size covers the MessagePacket, its Handle* array and the payload, and each
+// class is named for the payload it holds along with a few handles.  Packets
+// that do not fit any class, or whose class ran out of slabs, come from the
+// heap.  A packet is returned to the cache it came from, whichever cpu frees
+// it.
+constexpr size_t kPacketClassHandles = 4u;
+
+template <size_t kDataSize, size_t kSlabSize>
+struct PacketBuffer;
+
+template <size_t kDataSize, size_t kSlabSize>
+using PacketAllocatorTraits =
+    mxtl::ManualDeleteSlabAllocatorTraits<PacketBuffer<kDataSize, kSlabSize>*, kSlabSize>;
+
+template <size_t kDataSize, size_t kSlabSize>
+using PacketAllocator = mxtl::SlabAllocator<PacketAllocatorTraits<kDataSize, kSlabSize>>;
+
+template <size_t kDataSize, size_t kSlabSize>
+struct PacketBuffer
+    : public mxtl::SlabAllocated<PacketAllocatorTraits<kDataSize, kSlabSize>> {
+    static constexpr size_t kSize =
+        sizeof(MessagePacket) + kPacketClassHandles * sizeof(Handle*) + kDataSize;
+
+    // Leaves the storage uninitialized when constructed by the allocator.
+    PacketBuffer() {}
+
+    alignas(MessagePacket) uint8_t storage[kSize];
+};
+
+using SmallPacketAllocator = PacketAllocator<128u, 16u * 1024u>;
+using MediumPacketAllocator = PacketAllocator<1024u, 16u * 1024u>;
+using LargePacketAllocator = PacketAllocator<4096u, 64u * 1024u>;
+
+enum : uint8_t {
+    kPacketClassSmall,
+    kPacketClassMedium,
+    kPacketClassLarge,
+    kPacketClassHeap,
+};
+
+struct PacketCache {
+    // Slab limits per cpu: 256KB, 512KB and 1MB.
+    SmallPacketAllocator small{16u};
+    MediumPacketAllocator medium{32u};
+    LargePacketAllocator large{16u};
+};
+
+static_assert(SMP_MAX_CPUS <= UINT8_MAX + 1, "cpu number must fit in MessagePacket::cpu_");
+PacketCache packet_caches[SMP_MAX_CPUS];
+
+template <typename Allocator>
+void* AllocFrom(Allocator* allocator) {
+    auto buffer = allocator->New();
+    return buffer ? buffer->storage : nullptr;
+}
+
+void* AllocPacketStorage(size_t size, uint8_t* size_class, uint8_t* cpu) {
+    const uint curr_cpu = arch_curr_cpu_num();
+    PacketCache& cache = packet_caches[curr_cpu];
+    void* ptr = nullptr;
+
+    if (size <= SmallPacketAllocator::ObjType::kSize) {
+        ptr = AllocFrom(&cache.small);
+        *size_class = kPacketClassSmall;
+    } else if (size <= MediumPacketAllocator::ObjType::kSize) {
+        ptr = AllocFrom(&cache.medium);
+        *size_class = kPacketClassMedium;
+    } else if (size <= LargePacketAllocator::ObjType::kSize) {
+        ptr = AllocFrom(&cache.large);
+        *size_class = kPacketClassLarge;
+    }
+
+    if (ptr != nullptr) {
+        *cpu = static_cast<uint8_t>(curr_cpu);
+        return ptr;
+    }
+
+    *size_class = kPacketClassHeap;
+    *cpu = 0;
+    return malloc(size);
+}
+
+void FreePacketStorage(void* ptr, uint8_t size_class, uint8_t cpu) {
+    PacketCache& cache = packet_caches[cpu];
+
+    // The base class is empty and |storage| is the only member, so the buffer
+    // shares its address.
+    switch (size_class) {
+    case kPacketClassSmall:
+        cache.small.Delete(reinterpret_cast<SmallPacketAllocator::ObjType*>(ptr));
+        break;
+    case kPacketClassMedium:
+        cache.medium.Delete(reinterpret_cast<MediumPacketAllocator::ObjType*>(ptr));
+        break;
+    case kPacketClassLarge:
+        cache.large.Delete(reinterpret_cast<LargePacketAllocator::ObjType*>(ptr));
+        break;
+    default:
+        free(ptr);
+        break;
+    }
+}
+
+}  // namespace
 
 // static
 mx_status_t MessagePacket::NewPacket(uint32_t data_size, uint32_t num_handles,
@@ -26,12 +136,12 @@ mx_status_t MessagePacket::NewPacket(uint32_t data_size, uint32_t num_handles,
 
     // Allocate space for the MessagePacket object followed by num_handles
     // Handle*s followed by data_size bytes.
-    // TODO(dbort): Use mbuf-style memory for data_size, ideally allocating from
-    // somewhere other than the heap. Lets us better track and isolate channel
-    // memory usage.
-    char* ptr = static_cast<char*>(malloc(sizeof(MessagePacket) +
-                                          num_handles * sizeof(Handle*) +
-                                          data_size));
+    uint8_t size_class;
+    uint8_t cpu;
+    char* ptr = static_cast<char*>(AllocPacketStorage(sizeof(MessagePacket) +
+                                                      num_handles * sizeof(Handle*) +
+                                                      data_size,
+                                                      &size_class, &cpu));
     if (ptr == nullptr) {
         return MX_ERR_NO_MEMORY;
     }
@@ -41,7 +151,8 @@ mx_status_t MessagePacket::NewPacket(uint32_t data_size, uint32_t num_handles,
     // immediately after creation of the object.
     msg->reset(new (ptr) MessagePacket(
         data_size, num_handles,
-        reinterpret_cast<Handle**>(ptr + sizeof(MessagePacket))));
+        reinterpret_cast<Handle**>(ptr + sizeof(MessagePacket)),
+        size_class, cpu));
     return MX_OK;
 }
 
@@ -85,8 +196,19 @@ MessagePacket::~MessagePacket() {
 }
 
 MessagePacket::MessagePacket(uint32_t data_size,
-                             uint32_t num_handles, Handle** handles)
+                             uint32_t num_handles, Handle** handles,
+                             uint8_t size_class, uint8_t cpu)
     : handles_(handles), data_size_(data_size),
       // NewPacket ensures that num_handles fits in 16 bits.
-      num_handles_(static_cast<uint16_t>(num_handles)), owns_handles_(false) {
+      num_handles_(static_cast<uint16_t>(num_handles)), owns_handles_(false),
+      size_class_(size_class), cpu_(cpu) {
+}
+
+// static
+void MessagePacket::operator delete(void* ptr) {
+    // As with mxtl::SlabAllocated, this reads members of an object that has
+    // already been destructed.  That is only OK because the destructor does
+    // not touch |size_class_| or |cpu_|, and nothing else can change them.
+    auto msg = static_cast<MessagePacket*>(ptr);
+    FreePacketStorage(ptr, msg->size_class_, msg->cpu_);
 }
@@ -21,6 +21,9 @@
 
 #include <kernel/auto_lock.h>
 
+// The number of dequeued user packets a port keeps for reuse.
+static constexpr size_t kMaxFreePackets = 64u;
+
 PortPacket::PortPacket() : packet{}, observer(nullptr) {
     // Note that packet is initialized to zeros.
 }
@@ -108,11 +111,13 @@ mx_status_t PortDispatcher::Create(uint32_t options,
 }
 
 PortDispatcher::PortDispatcher(uint32_t /*options*/)
-    : zero_handles_(false) {
+    : zero_handles_(false), waiters_(0u), free_count_(0u) {
 }
 
 PortDispatcher::~PortDispatcher() {
     DEBUG_ASSERT(zero_handles_);
+    while (!free_packets_.is_empty())
+        delete free_packets_.pop_front();
 }
 
 void PortDispatcher::on_zero_handles() {
@@ -138,18 +143,33 @@ void PortDispatcher::on_zero_handles() {
 mx_status_t PortDispatcher::QueueUser(const mx_port_packet_t& packet) {
     canary_.Assert();
 
-    AllocChecker ac;
-    auto port_packet = new (&ac) PortPacket();
-    if (!ac.check())
-        return MX_ERR_NO_MEMORY;
+    int wake_count = 0;
+    {
+        AutoLock al(&lock_);
+        if (zero_handles_)
+            return MX_ERR_BAD_STATE;
+
+        PortPacket* port_packet;
+        if (!free_packets_.is_empty()) {
+            port_packet = free_packets_.pop_front();
+            --free_count_;
+        } else {
+            AllocChecker ac;
+            port_packet = new (&ac) PortPacket();
+            if (!ac.check())
+                return MX_ERR_NO_MEMORY;
+        }
+
+        port_packet->packet = packet;
+        port_packet->packet.type = MX_PKT_TYPE_USER | PKT_FLAG_EPHEMERAL;
+
+        wake_count = QueueLocked(port_packet);
+    }
 
-    port_packet->packet = packet;
-    port_packet->packet.type = MX_PKT_TYPE_USER | PKT_FLAG_EPHEMERAL;
+    if (wake_count)
+        thread_reschedule();
 
-    auto status = Queue(port_packet, 0u, 0u);
-    if (status < 0)
-        delete port_packet;
-    return status;
+    return MX_OK;
 }
 
 mx_status_t PortDispatcher::Queue(PortPacket* port_packet,
@@ -170,8 +190,7 @@ mx_status_t PortDispatcher::Queue(PortPacket* port_packet,
             port_packet->packet.signal.count = count;
         }
 
-        packets_.push_back(port_packet);
-        wake_count = sema_.Post();
+        wake_count = QueueLocked(port_packet);
     }
 
     if (wake_count)
@@ -180,6 +199,15 @@ mx_status_t PortDispatcher::Queue(PortPacket* port_packet,
     return MX_OK;
 }
 
+int PortDispatcher::QueueLocked(PortPacket* port_packet) {
+    packets_.push_back(port_packet);
+
+    // Posting takes the thread lock, so skip it while every consumer is
+    // busy. A waiter counts itself under |lock_| after it saw the queue
+    // empty, so it cannot miss this packet.
+    return waiters_ ? sema_.Post() : 0;
+}
+
 mx_status_t PortDispatcher::DeQueue(mx_time_t deadline, mx_port_packet_t* packet) {
     canary_.Assert();
 
@@ -189,21 +217,36 @@ mx_status_t PortDispatcher::DeQueue(mx_time_t deadline, mx_port_packet_t* packet
     while (true) {
         {
             AutoLock al(&lock_);
-            if (packets_.is_empty())
+            if (packets_.is_empty()) {
+                ++waiters_;
                 goto wait;
+            }
 
             port_packet = packets_.pop_front();
             observer = CopyLocked(port_packet, packet);
+
+            if (!observer && (port_packet->type() & PKT_FLAG_EPHEMERAL) &&
+                (free_count_ < kMaxFreePackets)) {
+                free_packets_.push_front(port_packet);
+                ++free_count_;
+                return MX_OK;
+            }
         }
 
         if (observer)
             delete observer;
-        else if (packet && (packet->type & PKT_FLAG_EPHEMERAL))
+        else if (port_packet->type() & PKT_FLAG_EPHEMERAL)
             delete port_packet;
         return MX_OK;
 
 wait:
+        // |sema_| may have been posted for a packet another thread took, so
+        // a successful wait only means the queue is worth checking again.
         status_t st = sema_.Wait(deadline);
+        {
+            AutoLock al(&lock_);
+            --waiters_;
+        }
         if (st != MX_OK)
             return st;
     }
@@ -142,7 +142,7 @@ void StateTracker::StrobeState(mx_signals_t notify_mask) {
         thread_reschedule();
 }
 
-void StateTracker::UpdateLastHandleSignal(uint32_t* count) {
+void StateTracker::UpdateLastHandleSignal(mxtl::atomic<uint32_t>* count) {
     canary_.Assert();
 
     if (count == nullptr)
@@ -158,7 +158,7 @@ void StateTracker::UpdateLastHandleSignal(uint32_t* count) {
 
         // We assume here that the value pointed by |count| can mutate by
         // other threads.
-        signals_ = (*count == 1u) ?
+        signals_ = (count->load() == 1u) ?
             signals_ | MX_SIGNAL_LAST_HANDLE : signals_ & ~MX_SIGNAL_LAST_HANDLE;
 
         if (previous_signals == signals_)
@@ -40,9 +40,9 @@ private:
 void call_all_on_hooks(StateTracker* st) {
     st->UpdateState(0, 7);
     st->StrobeState(7);
-    uint32_t count = 5;
+    mxtl::atomic<uint32_t> count(5u);
     st->UpdateLastHandleSignal(&count);
-    count = 1;
+    count.store(1u);
     st->UpdateLastHandleSignal(&count);
     st->Cancel(/* handle= */ nullptr);
     st->CancelByKey(/* handle= */ nullptr, /* port= */ nullptr, /* key= */ 2u);
@@ -141,9 +141,9 @@ bool on_state_change_via_last_handle(void* context) {
 
     // Cause OnStateChange() to be called. Need to transition out of and
     // back into MX_SIGNAL_LAST_HANDLE, because it's asserted by default.
-    uint32_t count = 2;
+    mxtl::atomic<uint32_t> count(2u);
     st.UpdateLastHandleSignal(&count);
-    count = 1;
+    count.store(1u);
     st.UpdateLastHandleSignal(&count);
 
     // Should have been removed.
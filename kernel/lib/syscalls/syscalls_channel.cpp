@@ -22,12 +22,16 @@
 #include <magenta/user_copy.h>
 
 #include <mxtl/algorithm.h>
+#include <mxtl/inline_array.h>
 #include <mxtl/ref_ptr.h>
 
 #include "syscalls_priv.h"
 
 #define LOCAL_TRACE 0
 
+// Messages up to this count are batched without a heap allocation.
+constexpr size_t kManyInlineCount = 8u;
+
 static mx_status_t channel_call_epilogue(ProcessDispatcher* up,
                                          mxtl::unique_ptr<MessagePacket> reply,
                                          mx_channel_call_args_t* args,
@@ -242,6 +246,158 @@ mx_status_t sys_channel_write(mx_handle_t handle_value, uint32_t options,
     return MX_OK;
 }
 
+mx_status_t sys_channel_read_many(mx_handle_t handle_value, uint32_t options,
+                                  user_ptr<mx_channel_msg_t> _msgs, uint32_t count,
+                                  user_ptr<uint32_t> _actual) {
+    LTRACEF("handle %d msgs %p count %u\n", handle_value, _msgs.get(), count);
+
+    if (options & ~MX_CHANNEL_READ_MAY_DISCARD)
+        return MX_ERR_NOT_SUPPORTED;
+    if (!count || count > kMaxMessagesPerCall)
+        return MX_ERR_INVALID_ARGS;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<ChannelDispatcher> channel;
+    mx_status_t result = up->GetDispatcherWithRights(handle_value, MX_RIGHT_READ, &channel);
+    if (result != MX_OK)
+        return result;
+
+    AllocChecker ac;
+    mxtl::InlineArray<mx_channel_msg_t, kManyInlineCount> descs(&ac, count);
+    if (!ac.check())
+        return MX_ERR_NO_MEMORY;
+    mxtl::InlineArray<mxtl::unique_ptr<MessagePacket>, kManyInlineCount> msgs(&ac, count);
+    if (!ac.check())
+        return MX_ERR_NO_MEMORY;
+
+    if (_msgs.copy_array_from_user(descs.get(), count) != MX_OK)
+        return MX_ERR_INVALID_ARGS;
+
+    uint32_t actual;
+    result = channel->ReadMany(descs.get(), count, msgs.get(), &actual,
+                               options & MX_CHANNEL_READ_MAY_DISCARD);
+    if (result != MX_OK && result != MX_ERR_BUFFER_TOO_SMALL)
+        return result;
+
+    // The messages are off the queue now, so a bad buffer only loses the
+    // message it was meant for, as with mx_channel_read().
+    for (uint32_t ix = 0; ix != actual; ++ix) {
+        mx_channel_msg_t* desc = &descs[ix];
+        MessagePacket* msg = msgs[ix].get();
+        if (desc->status != MX_OK)
+            continue;
+        if (desc->num_bytes > 0u) {
+            if (msg->CopyDataTo(make_user_ptr(desc->bytes)) != MX_OK) {
+                desc->status = MX_ERR_INVALID_ARGS;
+                continue;
+            }
+        }
+        if (desc->num_handles > 0u)
+            msg_get_handles(up, msg, make_user_ptr(desc->handles), desc->num_handles);
+    }
+
+    // Report the sizes of the message we stopped at, too.
+    uint32_t num_descs = mxtl::min(actual + 1u, count);
+    if (_msgs.copy_array_to_user(descs.get(), num_descs) != MX_OK)
+        return MX_ERR_INVALID_ARGS;
+    if (_actual) {
+        if (_actual.copy_to_user(actual) != MX_OK)
+            return MX_ERR_INVALID_ARGS;
+    }
+
+    for (uint32_t ix = 0; ix != actual; ++ix) {
+        ktrace(TAG_CHANNEL_READ, (uint32_t)channel->get_koid(),
+               descs[ix].num_bytes, descs[ix].num_handles, 0);
+    }
+    return result;
+}
+
+mx_status_t sys_channel_write_many(mx_handle_t handle_value, uint32_t options,
+                                   user_ptr<mx_channel_msg_t> _msgs, uint32_t count,
+                                   user_ptr<uint32_t> _actual) {
+    LTRACEF("handle %d msgs %p count %u options 0x%x\n",
+            handle_value, _msgs.get(), count, options);
+
+    if (options)
+        return MX_ERR_INVALID_ARGS;
+    if (!count || count > kMaxMessagesPerCall)
+        return MX_ERR_INVALID_ARGS;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<ChannelDispatcher> channel;
+    mx_status_t result = up->GetDispatcherWithRights(handle_value, MX_RIGHT_WRITE, &channel);
+    if (result != MX_OK)
+        return result;
+
+    AllocChecker ac;
+    mxtl::InlineArray<mx_channel_msg_t, kManyInlineCount> descs(&ac, count);
+    if (!ac.check())
+        return MX_ERR_NO_MEMORY;
+    mxtl::InlineArray<mxtl::unique_ptr<MessagePacket>, kManyInlineCount> msgs(&ac, count);
+    if (!ac.check())
+        return MX_ERR_NO_MEMORY;
+
+    if (_msgs.copy_array_from_user(descs.get(), count) != MX_OK)
+        return MX_ERR_INVALID_ARGS;
+
+    // Build the packets in order and stop at the first one that fails, so
+    // that what does get written is a prefix of what was asked for.
+    mx_handle_t handles[kMaxMessageHandles];
+    uint32_t num_msgs = 0u;
+    for (; num_msgs != count; ++num_msgs) {
+        mx_channel_msg_t* desc = &descs[num_msgs];
+        mxtl::unique_ptr<MessagePacket>* msg = &msgs[num_msgs];
+
+        result = MessagePacket::Create(make_user_ptr<const void>(desc->bytes), desc->num_bytes,
+                                       desc->num_handles, msg);
+        if (result == MX_OK && desc->num_handles > 0u) {
+            result = msg_put_handles(up, msg->get(), handles,
+                                     make_user_ptr<const mx_handle_t>(desc->handles),
+                                     desc->num_handles, static_cast<Dispatcher*>(channel.get()));
+        }
+        desc->status = result;
+        if (result != MX_OK)
+            break;
+    }
+
+    // Statuses go back for the messages built and the one that failed.
+    uint32_t num_descs = mxtl::min(num_msgs + 1u, count);
+
+    if (num_msgs > 0u) {
+        mx_status_t write_result = channel->WriteMany(msgs.get(), num_msgs);
+        if (write_result != MX_OK) {
+            // Write failed, put back the handles into this process.
+            AutoLock lock(up->handle_table_lock());
+            for (uint32_t ix = 0; ix != num_msgs; ++ix) {
+                MessagePacket* msg = msgs[ix].get();
+                for (uint32_t h = 0; h != msg->num_handles(); ++h)
+                    up->AddHandleLocked(HandleOwner(msg->mutable_handles()[h]));
+                descs[ix].status = write_result;
+            }
+            result = write_result;
+            num_msgs = 0u;
+        }
+    }
+
+    if (_msgs.copy_array_to_user(descs.get(), num_descs) != MX_OK)
+        return MX_ERR_INVALID_ARGS;
+    if (_actual) {
+        if (_actual.copy_to_user(num_msgs) != MX_OK)
+            return MX_ERR_INVALID_ARGS;
+    }
+
+    if (num_msgs == 0u)
+        return result;
+
+    for (uint32_t ix = 0; ix != num_msgs; ++ix) {
+        ktrace(TAG_CHANNEL_WRITE, (uint32_t)channel->get_koid(),
+               descs[ix].num_bytes, descs[ix].num_handles, 0);
+    }
+    return MX_OK;
+}
+
 mx_status_t sys_channel_call_noretry(mx_handle_t handle_value, uint32_t options,
                                      mx_time_t deadline,
                                      user_ptr<const mx_channel_call_args_t> _args,
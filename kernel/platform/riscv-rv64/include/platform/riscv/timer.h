@@ -11,4 +11,8 @@ __BEGIN_CDECLS
 
 enum handler_return riscv_timer_interrupt(void);
 
+/* conversions between the time CSR ticks and nanoseconds */
+lk_time_t riscv_ticks_to_ns(uint64_t ticks);
+uint64_t riscv_ns_to_ticks(lk_time_t ns);
+
 __END_CDECLS
@@ -16,10 +16,12 @@
 
 #include <platform/riscv/memory.h>
 #include <platform/riscv/console.h>
+#include <platform/riscv/timer.h>
 
 #include <arch/riscv/mmu.h>
 #include <arch/riscv/sbi.h>
 #include <arch/arch_ops.h>
+#include <arch/mp.h>
 
 #include <dev/display.h>
 #include <dev/hw_rng.h>
@@ -46,8 +48,24 @@ status_t display_get_info(struct display_info *info) {
 }
 
 static void halt_other_cpus(void) {
-
-    // TO_DO_RISCV
+#if WITH_SMP
+    static volatile int halted = 0;
+
+    if (atomic_swap(&halted, 1) == 0) {
+        // stop the other cpus
+        printf("stopping other cpus\n");
+        arch_mp_send_ipi(MP_CPU_ALL_BUT_LOCAL, MP_IPI_HALT);
+
+        // give them a moment to get there. With interrupts masked the
+        // timer interrupt is never taken, it only ends each wfi.
+        arch_disable_ints();
+        lk_time_t deadline = current_time() + LK_MSEC(100);
+        sbi_set_timer(riscv_ns_to_ticks(deadline));
+        while (current_time() < deadline) {
+            wait_for_interrupt();
+        }
+    }
+#endif
 }
 
 static volatile int panic_started;
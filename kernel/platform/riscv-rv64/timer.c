@@ -16,18 +16,60 @@
 #include <arch/riscv/timex.h>
 #include <arch/riscv/sbi.h>
 #include <platform/riscv/timer.h>
+#include <lib/fixed_point.h>
 #include <debug.h>
 #include <assert.h>
 
 static unsigned long           timebase; // ticks in one second
 
+//
+// the tick <-> ns ratios, precomputed from the timebase as a whole
+// part and a 64 bit binary fraction so a conversion is a multiply and
+// a high multiply instead of a 64 bit divide, the 128 bit product
+// can't overflow
+//
+struct tick_scale {
+    uint64_t whole;
+    uint64_t frac;
+};
+
+static struct tick_scale ns_per_tick;
+static struct tick_scale ticks_per_ns;
+
+static void tick_scale_init(struct tick_scale *scale, uint32_t dividend, uint32_t divisor)
+{
+    struct fp_32_64 fp;
+
+    fp_32_64_div_32_32(&fp, dividend, divisor);
+    scale->whole = fp.l0;
+    scale->frac = ((uint64_t)fp.l32 << 32) | fp.l64;
+}
+
+static inline uint64_t tick_scale_mul(uint64_t val, const struct tick_scale *scale)
+{
+    return val * scale->whole + (uint64_t)(((unsigned __int128)val * scale->frac) >> 64);
+}
+
+lk_time_t riscv_ticks_to_ns(uint64_t ticks)
+{
+    return tick_scale_mul(ticks, &ns_per_tick);
+}
+
+uint64_t riscv_ns_to_ticks(lk_time_t ns)
+{
+    //
+    // round up so the timer never fires before the deadline
+    //
+    return tick_scale_mul(ns, &ticks_per_ns) + 1;
+}
+
 //
 // lk_time_t is in nanoseconds
 //
 
 lk_time_t current_time(void)
 {
-    return (get_ticks() * LK_SEC(1)) / timebase;
+    return riscv_ticks_to_ns(get_ticks());
 }
 
 #if PLATFORM_HAS_DYNAMIC_TIMER
@@ -35,7 +77,7 @@ status_t platform_set_oneshot_timer(lk_time_t deadline)
 {
     DEBUG_ASSERT(arch_ints_disabled());
     
-    sbi_set_timer((deadline * timebase) / LK_SEC(1));
+    sbi_set_timer(riscv_ns_to_ticks(deadline));
 
     return MX_OK; // no error
 }
@@ -50,6 +92,10 @@ enum handler_return riscv_timer_interrupt(void)
 static void platform_init_timer(uint level)
 {
 	timebase = sbi_timebase();
+	ASSERT(timebase > 0 && timebase <= UINT32_MAX);
+
+	tick_scale_init(&ns_per_tick, LK_SEC(1), timebase);
+	tick_scale_init(&ticks_per_ns, timebase, LK_SEC(1));
 
 	/* Enable timer interrupts. */
 	csr_set(sie, SIE_STIE);
@@ -67,4 +113,14 @@ uint64_t ticks_per_second(void)
     return timebase;
 }
 
-LK_INIT_HOOK(timer, &platform_init_timer, LK_INIT_LEVEL_VM + 3);
\ No newline at end of file
+static void platform_init_timer_secondary_cpu(uint level)
+{
+	/* Enable timer interrupts on the secondary hart. */
+	csr_set(sie, SIE_STIE);
+}
+
+LK_INIT_HOOK(timer, &platform_init_timer, LK_INIT_LEVEL_VM + 3);
+
+/* secondary cpu initialize the timer just before the kernel starts with interrupts enabled */
+LK_INIT_HOOK_FLAGS(timer_secondary_cpu, &platform_init_timer_secondary_cpu,
+                   LK_INIT_LEVEL_THREADING - 1, LK_INIT_FLAG_SECONDARY_CPUS);
\ No newline at end of file
@@ -19,8 +19,11 @@
 //                              that this mutex must be acquired before mutex |x|.
 // TA_ACQ_AFTER(x)              Indicates that if both this mutex and muxex |x| are to be acquired,
 //                              that this mutex must be acquired after mutex |x|.
+// TA_ACQ_SHARED(x)             function acquires the mutex |x| for shared (read) access
 // TA_REL(x)                    function releases the mutex |x|
+// TA_REL_SHARED(x)             function releases shared access to the mutex |x|
 // TA_REQ(x)                    function requires that the caller hold the mutex |x|
+// TA_REQ_SHARED(x)             function requires that the caller hold at least shared access to |x|
 // TA_EXCL(x)                   function requires that the caller not be holding the mutex |x|
 // TA_RET_CAP(x)                function returns a reference to the mutex |x|
 // TA_SCOPED_CAP                type represents a scoped or RAII-style wrapper around a capability
@@ -37,8 +40,11 @@
 #define TA_ACQ(...) THREAD_ANNOTATION(acquire_capability(__VA_ARGS__))
 #define TA_ACQ_BEFORE(...) THREAD_ANNOTATION(acquired_before(__VA_ARGS__))
 #define TA_ACQ_AFTER(...) THREAD_ANNOTATION(acquired_after(__VA_ARGS__))
+#define TA_ACQ_SHARED(...) THREAD_ANNOTATION(acquire_shared_capability(__VA_ARGS__))
 #define TA_REL(...) THREAD_ANNOTATION(release_capability(__VA_ARGS__))
+#define TA_REL_SHARED(...) THREAD_ANNOTATION(release_shared_capability(__VA_ARGS__))
 #define TA_REQ(...) THREAD_ANNOTATION(requires_capability(__VA_ARGS__))
+#define TA_REQ_SHARED(...) THREAD_ANNOTATION(requires_shared_capability(__VA_ARGS__))
 #define TA_EXCL(...) THREAD_ANNOTATION(locks_excluded(__VA_ARGS__))
 #define TA_RET_CAP(x) THREAD_ANNOTATION(lock_returned(x))
 #define TA_SCOPED_CAP THREAD_ANNOTATION(scoped_lockable)
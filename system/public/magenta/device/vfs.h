@@ -48,6 +48,9 @@
 // Return path of block device underlying the filesystem. Requires O_ADMIN.
 #define IOCTL_VFS_GET_DEVICE_PATH \
     IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_VFS, 9)
+// Return statistics about the filesystem's block cache.
+#define IOCTL_VFS_GET_CACHE_STATS \
+    IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_VFS, 10)
 
 typedef struct {
     mx_handle_t channel; // Channel to which watch events will be sent
@@ -133,6 +136,20 @@ IOCTL_WRAPPER_IN(ioctl_vfs_watch_dir_v2, IOCTL_VFS_WATCH_DIR_V2, vfs_watch_dir_t
 // ssize_t ioctl_vfs_get_device_path(int fd, char* out, size_t out_len);
 IOCTL_WRAPPER_VAROUT(ioctl_vfs_get_device_path, IOCTL_VFS_GET_DEVICE_PATH, char);
 
+typedef struct vfs_cache_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t readahead_blocks; // blocks fetched speculatively
+    uint64_t readahead_hits;   // hits on blocks fetched speculatively
+    uint64_t writeback_blocks; // dirty blocks written back to disk
+    uint64_t flushes;          // batches of dirty blocks written back
+    uint32_t capacity_blocks;
+    uint32_t dirty_blocks;
+} vfs_cache_stats_t;
+
+// ssize_t ioctl_vfs_get_cache_stats(int fd, vfs_cache_stats_t* out);
+IOCTL_WRAPPER_OUT(ioctl_vfs_get_cache_stats, IOCTL_VFS_GET_CACHE_STATS, vfs_cache_stats_t);
+
 #define MOUNT_MKDIR_FLAG_REPLACE 1
 
 typedef struct mount_mkdir_config {
@@ -162,6 +162,18 @@ typedef struct {
     uint32_t rd_num_handles;
 } mx_channel_call_args_t;
 
+// Structure for mx_channel_read_many() and mx_channel_write_many():
+// one per message.  |num_bytes| and |num_handles| are the buffer sizes
+// going in and, for reads, the message sizes coming back.
+typedef struct {
+    void* bytes;
+    mx_handle_t* handles;
+    uint32_t num_bytes;
+    uint32_t num_handles;
+    mx_status_t status;
+    uint32_t reserved;
+} mx_channel_msg_t;
+
 // Structure for mx_object_wait_many():
 typedef struct {
     mx_handle_t handle;
@@ -243,6 +255,7 @@ typedef int64_t mx_rel_off_t;
 
 #define MX_CHANNEL_MAX_MSG_BYTES            65536u
 #define MX_CHANNEL_MAX_MSG_HANDLES          64u
+#define MX_CHANNEL_MAX_MSGS_PER_CALL        64u
 
 // Socket options and limits.
 #define MX_SOCKET_HALF_CLOSE                1u
@@ -219,6 +219,21 @@ mx_status_t VnodeBlob::Mmap(int flags, size_t len, size_t* off, mx_handle_t* out
     return CopyVmo(rights, out);
 }
 
+mx_status_t VnodeBlob::GetReadVmo(mx_handle_t* vmo, mx_handle_t* stale, size_t* size) {
+    if (IsDirectory()) {
+        return MX_ERR_NOT_FILE;
+    }
+
+    // Readable blobs are immutable, so the vmo never goes stale.
+    mx_status_t status;
+    if ((status = CopyVmo(MX_RIGHT_TRANSFER | MX_RIGHT_DUPLICATE | MX_RIGHT_READ |
+                          MX_RIGHT_MAP | MX_RIGHT_GET_PROPERTY, vmo)) != MX_OK) {
+        return status;
+    }
+    *size = blobstore_->GetNode(map_index_)->blob_size;
+    return MX_OK;
+}
+
 mx_status_t VnodeBlob::Sync() {
     // TODO(smklein): For now, this is a no-op, but it will change
     // once the kBlobFlagSync flag is in use.
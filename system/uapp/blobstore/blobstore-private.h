@@ -146,6 +146,7 @@ private:
     mx_status_t Truncate(size_t len) final;
     mx_status_t Unlink(const char* name, size_t len, bool must_be_dir) final;
     mx_status_t Mmap(int flags, size_t len, size_t* off, mx_handle_t* out) final;
+    mx_status_t GetReadVmo(mx_handle_t* vmo, mx_handle_t* stale, size_t* size) final;
     mx_status_t Sync() final;
 
     // Read both VMOs into memory, if we haven't already.
@@ -28,6 +28,12 @@ void duplicate_handles(uint32_t n, mx_handle_t src, mx_handle_t* dest) {
     }
 }
 
+int compare_u64(const void* a, const void* b) {
+    uint64_t x = *static_cast<const uint64_t*>(a);
+    uint64_t y = *static_cast<const uint64_t*>(b);
+    return (x > y) - (x < y);
+}
+
 struct TestArgs {
     uint32_t size;
     uint32_t handles;
@@ -39,6 +45,10 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
 
     uint64_t duration_ns = duration * 1000000000ull;
 
+    // Number of write/read round trips timed individually for the latency
+    // percentiles, after the throughput run.
+    static constexpr uint32_t latency_samples = 10000;
+
     // We'll write to mp[0] (and read from mp[1]).
     mx_handle_t mp[2] = {MX_HANDLE_INVALID, MX_HANDLE_INVALID};
     status = mx_channel_create(0u, &mp[0], &mp[1]);
@@ -94,6 +104,25 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
             break;
     }
 
+    mxtl::unique_ptr<uint64_t[]> latencies(new uint64_t[latency_samples]);
+    for (uint32_t i = 0; i < latency_samples; i++) {
+        uint64_t start_ticks = mx_ticks_get();
+        status = mx_channel_write(mp[0], 0, data.get(), test_args.size,
+                                  handles.get(), test_args.handles);
+        assert(status == MX_OK);
+
+        uint32_t r_size = test_args.size;
+        uint32_t r_handles = test_args.handles;
+        status = mx_channel_read(mp[1], 0u, data.get(), handles.get(), r_size,
+                                 r_handles, &r_size, &r_handles);
+        assert(status == MX_OK);
+        latencies[i] = mx_ticks_get() - start_ticks;
+    }
+    qsort(latencies.get(), latency_samples, sizeof(uint64_t), compare_u64);
+    double ns_per_tick = 1000000000.0 / static_cast<double>(mx_ticks_per_second());
+    double p50_ns = static_cast<double>(latencies[latency_samples / 2]) * ns_per_tick;
+    double p99_ns = static_cast<double>(latencies[latency_samples * 99 / 100]) * ns_per_tick;
+
     for (uint32_t i = 0; i < test_args.handles; i++) {
         status = mx_handle_close(handles[i]);
         assert(status == MX_OK);
@@ -108,8 +137,9 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
     double real_duration = static_cast<double>(end_ns - start_ns) / 1000000000.0;
     double its_per_second = static_cast<double>(big_its) * big_it_size / real_duration;
     printf("write/read %" PRIu32 " bytes, %" PRIu32 " handles (%" PRIu32 " pre-queued): "
-               "%.0f iterations/second\n",
-           test_args.size, test_args.handles, test_args.queue, its_per_second);
+               "%.0f messages/second, p50 %.0f ns, p99 %.0f ns\n",
+           test_args.size, test_args.handles, test_args.queue, its_per_second,
+           p50_ns, p99_ns);
 }
 
 }  // namespace
@@ -122,6 +152,7 @@ int main(int argc, char** argv) {
         "  -h    show help (this)\n"
         "  -o    run single test (default)\n"
         "  -s    run suite (ignores -S/-H/-Q)\n"
+        "  -c    run suite over the kernel's message size classes (ignores -S/-H/-Q)\n"
         "  -n N  set test repetition count to N (default: 1)\n"
         "  -d N  set test duration to N seconds (default: 5)\n"
         "  -S N  set message size to N bytes (default: 10)\n"
@@ -129,6 +160,7 @@ int main(int argc, char** argv) {
         "  -Q N  set message pre-queue count to N messages (default: 0)\n";
 
     bool run_suite = false;  // -o/-s
+    bool run_class_suite = false;  // -c
     uint32_t duration = 5;   // -d
     uint32_t repeats = 1;    // -n
     // Ignored when running a suite:
@@ -139,7 +171,7 @@ int main(int argc, char** argv) {
     };
 
     int opt;
-    while ((opt = getopt(argc, argv, "+hosn:d:S:H:Q:")) != -1) {
+    while ((opt = getopt(argc, argv, "+hoscn:d:S:H:Q:")) != -1) {
         // Our option values are always unsigned numbers.
         uint32_t value = 0;
         if (optarg) {
@@ -157,9 +189,15 @@ int main(int argc, char** argv) {
                 return EXIT_SUCCESS;
             case 'o':
                 run_suite = false;
+                run_class_suite = false;
                 break;
             case 's':
                 run_suite = true;
+                run_class_suite = false;
+                break;
+            case 'c':
+                run_suite = false;
+                run_class_suite = true;
                 break;
             case 'n':
                 assert(optarg);
@@ -217,6 +255,22 @@ int main(int argc, char** argv) {
             };
             for (size_t i = 0; i < mxtl::count_of(suite); i++)
                 do_test(duration, suite[i]);
+        } else if (run_class_suite) {
+            // The largest message that fits each of the kernel's packet size
+            // classes (128 bytes, 1 KiB and 4 KiB of data with up to 4
+            // handles), and the largest message, which comes from the heap.
+            static constexpr TestArgs suite[] = {
+                {128, 0, 0},
+                {128, 4, 0},
+                {1024, 0, 0},
+                {1024, 4, 0},
+                {4096, 0, 0},
+                {4096, 4, 0},
+                {65536, 0, 0},
+                {65536, 4, 0},
+            };
+            for (size_t i = 0; i < mxtl::count_of(suite); i++)
+                do_test(duration, suite[i]);
         } else {
             do_test(duration, test_args);
         }
@@ -0,0 +1,125 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+
+#include <magenta/syscalls.h>
+
+// Measures futex round trips between thread pairs, and the cost of waking
+// a futex nobody waits on, for growing numbers of threads.
+
+static constexpr uint32_t kMaxThreads = 64u;
+
+// Each pair of threads bounces a futex word back and forth with wait/wake,
+// so every round trip is two wakes and two waits.  The pairs use separate
+// futexes, so with no contention on the kernel side the round trip time
+// should not grow with the number of pairs.
+struct pingpong_state {
+    alignas(64) int state;
+    uint32_t iterations;
+    mx_time_t elapsed;
+};
+
+static int pinger_thread(void* arg) {
+    pingpong_state* pp = static_cast<pingpong_state*>(arg);
+    mx_time_t start = mx_time_get(MX_CLOCK_MONOTONIC);
+    for (uint32_t i = 0; i < pp->iterations; ++i) {
+        __atomic_store_n(&pp->state, 1, __ATOMIC_SEQ_CST);
+        mx_futex_wake(&pp->state, 1);
+        while (__atomic_load_n(&pp->state, __ATOMIC_SEQ_CST) == 1)
+            mx_futex_wait(&pp->state, 1, MX_TIME_INFINITE);
+    }
+    pp->elapsed = mx_time_get(MX_CLOCK_MONOTONIC) - start;
+    return 0;
+}
+
+static int ponger_thread(void* arg) {
+    pingpong_state* pp = static_cast<pingpong_state*>(arg);
+    for (uint32_t i = 0; i < pp->iterations; ++i) {
+        while (__atomic_load_n(&pp->state, __ATOMIC_SEQ_CST) == 0)
+            mx_futex_wait(&pp->state, 0, MX_TIME_INFINITE);
+        __atomic_store_n(&pp->state, 0, __ATOMIC_SEQ_CST);
+        mx_futex_wake(&pp->state, 1);
+    }
+    return 0;
+}
+
+static bool round_trip(uint32_t num_pairs) {
+    const uint32_t kIterations = 2000u;
+    static pingpong_state pps[kMaxThreads / 2];
+    thrd_t threads[kMaxThreads];
+
+    for (uint32_t i = 0; i < num_pairs; ++i) {
+        pps[i].state = 0;
+        pps[i].iterations = kIterations;
+        pps[i].elapsed = 0;
+        if (thrd_create_with_name(&threads[2 * i], ponger_thread, &pps[i], "ponger") !=
+                thrd_success ||
+            thrd_create_with_name(&threads[2 * i + 1], pinger_thread, &pps[i], "pinger") !=
+                thrd_success) {
+            printf("failed to create threads\n");
+            return false;
+        }
+    }
+
+    mx_time_t total = 0;
+    mx_time_t worst = 0;
+    for (uint32_t i = 0; i < num_pairs; ++i) {
+        thrd_join(threads[2 * i], NULL);
+        thrd_join(threads[2 * i + 1], NULL);
+        total += pps[i].elapsed;
+        if (pps[i].elapsed > worst)
+            worst = pps[i].elapsed;
+    }
+
+    printf("%2u threads: round trip avg %6" PRIu64 " ns, slowest pair %6" PRIu64 " ns\n",
+           num_pairs * 2, total / num_pairs / kIterations, worst / kIterations);
+    return true;
+}
+
+static int waker_thread(void* arg) {
+    // Waking a futex that nobody waits on, as unlocking an uncontended
+    // mutex does.
+    int futex_value = 0;
+    uint32_t iterations = *static_cast<uint32_t*>(arg);
+    for (uint32_t i = 0; i < iterations; ++i)
+        mx_futex_wake(&futex_value, 1);
+    return 0;
+}
+
+static bool wake_no_waiters(uint32_t num_threads) {
+    uint32_t iterations = 20000u;
+    thrd_t threads[kMaxThreads];
+
+    mx_time_t start = mx_time_get(MX_CLOCK_MONOTONIC);
+    for (uint32_t i = 0; i < num_threads; ++i) {
+        if (thrd_create_with_name(&threads[i], waker_thread, &iterations, "waker") !=
+            thrd_success) {
+            printf("failed to create threads\n");
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < num_threads; ++i)
+        thrd_join(threads[i], NULL);
+    mx_time_t elapsed = mx_time_get(MX_CLOCK_MONOTONIC) - start;
+
+    printf("%2u threads: %6" PRIu64 " ns per wake with no waiters\n",
+           num_threads, elapsed / iterations);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    for (uint32_t n = 1u; n <= kMaxThreads / 2; n *= 2) {
+        if (!round_trip(n))
+            return EXIT_FAILURE;
+    }
+    for (uint32_t n = 1u; n <= kMaxThreads; n *= 2) {
+        if (!wake_no_waiters(n))
+            return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
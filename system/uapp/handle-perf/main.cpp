@@ -0,0 +1,269 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <assert.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+
+#include <launchpad/launchpad.h>
+#include <magenta/compiler.h>
+#include <magenta/process.h>
+#include <magenta/processargs.h>
+#include <magenta/syscalls.h>
+#include <mxtl/algorithm.h>
+#include <mxtl/atomic.h>
+#include <mxtl/unique_ptr.h>
+
+namespace {
+
+void argument_error(const char* argv0, const char* message) {
+    fprintf(stderr, "%s: error: %s\nRun with -h for help.\n", argv0, message);
+    exit(EXIT_FAILURE);
+}
+
+struct WorkerArgs {
+    mx_handle_t event;
+    mx_time_t deadline;
+    mxtl::atomic<int>* go;
+    uint64_t ops;
+};
+
+// Duplicates and closes |event| until the deadline, counting both as an op.
+int worker_thread(void* arg) {
+    auto args = static_cast<WorkerArgs*>(arg);
+
+    while (!args->go->load())
+        thrd_yield();
+
+    uint64_t ops = 0;
+    do {
+        for (uint32_t i = 0; i < 1000; i++) {
+            mx_handle_t dup;
+            __UNUSED mx_status_t status =
+                mx_handle_duplicate(args->event, MX_RIGHT_SAME_RIGHTS, &dup);
+            assert(status == MX_OK);
+            status = mx_handle_close(dup);
+            assert(status == MX_OK);
+        }
+        ops += 2000;
+    } while (mx_time_get(MX_CLOCK_MONOTONIC) < args->deadline);
+
+    args->ops = ops;
+    return 0;
+}
+
+// Runs |threads| threads in this process for |duration| seconds and returns
+// the number of duplicates and closes they made in total.
+uint64_t run_threads(uint32_t threads, uint32_t duration) {
+    mx_handle_t event;
+    __UNUSED mx_status_t status = mx_event_create(0u, &event);
+    assert(status == MX_OK);
+
+    mxtl::atomic<int> go(0);
+    mxtl::unique_ptr<WorkerArgs[]> args(new WorkerArgs[threads]);
+    mxtl::unique_ptr<thrd_t[]> thrds(new thrd_t[threads]);
+    for (uint32_t i = 0; i < threads; i++) {
+        args[i].event = event;
+        args[i].go = &go;
+        args[i].ops = 0;
+        __UNUSED int ret = thrd_create(&thrds[i], worker_thread, &args[i]);
+        assert(ret == thrd_success);
+    }
+
+    mx_time_t deadline = mx_deadline_after(MX_SEC(duration));
+    for (uint32_t i = 0; i < threads; i++)
+        args[i].deadline = deadline;
+    go.store(1);
+
+    uint64_t ops = 0;
+    for (uint32_t i = 0; i < threads; i++) {
+        thrd_join(thrds[i], nullptr);
+        ops += args[i].ops;
+    }
+
+    status = mx_handle_close(event);
+    assert(status == MX_OK);
+    return ops;
+}
+
+// Worker process: waits for the go message on the startup channel, runs the
+// threads and sends back the number of ops.
+int run_worker(uint32_t threads, uint32_t duration) {
+    mx_handle_t channel = mx_get_startup_handle(PA_HND(PA_USER0, 0));
+    if (channel == MX_HANDLE_INVALID)
+        return EXIT_FAILURE;
+
+    __UNUSED mx_status_t status =
+        mx_object_wait_one(channel, MX_CHANNEL_READABLE, MX_TIME_INFINITE, nullptr);
+    assert(status == MX_OK);
+    uint8_t go;
+    uint32_t actual;
+    status = mx_channel_read(channel, 0u, &go, nullptr, sizeof(go), 0u, &actual, nullptr);
+    assert(status == MX_OK);
+
+    uint64_t ops = run_threads(threads, duration);
+    status = mx_channel_write(channel, 0u, &ops, sizeof(ops), nullptr, 0u);
+    assert(status == MX_OK);
+    mx_handle_close(channel);
+    return EXIT_SUCCESS;
+}
+
+// Runs |processes| copies of this program with |threads| threads each, and
+// returns the number of ops they made in total.
+uint64_t run_processes(const char* bin, uint32_t processes, uint32_t threads,
+                       uint32_t duration) {
+    char threads_arg[16];
+    char duration_arg[16];
+    snprintf(threads_arg, sizeof(threads_arg), "%" PRIu32, threads);
+    snprintf(duration_arg, sizeof(duration_arg), "%" PRIu32, duration);
+    const char* args[] = {bin, "-w", "-t", threads_arg, "-d", duration_arg};
+
+    mxtl::unique_ptr<mx_handle_t[]> channels(new mx_handle_t[processes]);
+    mxtl::unique_ptr<mx_handle_t[]> procs(new mx_handle_t[processes]);
+    for (uint32_t i = 0; i < processes; i++) {
+        mx_handle_t remote;
+        __UNUSED mx_status_t status = mx_channel_create(0u, &channels[i], &remote);
+        assert(status == MX_OK);
+
+        launchpad_t* lp;
+        launchpad_create(0, "handle-perf-worker", &lp);
+        launchpad_clone(lp, LP_CLONE_MXIO_STDIO | LP_CLONE_ENVIRON | LP_CLONE_DEFAULT_JOB);
+        launchpad_set_args(lp, static_cast<int>(mxtl::count_of(args)), args);
+        launchpad_add_handle(lp, remote, PA_HND(PA_USER0, 0));
+        launchpad_load_from_file(lp, bin);
+
+        const char* errmsg;
+        status = launchpad_go(lp, &procs[i], &errmsg);
+        if (status != MX_OK) {
+            fprintf(stderr, "failed to launch %s: %d: %s\n", bin, status, errmsg);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Start every worker at once.
+    for (uint32_t i = 0; i < processes; i++) {
+        uint8_t go = 1;
+        __UNUSED mx_status_t status =
+            mx_channel_write(channels[i], 0u, &go, sizeof(go), nullptr, 0u);
+        assert(status == MX_OK);
+    }
+
+    uint64_t ops = 0;
+    for (uint32_t i = 0; i < processes; i++) {
+        __UNUSED mx_status_t status = mx_object_wait_one(
+            channels[i], MX_CHANNEL_READABLE, MX_TIME_INFINITE, nullptr);
+        assert(status == MX_OK);
+        uint64_t worker_ops;
+        uint32_t actual;
+        status = mx_channel_read(channels[i], 0u, &worker_ops, nullptr,
+                                 sizeof(worker_ops), 0u, &actual, nullptr);
+        assert(status == MX_OK);
+        ops += worker_ops;
+
+        mx_object_wait_one(procs[i], MX_PROCESS_TERMINATED, MX_TIME_INFINITE, nullptr);
+        mx_handle_close(procs[i]);
+        mx_handle_close(channels[i]);
+    }
+    return ops;
+}
+
+void do_test(const char* bin, uint32_t duration, uint32_t processes, uint32_t threads) {
+    uint64_t start_ns = mx_time_get(MX_CLOCK_MONOTONIC);
+    uint64_t ops = (processes == 0u) ? run_threads(threads, duration)
+                                     : run_processes(bin, processes, threads, duration);
+    uint64_t end_ns = mx_time_get(MX_CLOCK_MONOTONIC);
+
+    double real_duration = static_cast<double>(end_ns - start_ns) / 1000000000.0;
+    printf("duplicate/close, %" PRIu32 " process(es) x %" PRIu32 " thread(s): "
+               "%.0f ops/second\n",
+           mxtl::max(processes, 1u), threads, static_cast<double>(ops) / real_duration);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    static constexpr char help[] =
+        "Usage: %s [options ...]\n"
+        "\n"
+        "Options:\n"
+        "  -h    show help (this)\n"
+        "  -o    run single test (default)\n"
+        "  -s    run suite (ignores -t/-p)\n"
+        "  -d N  set test duration to N seconds (default: 5)\n"
+        "  -t N  set thread count to N threads per process (default: 1)\n"
+        "  -p N  run the threads in N child processes (default: 0, in this process)\n";
+
+    bool run_suite = false;  // -o/-s
+    bool worker = false;     // -w, used for child processes
+    uint32_t duration = 5;   // -d
+    uint32_t threads = 1;    // -t
+    uint32_t processes = 0;  // -p
+
+    int opt;
+    while ((opt = getopt(argc, argv, "+hoswd:t:p:")) != -1) {
+        // Our option values are always unsigned numbers.
+        uint32_t value = 0;
+        if (optarg) {
+            errno = 0;
+            char* endptr = nullptr;
+            unsigned long long v = strtoull(optarg, &endptr, 10);
+            if (errno != 0 || *endptr != '\0' || v > UINT32_MAX)
+                argument_error(argv[0], "invalid numeric optional value");
+            value = static_cast<uint32_t>(v);
+        }
+
+        switch (opt) {
+            case 'h':
+                printf(help, argv[0]);
+                return EXIT_SUCCESS;
+            case 'o':
+                run_suite = false;
+                break;
+            case 's':
+                run_suite = true;
+                break;
+            case 'w':
+                worker = true;
+                break;
+            case 'd':
+                duration = value;
+                break;
+            case 't':
+                if (value == 0)
+                    argument_error(argv[0], "thread count must be positive");
+                threads = value;
+                break;
+            case 'p':
+                processes = value;
+                break;
+            default:  // '?'
+                argument_error(argv[0], "invalid option");
+                break;
+        }
+    }
+    if (optind < argc)
+        argument_error(argv[0], "unexpected positional argument");
+
+    if (worker)
+        return run_worker(threads, duration);
+
+    if (run_suite) {
+        // {processes, threads}
+        static constexpr uint32_t suite[][2] = {
+            {0, 1}, {0, 2}, {0, 4}, {0, 8},
+            {2, 1}, {4, 1}, {8, 1},
+        };
+        for (size_t i = 0; i < mxtl::count_of(suite); i++)
+            do_test(argv[0], duration, suite[i][0], suite[i][1]);
+    } else {
+        do_test(argv[0], duration, processes, threads);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -10,6 +10,7 @@
 #include <fs/trace.h>
 
 #include <mxalloc/new.h>
+#include <mxtl/algorithm.h>
 #include <mxtl/ref_ptr.h>
 #include <mxtl/unique_ptr.h>
 #include <magenta/device/device.h>
@@ -20,45 +21,317 @@
 namespace minfs {
 
 mx_status_t Bcache::Readblk(uint32_t bno, void* data) {
-    off_t off = bno * kMinfsBlockSize;
-    FS_TRACE(IO, "readblk() bno=%u off=%#llx\n", bno, (unsigned long long)off);
-    if (lseek(fd_, off, SEEK_SET) < 0) {
-        FS_TRACE_ERROR("minfs: cannot seek to block %u\n", bno);
-        return MX_ERR_IO;
-    }
-    if (read(fd_, data, kMinfsBlockSize) != kMinfsBlockSize) {
-        FS_TRACE_ERROR("minfs: cannot read block %u\n", bno);
-        return MX_ERR_IO;
+    FS_TRACE(IO, "readblk() bno=%u\n", bno);
+    Entry* entry = Lookup(bno);
+    if (entry != nullptr) {
+        stats_.hits++;
+        if (entry->prefetched) {
+            stats_.readahead_hits++;
+            entry->prefetched = false;
+        }
+    } else {
+        stats_.misses++;
+        mx_status_t status;
+        if ((status = Fill(bno, &entry)) != MX_OK) {
+            FS_TRACE_ERROR("minfs: cannot read block %u\n", bno);
+            return status;
+        }
     }
+    last_read_bno_ = bno;
+    memcpy(data, SlotData(entry->slot), kMinfsBlockSize);
     return MX_OK;
 }
 
 mx_status_t Bcache::Writeblk(uint32_t bno, const void* data) {
-    off_t off = bno * kMinfsBlockSize;
-    FS_TRACE(IO, "writeblk() bno=%u off=%#llx\n", bno, (unsigned long long)off);
-    if (lseek(fd_, off, SEEK_SET) < 0) {
-        FS_TRACE_ERROR("minfs: cannot seek to block %u\n", bno);
-        return MX_ERR_IO;
+    FS_TRACE(IO, "writeblk() bno=%u\n", bno);
+    mx_status_t status;
+    Entry* entry = Lookup(bno);
+    if (entry == nullptr) {
+        // The whole block is overwritten, so there is no need to read it.
+        if ((status = GetFreeEntry(&entry)) != MX_OK) {
+            return status;
+        }
+        entry->bno = bno;
+        entry->dirty = false;
+        Insert(entry);
+    }
+    entry->prefetched = false;
+    memcpy(SlotData(entry->slot), data, kMinfsBlockSize);
+#ifdef __Fuchsia__
+    if (!entry->dirty) {
+        entry->dirty = true;
+        dirty_count_++;
     }
-    if (write(fd_, data, kMinfsBlockSize) != kMinfsBlockSize) {
+#else
+    if ((status = WriteBack(&entry, 1)) != MX_OK) {
         FS_TRACE_ERROR("minfs: cannot write block %u\n", bno);
-        return MX_ERR_IO;
+        Invalidate(bno, 1);
+        return status;
     }
+#endif
     return MX_OK;
 }
 
+mx_status_t Bcache::Flush() {
+    if (dirty_count_ == 0) {
+        return MX_OK;
+    }
+    Entry* dirty[kMinfsBlockCacheSize];
+    size_t count = 0;
+    for (auto& entry : lru_) {
+        if (entry.dirty) {
+            dirty[count++] = &entry;
+        }
+    }
+    return WriteBack(dirty, count);
+}
+
 int Bcache::Sync() {
+    if (Flush() != MX_OK) {
+        return -1;
+    }
     return fsync(fd_);
 }
 
+Bcache::Entry* Bcache::Lookup(uint32_t bno) {
+    auto iter = hash_.find(bno);
+    if (!iter.IsValid()) {
+        return nullptr;
+    }
+    Entry* entry = iter.CopyPointer();
+    lru_.erase(*entry);
+    lru_.push_front(entry);
+    return entry;
+}
+
+mx_status_t Bcache::GetFreeEntry(Entry** out) {
+    if (!free_.is_empty()) {
+        *out = free_.pop_front();
+        return MX_OK;
+    }
+    assert(!lru_.is_empty());
+    if (lru_.back().dirty) {
+        // Write back every dirty block at once rather than one per eviction.
+        mx_status_t status;
+        if ((status = Flush()) != MX_OK) {
+            return status;
+        }
+    }
+    Entry* victim = lru_.pop_back();
+    hash_.erase(*victim);
+    *out = victim;
+    return MX_OK;
+}
+
+void Bcache::Insert(Entry* entry) {
+    lru_.push_front(entry);
+    hash_.insert(entry);
+}
+
+void Bcache::Invalidate(uint64_t bno, uint64_t count) {
+    for (auto iter = lru_.begin(); iter != lru_.end();) {
+        Entry* entry = iter.CopyPointer();
+        ++iter;
+        if ((entry->bno >= bno) && (entry->bno - bno < count)) {
+            assert(!entry->dirty);
+            lru_.erase(*entry);
+            hash_.erase(*entry);
+            free_.push_back(entry);
+        }
+    }
+}
+
+mx_status_t Bcache::Fill(uint32_t bno, Entry** out) {
+    // Only read ahead if this read continues the previous one; random access
+    // patterns (inode lookups, bitmap updates) fetch a single block.
+    const uint32_t want = (bno == last_read_bno_ + 1) ? kMinfsReadAheadBlocks : 1;
+
+    Entry* batch[kMinfsReadAheadBlocks];
+    BlockRun runs[kMinfsReadAheadBlocks];
+    size_t count = 0;
+    size_t run_count = 0;
+    mx_status_t status = MX_OK;
+    for (uint32_t i = 0; i < want; i++) {
+        const uint32_t b = bno + i;
+        if ((i > 0) && ((b >= blockmax_) || hash_.find(b).IsValid())) {
+            break;
+        }
+        Entry* entry;
+        if ((status = GetFreeEntry(&entry)) != MX_OK) {
+            break;
+        }
+        entry->bno = b;
+        entry->dirty = false;
+        entry->prefetched = (i > 0);
+        batch[count++] = entry;
+
+        if ((run_count > 0) && (runs[run_count - 1].slot + runs[run_count - 1].count == entry->slot)) {
+            runs[run_count - 1].count++;
+        } else {
+            runs[run_count].slot = entry->slot;
+            runs[run_count].bno = b;
+            runs[run_count].count = 1;
+            run_count++;
+        }
+    }
+
+#ifdef __Fuchsia__
+    // Blocks with newer copies in the journal must be checkpointed first.
+    if ((count > 0) && (journal_ != nullptr)) {
+        status = journal_->PrepareRead(bno, count);
+    }
+#endif
+    if ((count == 0) || (status != MX_OK) ||
+        ((status = IssueRuns(runs, run_count, false)) != MX_OK)) {
+        for (size_t i = 0; i < count; i++) {
+            free_.push_back(batch[i]);
+        }
+        return (status != MX_OK) ? status : MX_ERR_NO_RESOURCES;
+    }
+
+    // Insert in reverse, leaving the requested block most recently used.
+    for (size_t i = count; i > 0; i--) {
+        Insert(batch[i - 1]);
+    }
+    stats_.readahead_blocks += count - 1;
+    *out = batch[0];
+    return MX_OK;
+}
+
+mx_status_t Bcache::WriteBack(Entry** entries, size_t count) {
+    if (count == 0) {
+        return MX_OK;
+    }
+
+    // Sort by block number so that neighbouring blocks coalesce into runs.
+    for (size_t i = 1; i < count; i++) {
+        Entry* entry = entries[i];
+        size_t j = i;
+        for (; (j > 0) && (entries[j - 1]->bno > entry->bno); j--) {
+            entries[j] = entries[j - 1];
+        }
+        entries[j] = entry;
+    }
+
+    BlockRun runs[kMinfsBlockCacheSize];
+    size_t run_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        const Entry* entry = entries[i];
+        if (run_count > 0) {
+            BlockRun* run = &runs[run_count - 1];
+            if ((run->bno + run->count == entry->bno) && (run->slot + run->count == entry->slot)) {
+                run->count++;
+                continue;
+            }
+        }
+        runs[run_count].slot = entry->slot;
+        runs[run_count].bno = entry->bno;
+        runs[run_count].count = 1;
+        run_count++;
+    }
+
+    mx_status_t status;
+    if ((status = IssueRuns(runs, run_count, true)) != MX_OK) {
+        return status;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (entries[i]->dirty) {
+            entries[i]->dirty = false;
+            dirty_count_--;
+        }
+    }
+    stats_.writeback_blocks += count;
+    stats_.flushes++;
+    return MX_OK;
+}
+
+#ifdef __Fuchsia__
+mx_status_t Bcache::IssueRuns(const BlockRun* runs, size_t count, bool write) {
+    block_fifo_request_t requests[MAX_TXN_MESSAGES];
+    size_t i = 0;
+    while (i < count) {
+        size_t n = 0;
+        for (; (n < MAX_TXN_MESSAGES) && (i < count); n++, i++) {
+            requests[n].txnid = txnid_;
+            requests[n].vmoid = cache_vmoid_;
+            requests[n].opcode = write ? BLOCKIO_WRITE : BLOCKIO_READ;
+            requests[n].vmo_offset = static_cast<uint64_t>(runs[i].slot) * kMinfsBlockSize;
+            requests[n].dev_offset = static_cast<uint64_t>(runs[i].bno) * kMinfsBlockSize;
+            requests[n].length = static_cast<uint64_t>(runs[i].count) * kMinfsBlockSize;
+        }
+        mx_status_t status;
+        if ((status = RawTxn(requests, n)) != MX_OK) {
+            return status;
+        }
+    }
+    return MX_OK;
+}
+
+mx_status_t Bcache::Txn(block_fifo_request_t* requests, size_t count) {
+    mx_status_t status;
+    if ((status = Flush()) != MX_OK) {
+        return status;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if ((requests[i].opcode & BLOCKIO_OP_MASK) == BLOCKIO_WRITE) {
+            Invalidate(requests[i].dev_offset / kMinfsBlockSize,
+                       mxtl::roundup(requests[i].length, kMinfsBlockSize) / kMinfsBlockSize);
+        }
+    }
+    if (journal_ != nullptr) {
+        return journal_->Txn(requests, count);
+    }
+    return RawTxn(requests, count);
+}
+#else
+mx_status_t Bcache::IssueRuns(const BlockRun* runs, size_t count, bool write) {
+    for (size_t i = 0; i < count; i++) {
+        const off_t off = static_cast<off_t>(runs[i].bno) * kMinfsBlockSize;
+        const ssize_t len = static_cast<ssize_t>(runs[i].count) * kMinfsBlockSize;
+        void* data = SlotData(runs[i].slot);
+        ssize_t r = write ? pwrite(fd_, data, len, off) : pread(fd_, data, len, off);
+        if (r != len) {
+            FS_TRACE_ERROR("minfs: cannot %s blocks [%u, %u)\n", write ? "write" : "read",
+                           runs[i].bno, runs[i].bno + runs[i].count);
+            return MX_ERR_IO;
+        }
+    }
+    return MX_OK;
+}
+#endif
+
+mx_status_t Bcache::Init() {
+    const size_t size = kMinfsBlockCacheSize * kMinfsBlockSize;
+#ifdef __Fuchsia__
+    mx_status_t status;
+    if ((status = MappedVmo::Create(size, "minfs-bcache", &cache_vmo_)) != MX_OK) {
+        return status;
+    } else if ((status = AttachVmo(cache_vmo_->GetVmo(), &cache_vmoid_)) != MX_OK) {
+        return status;
+    }
+    cache_data_ = cache_vmo_->GetData();
+#else
+    cache_buffer_.reset(static_cast<uint8_t*>(malloc(size)));
+    if (cache_buffer_ == nullptr) {
+        return MX_ERR_NO_MEMORY;
+    }
+    cache_data_ = cache_buffer_.get();
+#endif
+    for (uint32_t i = 0; i < kMinfsBlockCacheSize; i++) {
+        entries_[i].slot = i;
+        free_.push_back(&entries_[i]);
+    }
+    return MX_OK;
+}
+
 mx_status_t Bcache::Create(mxtl::unique_ptr<Bcache>* out, int fd, uint32_t blockmax) {
     AllocChecker ac;
     mxtl::unique_ptr<Bcache> bc(new (&ac) Bcache(fd, blockmax));
     if (!ac.check()) {
         return MX_ERR_NO_MEMORY;
     }
-#ifdef __Fuchsia__
     mx_status_t status;
+#ifdef __Fuchsia__
     mx_handle_t fifo;
     ssize_t r;
 
@@ -74,6 +347,10 @@ mx_status_t Bcache::Create(mxtl::unique_ptr<Bcache>* out, int fd, uint32_t block
     }
 #endif
 
+    if ((status = bc->Init()) != MX_OK) {
+        return status;
+    }
+
     *out = mxtl::move(bc);
     return MX_OK;
 }
@@ -102,6 +379,12 @@ Bcache::Bcache(int fd, uint32_t blockmax) :
     fd_(fd), blockmax_(blockmax) {}
 
 Bcache::~Bcache() {
+    if (Flush() != MX_OK) {
+        FS_TRACE_ERROR("minfs: failed to write back %u cached blocks\n", dirty_count_);
+    }
+    hash_.clear();
+    lru_.clear();
+    free_.clear();
 #ifdef __Fuchsia__
     if (fifo_client_ != nullptr) {
         ioctl_block_free_txn(fd_, &txnid_);
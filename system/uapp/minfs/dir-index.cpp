@@ -0,0 +1,178 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <string.h>
+
+#include <mxalloc/new.h>
+#include <mxtl/unique_ptr.h>
+
+#include "minfs-private.h"
+#include "minfs.h"
+#include "misc.h"
+
+namespace minfs {
+namespace {
+
+constexpr uint32_t kInitialBuckets = 64;
+
+// The smallest record which can hold a direntry.
+constexpr uint32_t kMinRecordSize = DirentSize(1);
+
+} // namespace
+
+mx_status_t DirIndex::Create(mxtl::unique_ptr<DirIndex>* out) {
+    AllocChecker ac;
+    mxtl::unique_ptr<DirIndex> index(new (&ac) DirIndex());
+    if (!ac.check()) {
+        return MX_ERR_NO_MEMORY;
+    }
+    mx_status_t status;
+    if ((status = index->Rehash(kInitialBuckets)) != MX_OK) {
+        return status;
+    }
+    *out = mxtl::move(index);
+    return MX_OK;
+}
+
+DirIndex::~DirIndex() {}
+
+uint32_t DirIndex::Hash(const char* name, size_t len) {
+    return fnv1a32(name, len);
+}
+
+mx_status_t DirIndex::Rehash(uint32_t bucket_count) {
+    AllocChecker ac;
+    mxtl::unique_ptr<Record*[]> buckets(new (&ac) Record*[bucket_count]);
+    if (!ac.check()) {
+        return MX_ERR_NO_MEMORY;
+    }
+    memset(buckets.get(), 0, bucket_count * sizeof(Record*));
+
+    mxtl::unique_ptr<Record*[]> old_buckets = mxtl::move(buckets_);
+    uint32_t old_count = bucket_count_;
+    buckets_ = mxtl::move(buckets);
+    bucket_count_ = bucket_count;
+    for (uint32_t i = 0; i < old_count; i++) {
+        Record* record = old_buckets[i];
+        while (record != nullptr) {
+            Record* next = record->hash_next;
+            Record** bucket = Bucket(record->hash);
+            record->hash_next = *bucket;
+            *bucket = record;
+            record = next;
+        }
+    }
+    return MX_OK;
+}
+
+void DirIndex::Unhash(Record* record) {
+    Record** link = Bucket(record->hash);
+    while (*link != record) {
+        MX_DEBUG_ASSERT(*link != nullptr);
+        link = &(*link)->hash_next;
+    }
+    *link = record->hash_next;
+    record->hash_next = nullptr;
+    record->live = false;
+    live_count_--;
+}
+
+mx_status_t DirIndex::Update(uint32_t off, minfs_dirent_t* de) {
+    if ((de->ino != 0) && (live_count_ >= bucket_count_)) {
+        mx_status_t status;
+        if ((status = Rehash(bucket_count_ * 2)) != MX_OK) {
+            return status;
+        }
+    }
+
+    Record* record;
+    auto iter = records_.find(off);
+    if (iter.IsValid()) {
+        record = &*iter;
+        if (record->live) {
+            Unhash(record);
+        }
+    } else {
+        AllocChecker ac;
+        mxtl::unique_ptr<Record> new_record(new (&ac) Record());
+        if (!ac.check()) {
+            return MX_ERR_NO_MEMORY;
+        }
+        record = new_record.get();
+        record->off = off;
+        records_.insert(mxtl::move(new_record));
+    }
+
+    uint32_t reclen = MinfsReclen(de, off);
+    if (de->ino != 0) {
+        uint32_t size = DirentSize(de->namelen);
+        record->slack = (reclen > size) ? reclen - size : 0;
+        record->hash = Hash(de->name, de->namelen);
+        record->live = true;
+        Record** bucket = Bucket(record->hash);
+        record->hash_next = *bucket;
+        *bucket = record;
+        live_count_++;
+    } else {
+        record->slack = reclen;
+        record->hash = 0;
+    }
+
+    if ((record->slack >= kMinRecordSize) && (off < space_hint_)) {
+        space_hint_ = off;
+    }
+    return MX_OK;
+}
+
+void DirIndex::Remove(uint32_t off) {
+    auto iter = records_.find(off);
+    if (!iter.IsValid()) {
+        return;
+    }
+    if (iter->live) {
+        Unhash(&*iter);
+    }
+    records_.erase(iter);
+}
+
+DirIndex::Record* DirIndex::Find(uint32_t hash) const {
+    Record* record = *Bucket(hash);
+    while ((record != nullptr) && (record->hash != hash)) {
+        record = record->hash_next;
+    }
+    return record;
+}
+
+DirIndex::Record* DirIndex::FindNext(const Record* record) const {
+    uint32_t hash = record->hash;
+    Record* next = record->hash_next;
+    while ((next != nullptr) && (next->hash != hash)) {
+        next = next->hash_next;
+    }
+    return next;
+}
+
+DirIndex::Record* DirIndex::FindSpace(uint32_t reclen) {
+    auto iter = records_.lower_bound(space_hint_);
+    // Skip the records which are full, so later searches need not.
+    while (iter.IsValid() && (iter->slack < kMinRecordSize)) {
+        ++iter;
+    }
+    space_hint_ = iter.IsValid() ? iter->off : kMinfsMaxDirectorySize;
+    for (; iter.IsValid(); ++iter) {
+        if (iter->slack >= reclen) {
+            return &*iter;
+        }
+    }
+    return nullptr;
+}
+
+uint32_t DirIndex::PrevOffset(uint32_t off) const {
+    auto iter = records_.find(off);
+    MX_DEBUG_ASSERT(iter.IsValid());
+    --iter;
+    return iter.IsValid() ? iter->off : off;
+}
+
+} // namespace minfs
@@ -127,6 +127,9 @@ int emu_close(int fd) {
     file_t* f;
     FILE_WRAP(f, fd, close, fd);
     f->vn->Close();
+    // Drop the reference before clearing the slot, so that unlinked files
+    // are released.
+    f->vn = nullptr;
     memset(f, 0, sizeof(file_t));
     return 0;
 }
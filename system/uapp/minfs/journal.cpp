@@ -0,0 +1,404 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fs/trace.h>
+#include <mxalloc/new.h>
+#include <mxtl/algorithm.h>
+#include <mxtl/unique_ptr.h>
+
+#include "minfs-private.h"
+#include "minfs.h"
+#include "misc.h"
+
+namespace minfs {
+namespace {
+
+// The payload checksums come first, keeping them naturally aligned.
+uint64_t* EntrySums(void* blk) {
+    return reinterpret_cast<uint64_t*>(reinterpret_cast<uintptr_t>(blk) +
+                                       sizeof(minfs_journal_entry_t));
+}
+
+uint32_t* EntryBnos(void* blk, uint32_t count) {
+    return reinterpret_cast<uint32_t*>(reinterpret_cast<uintptr_t>(EntrySums(blk)) +
+                                       count * sizeof(uint64_t));
+}
+
+uint64_t EntryChecksum(const void* blk) {
+    uint8_t copy[kMinfsBlockSize];
+    memcpy(copy, blk, kMinfsBlockSize);
+    reinterpret_cast<minfs_journal_entry_t*>(copy)->checksum = 0;
+    return fnv1a64(copy, kMinfsBlockSize);
+}
+
+// Returns the number of payload blocks of the entry in 'blk', or zero if it
+// does not hold an intact header for entry 'seq'.
+uint32_t EntryCount(const void* blk, uint64_t seq) {
+    const minfs_journal_entry_t* hdr = reinterpret_cast<const minfs_journal_entry_t*>(blk);
+    if ((hdr->magic != kMinfsJournalEntryMagic) || (hdr->seq != seq) ||
+        (hdr->count == 0) || (hdr->count > kMinfsJournalMaxEntryBlocks)) {
+        return 0;
+    }
+    if (EntryChecksum(blk) != hdr->checksum) {
+        return 0;
+    }
+    return hdr->count;
+}
+
+} // namespace
+
+mx_status_t minfs_journal_replay(Bcache* bc, const minfs_info_t* info, uint64_t* seq_out) {
+    uint8_t hdr[kMinfsBlockSize];
+    uint8_t data[kMinfsBlockSize];
+    mx_status_t status;
+    if ((status = bc->Readblk(info->jnl_block, hdr)) != MX_OK) {
+        FS_TRACE_ERROR("minfs: could not read journal info block\n");
+        return status;
+    }
+    minfs_journal_info_t jinfo;
+    memcpy(&jinfo, hdr, sizeof(jinfo));
+    if (jinfo.magic != kMinfsJournalMagic) {
+        FS_TRACE_ERROR("minfs: bad journal magic\n");
+        return MX_ERR_IO_DATA_INTEGRITY;
+    }
+
+    // Find the committed entries. Every payload block is verified before
+    // anything is written back, so a torn entry is never partially replayed.
+    uint64_t seq = jinfo.seq_start;
+    uint32_t slot = 1;
+    uint32_t entries = 0;
+    while (slot < info->jnl_blocks) {
+        if ((status = bc->Readblk(info->jnl_block + slot, hdr)) != MX_OK) {
+            return status;
+        }
+        uint32_t count = EntryCount(hdr, seq);
+        if ((count == 0) || (count > info->jnl_blocks - slot - 1)) {
+            break;
+        }
+        const uint64_t* sums = EntrySums(hdr);
+        const uint32_t* bnos = EntryBnos(hdr, count);
+        bool intact = true;
+        for (uint32_t i = 0; intact && (i < count); i++) {
+            if ((status = bc->Readblk(info->jnl_block + slot + 1 + i, data)) != MX_OK) {
+                return status;
+            }
+            intact = (fnv1a64(data, kMinfsBlockSize) == sums[i]) &&
+                     (bnos[i] < info->block_count) &&
+                     ((bnos[i] < info->jnl_block) ||
+                      (bnos[i] >= info->jnl_block + info->jnl_blocks));
+        }
+        if (!intact) {
+            break;
+        }
+        slot += 1 + count;
+        seq++;
+        entries++;
+    }
+
+    *seq_out = seq;
+    if (entries == 0) {
+        return MX_OK;
+    }
+
+    // Apply the entries in order, so that the newest copy of a block wins.
+    slot = 1;
+    for (uint32_t e = 0; e < entries; e++) {
+        if ((status = bc->Readblk(info->jnl_block + slot, hdr)) != MX_OK) {
+            return status;
+        }
+        const minfs_journal_entry_t* entry = reinterpret_cast<const minfs_journal_entry_t*>(hdr);
+        const uint32_t count = entry->count;
+        const uint32_t* bnos = EntryBnos(hdr, count);
+        for (uint32_t i = 0; i < count; i++) {
+            if ((status = bc->Readblk(info->jnl_block + slot + 1 + i, data)) != MX_OK) {
+                return status;
+            } else if ((status = bc->Writeblk(bnos[i], data)) != MX_OK) {
+                return status;
+            }
+        }
+        slot += 1 + count;
+    }
+
+    // Only retire the entries once their home locations are on disk.
+    if ((status = bc->Flush()) != MX_OK) {
+        return status;
+    }
+    memset(hdr, 0, sizeof(hdr));
+    jinfo.seq_start = seq;
+    memcpy(hdr, &jinfo, sizeof(jinfo));
+    if ((status = bc->Writeblk(info->jnl_block, hdr)) != MX_OK) {
+        return status;
+    } else if ((status = bc->Flush()) != MX_OK) {
+        return status;
+    }
+    FS_TRACE(MINFS, "minfs: replayed %u journal entries\n", entries);
+    return MX_OK;
+}
+
+#ifdef __Fuchsia__
+
+Journal::Journal(Bcache* bc, const minfs_info_t* info, uint64_t seq)
+    : bc_(bc), start_(info->jnl_block), blocks_(info->jnl_blocks), seq_(seq), next_(1) {}
+
+Journal::~Journal() {
+    if (Checkpoint() != MX_OK) {
+        FS_TRACE_ERROR("minfs: failed to checkpoint journal\n");
+    }
+    vmos_.clear();
+}
+
+mx_status_t Journal::Create(Bcache* bc, const minfs_info_t* info, uint64_t seq,
+                            mxtl::unique_ptr<Journal>* out) {
+    AllocChecker ac;
+    mxtl::unique_ptr<Journal> journal(new (&ac) Journal(bc, info, seq));
+    if (!ac.check()) {
+        return MX_ERR_NO_MEMORY;
+    }
+    journal->pending_.reset(new (&ac) PendingBlock[info->jnl_blocks]);
+    if (!ac.check()) {
+        return MX_ERR_NO_MEMORY;
+    }
+
+    mx_status_t status;
+    if ((status = MappedVmo::Create(info->jnl_blocks * kMinfsBlockSize, "minfs-journal",
+                                    &journal->vmo_)) != MX_OK) {
+        return status;
+    } else if ((status = bc->AttachVmo(journal->vmo_->GetVmo(), &journal->vmoid_)) != MX_OK) {
+        return status;
+    }
+
+    *out = mxtl::move(journal);
+    return MX_OK;
+}
+
+mx_status_t Journal::RegisterVmo(vmoid_t vmoid, const void* data, mx_handle_t vmo) {
+    AllocChecker ac;
+    mxtl::unique_ptr<MetadataVmo> mv(new (&ac) MetadataVmo());
+    if (!ac.check()) {
+        return MX_ERR_NO_MEMORY;
+    }
+    mv->vmoid = vmoid;
+    mv->data = data;
+    mv->vmo = vmo;
+    vmos_.insert(mxtl::move(mv));
+    return MX_OK;
+}
+
+void Journal::UnregisterVmo(vmoid_t vmoid) {
+    vmos_.erase(vmoid);
+}
+
+bool Journal::IsPending(uint64_t bno, uint64_t count) const {
+    for (uint32_t i = 0; i < pending_count_; i++) {
+        if ((pending_[i].bno >= bno) && (pending_[i].bno - bno < count)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+mx_status_t Journal::PrepareRead(uint64_t bno, uint64_t count) {
+    return IsPending(bno, count) ? Checkpoint() : MX_OK;
+}
+
+mx_status_t Journal::ReleaseBlocks(uint32_t bno, uint32_t count) {
+    return IsPending(bno, count) ? Checkpoint() : MX_OK;
+}
+
+mx_status_t Journal::Txn(block_fifo_request_t* requests, size_t count) {
+    if (count > MAX_TXN_MESSAGES) {
+        return MX_ERR_INVALID_ARGS;
+    }
+
+    block_fifo_request_t direct[MAX_TXN_MESSAGES];
+    block_fifo_request_t logged[MAX_TXN_MESSAGES];
+    size_t direct_count = 0;
+    size_t logged_count = 0;
+    uint32_t logged_blocks = 0;
+    bool checkpoint = false;
+    for (size_t i = 0; i < count; i++) {
+        const uint16_t op = requests[i].opcode & BLOCKIO_OP_MASK;
+        if ((op == BLOCKIO_WRITE) && vmos_.find(requests[i].vmoid).IsValid()) {
+            logged[logged_count++] = requests[i];
+            logged_blocks += static_cast<uint32_t>(requests[i].length / kMinfsBlockSize);
+            continue;
+        }
+        if ((op == BLOCKIO_READ) &&
+            IsPending(requests[i].dev_offset / kMinfsBlockSize,
+                      mxtl::roundup(requests[i].length, kMinfsBlockSize) / kMinfsBlockSize)) {
+            checkpoint = true;
+        }
+        direct[direct_count++] = requests[i];
+    }
+
+    mx_status_t status;
+    if (checkpoint && ((status = Checkpoint()) != MX_OK)) {
+        return status;
+    }
+    // Data reaches the disk before any metadata which may refer to it.
+    if ((direct_count != 0) && ((status = bc_->RawTxn(direct, direct_count)) != MX_OK)) {
+        return status;
+    }
+    if (logged_count != 0) {
+        return Commit(logged, logged_count, logged_blocks);
+    }
+    return MX_OK;
+}
+
+mx_status_t Journal::Commit(block_fifo_request_t* requests, size_t count, uint32_t blocks) {
+    mx_status_t status;
+    if (blocks > blocks_ - 2) {
+        // Too large to log at all. Empty the log, so nothing older can be
+        // replayed over these blocks, and write them in place.
+        FS_TRACE_ERROR("minfs: %u metadata blocks exceed the journal; writing in place\n",
+                       blocks);
+        if ((status = Checkpoint()) != MX_OK) {
+            return status;
+        }
+        return bc_->RawTxn(requests, count);
+    }
+    if ((next_ + 1 + blocks > blocks_) && ((status = Checkpoint()) != MX_OK)) {
+        return status;
+    }
+
+    void* hdr = SlotData(next_);
+    memset(hdr, 0, kMinfsBlockSize);
+    uint64_t* sums = EntrySums(hdr);
+    uint32_t* bnos = EntryBnos(hdr, blocks);
+    uint32_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        const MetadataVmo& mv = *vmos_.find(requests[i].vmoid);
+        for (uint64_t off = 0; off < requests[i].length; off += kMinfsBlockSize, n++) {
+            void* dst = SlotData(next_ + 1 + n);
+            const uint64_t vmo_offset = requests[i].vmo_offset + off;
+            if (mv.data != nullptr) {
+                memcpy(dst, reinterpret_cast<const void*>(
+                           reinterpret_cast<uintptr_t>(mv.data) + vmo_offset), kMinfsBlockSize);
+            } else {
+                size_t actual;
+                status = mx_vmo_read(mv.vmo, dst, vmo_offset, kMinfsBlockSize, &actual);
+                if (status != MX_OK) {
+                    return status;
+                } else if (actual != kMinfsBlockSize) {
+                    return MX_ERR_IO;
+                }
+            }
+            sums[n] = fnv1a64(dst, kMinfsBlockSize);
+            bnos[n] = static_cast<uint32_t>((requests[i].dev_offset + off) / kMinfsBlockSize);
+        }
+    }
+    MX_DEBUG_ASSERT(n == blocks);
+
+    minfs_journal_entry_t* entry = reinterpret_cast<minfs_journal_entry_t*>(hdr);
+    entry->magic = kMinfsJournalEntryMagic;
+    entry->seq = seq_;
+    entry->count = blocks;
+    entry->checksum = EntryChecksum(hdr);
+
+    // The header and payload are contiguous, and go out as one request.
+    block_fifo_request_t request;
+    request.txnid = bc_->TxnId();
+    request.vmoid = vmoid_;
+    request.opcode = BLOCKIO_WRITE;
+    request.vmo_offset = static_cast<uint64_t>(next_) * kMinfsBlockSize;
+    request.dev_offset = static_cast<uint64_t>(start_ + next_) * kMinfsBlockSize;
+    request.length = static_cast<uint64_t>(1 + blocks) * kMinfsBlockSize;
+    if ((status = bc_->RawTxn(&request, 1)) != MX_OK) {
+        return status;
+    }
+
+    for (uint32_t i = 0; i < blocks; i++) {
+        pending_[pending_count_].bno = bnos[i];
+        pending_[pending_count_].slot = next_ + 1 + i;
+        pending_count_++;
+    }
+    next_ += 1 + blocks;
+    seq_++;
+    return MX_OK;
+}
+
+mx_status_t Journal::Checkpoint() {
+    if (pending_count_ == 0) {
+        return MX_OK;
+    }
+
+    // Sort by block, and then by age, so that only the newest copy of each
+    // block is written home and neighbouring blocks can share a request.
+    for (uint32_t i = 1; i < pending_count_; i++) {
+        PendingBlock pb = pending_[i];
+        uint32_t j = i;
+        for (; (j > 0) && ((pending_[j - 1].bno > pb.bno) ||
+                           ((pending_[j - 1].bno == pb.bno) && (pending_[j - 1].slot > pb.slot)));
+             j--) {
+            pending_[j] = pending_[j - 1];
+        }
+        pending_[j] = pb;
+    }
+
+    mx_status_t status;
+    block_fifo_request_t requests[MAX_TXN_MESSAGES];
+    size_t n = 0;
+    for (uint32_t i = 0; i < pending_count_; i++) {
+        if ((i + 1 < pending_count_) && (pending_[i + 1].bno == pending_[i].bno)) {
+            continue;
+        }
+        const uint64_t vmo_offset = static_cast<uint64_t>(pending_[i].slot) * kMinfsBlockSize;
+        const uint64_t dev_offset = static_cast<uint64_t>(pending_[i].bno) * kMinfsBlockSize;
+        if ((n > 0) && (requests[n - 1].vmo_offset + requests[n - 1].length == vmo_offset) &&
+            (requests[n - 1].dev_offset + requests[n - 1].length == dev_offset)) {
+            requests[n - 1].length += kMinfsBlockSize;
+            continue;
+        }
+        if (n == MAX_TXN_MESSAGES) {
+            if ((status = bc_->RawTxn(requests, n)) != MX_OK) {
+                return status;
+            }
+            n = 0;
+        }
+        requests[n].txnid = bc_->TxnId();
+        requests[n].vmoid = vmoid_;
+        requests[n].opcode = BLOCKIO_WRITE;
+        requests[n].vmo_offset = vmo_offset;
+        requests[n].dev_offset = dev_offset;
+        requests[n].length = kMinfsBlockSize;
+        n++;
+    }
+    if ((n > 0) && ((status = bc_->RawTxn(requests, n)) != MX_OK)) {
+        return status;
+    }
+
+    // Every logged block is home; retire the entries.
+    if ((status = WriteInfo()) != MX_OK) {
+        return status;
+    }
+    FS_TRACE(MINFS, "minfs: checkpointed %u journal blocks\n", pending_count_);
+    pending_count_ = 0;
+    next_ = 1;
+    return MX_OK;
+}
+
+mx_status_t Journal::WriteInfo() {
+    void* blk = SlotData(0);
+    memset(blk, 0, kMinfsBlockSize);
+    minfs_journal_info_t* jinfo = reinterpret_cast<minfs_journal_info_t*>(blk);
+    jinfo->magic = kMinfsJournalMagic;
+    jinfo->seq_start = seq_;
+
+    block_fifo_request_t request;
+    request.txnid = bc_->TxnId();
+    request.vmoid = vmoid_;
+    request.opcode = BLOCKIO_WRITE;
+    request.vmo_offset = 0;
+    request.dev_offset = static_cast<uint64_t>(start_) * kMinfsBlockSize;
+    request.length = kMinfsBlockSize;
+    return bc_->RawTxn(&request, 1);
+}
+
+#endif
+
+} // namespace minfs
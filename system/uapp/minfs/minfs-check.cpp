@@ -62,6 +62,23 @@ mx_status_t MinfsChecker::GetInodeNthBno(minfs_inode_t* inode, uint32_t n,
     return MX_OK;
 }
 
+// Returns true if a direntry already recorded in 'index' has the name of 'de'.
+static bool HasDuplicateName(VnodeMinfs* vn, const DirIndex* index, const minfs_dirent_t* de) {
+    for (const DirIndex::Record* record = index->Find(DirIndex::Hash(de->name, de->namelen));
+         record != nullptr; record = index->FindNext(record)) {
+        alignas(minfs_dirent_t) uint8_t data[DirentSize(NAME_MAX)];
+        size_t actual;
+        if (vn->ReadInternal(data, DirentSize(de->namelen), record->off, &actual) != MX_OK) {
+            continue;
+        }
+        const minfs_dirent_t* other = reinterpret_cast<const minfs_dirent_t*>(data);
+        if ((other->namelen == de->namelen) && !memcmp(other->name, de->name, de->namelen)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 mx_status_t MinfsChecker::CheckDirectory(minfs_inode_t* inode, uint32_t ino,
                                          uint32_t parent, uint32_t flags) {
     unsigned eno = 0;
@@ -77,6 +94,12 @@ mx_status_t MinfsChecker::CheckDirectory(minfs_inode_t* inode, uint32_t ino,
     memcpy(&vn->inode_, inode, kMinfsInodeSize);
     vn->ino_ = ino;
 
+    // Lookups through the directory index assume that names are unique.
+    mxtl::unique_ptr<DirIndex> index;
+    if ((flags & CD_DUMP) && (status = DirIndex::Create(&index)) != MX_OK) {
+        return status;
+    }
+
     size_t prev_off = 0;
     size_t off = 0;
     while (true) {
@@ -163,6 +186,11 @@ mx_status_t MinfsChecker::CheckDirectory(minfs_inode_t* inode, uint32_t ino,
                     FS_TRACE_ERROR("check: ino#%u: de[%u]: '..' ino=%u (not parent!)\n", ino, eno, de->ino);
                 }
             }
+            if ((index != nullptr) && HasDuplicateName(vn.get(), index.get(), de)) {
+                FS_TRACE_ERROR("check: ino#%u: de[%u]: duplicate entry '%.*s'\n",
+                               ino, eno, de->namelen, de->name);
+                conforming_ = false;
+            }
             //TODO: check for cycles (non-dot/dotdot dir ref already in checked bitmap)
             if (flags & CD_DUMP) {
                 FS_TRACE_INFO("ino#%u: de[%u]: ino=%u type=%u '%.*s' %s\n",
@@ -176,6 +204,10 @@ mx_status_t MinfsChecker::CheckDirectory(minfs_inode_t* inode, uint32_t ino,
             }
             dirent_count++;
         }
+        if ((index != nullptr) &&
+            (status = index->Update(static_cast<uint32_t>(off), de)) != MX_OK) {
+            return status;
+        }
         if (is_last) {
             break;
         } else {
@@ -215,7 +247,81 @@ const char* MinfsChecker::CheckDataBlock(uint32_t bno) {
     return nullptr;
 }
 
+mx_status_t MinfsChecker::CheckExtents(minfs_inode_t* inode, uint32_t ino) {
+    const minfs_extent_map_t* map = InodeExtentMap(inode);
+    uint32_t blocks = 0;
+    uint32_t count = map->count;
+    if (count > kMinfsMaxExtents) {
+       FS_TRACE_WARN("check: ino#%u: too many extents (%u)\n", ino, count);
+        conforming_ = false;
+        count = kMinfsMaxExtents;
+    }
+
+    // sanity-check the extent block
+    char overflow[kMinfsBlockSize];
+    memset(overflow, 0, sizeof(overflow));
+    if (map->ext_block != 0) {
+        const char* msg;
+        mx_status_t status;
+        if ((msg = CheckDataBlock(map->ext_block)) != nullptr) {
+           FS_TRACE_WARN("check: ino#%u: extent block(@%u): %s\n", ino, map->ext_block, msg);
+            conforming_ = false;
+        } else if ((status = fs_->bc_->Readblk(map->ext_block, overflow)) != MX_OK) {
+            return status;
+        }
+        blocks++;
+    }
+    if ((map->ext_block != 0) != (count > kMinfsInlineExtents)) {
+       FS_TRACE_WARN("check: ino#%u: extent block @%u with %u extents\n",
+             ino, map->ext_block, count);
+        conforming_ = false;
+        if (map->ext_block == 0) {
+            count = kMinfsInlineExtents;
+        }
+    }
+
+    // count and sanity-check data blocks
+    uint32_t blocks_allocated = 0;
+    for (uint32_t n = 0; n < count; n++) {
+        const minfs_extent_t* extent = ExtentAt(map, overflow, n);
+        if ((extent->count == 0) || (extent->fbn < blocks_allocated) ||
+            (static_cast<uint64_t>(extent->fbn) + extent->count > kMinfsMaxFileBlock)) {
+           FS_TRACE_WARN("check: ino#%u: extent %u [%u, %u) is out of order or range\n",
+                 ino, n, extent->fbn, extent->fbn + extent->count);
+            conforming_ = false;
+            continue;
+        }
+        for (uint32_t b = 0; b < extent->count; b++) {
+            const char* msg;
+            if ((msg = CheckDataBlock(extent->bno + b)) != nullptr) {
+               FS_TRACE_WARN("check: ino#%u: block %u(@%u): %s\n",
+                     ino, extent->fbn + b, extent->bno + b, msg);
+                conforming_ = false;
+            }
+        }
+        blocks += extent->count;
+        blocks_allocated = extent->fbn + extent->count;
+    }
+    if (blocks_allocated) {
+        unsigned max_blocks = mxtl::roundup(inode->size, kMinfsBlockSize) / kMinfsBlockSize;
+        if (blocks_allocated > max_blocks) {
+           FS_TRACE_WARN("check: ino#%u: filesize too small\n", ino);
+            conforming_ = false;
+        }
+    }
+    if (blocks != inode->block_count) {
+       FS_TRACE_WARN("check: ino#%u: block count %u, actual blocks %u\n",
+             ino, inode->block_count, blocks);
+        conforming_ = false;
+    }
+    return MX_OK;
+}
+
 mx_status_t MinfsChecker::CheckFile(minfs_inode_t* inode, uint32_t ino) {
+    if (InodeHasExtents(inode)) {
+        return CheckExtents(inode, ino);
+    }
+
     FS_TRACE_INFO("Direct blocks: \n");
     for (unsigned n = 0; n < kMinfsDirect; n++) {
         FS_TRACE_INFO(" %d,", inode->dnum[n]);
@@ -395,6 +501,30 @@ mx_status_t MinfsChecker::CheckAllocatedCounts() const {
     return status;
 }
 
+// Init() mounts the filesystem, which has already replayed any committed
+// entries; all that is left to verify is that the log region is reserved
+// and initialized.
+mx_status_t MinfsChecker::CheckJournal() const {
+    const minfs_info_t& info = fs_->info_;
+    if (!fs_->block_map_.Get(info.jnl_block, info.jnl_block + info.jnl_blocks)) {
+        FS_TRACE_ERROR("check: journal blocks are not marked allocated\n");
+        return MX_ERR_BAD_STATE;
+    }
+
+    char data[kMinfsBlockSize];
+    mx_status_t status;
+    if ((status = fs_->bc_->Readblk(info.jnl_block, data)) != MX_OK) {
+        FS_TRACE_ERROR("check: could not read journal info block\n");
+        return status;
+    }
+    const minfs_journal_info_t* jinfo = reinterpret_cast<const minfs_journal_info_t*>(data);
+    if (jinfo->magic != kMinfsJournalMagic) {
+        FS_TRACE_ERROR("check: bad journal magic %#llx\n", (unsigned long long)jinfo->magic);
+        return MX_ERR_BAD_STATE;
+    }
+    return MX_OK;
+}
+
 MinfsChecker::MinfsChecker()
     : conforming_(true), fs_(nullptr), alloc_inodes_(0), alloc_blocks_(0), links_() {};
 
@@ -454,6 +584,8 @@ mx_status_t minfs_check(mxtl::unique_ptr<Bcache> bc) {
     status |= (status != MX_OK) ? 0 : r;
     r = chk.CheckAllocatedCounts();
     status |= (status != MX_OK) ? 0 : r;
+    r = chk.CheckJournal();
+    status |= (status != MX_OK) ? 0 : r;
 
     //TODO: check allocated inodes that were abandoned
     //TODO: check allocated blocks that were not accounted for
@@ -58,6 +58,76 @@ mx_status_t VnodeMinfs::VmoWriteExact(const void* data, uint64_t offset, size_t
     }
     return MX_OK;
 }
+
+// Writes land in vmo_ before they are sent to disk, so a duplicate of it
+// always holds the file's contents; only the size can go out of date.
+mx_status_t VnodeMinfs::GetReadVmo(mx_handle_t* vmo, mx_handle_t* stale, size_t* size) {
+    if (IsDirectory()) {
+        return MX_ERR_NOT_FILE;
+    }
+
+    mx_status_t status;
+    if ((status = InitVmo()) != MX_OK) {
+        return status;
+    }
+    if (!read_vmo_stale_.is_valid() &&
+        (status = mx::event::create(0, &read_vmo_stale_)) != MX_OK) {
+        return status;
+    }
+
+    mx::vmo out_vmo;
+    mx::event out_stale;
+    if ((status = vmo_.duplicate(MX_RIGHT_TRANSFER | MX_RIGHT_DUPLICATE | MX_RIGHT_READ |
+                                 MX_RIGHT_MAP | MX_RIGHT_GET_PROPERTY, &out_vmo)) != MX_OK) {
+        return status;
+    }
+    if ((status = read_vmo_stale_.duplicate(MX_RIGHT_TRANSFER | MX_RIGHT_READ,
+                                            &out_stale)) != MX_OK) {
+        return status;
+    }
+    *vmo = out_vmo.release();
+    *stale = out_stale.release();
+    *size = inode_.size;
+    return MX_OK;
+}
+
+mx_status_t VnodeMinfs::Mmap(int flags, size_t len, size_t* off, mx_handle_t* out) {
+    if (IsDirectory()) {
+        return MX_ERR_NOT_SUPPORTED;
+    }
+    if (flags & (MXIO_MMAP_FLAG_WRITE | MXIO_MMAP_FLAG_EXEC)) {
+        return MX_ERR_NOT_SUPPORTED;
+    }
+    if ((*off > inode_.size) || (len > inode_.size - *off)) {
+        return MX_ERR_OUT_OF_RANGE;
+    }
+
+    mx_status_t status;
+    if ((status = InitVmo()) != MX_OK) {
+        return status;
+    }
+
+    // Hand out a snapshot rather than vmo_ itself, so that the mapping can
+    // neither modify the file nor resize the vmo behind our back.
+    mx::vmo clone;
+    if ((status = vmo_.clone(MX_VMO_CLONE_COPY_ON_WRITE, 0, inode_.size, &clone)) != MX_OK) {
+        return status;
+    }
+    mx::vmo result;
+    if ((status = clone.replace(MX_RIGHT_TRANSFER | MX_RIGHT_READ | MX_RIGHT_MAP,
+                                &result)) != MX_OK) {
+        return status;
+    }
+    *out = result.release();
+    return MX_OK;
+}
+
+void VnodeMinfs::ReadVmoInvalidate() {
+    if (read_vmo_stale_.is_valid()) {
+        read_vmo_stale_.signal(0, MXIO_READ_VMO_STALE);
+        read_vmo_stale_.reset();
+    }
+}
 #endif
 
 
@@ -80,6 +150,10 @@ void VnodeMinfs::InodeSync(WriteTxn* txn, uint32_t flags) {
 // Delete all blocks (relative to a file) from "start" (inclusive) to the end of
 // the file. Does not update mtime/atime.
 mx_status_t VnodeMinfs::BlocksShrink(WriteTxn *txn, uint32_t start) {
+    if (InodeHasExtents(&inode_)) {
+        return ExtentShrink(txn, start);
+    }
+
     bool doSync = false;
 
     // release direct blocks
@@ -178,8 +252,22 @@ mx_status_t VnodeMinfs::InitIndirectVmo() {
         vmo_indirect_ = nullptr;
         return status;
     }
+    if ((status = fs_->journal_->RegisterVmo(vmoid_indirect_, vmo_indirect_->GetData(),
+                                             vmo_indirect_->GetVmo())) != MX_OK) {
+        vmo_indirect_ = nullptr;
+        return status;
+    }
 
     ReadTxn txn(fs_->bc_.get());
+    if (InodeHasExtents(&inode_)) {
+        // Only the first block is used, to hold the extent block.
+        uint32_t ebno;
+        if ((ebno = InodeExtentMap(&inode_)->ext_block) != 0) {
+            fs_->ValidateBno(ebno);
+            txn.Enqueue(vmoid_indirect_, 0, ebno, 1);
+        }
+        return txn.Flush();
+    }
     for (uint32_t i = 0; i < kMinfsIndirect; i++) {
         uint32_t ibno;
         if ((ibno = inode_.inum[i]) != 0) {
@@ -215,8 +303,29 @@ mx_status_t VnodeMinfs::InitVmo() {
         vmo_.reset();
         return status;
     }
+    // Directory contents are metadata; file contents are not.
+    if (IsDirectory() &&
+        (status = fs_->journal_->RegisterVmo(vmoid_, nullptr, vmo_.get())) != MX_OK) {
+        vmo_.reset();
+        return status;
+    }
     ReadTxn txn(fs_->bc_.get());
 
+    if (InodeHasExtents(&inode_)) {
+        const minfs_extent_map_t* map = InodeExtentMap(&inode_);
+        if ((map->count > kMinfsInlineExtents) && ((status = InitExtentBlock()) != MX_OK)) {
+            vmo_.reset();
+            return status;
+        }
+        // Each extent is read with a single request.
+        for (uint32_t n = 0; n < map->count; n++) {
+            const minfs_extent_t* extent = ExtentAt(n);
+            fs_->ValidateBno(extent->bno);
+            txn.Enqueue(vmoid_, extent->fbn, extent->bno, extent->count);
+        }
+        return txn.Flush();
+    }
+
     // Initialize all direct blocks
     uint32_t bno;
     for (uint32_t d = 0; d < kMinfsDirect; d++) {
@@ -259,6 +368,11 @@ mx_status_t VnodeMinfs::InitVmo() {
 
 // Get the bno corresponding to the nth logical block within the file.
 mx_status_t VnodeMinfs::GetBno(WriteTxn* txn, uint32_t n, uint32_t* bno) {
+    if (InodeHasExtents(&inode_)) {
+        uint32_t count;
+        return GetBnoRun(txn, n, 1, bno, &count);
+    }
+
     uint32_t hint = 0;
     // direct blocks are simple... is there an entry in dnum[]?
     if (n < kMinfsDirect) {
@@ -357,6 +471,330 @@ mx_status_t VnodeMinfs::GetBno(WriteTxn* txn, uint32_t n, uint32_t* bno) {
     return MX_OK;
 }
 
+mx_status_t VnodeMinfs::GetBnoRun(WriteTxn* txn, uint32_t n, uint32_t max, uint32_t* bno,
+                                  uint32_t* count) {
+    MX_DEBUG_ASSERT(max > 0);
+    if (!InodeHasExtents(&inode_)) {
+        // Blocks are mapped one at a time; BlockTxn merges neighbours.
+        *count = 1;
+        return GetBno(txn, n, bno);
+    }
+    if (n >= kMinfsMaxFileBlock) {
+        return MX_ERR_OUT_OF_RANGE;
+    }
+
+    mx_status_t status;
+    if ((status = ExtentLookup(n, bno, count)) != MX_OK) {
+        return status;
+    }
+    *count = mxtl::min(*count, max);
+    if ((*bno == 0) && (txn != nullptr)) {
+        return ExtentAllocate(txn, n, *count, bno, count);
+    }
+    return MX_OK;
+}
+
+mx_status_t VnodeMinfs::InitExtentBlock() {
+#ifdef __Fuchsia__
+    return InitIndirectVmo();
+#else
+    if (ext_data_ != nullptr) {
+        return MX_OK;
+    }
+    AllocChecker ac;
+    ext_data_.reset(new (&ac) uint8_t[kMinfsBlockSize]);
+    if (!ac.check()) {
+        return MX_ERR_NO_MEMORY;
+    }
+    uint32_t ebno;
+    if ((ebno = InodeExtentMap(&inode_)->ext_block) == 0) {
+        memset(ext_data_.get(), 0, kMinfsBlockSize);
+        return MX_OK;
+    }
+    fs_->ValidateBno(ebno);
+    mx_status_t status;
+    if ((status = fs_->bc_->Readblk(ebno, ext_data_.get())) != MX_OK) {
+        ext_data_.reset();
+        return status;
+    }
+    return MX_OK;
+#endif
+}
+
+minfs_extent_t* VnodeMinfs::ExtentAt(uint32_t n) {
+#ifdef __Fuchsia__
+    void* overflow = (vmo_indirect_ != nullptr) ? vmo_indirect_->GetData() : nullptr;
+#else
+    void* overflow = ext_data_.get();
+#endif
+    MX_DEBUG_ASSERT((n < kMinfsInlineExtents) || (overflow != nullptr));
+    return minfs::ExtentAt(InodeExtentMap(&inode_), overflow, n);
+}
+
+uint32_t VnodeMinfs::ExtentSearch(uint32_t n) {
+    uint32_t lo = 0;
+    uint32_t hi = InodeExtentMap(&inode_)->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (ExtentAt(mid)->fbn <= n) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+mx_status_t VnodeMinfs::ExtentLookup(uint32_t n, uint32_t* bno, uint32_t* count) {
+    const minfs_extent_map_t* map = InodeExtentMap(&inode_);
+    mx_status_t status;
+    if ((map->count > kMinfsInlineExtents) && ((status = InitExtentBlock()) != MX_OK)) {
+        return status;
+    }
+
+    uint32_t i = ExtentSearch(n);
+    if (i > 0) {
+        const minfs_extent_t* extent = ExtentAt(i - 1);
+        if (n - extent->fbn < extent->count) {
+            fs_->ValidateBno(extent->bno);
+            *bno = extent->bno + (n - extent->fbn);
+            *count = extent->count - (n - extent->fbn);
+            return MX_OK;
+        }
+    }
+    *bno = 0;
+    *count = static_cast<uint32_t>(((i < map->count) ? ExtentAt(i)->fbn : kMinfsMaxFileBlock) - n);
+    return MX_OK;
+}
+
+mx_status_t VnodeMinfs::ExtentAllocate(WriteTxn* txn, uint32_t n, uint32_t max, uint32_t* bno,
+                                       uint32_t* count) {
+    minfs_extent_map_t* map = InodeExtentMap(&inode_);
+    mx_status_t status;
+    if ((map->count >= kMinfsInlineExtents) && ((status = InitExtentBlock()) != MX_OK)) {
+        return status;
+    }
+
+    // Extents [0, i) start before 'n'; the hole at 'n' lies between the
+    // (i - 1)th and the ith.
+    uint32_t i = ExtentSearch(n);
+    minfs_extent_t* prev = (i > 0) ? ExtentAt(i - 1) : nullptr;
+    minfs_extent_t* next = (i < map->count) ? ExtentAt(i) : nullptr;
+
+    // Prefer the blocks which would keep the file contiguous on disk.
+    uint32_t hint = (prev != nullptr) ? prev->bno + (n - prev->fbn) : 0;
+    uint32_t run;
+    if ((status = fs_->BlockNewRun(txn, hint, max, bno, &run)) != MX_OK) {
+        return status;
+    }
+
+    const bool extends_prev = (prev != nullptr) && (prev->fbn + prev->count == n) &&
+                              (prev->bno + prev->count == *bno);
+    const bool extends_next = (next != nullptr) && (n + run == next->fbn) &&
+                              (*bno + run == next->bno);
+    if (extends_prev && extends_next) {
+        // The new blocks join the neighbouring extents into one.
+        prev->count += run + next->count;
+        for (uint32_t j = i + 1; j < map->count; j++) {
+            *ExtentAt(j - 1) = *ExtentAt(j);
+        }
+        map->count--;
+    } else if (extends_prev) {
+        prev->count += run;
+    } else if (extends_next) {
+        next->fbn = n;
+        next->bno = *bno;
+        next->count += run;
+    } else {
+        if (map->count == kMinfsMaxExtents) {
+            // The file is too fragmented for the extent table; carry on
+            // with a block map instead.
+            fs_->BlockFreeRun(txn, *bno, run);
+            if ((status = ExtentsToBlockMap(txn)) != MX_OK) {
+                return status;
+            }
+            *count = 1;
+            return GetBno(txn, n, bno);
+        }
+        if (map->count == kMinfsInlineExtents) {
+            // The inline extents are full; spill over into an extent block.
+            uint32_t ebno;
+            if ((status = fs_->BlockNew(txn, 0, &ebno)) != MX_OK) {
+                fs_->BlockFreeRun(txn, *bno, run);
+                return status;
+            }
+            memset(ExtentAt(kMinfsInlineExtents), 0, kMinfsBlockSize);
+            map->ext_block = ebno;
+            inode_.block_count++;
+        }
+        for (uint32_t j = map->count; j > i; j--) {
+            *ExtentAt(j) = *ExtentAt(j - 1);
+        }
+        minfs_extent_t* extent = ExtentAt(i);
+        extent->fbn = n;
+        extent->bno = *bno;
+        extent->count = run;
+        map->count++;
+    }
+
+    inode_.block_count += run;
+    *count = run;
+    ExtentBlockSync(txn);
+    InodeSync(txn, kMxFsSyncDefault);
+    return MX_OK;
+}
+
+mx_status_t VnodeMinfs::ExtentsToBlockMap(WriteTxn* txn) {
+    minfs_extent_map_t* map = InodeExtentMap(&inode_);
+    mx_status_t status;
+    // On Fuchsia, this also sets up vmo_indirect_ for the indirect blocks.
+    if ((status = InitExtentBlock()) != MX_OK) {
+        return status;
+    }
+
+    // The block map overlays the extent map, so take a copy of the extents.
+    const uint32_t extent_count = map->count;
+    AllocChecker ac;
+    mxtl::unique_ptr<minfs_extent_t[]> extents(new (&ac) minfs_extent_t[extent_count]);
+    if (!ac.check()) {
+        return MX_ERR_NO_MEMORY;
+    }
+    for (uint32_t n = 0; n < extent_count; n++) {
+        extents[n] = *ExtentAt(n);
+    }
+
+    // Allocate the indirect blocks first, so that failure leaves the
+    // extent map untouched.
+    constexpr uint32_t direct_per_indirect = kMinfsBlockSize / sizeof(uint32_t);
+    uint32_t ibnos[kMinfsIndirect] = {};
+    for (uint32_t n = 0; n < extent_count; n++) {
+        const minfs_extent_t& extent = extents[n];
+        uint32_t end = extent.fbn + extent.count;
+        if (end <= kMinfsDirect) {
+            continue;
+        }
+        uint32_t start = mxtl::max(extent.fbn, kMinfsDirect);
+        for (uint32_t i = (start - kMinfsDirect) / direct_per_indirect;
+             i <= (end - 1 - kMinfsDirect) / direct_per_indirect; i++) {
+            if ((ibnos[i] == 0) && ((status = fs_->BlockNew(txn, 0, &ibnos[i])) != MX_OK)) {
+                for (uint32_t j = 0; j < kMinfsIndirect; j++) {
+                    if (ibnos[j] != 0) {
+                        fs_->BlockFree(txn, ibnos[j]);
+                    }
+                }
+                return status;
+            }
+        }
+    }
+
+#ifdef __Fuchsia__
+    // The extent block lived in the first block of vmo_indirect_, which now
+    // holds the indirect blocks.
+    uint8_t* idata = static_cast<uint8_t*>(vmo_indirect_->GetData());
+#else
+    mxtl::unique_ptr<uint8_t[]> idata_buf(new (&ac) uint8_t[kMinfsBlockSize * kMinfsIndirect]);
+    if (!ac.check()) {
+        for (uint32_t j = 0; j < kMinfsIndirect; j++) {
+            if (ibnos[j] != 0) {
+                fs_->BlockFree(txn, ibnos[j]);
+            }
+        }
+        return MX_ERR_NO_MEMORY;
+    }
+    uint8_t* idata = idata_buf.get();
+#endif
+    memset(idata, 0, kMinfsBlockSize * kMinfsIndirect);
+
+    uint32_t ebno = map->ext_block;
+    memset(inode_.dnum, 0, sizeof(inode_.dnum));
+    memset(inode_.inum, 0, sizeof(inode_.inum));
+    inode_.flags &= ~kMinfsInodeFlagExtents;
+    for (uint32_t n = 0; n < extent_count; n++) {
+        const minfs_extent_t& extent = extents[n];
+        for (uint32_t b = 0; b < extent.count; b++) {
+            uint32_t fbn = extent.fbn + b;
+            if (fbn < kMinfsDirect) {
+                inode_.dnum[fbn] = extent.bno + b;
+            } else {
+                uint32_t* ientry = reinterpret_cast<uint32_t*>(idata);
+                ientry[fbn - kMinfsDirect] = extent.bno + b;
+            }
+        }
+    }
+    for (uint32_t i = 0; i < kMinfsIndirect; i++) {
+        if (ibnos[i] == 0) {
+            continue;
+        }
+        inode_.inum[i] = ibnos[i];
+        inode_.block_count++;
+#ifdef __Fuchsia__
+        txn->Enqueue(vmoid_indirect_, i, ibnos[i], 1);
+#else
+        fs_->bc_->Writeblk(ibnos[i], idata + kMinfsBlockSize * i);
+#endif
+    }
+
+    if (ebno != 0) {
+        fs_->BlockFree(txn, ebno);
+        inode_.block_count--;
+    }
+#ifndef __Fuchsia__
+    ext_data_.reset();
+#endif
+    InodeSync(txn, kMxFsSyncDefault);
+    return MX_OK;
+}
+
+mx_status_t VnodeMinfs::ExtentShrink(WriteTxn* txn, uint32_t start) {
+    minfs_extent_map_t* map = InodeExtentMap(&inode_);
+    mx_status_t status;
+    if ((map->count > kMinfsInlineExtents) && ((status = InitExtentBlock()) != MX_OK)) {
+        return status;
+    }
+
+    // Extents are sorted, so only the last ones can extend past 'start'.
+    bool dirty = false;
+    while (map->count > 0) {
+        minfs_extent_t* extent = ExtentAt(map->count - 1);
+        if (extent->fbn + extent->count <= start) {
+            break;
+        }
+        fs_->ValidateBno(extent->bno);
+        uint32_t keep = (extent->fbn < start) ? start - extent->fbn : 0;
+        fs_->BlockFreeRun(txn, extent->bno + keep, extent->count - keep);
+        inode_.block_count -= extent->count - keep;
+        dirty = true;
+        if (keep != 0) {
+            extent->count = keep;
+            break;
+        }
+        map->count--;
+    }
+
+    if (dirty) {
+        ExtentBlockSync(txn);
+        InodeSync(txn, kMxFsSyncDefault);
+    }
+    return MX_OK;
+}
+
+void VnodeMinfs::ExtentBlockSync(WriteTxn* txn) {
+    minfs_extent_map_t* map = InodeExtentMap(&inode_);
+    if (map->ext_block == 0) {
+        return;
+    } else if (map->count > kMinfsInlineExtents) {
+#ifdef __Fuchsia__
+        txn->Enqueue(vmoid_indirect_, 0, map->ext_block, 1);
+#else
+        txn->Enqueue(ext_data_.get(), 0, map->ext_block, 1);
+#endif
+        return;
+    }
+    fs_->BlockFree(txn, map->ext_block);
+    map->ext_block = 0;
+    inode_.block_count--;
+}
+
 // Immediately stop iterating over the directory.
 #define DIR_CB_DONE 0
 // Access the next direntry in the directory. Offsets updated.
@@ -379,10 +817,14 @@ mx_status_t VnodeMinfs::WriteExactInternal(WriteTxn* txn, const void* data,
                                            size_t len, size_t off) {
     size_t actual;
     mx_status_t status = WriteInternal(txn, data, len, off, &actual);
+    if ((status == MX_OK) && (actual != len)) {
+        status = MX_ERR_IO;
+    }
     if (status != MX_OK) {
+        // A directory may have been left partly rewritten; don't trust the
+        // index to describe it any more.
+        dir_index_.reset();
         return status;
-    } else if (actual != len) {
-        return MX_ERR_IO;
     }
     InodeSync(txn, kMxFsSyncMtime);
     return MX_OK;
@@ -450,6 +892,7 @@ mx_status_t VnodeMinfs::UnlinkChild(WriteTxn* txn,
     // Read the direntries we're considering merging with.
     // Verify they are free and small enough to merge.
     size_t coalesced_size = MinfsReclen(de, off);
+    bool coalesced_next = false;
     // Coalesce with "next" first, so the kMinfsReclenLast bit can easily flow
     // back to "de" and "de_prev".
     if (!(de->reclen & kMinfsReclenLast)) {
@@ -462,6 +905,7 @@ mx_status_t VnodeMinfs::UnlinkChild(WriteTxn* txn,
             return status;
         }
         if (de_next.ino == 0) {
+            coalesced_next = true;
             coalesced_size += MinfsReclen(&de_next, off_next);
             // If the next entry *was* last, then 'de' is now last.
             de->reclen |= (de_next.reclen & kMinfsReclenLast);
@@ -493,6 +937,15 @@ mx_status_t VnodeMinfs::UnlinkChild(WriteTxn* txn,
     if ((status = WriteExactInternal(txn, de, MINFS_DIRENT_SIZE, off)) != MX_OK) {
         return status;
     }
+    if (dir_index_ != nullptr) {
+        if (coalesced_next) {
+            dir_index_->Remove(static_cast<uint32_t>(off_next));
+        }
+        if (off != offs->off) {
+            dir_index_->Remove(static_cast<uint32_t>(offs->off));
+        }
+        DirIndexUpdate(static_cast<uint32_t>(off), de);
+    }
 
     if (de->reclen & kMinfsReclenLast) {
         // Truncating the directory merely removed unused space; if it fails,
@@ -641,6 +1094,7 @@ static mx_status_t add_dirent(mxtl::RefPtr<VnodeMinfs> vndir,
     if (status != MX_OK) {
         return status;
     }
+    vndir->DirIndexUpdate(static_cast<uint32_t>(off), de);
     vndir->inode_.dirent_count++;
     if (args->type == kMinfsTypeDir) {
         // Child directory has '..' which will point to parent directory
@@ -678,6 +1132,7 @@ static mx_status_t cb_dir_append(mxtl::RefPtr<VnodeMinfs> vndir, minfs_dirent_t*
         if (status != MX_OK) {
             return status;
         }
+        vndir->DirIndexUpdate(static_cast<uint32_t>(offs->off), de);
         offs->off += size;
         // create new entry in the remaining space
         char data[kMinfsMaxDirentSize];
@@ -700,37 +1155,126 @@ static mx_status_t cb_dir_append(mxtl::RefPtr<VnodeMinfs> vndir, minfs_dirent_t*
 //          Since 'func' may create / remove surrounding dirents, it is responsible for
 //          updating the offset information to access the next dirent.
 mx_status_t VnodeMinfs::ForEachDirent(DirArgs* args, const DirentCallback func) {
-    char data[kMinfsMaxDirentSize];
-    minfs_dirent_t* de = (minfs_dirent_t*) data;
     DirectoryOffset offs = {
         .off = 0,
         .off_prev = 0,
     };
     while (offs.off + MINFS_DIRENT_SIZE < kMinfsMaxDirectorySize) {
-        FS_TRACE(MINFS, "Reading dirent at offset %zd\n", offs.off);
-        size_t r;
-        mx_status_t status = ReadInternal(data, kMinfsMaxDirentSize, offs.off, &r);
-        if (status != MX_OK) {
-            return status;
-        } else if ((status = validate_dirent(de, r, offs.off)) != MX_OK) {
+        mx_status_t status = VisitDirent(args, func, &offs);
+        if (status != DIR_CB_NEXT) {
             return status;
         }
+    }
+    return MX_ERR_NOT_FOUND;
+}
 
-        switch ((status = func(mxtl::RefPtr<VnodeMinfs>(this), de, args, &offs))) {
-        case DIR_CB_NEXT:
-            break;
-        case DIR_CB_SAVE_SYNC:
-            inode_.seq_num++;
-            InodeSync(args->txn, kMxFsSyncMtime);
-            return MX_OK;
-        case DIR_CB_DONE:
-        default:
+mx_status_t VnodeMinfs::VisitDirent(DirArgs* args, const DirentCallback func,
+                                    DirectoryOffset* offs) {
+    char data[kMinfsMaxDirentSize];
+    minfs_dirent_t* de = (minfs_dirent_t*) data;
+    FS_TRACE(MINFS, "Reading dirent at offset %zd\n", offs->off);
+    size_t r;
+    mx_status_t status = ReadInternal(data, kMinfsMaxDirentSize, offs->off, &r);
+    if (status != MX_OK) {
+        return status;
+    } else if ((status = validate_dirent(de, r, offs->off)) != MX_OK) {
+        return status;
+    }
+
+    switch ((status = func(mxtl::RefPtr<VnodeMinfs>(this), de, args, offs))) {
+    case DIR_CB_NEXT:
+        return DIR_CB_NEXT;
+    case DIR_CB_SAVE_SYNC:
+        inode_.seq_num++;
+        InodeSync(args->txn, kMxFsSyncMtime);
+        return MX_OK;
+    case DIR_CB_DONE:
+    default:
+        return status;
+    }
+}
+
+mx_status_t VnodeMinfs::DirIndexUpdate(uint32_t off, minfs_dirent_t* de) {
+    if (dir_index_ == nullptr) {
+        return MX_OK;
+    }
+    mx_status_t status = dir_index_->Update(off, de);
+    if (status != MX_OK) {
+        dir_index_.reset();
+    }
+    return status;
+}
+
+static mx_status_t cb_dir_index(mxtl::RefPtr<VnodeMinfs> vndir, minfs_dirent_t* de,
+                                DirArgs* args, DirectoryOffset* offs) {
+    mx_status_t status = vndir->DirIndexUpdate(static_cast<uint32_t>(offs->off), de);
+    if (status != MX_OK) {
+        return status;
+    }
+    return do_next_dirent(de, offs);
+}
+
+void VnodeMinfs::InitDirIndex() {
+    if (dir_index_ != nullptr) {
+        return;
+    }
+    dir_index_ = fs_->DirIndexTake(ino_);
+    if ((dir_index_ != nullptr) || (inode_.size < kMinfsDirIndexMinSize)) {
+        return;
+    }
+    if (DirIndex::Create(&dir_index_) != MX_OK) {
+        return;
+    }
+    DirArgs args = DirArgs();
+    if (ForEachDirent(&args, cb_dir_index) != MX_ERR_NOT_FOUND) {
+        // Fall back to scanning the directory.
+        dir_index_.reset();
+    }
+}
+
+mx_status_t VnodeMinfs::FindDirent(DirArgs* args, const DirentCallback func) {
+    InitDirIndex();
+    if (dir_index_ == nullptr) {
+        return ForEachDirent(args, func);
+    }
+
+    uint32_t hash = DirIndex::Hash(args->name, args->len);
+    for (DirIndex::Record* record = dir_index_->Find(hash); record != nullptr;
+         record = dir_index_->FindNext(record)) {
+        DirectoryOffset offs = {
+            .off = record->off,
+            .off_prev = dir_index_->PrevOffset(record->off),
+        };
+        mx_status_t status = VisitDirent(args, func, &offs);
+        if (status != DIR_CB_NEXT) {
             return status;
         }
     }
     return MX_ERR_NOT_FOUND;
 }
 
+mx_status_t VnodeMinfs::AppendDirent(DirArgs* args) {
+    InitDirIndex();
+    if (dir_index_ != nullptr) {
+        DirIndex::Record* record = dir_index_->FindSpace(args->reclen);
+        if (record == nullptr) {
+            return MX_ERR_NOT_FOUND;
+        }
+        DirectoryOffset offs = {
+            .off = record->off,
+            .off_prev = dir_index_->PrevOffset(record->off),
+        };
+        mx_status_t status = VisitDirent(args, cb_dir_append, &offs);
+        if (status != DIR_CB_NEXT) {
+            return status;
+        }
+        // The index disagrees with the directory itself.
+        FS_TRACE_ERROR("minfs: directory index out of sync at offset %u\n", record->off);
+        dir_index_.reset();
+    }
+    return ForEachDirent(args, cb_dir_append);
+}
+
 VnodeMinfs::~VnodeMinfs() {
     if (inode_.link_count == 0) {
 #ifdef __Fuchsia__
@@ -740,11 +1284,19 @@ VnodeMinfs::~VnodeMinfs() {
 #else
         fs_->InoFree(inode_, ino_);
 #endif
+    } else if (dir_index_ != nullptr) {
+        fs_->DirIndexSave(ino_, mxtl::move(dir_index_));
     }
 
     fs_->VnodeRelease(this);
 #ifdef __Fuchsia__
+    if ((vmo_indirect_ != nullptr) && (fs_->journal_ != nullptr)) {
+        fs_->journal_->UnregisterVmo(vmoid_indirect_);
+    }
     if (vmo_.is_valid()) {
+        if (fs_->journal_ != nullptr) {
+            fs_->journal_->UnregisterVmo(vmoid_);
+        }
         block_fifo_request_t request;
         request.txnid = fs_->bc_->TxnId();
         request.vmoid = vmoid_;
@@ -867,12 +1419,24 @@ mx_status_t VnodeMinfs::WriteInternal(WriteTxn* txn, const void* data,
     size_t adjust = off % kMinfsBlockSize;
 
     while ((len > 0) && (n < kMinfsMaxFileBlock)) {
-        size_t xfer;
-        if (len > (kMinfsBlockSize - adjust)) {
-            xfer = kMinfsBlockSize - adjust;
-        } else {
-            xfer = len;
+        // Map as many of the remaining blocks as are contiguous on disk, so
+        // they can be written with a single request.
+        uint32_t want = static_cast<uint32_t>(mxtl::min<uint64_t>(
+            (adjust + len + kMinfsBlockSize - 1) / kMinfsBlockSize, kMinfsMaxFileBlock - n));
+        uint32_t bno;
+        uint32_t run;
+#ifdef __Fuchsia__
+        if ((status = GetBnoRun(txn, n, want, &bno, &run)) != MX_OK) {
+            return status;
+        }
+#else
+        if ((status = GetBnoRun(txn, n, want, &bno, &run)) != MX_OK) {
+            goto done;
         }
+#endif
+        assert(bno != 0);
+        size_t xfer = mxtl::min(len, run * kMinfsBlockSize - adjust);
+        run = static_cast<uint32_t>((adjust + xfer + kMinfsBlockSize - 1) / kMinfsBlockSize);
 
 #ifdef __Fuchsia__
         size_t xfer_off = n * kMinfsBlockSize + adjust;
@@ -882,40 +1446,38 @@ mx_status_t VnodeMinfs::WriteInternal(WriteTxn* txn, const void* data,
                 goto done;
             }
             inode_.size = static_cast<uint32_t>(new_size);
+            ReadVmoInvalidate();
         }
 
-        // Update this block of the in-memory VMO
+        // Update these blocks of the in-memory VMO
         if ((status = VmoWriteExact(data, xfer_off, xfer)) != MX_OK) {
             return MX_ERR_IO;
         }
 
-        // Update this block on-disk
-        uint32_t bno;
-        if ((status = GetBno(txn, n, &bno)) != MX_OK) {
-            return status;
-        }
-        assert(bno != 0);
-        txn->Enqueue(vmoid_, n, bno, 1);
+        // Update these blocks on-disk
+        txn->Enqueue(vmoid_, n, bno, run);
 #else
-        uint32_t bno;
-        if ((status = GetBno(txn, n, &bno)) != MX_OK) {
-            goto done;
-        }
-        assert(bno != 0);
-        char wdata[kMinfsBlockSize];
-        if (fs_->bc_->Readblk(bno, wdata)) {
-            return MX_ERR_IO;
-        }
-        memcpy(wdata + adjust, data, xfer);
-        if (fs_->bc_->Writeblk(bno, wdata)) {
-            return MX_ERR_IO;
+        const uint8_t* src = static_cast<const uint8_t*>(data);
+        for (uint32_t b = 0; b < run; b++) {
+            size_t bxfer = mxtl::min(xfer - (src - static_cast<const uint8_t*>(data)),
+                                     kMinfsBlockSize - adjust);
+            char wdata[kMinfsBlockSize];
+            if (fs_->bc_->Readblk(bno + b, wdata)) {
+                return MX_ERR_IO;
+            }
+            memcpy(wdata + adjust, src, bxfer);
+            if (fs_->bc_->Writeblk(bno + b, wdata)) {
+                return MX_ERR_IO;
+            }
+            src += bxfer;
+            adjust = 0;
         }
 #endif
 
         adjust = 0;
         len -= xfer;
         data = (void*)((uintptr_t)(data) + xfer);
-        n++;
+        n += run;
     }
 
 done:
@@ -961,7 +1523,7 @@ mx_status_t VnodeMinfs::LookupInternal(mxtl::RefPtr<fs::Vnode>* out,
     args.name = name;
     args.len = len;
     mx_status_t status;
-    if ((status = ForEachDirent(&args, cb_dir_find)) < 0) {
+    if ((status = FindDirent(&args, cb_dir_find)) < 0) {
         return status;
     }
     mxtl::RefPtr<VnodeMinfs> vn;
@@ -1110,6 +1672,9 @@ mx_status_t VnodeMinfs::Allocate(Minfs* fs, uint32_t type, mxtl::RefPtr<VnodeMin
     (*out)->inode_.magic = MinfsMagic(type);
     (*out)->inode_.create_time = (*out)->inode_.modify_time = minfs_gettime_utc();
     (*out)->inode_.link_count = (type == kMinfsTypeDir ? 2 : 1);
+    if (fs->info_.version >= kMinfsVersionExtents) {
+        (*out)->inode_.flags = kMinfsInodeFlagExtents;
+    }
     return MX_OK;
 }
 
@@ -1144,7 +1709,7 @@ mx_status_t VnodeMinfs::Create(mxtl::RefPtr<fs::Vnode>* out, const char* name, s
     args.len = len;
     // ensure file does not exist
     mx_status_t status;
-    if ((status = ForEachDirent(&args, cb_dir_find)) != MX_ERR_NOT_FOUND) {
+    if ((status = FindDirent(&args, cb_dir_find)) != MX_ERR_NOT_FOUND) {
         return MX_ERR_ALREADY_EXISTS;
     }
 
@@ -1175,7 +1740,7 @@ mx_status_t VnodeMinfs::Create(mxtl::RefPtr<fs::Vnode>* out, const char* name, s
     args.type = type;
     args.reclen = static_cast<uint32_t>(DirentSize(static_cast<uint8_t>(len)));
     args.txn = &txn;
-    if ((status = ForEachDirent(&args, cb_dir_append)) < 0) {
+    if ((status = AppendDirent(&args)) < 0) {
         return status;
     }
 
@@ -1201,6 +1766,24 @@ ssize_t VnodeMinfs::Ioctl(uint32_t op, const void* in_buf, size_t in_len, void*
             strcpy(info->name, kFsName);
             return sizeof(*info);
         }
+        case IOCTL_VFS_GET_CACHE_STATS: {
+            if (out_len < sizeof(vfs_cache_stats_t)) {
+                return MX_ERR_INVALID_ARGS;
+            }
+
+            BlockCacheStats stats;
+            fs_->bc_->GetStats(&stats);
+            vfs_cache_stats_t* info = static_cast<vfs_cache_stats_t*>(out_buf);
+            info->hits = stats.hits;
+            info->misses = stats.misses;
+            info->readahead_blocks = stats.readahead_blocks;
+            info->readahead_hits = stats.readahead_hits;
+            info->writeback_blocks = stats.writeback_blocks;
+            info->flushes = stats.flushes;
+            info->capacity_blocks = kMinfsBlockCacheSize;
+            info->dirty_blocks = fs_->bc_->DirtyCount();
+            return sizeof(*info);
+        }
         case IOCTL_VFS_UNMOUNT_FS: {
             mx_status_t status = Sync();
             if (status != MX_OK) {
@@ -1245,7 +1828,7 @@ mx_status_t VnodeMinfs::Unlink(const char* name, size_t len, bool must_be_dir) {
     args.len = len;
     args.type = must_be_dir ? kMinfsTypeDir : 0;
     args.txn = &txn;
-    return ForEachDirent(&args, cb_dir_unlink);
+    return FindDirent(&args, cb_dir_unlink);
 }
 
 mx_status_t VnodeMinfs::Truncate(size_t len) {
@@ -1270,6 +1853,7 @@ mx_status_t VnodeMinfs::TruncateInternal(WriteTxn* txn, size_t len) {
     if (InitVmo() != MX_OK) {
         return MX_ERR_IO;
     }
+    ReadVmoInvalidate();
 #endif
 
     if (len < inode_.size) {
@@ -1392,7 +1976,7 @@ mx_status_t VnodeMinfs::Rename(mxtl::RefPtr<fs::Vnode> _newdir, const char* oldn
     DirArgs args = DirArgs();
     args.name = oldname;
     args.len = oldlen;
-    if ((status = ForEachDirent(&args, cb_dir_find)) < 0) {
+    if ((status = FindDirent(&args, cb_dir_find)) < 0) {
         return status;
     } else if ((status = fs_->VnodeGet(&oldvn, args.ino)) < 0) {
         return status;
@@ -1413,11 +1997,11 @@ mx_status_t VnodeMinfs::Rename(mxtl::RefPtr<fs::Vnode> _newdir, const char* oldn
     args.len = newlen;
     args.ino = oldvn->ino_;
     args.type = oldvn->IsDirectory() ? kMinfsTypeDir : kMinfsTypeFile;
-    status = newdir->ForEachDirent(&args, cb_dir_attempt_rename);
+    status = newdir->FindDirent(&args, cb_dir_attempt_rename);
     if (status == MX_ERR_NOT_FOUND) {
         // if 'newname' does not exist, create it
         args.reclen = static_cast<uint32_t>(DirentSize(static_cast<uint8_t>(newlen)));
-        if ((status = newdir->ForEachDirent(&args, cb_dir_append)) < 0) {
+        if ((status = newdir->AppendDirent(&args)) < 0) {
             return status;
         }
     } else if (status != MX_OK) {
@@ -1435,7 +2019,7 @@ mx_status_t VnodeMinfs::Rename(mxtl::RefPtr<fs::Vnode> _newdir, const char* oldn
         args.name = "..";
         args.len = 2;
         args.ino = newdir->ino_;
-        if ((status = vn->ForEachDirent(&args, cb_dir_update_inode)) < 0) {
+        if ((status = vn->FindDirent(&args, cb_dir_update_inode)) < 0) {
             return status;
         }
     }
@@ -1447,7 +2031,7 @@ mx_status_t VnodeMinfs::Rename(mxtl::RefPtr<fs::Vnode> _newdir, const char* oldn
     // finally, remove oldname from its original position
     args.name = oldname;
     args.len = oldlen;
-    return ForEachDirent(&args, cb_dir_force_unlink);
+    return FindDirent(&args, cb_dir_force_unlink);
 }
 
 mx_status_t VnodeMinfs::Link(const char* name, size_t len, mxtl::RefPtr<fs::Vnode> _target) {
@@ -1477,7 +2061,7 @@ mx_status_t VnodeMinfs::Link(const char* name, size_t len, mxtl::RefPtr<fs::Vnod
     args.name = name;
     args.len = len;
     mx_status_t status;
-    if ((status = ForEachDirent(&args, cb_dir_find)) != MX_ERR_NOT_FOUND) {
+    if ((status = FindDirent(&args, cb_dir_find)) != MX_ERR_NOT_FOUND) {
         return (status == MX_OK) ? MX_ERR_ALREADY_EXISTS : status;
     }
 
@@ -1486,7 +2070,7 @@ mx_status_t VnodeMinfs::Link(const char* name, size_t len, mxtl::RefPtr<fs::Vnod
     args.type = kMinfsTypeFile; // We can't hard link directories
     args.reclen = static_cast<uint32_t>(DirentSize(static_cast<uint8_t>(len)));
     args.txn = &txn;
-    if ((status = ForEachDirent(&args, cb_dir_append)) < 0) {
+    if ((status = AppendDirent(&args)) < 0) {
         return status;
     }
 
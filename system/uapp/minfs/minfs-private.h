@@ -6,12 +6,14 @@
 
 #ifdef __Fuchsia__
 #include <fs/dispatcher.h>
+#include <mx/event.h>
 #include <mx/vmo.h>
 #endif
 
 #include <mxtl/algorithm.h>
 #include <mxtl/intrusive_hash_table.h>
 #include <mxtl/intrusive_single_list.h>
+#include <mxtl/intrusive_wavl_tree.h>
 #include <mxtl/macros.h>
 #include <mxtl/ref_ptr.h>
 #include <mxtl/unique_ptr.h>
@@ -44,11 +46,99 @@ constexpr uint32_t kMxFsSyncDefault = 0; // default: no implicit time update
 constexpr uint32_t kMxFsSyncMtime = (1 << 0);
 constexpr uint32_t kMxFsSyncCtime = (1 << 1);
 
-constexpr uint32_t kMinfsBlockCacheSize = 64;
+#ifdef __Fuchsia__
+
+// Write-ahead log of metadata blocks.
+//
+// Every write transaction issued through Bcache::Txn() is split in two: writes
+// from VMOs which were not registered with the journal (file data) go straight
+// to disk, and once they have completed, the blocks written from registered
+// VMOs (bitmaps, inode table, superblock, directories, indirect blocks) are
+// copied into the log and committed with a single sequential request.
+// Home locations are only written at checkpoints, when the log fills up or on
+// teardown, so a block dirtied by many operations is written back once.
+class Journal {
+public:
+    DISALLOW_COPY_ASSIGN_AND_MOVE(Journal);
+
+    // 'seq' is the sequence number of the first entry to write, as returned
+    // by minfs_journal_replay().
+    static mx_status_t Create(Bcache* bc, const minfs_info_t* info, uint64_t seq,
+                              mxtl::unique_ptr<Journal>* out);
+    ~Journal();
+
+    // Identifies a VMO holding metadata. If 'data' is null, blocks are read
+    // out of 'vmo' when they are committed.
+    mx_status_t RegisterVmo(vmoid_t vmoid, const void* data, mx_handle_t vmo);
+    void UnregisterVmo(vmoid_t vmoid);
+
+    mx_status_t Txn(block_fifo_request_t* requests, size_t count);
+
+    // Checkpoints if any of the blocks in [bno, bno + count) are only
+    // up-to-date within the log.
+    mx_status_t PrepareRead(uint64_t bno, uint64_t count);
+
+    // Called when blocks [bno, bno + count) are freed. If any of them is
+    // logged, the log is checkpointed so a stale copy can never be replayed
+    // over the block's next owner.
+    mx_status_t ReleaseBlocks(uint32_t bno, uint32_t count);
+
+    mx_status_t Checkpoint();
+
+private:
+    struct MetadataVmo : public mxtl::SinglyLinkedListable<mxtl::unique_ptr<MetadataVmo>> {
+        vmoid_t GetKey() const { return vmoid; }
+        static size_t GetHash(vmoid_t key) { return key; }
+
+        vmoid_t vmoid;
+        const void* data;
+        mx_handle_t vmo;
+    };
+
+    // A block which has been logged, but not yet checkpointed.
+    struct PendingBlock {
+        uint32_t bno;
+        uint32_t slot; // Index of the copy within the journal region
+    };
+
+    Journal(Bcache* bc, const minfs_info_t* info, uint64_t seq);
+
+    void* SlotData(uint32_t slot) const {
+        return reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(vmo_->GetData()) +
+                                       slot * kMinfsBlockSize);
+    }
+    bool IsPending(uint64_t bno, uint64_t count) const;
+    mx_status_t Commit(block_fifo_request_t* requests, size_t count, uint32_t blocks);
+    mx_status_t WriteInfo();
+
+    Bcache* bc_;
+    const uint32_t start_;   // First block of the journal region
+    const uint32_t blocks_;  // Size of the journal region
+    uint64_t seq_;           // Sequence number of the next entry
+    uint32_t next_;          // Slot of the next entry's header
+
+    mxtl::unique_ptr<MappedVmo> vmo_{};
+    vmoid_t vmoid_{};
+    mxtl::HashTable<vmoid_t, mxtl::unique_ptr<MetadataVmo>> vmos_{};
+    mxtl::unique_ptr<PendingBlock[]> pending_{};
+    uint32_t pending_count_{};
+};
+
+#endif
+
+// Replays any committed journal entries to their home locations, and resets
+// the log. On success, 'seq_out' holds the sequence number for the next entry.
+mx_status_t minfs_journal_replay(Bcache* bc, const minfs_info_t* info, uint64_t* seq_out);
 
 // Used by fsck
 class MinfsChecker;
 
+// Directories smaller than this are simply scanned.
+constexpr uint32_t kMinfsDirIndexMinSize = kMinfsBlockSize;
+// Number of directory indexes kept for directories without a vnode.
+constexpr uint32_t kMinfsDirIndexCacheSize = 4;
+
+class DirIndex;
 class VnodeMinfs;
 
 class Minfs {
@@ -73,9 +163,18 @@ public:
     // Allocate a new data block.
     mx_status_t BlockNew(WriteTxn* txn, uint32_t hint, uint32_t* out_bno);
 
+    // Allocate a run of up to 'max' contiguous data blocks, preferring one
+    // which starts at 'hint'. Returns the first block in 'out_bno' and the
+    // length of the run, which is at least one, in 'out_count'.
+    mx_status_t BlockNewRun(WriteTxn* txn, uint32_t hint, uint32_t max,
+                            uint32_t* out_bno, uint32_t* out_count);
+
     // free block in block bitmap
     mx_status_t BlockFree(WriteTxn* txn, uint32_t bno);
 
+    // free blocks [bno, bno + count) in block bitmap
+    mx_status_t BlockFreeRun(WriteTxn* txn, uint32_t bno, uint32_t count);
+
     // free ino in inode bitmap, release all blocks held by inode
     mx_status_t InoFree(
 #ifdef __Fuchsia__
@@ -87,6 +186,12 @@ public:
     // Does not modify inode bitmap.
     mx_status_t InodeSync(WriteTxn* txn, uint32_t ino, const minfs_inode_t* inode);
 
+    // Directory vnodes usually only live for the duration of a path walk, so
+    // their indexes are kept here in between, until evicted or the directory
+    // is freed.
+    void DirIndexSave(uint32_t ino, mxtl::unique_ptr<DirIndex> index);
+    mxtl::unique_ptr<DirIndex> DirIndexTake(uint32_t ino);
+
 #ifdef __Fuchsia__
     fs::Dispatcher* GetDispatcher() {
         return dispatcher_.get();
@@ -98,6 +203,10 @@ public:
     }
 
     mxtl::unique_ptr<Bcache> bc_{};
+#ifdef __Fuchsia__
+    // Declared after 'bc_', so it is torn down first.
+    mxtl::unique_ptr<Journal> journal_{};
+#endif
     minfs_info_t info_{};
 
 private:
@@ -112,6 +221,12 @@ private:
 #ifdef __Fuchsia__
     mxtl::unique_ptr<fs::Dispatcher> dispatcher_{nullptr};
 #endif
+    struct SavedDirIndex {
+        uint32_t ino;
+        mxtl::unique_ptr<DirIndex> index;
+    };
+    SavedDirIndex dir_indexes_[kMinfsDirIndexCacheSize]{};
+    uint32_t dir_index_evict_{}; // Slot to reuse next
     uint32_t abmblks_{};
     uint32_t ibmblks_{};
     RawBitmap inode_map_{};
@@ -145,6 +260,61 @@ struct DirectoryOffset {
     size_t off_prev; // Offset in directory of previous record
 };
 
+// An in-memory index of the records of a directory, so that lookups and
+// insertions need not visit every direntry. It holds no names: records are
+// found by the hash of their name, and the caller compares the name itself.
+class DirIndex {
+public:
+    DISALLOW_COPY_ASSIGN_AND_MOVE(DirIndex);
+
+    struct Record : public mxtl::WAVLTreeContainable<mxtl::unique_ptr<Record>> {
+        uint32_t GetKey() const { return off; }
+
+        uint32_t off;
+        uint32_t slack;  // Bytes available to a new direntry within the record
+        uint32_t hash;   // Hash of the name; live records only
+        bool live;
+        Record* hash_next;
+    };
+
+    static mx_status_t Create(mxtl::unique_ptr<DirIndex>* out);
+    ~DirIndex();
+
+    static uint32_t Hash(const char* name, size_t len);
+
+    // Records the direntry 'de', which is now on disk at 'off'. On failure,
+    // the index no longer matches the directory.
+    mx_status_t Update(uint32_t off, minfs_dirent_t* de);
+    // Forgets the record at 'off', which was merged into a neighbor.
+    void Remove(uint32_t off);
+
+    // Iterates over the live records whose name has hash 'hash'.
+    Record* Find(uint32_t hash) const;
+    Record* FindNext(const Record* record) const;
+
+    // Returns the first record which can hold a direntry of 'reclen' bytes,
+    // or nullptr if the directory is full.
+    Record* FindSpace(uint32_t reclen);
+
+    // Returns the offset of the record preceding 'off', or 'off' itself for
+    // the first record.
+    uint32_t PrevOffset(uint32_t off) const;
+
+private:
+    DirIndex() {}
+
+    Record** Bucket(uint32_t hash) const { return &buckets_[hash & (bucket_count_ - 1)]; }
+    mx_status_t Rehash(uint32_t bucket_count);
+    void Unhash(Record* record);
+
+    mxtl::WAVLTree<uint32_t, mxtl::unique_ptr<Record>> records_{};
+    mxtl::unique_ptr<Record*[]> buckets_{};
+    uint32_t bucket_count_{};
+    uint32_t live_count_{};
+    // Every record before this offset is too full to hold a direntry.
+    uint32_t space_hint_{};
+};
+
 #define INO_HASH(ino) fnv1a_tiny(ino, kMinfsHashBits)
 
 // clang-format off
@@ -171,6 +341,9 @@ public:
 
     mx_status_t UnlinkChild(WriteTxn* txn, mxtl::RefPtr<VnodeMinfs> child,
                             minfs_dirent_t* de, DirectoryOffset* offs);
+    // Called whenever the record at 'off' is rewritten, to keep the
+    // directory index (if any) in sync with the directory.
+    mx_status_t DirIndexUpdate(uint32_t off, minfs_dirent_t* de);
     // Remove the link to a vnode (referring to inodes exclusively).
     // Has no impact on direntries (or parent inode).
     void RemoveInodeLink(WriteTxn* txn);
@@ -226,10 +399,39 @@ private:
     // Allocate the block if requested with a non-null "txn".
     mx_status_t GetBno(WriteTxn* txn, uint32_t n, uint32_t* bno);
 
+    // Like GetBno, but for the run of up to 'max' logical blocks starting at
+    // the 'nth', which are contiguous on disk (or all unallocated). The length
+    // of the run, which is at least one, is returned in 'count'.
+    mx_status_t GetBnoRun(WriteTxn* txn, uint32_t n, uint32_t max, uint32_t* bno,
+                          uint32_t* count);
+
     // Deletes all blocks (relateive to a file) from "start" (inclusive) to the end
     // of the file. Does not update mtime/atime.
     mx_status_t BlocksShrink(WriteTxn* txn, uint32_t start);
 
+    // Extent-mapped inodes only; see InodeHasExtents().
+    //
+    // Make every extent reachable through ExtentAt, by loading the extent
+    // block if the inode has one.
+    mx_status_t InitExtentBlock();
+    minfs_extent_t* ExtentAt(uint32_t n);
+    // Returns the index of the first extent which starts after logical block 'n'.
+    uint32_t ExtentSearch(uint32_t n);
+    // Find the run at logical block 'n', which is either one extent or the hole
+    // up to the next one. 'bno' is zero for a hole.
+    mx_status_t ExtentLookup(uint32_t n, uint32_t* bno, uint32_t* count);
+    // Map up to 'max' blocks of the hole at logical block 'n' to newly
+    // allocated, contiguous blocks.
+    mx_status_t ExtentAllocate(WriteTxn* txn, uint32_t n, uint32_t max, uint32_t* bno,
+                               uint32_t* count);
+    mx_status_t ExtentShrink(WriteTxn* txn, uint32_t start);
+    // Remap the file with dnum[] and inum[], once it has more extents than
+    // the extent map can hold.
+    mx_status_t ExtentsToBlockMap(WriteTxn* txn);
+    // Write back the extent block after the extents change, or release it once
+    // they all fit in the inode.
+    void ExtentBlockSync(WriteTxn* txn);
+
     // Update the vnode's inode and write it to disk
     void InodeSync(WriteTxn* txn, uint32_t flags);
 
@@ -239,6 +441,16 @@ private:
 
     // Directories only
     mx_status_t ForEachDirent(DirArgs* args, const DirentCallback func);
+    // Like ForEachDirent, but only visits the direntries which may be named
+    // 'args->name', using the directory index.
+    mx_status_t FindDirent(DirArgs* args, const DirentCallback func);
+    // Adds the direntry described by 'args', in the first record with room.
+    mx_status_t AppendDirent(DirArgs* args);
+    // Calls 'func' on the direntry at 'offs'. Returns DIR_CB_NEXT if the
+    // caller should move on to another direntry.
+    mx_status_t VisitDirent(DirArgs* args, const DirentCallback func, DirectoryOffset* offs);
+    // Builds the directory index, if the directory is large enough to need one.
+    void InitDirIndex();
 
 #ifdef __Fuchsia__
     fs::Dispatcher* GetDispatcher() final;
@@ -258,6 +470,15 @@ private:
     vmoid_t vmoid_{};
     vmoid_t vmoid_indirect_{};
 
+    // Clients may read straight from vmo_ (see GetReadVmo), trusting the
+    // size they were given until this event is signalled.
+    mx_status_t GetReadVmo(mx_handle_t* vmo, mx_handle_t* stale, size_t* size) final;
+    // Read-only mappings get a copy-on-write snapshot of vmo_.
+    mx_status_t Mmap(int flags, size_t len, size_t* off, mx_handle_t* out) final;
+    // Called whenever inode_.size changes.
+    void ReadVmoInvalidate();
+    mx::event read_vmo_stale_{};
+
     // Use the watcher container to implement a directory watcher
     void Notify(const char* name, size_t len, unsigned event) final;
     mx_status_t WatchDir(mx_handle_t* out) final;
@@ -272,7 +493,14 @@ private:
 
     fs::RemoteContainer remoter_{};
     fs::WatcherContainer watcher_{};
+#else
+    // Contents of the extent block of an extent-mapped inode. On Fuchsia, it
+    // occupies the first block of vmo_indirect_.
+    mxtl::unique_ptr<uint8_t[]> ext_data_{};
 #endif
+    // Built on demand for large directories; dropped (and later rebuilt)
+    // whenever an update to it fails.
+    mxtl::unique_ptr<DirIndex> dir_index_{};
 };
 
 // write the inode data of this vnode to disk (default does not update time values)
@@ -295,6 +523,7 @@ public:
     mx_status_t CheckForUnusedInodes() const;
     mx_status_t CheckLinkCounts() const;
     mx_status_t CheckAllocatedCounts() const;
+    mx_status_t CheckJournal() const;
 
     // "Set once"-style flag to identify if anything nonconforming
     // was found in the underlying filesystem -- even if it was fixed.
@@ -308,6 +537,7 @@ private:
     mx_status_t CheckDirectory(minfs_inode_t* inode, uint32_t ino,
                                uint32_t parent, uint32_t flags);
     const char* CheckDataBlock(uint32_t bno);
+    mx_status_t CheckExtents(minfs_inode_t* inode, uint32_t ino);
     mx_status_t CheckFile(minfs_inode_t* inode, uint32_t ino);
 
     mxtl::unique_ptr<Minfs> fs_;
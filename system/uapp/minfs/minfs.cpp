@@ -31,6 +31,7 @@ void minfs_dump_info(const minfs_info_t* info) {
     FS_TRACE(MINFS, "minfs: inode bitmap @ %10u\n", info->ibm_block);
     FS_TRACE(MINFS, "minfs: alloc bitmap @ %10u\n", info->abm_block);
     FS_TRACE(MINFS, "minfs: inode table  @ %10u\n", info->ino_block);
+    FS_TRACE(MINFS, "minfs: journal      @ %10u (%u blocks)\n", info->jnl_block, info->jnl_blocks);
     FS_TRACE(MINFS, "minfs: data blocks  @ %10u\n", info->dat_block);
 }
 
@@ -49,7 +50,7 @@ mx_status_t minfs_check_info(const minfs_info_t* info, uint32_t max) {
         FS_TRACE_ERROR("minfs: bad magic\n");
         return MX_ERR_INVALID_ARGS;
     }
-    if (info->version != kMinfsVersion) {
+    if ((info->version < kMinfsVersionMin) || (info->version > kMinfsVersion)) {
         FS_TRACE_ERROR("minfs: FS Version: %08x. Driver version: %08x\n", info->version,
               kMinfsVersion);
         return MX_ERR_INVALID_ARGS;
@@ -63,6 +64,14 @@ mx_status_t minfs_check_info(const minfs_info_t* info, uint32_t max) {
         FS_TRACE_ERROR("minfs: too large for device\n");
         return MX_ERR_INVALID_ARGS;
     }
+    const uint32_t inoblks = (info->inode_count + kMinfsInodesPerBlock - 1) / kMinfsInodesPerBlock;
+    if ((info->jnl_blocks < kMinfsJournalMinBlocks) ||
+        (info->jnl_blocks > kMinfsJournalMaxBlocks) ||
+        (info->jnl_block < info->ino_block + inoblks) ||
+        (info->jnl_block + info->jnl_blocks > info->dat_block)) {
+        FS_TRACE_ERROR("minfs: bad journal layout\n");
+        return MX_ERR_INVALID_ARGS;
+    }
     //TODO: validate layout
     return 0;
 }
@@ -95,6 +104,11 @@ Minfs::Minfs(mxtl::unique_ptr<Bcache> bc, const minfs_info_t* info) : bc_(mxtl::
 
 Minfs::~Minfs() {
     vnode_hash_.clear();
+#ifdef __Fuchsia__
+    // Checkpoints the log, leaving it empty for the next mount.
+    bc_->SetJournal(nullptr);
+    journal_.reset();
+#endif
 }
 
 mx_status_t Minfs::InoFree(
@@ -110,6 +124,9 @@ mx_status_t Minfs::InoFree(
     auto ibm_id = inode_map_.StorageUnsafe()->GetData();
 #endif
 
+    // A saved index would describe whichever directory reuses the inode
+    DirIndexTake(ino);
+
     // Free the inode bit itself
     inode_map_.Clear(ino, ino + 1);
     info_.alloc_inode_count--;
@@ -118,6 +135,41 @@ mx_status_t Minfs::InoFree(
     txn.Enqueue(ibm_id, bitblock, info_.ibm_block + bitblock, 1);
     uint32_t block_count = inode.block_count;
 
+    if (InodeHasExtents(&inode)) {
+        const minfs_extent_map_t* map = InodeExtentMap(&inode);
+        const void* overflow = nullptr;
+#ifndef __Fuchsia__
+        uint8_t edata[kMinfsBlockSize];
+#endif
+        uint32_t count = mxtl::min(map->count, kMinfsInlineExtents);
+        if (map->ext_block != 0) {
+            ValidateBno(map->ext_block);
+#ifdef __Fuchsia__
+            overflow = vmo_indirect->GetData();
+#else
+            bc_->Readblk(map->ext_block, edata);
+            overflow = edata;
+#endif
+            count = mxtl::min(map->count, kMinfsMaxExtents);
+        }
+
+        // release every extent, and then the block holding the overflow
+        for (uint32_t n = 0; n < count; n++) {
+            const minfs_extent_t* extent = ExtentAt(map, overflow, n);
+            ValidateBno(extent->bno);
+            block_count -= extent->count;
+            BlockFreeRun(&txn, extent->bno, extent->count);
+        }
+        if (map->ext_block != 0) {
+            block_count--;
+            BlockFree(&txn, map->ext_block);
+        }
+
+        CountUpdate(&txn);
+        MX_DEBUG_ASSERT(block_count == 0);
+        return MX_OK;
+    }
+
     // release all direct blocks
     for (unsigned n = 0; n < kMinfsDirect; n++) {
         if (inode.dnum[n] == 0) {
@@ -229,6 +281,31 @@ void Minfs::VnodeRelease(VnodeMinfs* vn) {
     vnode_hash_.erase(*vn);
 }
 
+void Minfs::DirIndexSave(uint32_t ino, mxtl::unique_ptr<DirIndex> index) {
+    SavedDirIndex* slot = nullptr;
+    for (uint32_t i = 0; i < kMinfsDirIndexCacheSize; i++) {
+        if (dir_indexes_[i].index == nullptr) {
+            slot = &dir_indexes_[i];
+            break;
+        }
+    }
+    if (slot == nullptr) {
+        slot = &dir_indexes_[dir_index_evict_];
+        dir_index_evict_ = (dir_index_evict_ + 1) % kMinfsDirIndexCacheSize;
+    }
+    slot->ino = ino;
+    slot->index = mxtl::move(index);
+}
+
+mxtl::unique_ptr<DirIndex> Minfs::DirIndexTake(uint32_t ino) {
+    for (uint32_t i = 0; i < kMinfsDirIndexCacheSize; i++) {
+        if ((dir_indexes_[i].index != nullptr) && (dir_indexes_[i].ino == ino)) {
+            return mxtl::move(dir_indexes_[i].index);
+        }
+    }
+    return nullptr;
+}
+
 mx_status_t Minfs::VnodeGet(mxtl::RefPtr<VnodeMinfs>* out, uint32_t ino) {
     if ((ino < 1) || (ino >= info_.inode_count)) {
         return MX_ERR_OUT_OF_RANGE;
@@ -262,17 +339,26 @@ mx_status_t Minfs::VnodeGet(mxtl::RefPtr<VnodeMinfs>* out, uint32_t ino) {
 
 mx_status_t Minfs::BlockFree(WriteTxn* txn, uint32_t bno) {
     ValidateBno(bno);
+    return BlockFreeRun(txn, bno, 1);
+}
 
+mx_status_t Minfs::BlockFreeRun(WriteTxn* txn, uint32_t bno, uint32_t count) {
 #ifdef __Fuchsia__
+    mx_status_t status;
+    if ((status = journal_->ReleaseBlocks(bno, count)) != MX_OK) {
+        return status;
+    }
     auto bbm_id = block_map_vmoid_;
 #else
     auto bbm_id = block_map_.StorageUnsafe()->GetData();
 #endif
 
-    block_map_.Clear(bno, bno + 1);
-    info_.alloc_block_count--;
-    uint32_t bitblock = bno / kMinfsBlockBits;
-    txn->Enqueue(bbm_id, bitblock, info_.abm_block + bitblock, 1);
+    block_map_.Clear(bno, bno + count);
+    info_.alloc_block_count -= count;
+    uint32_t first_bitblock = bno / kMinfsBlockBits;
+    uint32_t last_bitblock = (bno + count - 1) / kMinfsBlockBits;
+    txn->Enqueue(bbm_id, first_bitblock, info_.abm_block + first_bitblock,
+                 last_bitblock - first_bitblock + 1);
     return CountUpdate(txn);
 }
 
@@ -313,6 +399,46 @@ mx_status_t Minfs::BlockNew(WriteTxn* txn, uint32_t hint, uint32_t* out_bno) {
     return MX_OK;
 }
 
+mx_status_t Minfs::BlockNewRun(WriteTxn* txn, uint32_t hint, uint32_t max,
+                               uint32_t* out_bno, uint32_t* out_count) {
+    MX_DEBUG_ASSERT(max > 0);
+    // Prefer to continue the run ending at 'hint', then any run long enough
+    // for the whole request, and only then settle for the first free block.
+    size_t bitoff_start;
+    if ((hint != 0) && (hint < block_map_.size()) && !block_map_.Get(hint, hint + 1)) {
+        bitoff_start = hint;
+    } else if ((block_map_.Find(false, hint, block_map_.size(), max, &bitoff_start) != MX_OK) &&
+               (block_map_.Find(false, 0, block_map_.size(), max, &bitoff_start) != MX_OK) &&
+               (block_map_.Find(false, hint, block_map_.size(), 1, &bitoff_start) != MX_OK) &&
+               (block_map_.Find(false, 0, hint, 1, &bitoff_start) != MX_OK)) {
+        return MX_ERR_NO_SPACE;
+    }
+    size_t bitoff_end = block_map_.Scan(bitoff_start, bitoff_start + max, false);
+
+    mx_status_t status = block_map_.Set(bitoff_start, bitoff_end);
+    assert(status == MX_OK);
+    uint32_t bno = static_cast<uint32_t>(bitoff_start);
+    uint32_t count = static_cast<uint32_t>(bitoff_end - bitoff_start);
+    info_.alloc_block_count += count;
+    ValidateBno(bno);
+    ValidateBno(bno + count - 1);
+
+    // commit the bitmap
+#ifdef __Fuchsia__
+    auto bbm_id = block_map_vmoid_;
+#else
+    auto bbm_id = block_map_.StorageUnsafe()->GetData();
+#endif
+    uint32_t first_bitblock = bno / kMinfsBlockBits;
+    uint32_t last_bitblock = (bno + count - 1) / kMinfsBlockBits;
+    txn->Enqueue(bbm_id, first_bitblock, info_.abm_block + first_bitblock,
+                 last_bitblock - first_bitblock + 1);
+    *out_bno = bno;
+    *out_count = count;
+
+    return CountUpdate(txn);
+}
+
 mx_status_t Minfs::CountUpdate(WriteTxn* txn) {
     mx_status_t status = MX_OK;
 
@@ -370,6 +496,22 @@ mx_status_t Minfs::Create(Minfs** out, mxtl::unique_ptr<Bcache> bc, const minfs_
     if (!ac.check()) {
         return MX_ERR_NO_MEMORY;
     }
+
+    // Bring the metadata up to date before any of it is loaded. The
+    // superblock may itself have been replayed, so read it again.
+    uint64_t seq;
+    if ((status = minfs_journal_replay(fs->bc_.get(), info, &seq)) != MX_OK) {
+        FS_TRACE_ERROR("minfs: failed to replay journal\n");
+        return status;
+    }
+    char blk[kMinfsBlockSize];
+    if ((status = fs->bc_->Readblk(0, blk)) != MX_OK) {
+        return status;
+    }
+    memcpy(&fs->info_, blk, sizeof(minfs_info_t));
+    if ((status = minfs_check_info(&fs->info_, blocks)) != MX_OK) {
+        return status;
+    }
 #ifdef __Fuchsia__
     if ((status = fs::VfsDispatcher::Create(mxrio_handler, kPoolSize,
                                             &fs->dispatcher_)) != MX_OK) {
@@ -438,6 +580,25 @@ mx_status_t Minfs::Create(Minfs** out, mxtl::unique_ptr<Bcache> bc, const minfs_
         return status;
     }
 
+    // From here on, metadata writes go through the journal.
+    if ((status = Journal::Create(fs->bc_.get(), &fs->info_, seq, &fs->journal_)) != MX_OK) {
+        return status;
+    }
+    Journal* journal = fs->journal_.get();
+    if (((status = journal->RegisterVmo(fs->block_map_vmoid_,
+                                        fs->block_map_.StorageUnsafe()->GetData(),
+                                        fs->block_map_.StorageUnsafe()->GetVmo())) != MX_OK) ||
+        ((status = journal->RegisterVmo(fs->inode_map_vmoid_,
+                                        fs->inode_map_.StorageUnsafe()->GetData(),
+                                        fs->inode_map_.StorageUnsafe()->GetVmo())) != MX_OK) ||
+        ((status = journal->RegisterVmo(fs->inode_table_vmoid_, fs->inode_table_->GetData(),
+                                        fs->inode_table_->GetVmo())) != MX_OK) ||
+        ((status = journal->RegisterVmo(fs->info_vmoid_, fs->info_vmo_->GetData(),
+                                        fs->info_vmo_->GetVmo())) != MX_OK)) {
+        return status;
+    }
+    fs->bc_->SetJournal(journal);
+
 #else
     for (uint32_t n = 0; n < fs->abmblks_; n++) {
         void* bmdata = fs::GetBlock<kMinfsBlockSize>(fs->block_map_.StorageUnsafe()->GetData(), n);
@@ -533,7 +694,9 @@ int minfs_mkfs(mxtl::unique_ptr<Bcache> bc) {
     info.ibm_block = 8;
     info.abm_block = info.ibm_block + mxtl::roundup(ibmblks, 8u);
     info.ino_block = info.abm_block + mxtl::roundup(abmblks, 8u);
-    info.dat_block = info.ino_block + inoblks;
+    info.jnl_block = info.ino_block + inoblks;
+    info.jnl_blocks = mxtl::clamp(blocks / 64, kMinfsJournalMinBlocks, kMinfsJournalMaxBlocks);
+    info.dat_block = info.jnl_block + info.jnl_blocks;
     minfs_dump_info(&info);
 
     RawBitmap abm;
@@ -604,9 +767,21 @@ int minfs_mkfs(mxtl::unique_ptr<Bcache> bc) {
     ino[kMinfsRootIno].block_count = 1;
     ino[kMinfsRootIno].link_count = 2;
     ino[kMinfsRootIno].dirent_count = 2;
-    ino[kMinfsRootIno].dnum[0] = info.dat_block;
+    ino[kMinfsRootIno].flags = kMinfsInodeFlagExtents;
+    minfs_extent_map_t* map = InodeExtentMap(&ino[kMinfsRootIno]);
+    map->extent[0].fbn = 0;
+    map->extent[0].bno = info.dat_block;
+    map->extent[0].count = 1;
+    map->count = 1;
     bc->Writeblk(info.ino_block, blk);
 
+    // write an empty journal
+    memset(blk, 0, sizeof(blk));
+    minfs_journal_info_t* jinfo = reinterpret_cast<minfs_journal_info_t*>(&blk[0]);
+    jinfo->magic = kMinfsJournalMagic;
+    jinfo->seq_start = 1;
+    bc->Writeblk(info.jnl_block, blk);
+
     memset(blk, 0, sizeof(blk));
     memcpy(blk, &info, sizeof(info));
     bc->Writeblk(0, blk);
@@ -25,6 +25,7 @@
 
 #ifdef __Fuchsia__
 #include <block-client/client.h>
+#include <fs/mapped-vmo.h>
 using RawBitmap = bitmap::RawBitmapGeneric<bitmap::VmoStorage>;
 #else
 using RawBitmap = bitmap::RawBitmapGeneric<bitmap::DefaultStorage>;
@@ -36,7 +37,12 @@ namespace minfs {
 
 constexpr uint64_t kMinfsMagic0 = (0x002153466e694d21ULL);
 constexpr uint64_t kMinfsMagic1 = (0x385000d3d3d3d304ULL);
-constexpr uint32_t kMinfsVersion = 0x00000003;
+constexpr uint32_t kMinfsVersion = 0x00000005;
+// Oldest version which can be mounted; such volumes have no extent-mapped
+// inodes, and new inodes on them stay block-mapped.
+constexpr uint32_t kMinfsVersionMin = 0x00000004;
+// First version with extent-mapped inodes.
+constexpr uint32_t kMinfsVersionExtents = 0x00000005;
 
 constexpr uint32_t kMinfsRootIno        = 1;
 constexpr uint32_t kMinfsFlagClean      = 1;
@@ -76,10 +82,12 @@ typedef struct {
     uint32_t abm_block;     // first blockno of block allocation bitmap
     uint32_t ino_block;     // first blockno of inode table
     uint32_t dat_block;     // first blockno available for file data
+    uint32_t jnl_block;     // first blockno of metadata journal
+    uint32_t jnl_blocks;    // number of blocks in metadata journal
 } minfs_info_t;
 
 // Notes:
-// - the ibm, abm, ino, and dat regions must be in that order
+// - the ibm, abm, ino, jnl, and dat regions must be in that order
 //   and may not overlap
 // - the abm has an entry for every block on the volume, including
 //   the info block (0), the bitmaps, etc
@@ -92,6 +100,48 @@ typedef struct {
 //   at offset: ino % kMinfsInodesPerBlock
 // - inode 0 is never used, should be marked allocated but ignored
 
+// Metadata journal
+//
+// The first block of the journal region holds a minfs_journal_info_t.
+// Log entries follow it, each made of a minfs_journal_entry_t header block
+// and 'count' payload blocks, which are copies of the metadata blocks
+// bno[0..count). Entries are appended from journal block 1 with
+// consecutive sequence numbers, and never wrap; once the log is full, every
+// logged block is written to its home location (a checkpoint) and
+// 'seq_start' moves past the checkpointed entries.
+//
+// At mount, entries from 'seq_start' onwards are replayed in order, up to
+// the first one with a bad header, a bad payload checksum, or an unexpected
+// sequence number.
+
+constexpr uint64_t kMinfsJournalMagic      = (0x6c6e726a53466e4dULL);
+constexpr uint64_t kMinfsJournalEntryMagic = (0x79746e4553466e4dULL);
+constexpr uint32_t kMinfsJournalMinBlocks  = 16;
+constexpr uint32_t kMinfsJournalMaxBlocks  = 256;
+
+typedef struct {
+    uint64_t magic;
+    uint64_t seq_start;     // sequence number of the first entry to replay
+} minfs_journal_info_t;
+
+typedef struct {
+    uint64_t magic;
+    uint64_t seq;
+    uint32_t count;         // number of payload blocks
+    uint32_t reserved;
+    uint64_t checksum;      // fnv1a64 of the header block, computed with
+                            // this field zeroed
+    // Followed by:
+    // uint64_t sum[count];      fnv1a64 of each payload block
+    // uint32_t bno[count];      target block numbers
+} minfs_journal_entry_t;
+
+constexpr uint32_t kMinfsJournalMaxEntryBlocks =
+    (kMinfsBlockSize - sizeof(minfs_journal_entry_t)) / (sizeof(uint32_t) + sizeof(uint64_t));
+
+static_assert(kMinfsJournalMaxBlocks <= kMinfsJournalMaxEntryBlocks,
+              "A journal entry header must be able to describe a full journal");
+
 typedef struct {
     uint32_t magic;
     uint32_t size;
@@ -102,7 +152,8 @@ typedef struct {
     uint32_t seq_num;               // bumped when modified
     uint32_t gen_num;               // bumped when deleted
     uint32_t dirent_count;          // for directories
-    uint32_t rsvd[5];
+    uint32_t flags;                 // kMinfsInodeFlag*
+    uint32_t rsvd[4];
     uint32_t dnum[kMinfsDirect];    // direct blocks
     uint32_t inum[kMinfsIndirect];  // indirect blocks
 } minfs_inode_t;
@@ -110,6 +161,67 @@ typedef struct {
 static_assert(sizeof(minfs_inode_t) == kMinfsInodeSize,
               "minfs inode size is wrong");
 
+// The inode maps its blocks with a minfs_extent_map_t, which takes the place
+// of dnum[] and inum[].
+constexpr uint32_t kMinfsInodeFlagExtents = 1;
+
+typedef struct {
+    uint32_t fbn;                   // first file block of the extent
+    uint32_t bno;                   // first device block of the extent
+    uint32_t count;                 // number of blocks
+} minfs_extent_t;
+
+constexpr uint32_t kMinfsInlineExtents   = 15;
+constexpr uint32_t kMinfsExtentsPerBlock = (kMinfsBlockSize / sizeof(minfs_extent_t));
+constexpr uint32_t kMinfsMaxExtents      = (kMinfsInlineExtents + kMinfsExtentsPerBlock);
+
+typedef struct {
+    minfs_extent_t extent[kMinfsInlineExtents];
+    uint32_t count;                 // number of extents
+    uint32_t ext_block;             // holds extents kMinfsInlineExtents..count
+    uint32_t rsvd;
+} minfs_extent_map_t;
+
+static_assert(sizeof(minfs_extent_map_t) == sizeof(uint32_t) * (kMinfsDirect + kMinfsIndirect),
+              "minfs extent map does not overlay the block map");
+
+// Notes:
+// - extents are sorted by fbn and do not overlap; unmapped file blocks
+//   between them are holes, which read as zeroes
+// - ext_block is nonzero exactly when count exceeds kMinfsInlineExtents,
+//   and is included in the inode's block_count
+// - an inode which needs more than kMinfsMaxExtents extents is converted
+//   to the block map, which can describe any layout
+// - the file size limit (kMinfsMaxFileSize) is the same for both formats
+
+inline bool InodeHasExtents(const minfs_inode_t* inode) {
+    return (inode->flags & kMinfsInodeFlagExtents) != 0;
+}
+
+inline minfs_extent_map_t* InodeExtentMap(minfs_inode_t* inode) {
+    return reinterpret_cast<minfs_extent_map_t*>(inode->dnum);
+}
+
+inline const minfs_extent_map_t* InodeExtentMap(const minfs_inode_t* inode) {
+    return reinterpret_cast<const minfs_extent_map_t*>(inode->dnum);
+}
+
+// Returns extent 'n' of 'map'; 'overflow' holds the contents of its ext_block.
+inline minfs_extent_t* ExtentAt(minfs_extent_map_t* map, void* overflow, uint32_t n) {
+    if (n < kMinfsInlineExtents) {
+        return &map->extent[n];
+    }
+    return reinterpret_cast<minfs_extent_t*>(overflow) + (n - kMinfsInlineExtents);
+}
+
+inline const minfs_extent_t* ExtentAt(const minfs_extent_map_t* map, const void* overflow,
+                                      uint32_t n) {
+    if (n < kMinfsInlineExtents) {
+        return &map->extent[n];
+    }
+    return reinterpret_cast<const minfs_extent_t*>(overflow) + (n - kMinfsInlineExtents);
+}
+
 typedef struct {
     uint32_t ino;                   // inode number
     uint32_t reclen;                // Low 28 bits: Length of record
@@ -163,6 +275,23 @@ static_assert(kMinfsMaxDirectorySize <= kMinfsReclenMask,
 
 // Block Cache (bcache.c)
 constexpr uint32_t kMinfsHashBits = (8);
+constexpr uint32_t kMinfsBlockCacheSize = 64;
+// Blocks fetched per read once sequential access is detected.
+constexpr uint32_t kMinfsReadAheadBlocks = 8;
+
+static_assert(kMinfsReadAheadBlocks <= kMinfsBlockCacheSize / 2,
+              "Read-ahead must not be able to evict the whole block cache");
+
+class Journal;
+
+struct BlockCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t readahead_blocks; // Blocks fetched speculatively
+    uint64_t readahead_hits;   // Hits on blocks which were fetched speculatively
+    uint64_t writeback_blocks; // Dirty blocks written back to disk
+    uint64_t flushes;          // Batched write-back transactions
+};
 
 class Bcache {
 public:
@@ -171,8 +300,12 @@ public:
 
     static mx_status_t Create(mxtl::unique_ptr<Bcache>* out, int fd, uint32_t blockmax);
 
-    // Raw block read functions.
-    // These do not track blocks (or attempt to access the block cache)
+    // Cached block read and write functions.
+    //
+    // Blocks are held in an LRU cache of kMinfsBlockCacheSize blocks. On
+    // Fuchsia, writes are deferred until the block is evicted, Sync() is
+    // called, or a transaction is issued through Txn(); the host tools write
+    // through, since they may exit without tearing down the cache.
     mx_status_t Readblk(uint32_t bno, void* data);
     mx_status_t Writeblk(uint32_t bno, const void* data);
 
@@ -181,23 +314,91 @@ public:
 #ifdef __Fuchsia__
     ssize_t GetDevicePath(char* out, size_t out_len);
     mx_status_t AttachVmo(mx_handle_t vmo, vmoid_t* out);
-    mx_status_t Txn(block_fifo_request_t* requests, size_t count) {
-        return block_fifo_txn(fifo_client_, requests, count);
-    }
+    // Issues requests on the block fifo. Dirty cached blocks are written back
+    // first, and cached copies of blocks overwritten by the requests are
+    // dropped, so the cache stays coherent with VMO-based transactions.
+    mx_status_t Txn(block_fifo_request_t* requests, size_t count);
     txnid_t TxnId() const { return txnid_; }
+
+    // Routes transactions issued through Txn() via the metadata journal.
+    void SetJournal(Journal* journal) { journal_ = journal; }
 #endif
 
+    // Writes back all dirty blocks without syncing the underlying device.
+    mx_status_t Flush();
     int Sync();
 
+    void GetStats(BlockCacheStats* out) const { *out = stats_; }
+    uint32_t DirtyCount() const { return dirty_count_; }
+
     ~Bcache();
 
 private:
+    // One cached block; 'slot' is its fixed index within the cache buffer.
+    struct Entry : public mxtl::SinglyLinkedListable<Entry*>,
+                   public mxtl::DoublyLinkedListable<Entry*> {
+        uint32_t GetKey() const { return bno; }
+        static size_t GetHash(uint32_t key) { return fnv1a_tiny(key, kMinfsHashBits); }
+
+        uint32_t bno;
+        uint32_t slot;
+        bool dirty;
+        bool prefetched; // Read ahead, and not yet accessed
+    };
+
+    // A run of blocks contiguous both on disk and within the cache buffer.
+    struct BlockRun {
+        uint32_t slot;
+        uint32_t bno;
+        uint32_t count;
+    };
+
     Bcache(int fd, uint32_t blockmax);
+    mx_status_t Init();
+
+    void* SlotData(uint32_t slot) const {
+        return reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(cache_data_) +
+                                       slot * kMinfsBlockSize);
+    }
+
+    // Looks up a cached block, marking it most recently used.
+    Entry* Lookup(uint32_t bno);
+    // Takes an entry off the free list, evicting the least recently used
+    // block if necessary. The entry is in neither the LRU list nor the hash.
+    mx_status_t GetFreeEntry(Entry** out);
+    void Insert(Entry* entry);
+    void Invalidate(uint64_t bno, uint64_t count);
+
+    // Fetches 'bno' and, if reads appear sequential, the blocks following it.
+    mx_status_t Fill(uint32_t bno, Entry** out);
+    mx_status_t WriteBack(Entry** entries, size_t count);
+    mx_status_t IssueRuns(const BlockRun* runs, size_t count, bool write);
 
 #ifdef __Fuchsia__
+    // The journal issues its own requests, bypassing both the cache and itself.
+    friend class Journal;
+    mx_status_t RawTxn(block_fifo_request_t* requests, size_t count) {
+        return block_fifo_txn(fifo_client_, requests, count);
+    }
+
     fifo_client_t* fifo_client_{}; // Fast path to interact with block device
     txnid_t txnid_{}; // TODO(smklein): One per thread
+    mxtl::unique_ptr<MappedVmo> cache_vmo_{};
+    vmoid_t cache_vmoid_{};
+    Journal* journal_{};
+#else
+    mxtl::unique_free_ptr<uint8_t> cache_buffer_{};
 #endif
+    void* cache_data_{};
+
+    Entry entries_[kMinfsBlockCacheSize]{};
+    mxtl::DoublyLinkedList<Entry*> lru_{};  // Most recently used at the front
+    mxtl::DoublyLinkedList<Entry*> free_{};
+    mxtl::HashTable<uint32_t, Entry*> hash_{};
+    uint32_t dirty_count_{};
+    uint32_t last_read_bno_{};
+    BlockCacheStats stats_{};
+
     int fd_ = -1;
     uint32_t blockmax_{};
 };
@@ -5,6 +5,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -16,8 +17,11 @@
 #include <mxtl/algorithm.h>
 
 #include "host.h"
+#include "minfs-private.h"
 #include "misc.h"
 
+extern mxtl::RefPtr<minfs::VnodeMinfs> fake_root;
+
 #define TRY(func) ({\
     int ret = (func); \
     if (ret < 0) { \
@@ -260,6 +264,61 @@ int test_maxfile() {
     return (r < 0) ? -1 : 0;
 }
 
+// Fill the volume with one-block files and free every other one, so that a
+// large file must be written into more runs than the extent map can hold.
+int test_fragmented() {
+    char name[32];
+    char data[8192];
+    memset(data, 0x5a, sizeof(data));
+    int count = 0;
+    for (;; count++) {
+        snprintf(name, sizeof(name), "::frag%06d", count);
+        int fd = emu_open(name, O_CREAT | O_WRONLY, 0644);
+        if (fd < 0) {
+            // Out of inodes before running out of blocks.
+            break;
+        }
+        ssize_t r = emu_write(fd, data, sizeof(data));
+        emu_close(fd);
+        if (r != sizeof(data)) {
+            TRY(emu_unlink(name));
+            break;
+        }
+    }
+    for (int n = 0; n < count; n += 2) {
+        snprintf(name, sizeof(name), "::frag%06d", n);
+        TRY(emu_unlink(name));
+    }
+
+    // Each block is tagged with its index, to catch misplaced blocks. Holes
+    // are left for the indirect blocks the file ends up needing, one per
+    // kPerIndirect blocks, plus a few for the extent block it starts with.
+    const int kPerIndirect = minfs::kMinfsBlockSize / sizeof(uint32_t);
+    int holes = count / 2;
+    int blocks = holes - (holes + kPerIndirect - 1) / kPerIndirect - 4;
+    blocks = mxtl::min(blocks, static_cast<int>(minfs::kMinfsMaxFileBlock));
+    int fd = TRY(emu_open("::fragfile", O_CREAT | O_RDWR, 0644));
+    for (int n = 0; n < blocks; n++) {
+        memcpy(data, &n, sizeof(n));
+        if (TRY(emu_write(fd, data, sizeof(data))) != sizeof(data)) {
+            fprintf(stderr, "short write at block %d of %d\n", n, blocks);
+            return -1;
+        }
+    }
+    TRY(emu_lseek(fd, 0, SEEK_SET));
+    for (int n = 0; n < blocks; n++) {
+        int tag;
+        if ((TRY(emu_read(fd, data, sizeof(data))) != sizeof(data)) ||
+            (memcpy(&tag, data, sizeof(tag)), tag != n)) {
+            fprintf(stderr, "bad data at block %d\n", n);
+            return -1;
+        }
+    }
+    emu_close(fd);
+    fprintf(stderr, "wrote %d blocks into one-block holes\n", blocks);
+    return 0;
+}
+
 int test_basic() {
     TRY(emu_mkdir("::alpha", 0755));
     TRY(emu_mkdir("::alpha/bravo", 0755));
@@ -305,6 +364,200 @@ int test_rename() {
     return 0;
 }
 
+static minfs::BlockCacheStats cache_stats() {
+    minfs::BlockCacheStats stats;
+    fake_root->fs_->bc_->GetStats(&stats);
+    return stats;
+}
+
+static int write_blocks(const char* name, uint32_t count, uint8_t tag) {
+    char data[minfs::kMinfsBlockSize];
+    memset(data, tag, sizeof(data));
+    int fd = TRY(emu_open(name, O_CREAT | O_RDWR, 0644));
+    for (uint32_t n = 0; n < count; n++) {
+        if (TRY(emu_write(fd, data, sizeof(data))) != sizeof(data)) {
+            return -1;
+        }
+    }
+    return fd;
+}
+
+// Host tools read file data through the block cache, so its counters can be
+// checked against a known access pattern.
+int test_cache() {
+    char data[minfs::kMinfsBlockSize];
+    char expected[minfs::kMinfsBlockSize];
+    const uint32_t blocks = minfs::kMinfsDirect;
+
+    int fd = write_blocks("::cached", blocks, 0x11);
+    // Push the first file out of the cache by writing a larger one.
+    emu_close(write_blocks("::evictor", minfs::kMinfsBlockCacheSize * 2, 0x22));
+
+    // A sequential read misses once per read-ahead window, not once per block.
+    minfs::BlockCacheStats before = cache_stats();
+    TRY(emu_lseek(fd, 0, SEEK_SET));
+    for (uint32_t n = 0; n < blocks; n++) {
+        TRY(emu_read(fd, data, sizeof(data)));
+    }
+    minfs::BlockCacheStats after = cache_stats();
+    if ((after.readahead_blocks == before.readahead_blocks) ||
+        (after.readahead_hits == before.readahead_hits) ||
+        (after.misses - before.misses >= blocks / 2)) {
+        fprintf(stderr, "sequential read: %" PRIu64 " misses, %" PRIu64 " blocks read ahead, "
+                "%" PRIu64 " read-ahead hits\n", after.misses - before.misses,
+                after.readahead_blocks - before.readahead_blocks,
+                after.readahead_hits - before.readahead_hits);
+        return -1;
+    }
+
+    // Reading the same block again is a hit.
+    before = after;
+    TRY(emu_lseek(fd, 0, SEEK_SET));
+    TRY(emu_read(fd, data, sizeof(data)));
+    after = cache_stats();
+    if ((after.misses != before.misses) || (after.hits == before.hits)) {
+        fprintf(stderr, "repeated read missed the cache\n");
+        return -1;
+    }
+
+    // A block just written is read back from the cache, before any flush.
+    memset(expected, 0x33, sizeof(expected));
+    TRY(emu_lseek(fd, minfs::kMinfsBlockSize, SEEK_SET));
+    TRY(emu_write(fd, expected, sizeof(expected)));
+    before = cache_stats();
+    TRY(emu_lseek(fd, minfs::kMinfsBlockSize, SEEK_SET));
+    TRY(emu_read(fd, data, sizeof(data)));
+    after = cache_stats();
+    if (memcmp(data, expected, sizeof(data)) || (after.misses != before.misses) ||
+        (after.flushes != before.flushes)) {
+        fprintf(stderr, "written block not read back from the cache\n");
+        return -1;
+    }
+
+    emu_close(fd);
+    TRY(emu_unlink("::cached"));
+    TRY(emu_unlink("::evictor"));
+    return 0;
+}
+
+// Writes a journal entry for 'seq' into journal slot 'slot', logging one
+// payload block filled with tags[i] for each of bnos[0..count).
+static int write_journal_entry(minfs::Bcache* bc, const minfs::minfs_info_t& info,
+                               uint32_t slot, uint64_t seq, const uint32_t* bnos,
+                               const uint8_t* tags, uint32_t count) {
+    uint8_t hdr[minfs::kMinfsBlockSize];
+    uint8_t data[minfs::kMinfsBlockSize];
+    memset(hdr, 0, sizeof(hdr));
+    minfs::minfs_journal_entry_t* entry = reinterpret_cast<minfs::minfs_journal_entry_t*>(hdr);
+    entry->magic = minfs::kMinfsJournalEntryMagic;
+    entry->seq = seq;
+    entry->count = count;
+    uint64_t* sums = reinterpret_cast<uint64_t*>(hdr + sizeof(*entry));
+    uint32_t* bno = reinterpret_cast<uint32_t*>(sums + count);
+    for (uint32_t i = 0; i < count; i++) {
+        memset(data, tags[i], sizeof(data));
+        sums[i] = fnv1a64(data, sizeof(data));
+        bno[i] = bnos[i];
+        if (bc->Writeblk(info.jnl_block + slot + 1 + i, data) != MX_OK) {
+            return -1;
+        }
+    }
+    entry->checksum = fnv1a64(hdr, sizeof(hdr));
+    return (bc->Writeblk(info.jnl_block + slot, hdr) == MX_OK) ? 0 : -1;
+}
+
+static int check_block(minfs::Bcache* bc, uint32_t bno, uint8_t tag) {
+    uint8_t data[minfs::kMinfsBlockSize];
+    if (bc->Readblk(bno, data) != MX_OK) {
+        return -1;
+    }
+    for (size_t n = 0; n < sizeof(data); n++) {
+        if (data[n] != tag) {
+            fprintf(stderr, "block %u holds %#x, expected %#x\n", bno, data[n], tag);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static uint64_t journal_seq_start(minfs::Bcache* bc, const minfs::minfs_info_t& info) {
+    uint8_t data[minfs::kMinfsBlockSize];
+    if (bc->Readblk(info.jnl_block, data) != MX_OK) {
+        return 0;
+    }
+    return reinterpret_cast<minfs::minfs_journal_info_t*>(data)->seq_start;
+}
+
+// Replays hand-built journal entries the way a mount does, targeting free
+// blocks at the end of the volume.
+int test_journal() {
+    minfs::Bcache* bc = fake_root->fs_->bc_.get();
+    const minfs::minfs_info_t info = fake_root->fs_->info_;
+    const uint32_t bnos[2] = { info.block_count - 1, info.block_count - 2 };
+    uint8_t tags[2];
+    uint64_t seq = journal_seq_start(bc, info);
+    uint64_t next;
+
+    // A committed entry is written home, and the journal is checkpointed
+    // past it, so replaying again does nothing.
+    tags[0] = 0xa1;
+    tags[1] = 0xa2;
+    TRY(write_journal_entry(bc, info, 1, seq, bnos, tags, 2));
+    if (minfs::minfs_journal_replay(bc, &info, &next) != MX_OK) {
+        return -1;
+    }
+    TRY(check_block(bc, bnos[0], 0xa1));
+    TRY(check_block(bc, bnos[1], 0xa2));
+    if ((next != seq + 1) || (journal_seq_start(bc, info) != seq + 1)) {
+        fprintf(stderr, "journal not checkpointed after replay\n");
+        return -1;
+    }
+    seq = next;
+    tags[0] = 0xb1;
+    TRY(write_journal_entry(bc, info, 3, seq, bnos, tags, 1));
+    if ((minfs::minfs_journal_replay(bc, &info, &next) != MX_OK) || (next != seq)) {
+        return -1;
+    }
+    TRY(check_block(bc, bnos[0], 0xa1));
+
+    // An entry whose payload does not match its checksum is torn; the
+    // intact entry before it is still applied.
+    tags[0] = 0xc1;
+    TRY(write_journal_entry(bc, info, 1, seq, &bnos[0], &tags[0], 1));
+    tags[1] = 0xc2;
+    TRY(write_journal_entry(bc, info, 3, seq + 1, &bnos[1], &tags[1], 1));
+    uint8_t data[minfs::kMinfsBlockSize];
+    memset(data, 0xee, sizeof(data));
+    TRY(bc->Writeblk(info.jnl_block + 4, data));
+    if ((minfs::minfs_journal_replay(bc, &info, &next) != MX_OK) || (next != seq + 1)) {
+        return -1;
+    }
+    TRY(check_block(bc, bnos[0], 0xc1));
+    TRY(check_block(bc, bnos[1], 0xa2));
+    seq = next;
+
+    // Neither a corrupt header nor an unexpected sequence number is replayed.
+    tags[0] = 0xd1;
+    TRY(write_journal_entry(bc, info, 1, seq, bnos, tags, 1));
+    TRY(bc->Readblk(info.jnl_block + 1, data));
+    reinterpret_cast<minfs::minfs_journal_entry_t*>(data)->checksum ^= 1;
+    TRY(bc->Writeblk(info.jnl_block + 1, data));
+    if ((minfs::minfs_journal_replay(bc, &info, &next) != MX_OK) || (next != seq)) {
+        return -1;
+    }
+    TRY(check_block(bc, bnos[0], 0xc1));
+    TRY(write_journal_entry(bc, info, 1, seq + 1, bnos, tags, 1));
+    if ((minfs::minfs_journal_replay(bc, &info, &next) != MX_OK) || (next != seq)) {
+        return -1;
+    }
+    TRY(check_block(bc, bnos[0], 0xc1));
+
+    // Leave no entry behind for the next mount.
+    memset(data, 0, sizeof(data));
+    TRY(bc->Writeblk(info.jnl_block + 1, data));
+    return 0;
+}
+
 int run_fs_tests(int argc, char** argv) {
     fprintf(stderr, "--- fs tests ---\n");
     if (argc > 0) {
@@ -314,12 +567,21 @@ int run_fs_tests(int argc, char** argv) {
         if (!strcmp(argv[0], "rw1")) {
             return test_rw1();
         }
+        if (!strcmp(argv[0], "fragmented")) {
+            return test_fragmented();
+        }
         if (!strcmp(argv[0], "basic")) {
             return test_basic();
         }
         if (!strcmp(argv[0], "rename")) {
             return test_rename();
         }
+        if (!strcmp(argv[0], "cache")) {
+            return test_cache();
+        }
+        if (!strcmp(argv[0], "journal")) {
+            return test_journal();
+        }
         fprintf(stderr, "unknown test: %s\n", argv[0]);
         return -1;
     }
@@ -0,0 +1,184 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <assert.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+
+#include <magenta/compiler.h>
+#include <magenta/syscalls.h>
+#include <magenta/syscalls/port.h>
+#include <mxtl/algorithm.h>
+#include <mxtl/unique_ptr.h>
+
+namespace {
+
+constexpr uint64_t kStopKey = ~0ull;
+
+void argument_error(const char* argv0, const char* message) {
+    fprintf(stderr, "%s: error: %s\nRun with -h for help.\n", argv0, message);
+    exit(EXIT_FAILURE);
+}
+
+struct ThreadArgs {
+    mx_handle_t port;
+    uint32_t packets;
+    uint64_t received;
+};
+
+// Queues |packets| user packets on the port.
+int producer_thread(void* arg) {
+    auto args = static_cast<ThreadArgs*>(arg);
+    mx_port_packet_t in = {};
+    in.type = MX_PKT_TYPE_USER;
+    for (uint32_t i = 0; i < args->packets; i++) {
+        in.key = i;
+        __UNUSED mx_status_t status = mx_port_queue(args->port, &in, 0u);
+        assert(status == MX_OK);
+    }
+    return 0;
+}
+
+// Dequeues packets until it sees a stop packet.
+int consumer_thread(void* arg) {
+    auto args = static_cast<ThreadArgs*>(arg);
+    mx_port_packet_t out = {};
+    for (;;) {
+        __UNUSED mx_status_t status = mx_port_wait(args->port, MX_TIME_INFINITE, &out, 0u);
+        assert(status == MX_OK);
+        if (out.key == kStopKey)
+            return 0;
+        args->received++;
+    }
+}
+
+void do_test(uint32_t packets, uint32_t producers, uint32_t consumers) {
+    mx_handle_t port;
+    __UNUSED mx_status_t status = mx_port_create(0u, &port);
+    assert(status == MX_OK);
+
+    mxtl::unique_ptr<ThreadArgs[]> producer_args(new ThreadArgs[producers]);
+    mxtl::unique_ptr<ThreadArgs[]> consumer_args(new ThreadArgs[consumers]);
+    mxtl::unique_ptr<thrd_t[]> producer_thrds(new thrd_t[producers]);
+    mxtl::unique_ptr<thrd_t[]> consumer_thrds(new thrd_t[consumers]);
+
+    uint64_t start_ns = mx_time_get(MX_CLOCK_MONOTONIC);
+
+    for (uint32_t i = 0; i < consumers; i++) {
+        consumer_args[i] = {port, 0u, 0u};
+        __UNUSED int ret = thrd_create(&consumer_thrds[i], consumer_thread, &consumer_args[i]);
+        assert(ret == thrd_success);
+    }
+    for (uint32_t i = 0; i < producers; i++) {
+        producer_args[i] = {port, packets, 0u};
+        __UNUSED int ret = thrd_create(&producer_thrds[i], producer_thread, &producer_args[i]);
+        assert(ret == thrd_success);
+    }
+    for (uint32_t i = 0; i < producers; i++)
+        thrd_join(producer_thrds[i], nullptr);
+
+    // The stop packets queue behind every other packet.
+    mx_port_packet_t stop = {};
+    stop.key = kStopKey;
+    for (uint32_t i = 0; i < consumers; i++) {
+        status = mx_port_queue(port, &stop, 0u);
+        assert(status == MX_OK);
+    }
+
+    uint64_t received = 0;
+    for (uint32_t i = 0; i < consumers; i++) {
+        thrd_join(consumer_thrds[i], nullptr);
+        received += consumer_args[i].received;
+    }
+
+    uint64_t end_ns = mx_time_get(MX_CLOCK_MONOTONIC);
+    assert(received == static_cast<uint64_t>(packets) * producers);
+    mx_handle_close(port);
+
+    double real_duration = static_cast<double>(end_ns - start_ns) / 1000000000.0;
+    printf("port queue/wait, %" PRIu32 " producer(s) x %" PRIu32 " consumer(s): "
+               "%.0f packets/second\n",
+           producers, consumers, static_cast<double>(received) / real_duration);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    static constexpr char help[] =
+        "Usage: %s [options ...]\n"
+        "\n"
+        "Options:\n"
+        "  -h    show help (this)\n"
+        "  -o    run single test (default)\n"
+        "  -s    run suite (ignores -p/-c)\n"
+        "  -n N  queue N packets per producer (default: 100000)\n"
+        "  -p N  set producer thread count to N (default: 1)\n"
+        "  -c N  set consumer thread count to N (default: 1)\n";
+
+    bool run_suite = false;    // -o/-s
+    uint32_t packets = 100000; // -n
+    uint32_t producers = 1;    // -p
+    uint32_t consumers = 1;    // -c
+
+    int opt;
+    while ((opt = getopt(argc, argv, "hosn:p:c:")) != -1) {
+        // Our option values are always unsigned numbers.
+        uint32_t value = 0;
+        if (optarg) {
+            errno = 0;
+            char* endptr = nullptr;
+            unsigned long long v = strtoull(optarg, &endptr, 10);
+            if (errno != 0 || *endptr != '\0' || v > UINT32_MAX)
+                argument_error(argv[0], "invalid numeric optional value");
+            value = static_cast<uint32_t>(v);
+        }
+
+        switch (opt) {
+            case 'h':
+                printf(help, argv[0]);
+                return EXIT_SUCCESS;
+            case 'o':
+                run_suite = false;
+                break;
+            case 's':
+                run_suite = true;
+                break;
+            case 'n':
+                packets = value;
+                break;
+            case 'p':
+                if (value == 0)
+                    argument_error(argv[0], "producer count must be positive");
+                producers = value;
+                break;
+            case 'c':
+                if (value == 0)
+                    argument_error(argv[0], "consumer count must be positive");
+                consumers = value;
+                break;
+            default:  // '?'
+                argument_error(argv[0], "invalid option");
+                break;
+        }
+    }
+    if (optind < argc)
+        argument_error(argv[0], "unexpected positional argument");
+
+    if (run_suite) {
+        static constexpr uint32_t kThreads[] = {1, 2, 4};
+        for (auto p : kThreads) {
+            for (auto c : kThreads)
+                do_test(packets, p, c);
+        }
+    } else {
+        do_test(packets, producers, consumers);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,146 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Compares the libc memcpy/memmove/memcmp/strlen against straightforward
+// C versions of the same routines over a range of sizes and alignments.
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <magenta/compiler.h>
+#include <magenta/syscalls.h>
+
+#define MAX_SIZE (1024 * 1024)
+#define BENCH_BYTES (64 * 1024 * 1024)
+#define MAX_ITER 100000
+
+__NO_INLINE static void* generic_memcpy(void* dst, const void* src, size_t n) {
+    uint8_t* d = dst;
+    const uint8_t* s = src;
+    while (n--)
+        *d++ = *s++;
+    return dst;
+}
+
+__NO_INLINE static void* generic_memmove(void* dst, const void* src, size_t n) {
+    uint8_t* d = dst;
+    const uint8_t* s = src;
+    if (d < s) {
+        while (n--)
+            *d++ = *s++;
+    } else {
+        while (n--)
+            d[n] = s[n];
+    }
+    return dst;
+}
+
+__NO_INLINE static int generic_memcmp(const void* s1, const void* s2, size_t n) {
+    const uint8_t* a = s1;
+    const uint8_t* b = s2;
+    for (; n; n--, a++, b++) {
+        if (*a != *b)
+            return *a - *b;
+    }
+    return 0;
+}
+
+__NO_INLINE static size_t generic_strlen(const char* s) {
+    const char* p = s;
+    while (*p)
+        p++;
+    return p - s;
+}
+
+typedef void (*bench_fn)(uint8_t* dst, uint8_t* src, size_t size, int generic);
+
+static void bench_memcpy(uint8_t* dst, uint8_t* src, size_t size, int generic) {
+    if (generic)
+        generic_memcpy(dst, src, size);
+    else
+        memcpy(dst, src, size);
+}
+
+static void bench_memmove(uint8_t* dst, uint8_t* src, size_t size, int generic) {
+    // an overlapping backward move, src and dst share the buffer
+    if (generic)
+        generic_memmove(src + 8, src, size);
+    else
+        memmove(src + 8, src, size);
+}
+
+static volatile int sink;
+
+static void bench_memcmp(uint8_t* dst, uint8_t* src, size_t size, int generic) {
+    sink = generic ? generic_memcmp(dst, src, size) : memcmp(dst, src, size);
+}
+
+static void bench_strlen(uint8_t* dst, uint8_t* src, size_t size, int generic) {
+    sink = (int)(generic ? generic_strlen((const char*)src) : strlen((const char*)src));
+}
+
+static uint64_t run_one(bench_fn fn, uint8_t* dst, uint8_t* src, size_t size,
+                        uint32_t iter, int generic) {
+    mx_time_t t = mx_time_get(MX_CLOCK_MONOTONIC);
+    for (uint32_t i = 0; i < iter; i++)
+        fn(dst, src, size, generic);
+    t = mx_time_get(MX_CLOCK_MONOTONIC) - t;
+
+    uint64_t bytes = (uint64_t)size * iter;
+    return t ? bytes * 1000 / t : 0;
+}
+
+static void run_bench(const char* name, bench_fn fn, uint8_t* dst, uint8_t* src,
+                      size_t offset, int is_strlen) {
+    printf("\n%s, src offset %zu\n", name, offset);
+    printf("%10s %10s %14s %14s\n", "size", "iter", "libc MB/s", "generic MB/s");
+
+    for (size_t size = 16; size <= MAX_SIZE; size <<= 1) {
+        uint32_t iter = BENCH_BYTES / size;
+        if (iter > MAX_ITER)
+            iter = MAX_ITER;
+
+        // memcmp walks the whole buffer, strlen needs the terminator
+        memset(src, 'a', MAX_SIZE + 64);
+        memset(dst, 'a', MAX_SIZE + 64);
+        if (is_strlen)
+            src[offset + size] = 0;
+
+        uint64_t libc = run_one(fn, dst, src + offset, size, iter, 0);
+        uint64_t generic = run_one(fn, dst, src + offset, size, iter, 1);
+        printf("%10zu %10u %14" PRIu64 " %14" PRIu64 "\n", size, iter, libc, generic);
+    }
+}
+
+int main(int argc, char** argv) {
+    uint8_t* src = aligned_alloc(64, MAX_SIZE + 128);
+    uint8_t* dst = aligned_alloc(64, MAX_SIZE + 128);
+    if (!src || !dst) {
+        printf("string-bench: out of memory\n");
+        return -1;
+    }
+
+    static const struct {
+        const char* name;
+        bench_fn fn;
+        int is_strlen;
+    } benches[] = {
+        {"memcpy", bench_memcpy, 0},
+        {"memmove", bench_memmove, 0},
+        {"memcmp", bench_memcmp, 0},
+        {"strlen", bench_strlen, 1},
+    };
+
+    for (size_t i = 0; i < countof(benches); i++) {
+        run_bench(benches[i].name, benches[i].fn, dst, src, 0, benches[i].is_strlen);
+        run_bench(benches[i].name, benches[i].fn, dst, src, 3, benches[i].is_strlen);
+    }
+
+    free(src);
+    free(dst);
+    return 0;
+}
@@ -243,6 +243,17 @@ public:
         return MX_ERR_NOT_SUPPORTED;
     }
 
+    // Acquire a read-only vmo holding the contents of a file, which clients
+    // may read from directly instead of issuing read requests.
+    //
+    // The vmo must reflect later writes to the file. If the file's size may
+    // change, 'stale' is set to an event which is signalled with
+    // MXIO_READ_VMO_STALE once 'size' is no longer accurate; otherwise it is
+    // left as MX_HANDLE_INVALID.
+    virtual mx_status_t GetReadVmo(mx_handle_t* vmo, mx_handle_t* stale, size_t* size) {
+        return MX_ERR_NOT_SUPPORTED;
+    }
+
     // Syncs the vnode with its underlying storage
     virtual mx_status_t Sync() {
         return MX_ERR_NOT_SUPPORTED;
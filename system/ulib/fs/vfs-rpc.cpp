@@ -531,6 +531,29 @@ mx_status_t vfs_handler_vn(mxrio_msg_t* msg, mxtl::RefPtr<Vnode> vn, vfs_iostate
         }
         return status;
     }
+    case MXRIO_READ_VMO: {
+        // The client takes over the seek offset while it reads from the vmo,
+        // which is only safe if nothing else on this connection moves it.
+        if ((ios->io_flags & O_ACCMODE) != O_RDONLY) {
+            return MX_ERR_NOT_SUPPORTED;
+        }
+        mxrio_read_vmo_t* data = reinterpret_cast<mxrio_read_vmo_t*>(msg->data);
+
+        mx_handle_t stale = MX_HANDLE_INVALID;
+        size_t size;
+        mx_status_t status = vn->GetReadVmo(&msg->handle[0], &stale, &size);
+        if (status != MX_OK) {
+            return status;
+        }
+        data->offset = ios->io_off;
+        data->size = size;
+        msg->datalen = sizeof(mxrio_read_vmo_t);
+        msg->hcount = 1;
+        if (stale != MX_HANDLE_INVALID) {
+            msg->handle[msg->hcount++] = stale;
+        }
+        return MX_OK;
+    }
     case MXRIO_SYNC: {
         return vn->Sync();
     }
@@ -51,7 +51,8 @@ __BEGIN_CDECLS
 #define MXRIO_LINK        (0x0000001a | MXRIO_ONE_HANDLE)
 #define MXRIO_MMAP         0x0000001b
 #define MXRIO_FCNTL        0x0000001c
-#define MXRIO_NUM_OPS      29
+#define MXRIO_READ_VMO     0x0000001d
+#define MXRIO_NUM_OPS      30
 
 #define MXRIO_OP(n)        ((n) & 0x3FF) // opcode
 #define MXRIO_HC(n)        (((n) >> 8) & 3) // handle count
@@ -64,7 +65,8 @@ __BEGIN_CDECLS
     "read_at", "write_at", "truncate", "rename", \
     "connect", "bind", "listen", "getsockname", \
     "getpeername", "getsockopt", "setsockopt", "getaddrinfo", \
-    "setattr", "sync", "link", "mmap", "fcntl" }
+    "setattr", "sync", "link", "mmap", "fcntl", \
+    "read_vmo" }
 
 const char* mxio_opname(uint32_t op);
 
@@ -155,6 +157,15 @@ typedef struct mxrio_mmap_data {
     int32_t flags;
 } mxrio_mmap_data_t;
 
+// Asserted on the event returned by READ_VMO once the file's size changes,
+// after which the client must stop reading from the VMO and ask again.
+#define MXIO_READ_VMO_STALE    MX_USER_SIGNAL_0
+
+typedef struct mxrio_read_vmo {
+    uint64_t offset;    // the connection's seek offset, owned by the client from now on
+    uint64_t size;      // the file's size, valid until the event is signalled
+} mxrio_read_vmo_t;
+
 static_assert(MXIO_CHUNK_SIZE >= PATH_MAX, "MXIO_CHUNK_SIZE must be large enough to contain paths");
 
 #define READDIR_CMD_NONE  0
@@ -193,6 +204,7 @@ static_assert(MXIO_CHUNK_SIZE >= PATH_MAX, "MXIO_CHUNK_SIZE must be large enough
 // LINK        0          0        <name1>0<name2>0  0           -               -
 // MMAP        maxreply   0        mmap_data_msg     0           mmap_data_msg   vmohandle
 // FCNTL       cmd        flags    0                 flags       -               -
+// READ_VMO    0          0        -                 0           read_vmo_msg    vmohandle [event]
 //
 // proposed:
 //
@@ -19,6 +19,16 @@ struct mxrio {
 
     // transaction id used for synchronous remoteio calls
     _Atomic mx_txid_t txid;
+
+    // read-only view of a file's contents, obtained with READ_VMO.
+    // While it is held, reads and seeks are served locally, and
+    // vmo_ptr (rather than the server) holds the seek offset.
+    mtx_t vmo_lock;
+    mx_handle_t vmo;
+    mx_handle_t vmo_stale;
+    mx_off_t vmo_size;
+    mx_off_t vmo_ptr;
+    bool vmo_unsupported;
 };
 
 // These are for the benefit of namespace.c
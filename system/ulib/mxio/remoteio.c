@@ -334,6 +334,134 @@ ssize_t mxrio_ioctl(mxio_t* io, uint32_t op, const void* in_buf,
     return r;
 }
 
+static off_t seek_common(mxrio_t* rio, off_t offset, int whence) {
+    mxrio_msg_t msg;
+    mx_status_t r;
+
+    memset(&msg, 0, MXRIO_HDR_SZ);
+    msg.op = MXRIO_SEEK;
+    msg.arg2.off = offset;
+    msg.arg = whence;
+
+    if ((r = mxrio_txn(rio, &msg)) < 0) {
+        return r;
+    }
+
+    discard_handles(msg.handle, msg.hcount);
+    return msg.arg2.off;
+}
+
+// A read-only file connection may ask the server for a vmo holding the
+// file's contents (READ_VMO), after which reads and seeks no longer need
+// a round-trip per MXIO_CHUNK_SIZE. If the server also returns an event,
+// the vmo is given up and requested again once the event reports that
+// the file's size has changed.
+//
+// The vmo_* helpers must be called with rio->vmo_lock held.
+
+// Closes the vmo, handing the seek offset back to the server.
+static void vmo_release(mxrio_t* rio) {
+    mx_handle_close(rio->vmo);
+    rio->vmo = MX_HANDLE_INVALID;
+    if (rio->vmo_stale != MX_HANDLE_INVALID) {
+        mx_handle_close(rio->vmo_stale);
+        rio->vmo_stale = MX_HANDLE_INVALID;
+    }
+    seek_common(rio, rio->vmo_ptr, SEEK_SET);
+}
+
+// Ensures rio->vmo is valid and up to date, asking the server for
+// a new one if needed.
+static mx_status_t vmo_acquire(mxrio_t* rio) {
+    if (rio->vmo != MX_HANDLE_INVALID) {
+        if ((rio->vmo_stale == MX_HANDLE_INVALID) ||
+            (mx_object_wait_one(rio->vmo_stale, MXIO_READ_VMO_STALE, 0, NULL) ==
+             MX_ERR_TIMED_OUT)) {
+            return MX_OK;
+        }
+        vmo_release(rio);
+    }
+    if (rio->vmo_unsupported) {
+        return MX_ERR_NOT_SUPPORTED;
+    }
+
+    mxrio_msg_t msg;
+    mx_status_t r;
+    memset(&msg, 0, MXRIO_HDR_SZ);
+    msg.op = MXRIO_READ_VMO;
+    if ((r = mxrio_txn(rio, &msg)) < 0) {
+        // Other errors may be transient, so only give up on the vmo for
+        // good if the server can't provide one at all.
+        if (r == MX_ERR_NOT_SUPPORTED) {
+            rio->vmo_unsupported = true;
+        }
+        return r;
+    }
+    if ((msg.hcount < 1) || (msg.hcount > 2) ||
+        (msg.datalen != sizeof(mxrio_read_vmo_t))) {
+        discard_handles(msg.handle, msg.hcount);
+        return MX_ERR_IO;
+    }
+    mxrio_read_vmo_t* data = (mxrio_read_vmo_t*)msg.data;
+    rio->vmo = msg.handle[0];
+    rio->vmo_stale = (msg.hcount == 2) ? msg.handle[1] : MX_HANDLE_INVALID;
+    rio->vmo_size = data->size;
+    rio->vmo_ptr = data->offset;
+    return MX_OK;
+}
+
+// Reads from the file's vmo, at 'offset' or (if NULL) at the seek offset.
+// Returns MX_ERR_NOT_SUPPORTED if the read must go to the server instead.
+static ssize_t read_vmo(mxrio_t* rio, void* data, size_t len, const mx_off_t* offset) {
+    mtx_lock(&rio->vmo_lock);
+    if (vmo_acquire(rio) != MX_OK) {
+        mtx_unlock(&rio->vmo_lock);
+        return MX_ERR_NOT_SUPPORTED;
+    }
+
+    mx_off_t at = (offset != NULL) ? *offset : rio->vmo_ptr;
+    if (at >= rio->vmo_size) {
+        len = 0;
+    } else if (len > (rio->vmo_size - at)) {
+        len = rio->vmo_size - at;
+    }
+
+    if ((len > 0) && (mx_vmo_read(rio->vmo, data, at, len, &len) != MX_OK)) {
+        // The file shrank underneath us; let the server sort it out.
+        vmo_release(rio);
+        mtx_unlock(&rio->vmo_lock);
+        return MX_ERR_NOT_SUPPORTED;
+    }
+    if (offset == NULL) {
+        rio->vmo_ptr = at + len;
+    }
+    mtx_unlock(&rio->vmo_lock);
+    return len;
+}
+
+// Returns a copy-on-write snapshot of the file's contents. The server
+// keeps writing into its own vmo, so that is never handed out directly.
+static mx_status_t snapshot_vmo(mxrio_t* rio, mx_handle_t* out, mx_off_t* size) {
+    mtx_lock(&rio->vmo_lock);
+    mx_status_t r;
+    mx_handle_t clone;
+    if ((r = vmo_acquire(rio)) == MX_OK) {
+        *size = rio->vmo_size;
+        r = mx_vmo_clone(rio->vmo, MX_VMO_CLONE_COPY_ON_WRITE, 0, rio->vmo_size, &clone);
+    }
+    mtx_unlock(&rio->vmo_lock);
+    if (r != MX_OK) {
+        return r;
+    }
+    // No WRITE or SET_PROPERTY; DUPLICATE is kept so callers can clone it.
+    r = mx_handle_replace(clone, MX_RIGHT_TRANSFER | MX_RIGHT_DUPLICATE | MX_RIGHT_READ |
+                          MX_RIGHT_MAP | MX_RIGHT_GET_PROPERTY, out);
+    if (r != MX_OK) {
+        mx_handle_close(clone);
+    }
+    return r;
+}
+
 static ssize_t write_common(uint32_t op, mxio_t* io, const void* _data, size_t len, off_t offset) {
     mxrio_t* rio = (mxrio_t*)io;
     const uint8_t* data = _data;
@@ -375,6 +503,14 @@ static ssize_t write_common(uint32_t op, mxio_t* io, const void* _data, size_t l
 }
 
 static ssize_t mxrio_write(mxio_t* io, const void* _data, size_t len) {
+    mxrio_t* rio = (mxrio_t*)io;
+
+    // Writes advance the seek offset on the server, so it must hold it.
+    mtx_lock(&rio->vmo_lock);
+    if (rio->vmo != MX_HANDLE_INVALID) {
+        vmo_release(rio);
+    }
+    mtx_unlock(&rio->vmo_lock);
     return write_common(MXRIO_WRITE, io, _data, len, 0);
 }
 
@@ -424,29 +560,54 @@ static ssize_t read_common(uint32_t op, mxio_t* io, void* _data, size_t len, off
 }
 
 static ssize_t mxrio_read(mxio_t* io, void* _data, size_t len) {
+    ssize_t r = read_vmo((mxrio_t*)io, _data, len, NULL);
+    if (r != MX_ERR_NOT_SUPPORTED) {
+        return r;
+    }
     return read_common(MXRIO_READ, io, _data, len, 0);
 }
 
 static ssize_t mxrio_read_at(mxio_t* io, void* _data, size_t len, mx_off_t offset) {
+    ssize_t r = read_vmo((mxrio_t*)io, _data, len, &offset);
+    if (r != MX_ERR_NOT_SUPPORTED) {
+        return r;
+    }
     return read_common(MXRIO_READ_AT, io, _data, len, offset);
 }
 
 static off_t mxrio_seek(mxio_t* io, off_t offset, int whence) {
     mxrio_t* rio = (mxrio_t*)io;
-    mxrio_msg_t msg;
-    mx_status_t r;
 
-    memset(&msg, 0, MXRIO_HDR_SZ);
-    msg.op = MXRIO_SEEK;
-    msg.arg2.off = offset;
-    msg.arg = whence;
-
-    if ((r = mxrio_txn(rio, &msg)) < 0) {
-        return r;
+    mtx_lock(&rio->vmo_lock);
+    if ((rio->vmo != MX_HANDLE_INVALID) && (vmo_acquire(rio) == MX_OK)) {
+        // The seek offset lives here while the vmo is held.
+        mx_off_t base;
+        switch (whence) {
+        case SEEK_SET:
+            base = 0;
+            break;
+        case SEEK_CUR:
+            base = rio->vmo_ptr;
+            break;
+        case SEEK_END:
+            base = rio->vmo_size;
+            break;
+        default:
+            mtx_unlock(&rio->vmo_lock);
+            return MX_ERR_INVALID_ARGS;
+        }
+        mx_off_t at = base + offset;
+        if ((offset < 0) ? (at > base) : (at < base)) {
+            // wrapped around
+            mtx_unlock(&rio->vmo_lock);
+            return MX_ERR_INVALID_ARGS;
+        }
+        rio->vmo_ptr = at;
+        mtx_unlock(&rio->vmo_lock);
+        return at;
     }
-
-    discard_handles(msg.handle, msg.hcount);
-    return msg.arg2.off;
+    mtx_unlock(&rio->vmo_lock);
+    return seek_common(rio, offset, whence);
 }
 
 mx_status_t mxrio_close(mxio_t* io) {
@@ -461,6 +622,15 @@ mx_status_t mxrio_close(mxio_t* io) {
         discard_handles(msg.handle, msg.hcount);
     }
 
+    if (rio->vmo != MX_HANDLE_INVALID) {
+        mx_handle_close(rio->vmo);
+        rio->vmo = MX_HANDLE_INVALID;
+    }
+    if (rio->vmo_stale != MX_HANDLE_INVALID) {
+        mx_handle_close(rio->vmo_stale);
+        rio->vmo_stale = MX_HANDLE_INVALID;
+    }
+
     mx_handle_t h = rio->h;
     rio->h = 0;
     mx_handle_close(h);
@@ -842,6 +1012,11 @@ mx_status_t __mxrio_clone(mx_handle_t h, mx_handle_t* handles, uint32_t* types)
 static mx_status_t mxrio_unwrap(mxio_t* io, mx_handle_t* handles, uint32_t* types) {
     mxrio_t* rio = (void*)io;
     mx_status_t r;
+    mtx_lock(&rio->vmo_lock);
+    if (rio->vmo != MX_HANDLE_INVALID) {
+        vmo_release(rio);
+    }
+    mtx_unlock(&rio->vmo_lock);
     handles[0] = rio->h;
     types[0] = PA_MXIO_REMOTE;
     if (rio->h2 != 0) {
@@ -878,6 +1053,18 @@ static void mxrio_wait_end(mxio_t* io, mx_signals_t signals, uint32_t* _events)
     *_events = ((signals >> POLL_SHIFT) & POLL_MASK) | events;
 }
 
+static mx_status_t mxrio_get_vmo(mxio_t* io, mx_handle_t* out, size_t* off, size_t* len) {
+    mxrio_t* rio = (mxrio_t*)io;
+    mx_off_t size;
+    mx_status_t r;
+    if ((r = snapshot_vmo(rio, out, &size)) != MX_OK) {
+        return r;
+    }
+    *off = 0;
+    *len = size;
+    return MX_OK;
+}
+
 static mxio_ops_t mx_remote_ops = {
     .read = mxrio_read,
     .read_at = mxrio_read_at,
@@ -895,7 +1082,7 @@ static mxio_ops_t mx_remote_ops = {
     .wait_end = mxrio_wait_end,
     .unwrap = mxrio_unwrap,
     .posix_ioctl = mxio_default_posix_ioctl,
-    .get_vmo = mxio_default_get_vmo,
+    .get_vmo = mxrio_get_vmo,
 };
 
 mxio_t* mxio_remote_create(mx_handle_t h, mx_handle_t e) {
@@ -910,5 +1097,6 @@ mxio_t* mxio_remote_create(mx_handle_t h, mx_handle_t e) {
     atomic_init(&rio->io.refcount, 1);
     rio->h = h;
     rio->h2 = e;
+    mtx_init(&rio->vmo_lock, mtx_plain);
     return &rio->io;
 }
@@ -183,6 +183,12 @@ public:
     // make_iterator : construct an iterator out of a pointer to an object
     iterator make_iterator(ValueType& obj) { return iterator(&obj); }
 
+    // root : an iterator to the root node of the tree, invalid if the tree is
+    // empty.  Used along with the iterators' parent()/left()/right() to walk
+    // trees augmented through their Observer.
+    iterator       root()       { return iterator(PtrTraits::GetRaw(root_)); }
+    const_iterator root() const { return const_iterator(PtrTraits::GetRaw(root_)); }
+
     // is_empty : True if the tree has at least one element in it, false otherwise.
     bool is_empty() const { return root_ == nullptr; }
 
@@ -575,6 +581,23 @@ private:
             return IsValid() ? PtrTraits::Copy(node_) : nullptr;
         }
 
+        // Structural accessors.  Each returns an invalid iterator if this
+        // iterator is invalid or if there is no such node.
+        iterator_impl parent() const {
+            return IsValid() ? iterator_impl(NodeTraits::node_state(*node_).parent_)
+                             : iterator_impl();
+        }
+
+        iterator_impl left() const {
+            return IsValid() ? iterator_impl(PtrTraits::GetRaw(NodeTraits::node_state(*node_).left_))
+                             : iterator_impl();
+        }
+
+        iterator_impl right() const {
+            return IsValid() ? iterator_impl(PtrTraits::GetRaw(NodeTraits::node_state(*node_).right_))
+                             : iterator_impl();
+        }
+
         typename IterTraits::RefType operator*()     const { MX_DEBUG_ASSERT(node_); return *node_; }
         typename IterTraits::RawPtrType operator->() const { MX_DEBUG_ASSERT(node_); return node_; }
 
@@ -666,6 +689,7 @@ private:
 
             ++count_;
             Observer::RecordInsert();
+            Observer::RecordInsertLinked(iterator(PtrTraits::GetRaw(root_)));
             return;
         }
 
@@ -741,6 +765,7 @@ private:
 
         ++count_;
         Observer::RecordInsert();
+        Observer::RecordInsertLinked(iterator(PtrTraits::GetRaw(*owner)));
 
         // Finally, perform post-insert balance operations.
         BalancePostInsert(PtrTraits::GetRaw(*owner));
@@ -881,6 +906,7 @@ private:
         // Update the count bookkeeping.
         --count_;
         Observer::RecordErase();
+        Observer::RecordEraseUnlinked(iterator(parent));
 
         // Time to rebalance.  We know that we don't need to rebalance if we
         // just removed the root (IOW - its parent was the sentinel value).
@@ -1260,6 +1286,8 @@ private:
         Z_ns.parent_ = X;
         if (Y)
             NodeTraits::node_state(*Y).parent_ = Z;
+
+        Observer::RecordRotation(iterator(Z), iterator(X));
     }
 
     // PostInsertFixupLR<LRTraits>
@@ -37,6 +37,30 @@ struct DefaultWAVLTreeObserver {
     static void RecordEraseRotation()        { }
     static void RecordEraseDoubleRotation()  { }
 
+    // Augmentation hooks.
+    //
+    // Observers which keep per-subtree bookkeeping in the nodes of the tree
+    // (for example, the largest gap between neighbouring keys) are told about
+    // every structural change, so that they can recompute that bookkeeping
+    // from each node's children.  The iterator passed gives access to the
+    // node's parent() and left()/right() children.
+    //
+    // RecordInsertLinked  : |node| has just been linked in as a leaf, before
+    //                       any rebalancing.  It and each of its ancestors
+    //                       gained a descendant.
+    // RecordRotation      : |raised| has taken the place of its old parent,
+    //                       |lowered|, which is now its child.  Only the
+    //                       subtrees of these two nodes changed, and |lowered|
+    //                       must be recomputed first.
+    // RecordEraseUnlinked : a node has just been unlinked, before any
+    //                       rebalancing.  |node| is the lowest node which lost
+    //                       a descendant; it and each of its ancestors need
+    //                       recomputing.  It is invalid if the node removed
+    //                       was the root.
+    template <typename Iter> static void RecordInsertLinked(Iter node)            { }
+    template <typename Iter> static void RecordRotation(Iter lowered, Iter raised) { }
+    template <typename Iter> static void RecordEraseUnlinked(Iter node)           { }
+
     template <typename TreeType>
     static bool VerifyRankRule(const TreeType& tree, typename TreeType::RawPtrType node) {
         return true;
@@ -51,6 +75,10 @@ struct DefaultWAVLTreeObserver {
 }  // namespace tests
 }  // namespace intrusive_containers
 
+// Observers which only care about some of the hooks above may derive from the
+// default one and hide the rest.
+using DefaultWAVLTreeObserver = tests::intrusive_containers::DefaultWAVLTreeObserver;
+
 // Prototypes for the WAVL tree node state.  By default, we just use a bool to
 // record the rank parity of a node.  During testing, however, we actually use a
 // specialized version of the node state in which the rank is stored as an
@@ -455,6 +455,93 @@ static bool channel_may_discard(void) {
     END_TEST;
 }
 
+static bool channel_read_write_many(void) {
+    BEGIN_TEST;
+
+    mx_handle_t channel[2];
+    ASSERT_EQ(mx_channel_create(0, &channel[0], &channel[1]), MX_OK, "");
+
+    mx_handle_t event;
+    ASSERT_EQ(mx_event_create(0u, &event), MX_OK, "");
+
+    // Three messages in one call, the last one carrying a handle.
+    uint32_t data[3] = {1u, 2u, 3u};
+    mx_channel_msg_t msgs[4] = {};
+    for (uint32_t i = 0; i < 3u; ++i) {
+        msgs[i].bytes = &data[i];
+        msgs[i].num_bytes = sizeof(data[i]);
+    }
+    msgs[2].handles = &event;
+    msgs[2].num_handles = 1u;
+
+    uint32_t actual = 0u;
+    ASSERT_EQ(mx_channel_write_many(channel[0], 0u, msgs, 3u, &actual), MX_OK, "");
+    EXPECT_EQ(actual, 3u, "");
+    for (uint32_t i = 0; i < 3u; ++i)
+        EXPECT_EQ(msgs[i].status, MX_OK, "");
+
+    // Reading asks for up to four and gets the three that are queued.
+    uint32_t rd_data[4] = {};
+    mx_handle_t rd_handles[4] = {};
+    for (uint32_t i = 0; i < 4u; ++i) {
+        msgs[i].bytes = &rd_data[i];
+        msgs[i].num_bytes = sizeof(rd_data[i]);
+        msgs[i].handles = &rd_handles[i];
+        msgs[i].num_handles = 1u;
+        msgs[i].status = MX_ERR_INTERNAL;
+    }
+    ASSERT_EQ(mx_channel_read_many(channel[1], 0u, msgs, 4u, &actual), MX_OK, "");
+    EXPECT_EQ(actual, 3u, "");
+    for (uint32_t i = 0; i < 3u; ++i) {
+        EXPECT_EQ(msgs[i].status, MX_OK, "");
+        EXPECT_EQ(msgs[i].num_bytes, sizeof(uint32_t), "");
+        EXPECT_EQ(rd_data[i], i + 1u, "messages out of order");
+    }
+    EXPECT_EQ(msgs[0].num_handles, 0u, "");
+    EXPECT_EQ(msgs[2].num_handles, 1u, "");
+    EXPECT_EQ(mx_object_wait_one(channel[1], MX_CHANNEL_READABLE, 0u, NULL), MX_ERR_TIMED_OUT, "");
+    EXPECT_EQ(mx_channel_read_many(channel[1], 0u, msgs, 4u, &actual), MX_ERR_SHOULD_WAIT, "");
+
+    // A message too big for its buffer stops the read and stays queued.
+    for (uint32_t i = 0; i < 2u; ++i) {
+        msgs[i].bytes = &data[i];
+        msgs[i].num_bytes = sizeof(data[i]);
+        msgs[i].handles = NULL;
+        msgs[i].num_handles = 0u;
+    }
+    ASSERT_EQ(mx_channel_write_many(channel[0], 0u, msgs, 2u, &actual), MX_OK, "");
+    EXPECT_EQ(actual, 2u, "");
+
+    msgs[0].bytes = &rd_data[0];
+    msgs[0].num_bytes = sizeof(rd_data[0]);
+    msgs[1].bytes = &rd_data[1];
+    msgs[1].num_bytes = 1u;
+    ASSERT_EQ(mx_channel_read_many(channel[1], 0u, msgs, 2u, &actual), MX_OK, "");
+    EXPECT_EQ(actual, 1u, "");
+    EXPECT_EQ(msgs[0].status, MX_OK, "");
+    EXPECT_EQ(msgs[1].status, MX_ERR_BUFFER_TOO_SMALL, "");
+    EXPECT_EQ(msgs[1].num_bytes, sizeof(uint32_t), "wrong size");
+    EXPECT_EQ(mx_object_wait_one(channel[1], MX_CHANNEL_READABLE, 0u, NULL), MX_OK, "");
+
+    ASSERT_EQ(mx_channel_read_many(channel[1], 0u, &msgs[1], 1u, &actual), MX_OK, "");
+    EXPECT_EQ(actual, 1u, "");
+    EXPECT_EQ(rd_data[1], 2u, "");
+
+    // Handles stay with the writer when the peer is gone.
+    EXPECT_EQ(mx_handle_close(channel[1]), MX_OK, "");
+    msgs[0].bytes = &data[0];
+    msgs[0].num_bytes = sizeof(data[0]);
+    msgs[0].handles = &rd_handles[2];
+    msgs[0].num_handles = 1u;
+    EXPECT_EQ(mx_channel_write_many(channel[0], 0u, msgs, 1u, &actual), MX_ERR_PEER_CLOSED, "");
+    EXPECT_EQ(actual, 0u, "");
+    EXPECT_EQ(msgs[0].status, MX_ERR_PEER_CLOSED, "");
+    EXPECT_EQ(mx_handle_close(rd_handles[2]), MX_OK, "handle was lost");
+
+    EXPECT_EQ(mx_handle_close(channel[0]), MX_OK, "");
+
+    END_TEST;
+}
 
 static uint32_t call_test_done = 0;
 static mtx_t call_test_lock;
@@ -869,6 +956,7 @@ RUN_TEST(channel_non_transferable)
 RUN_TEST(channel_duplicate_handles)
 RUN_TEST(channel_multithread_read)
 RUN_TEST(channel_may_discard)
+RUN_TEST(channel_read_write_many)
 RUN_TEST(channel_call)
 RUN_TEST(channel_call2)
 RUN_TEST(bad_channel_call_finish)
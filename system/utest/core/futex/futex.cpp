@@ -526,6 +526,68 @@ static bool test_event_signaling() {
     END_TEST;
 }
 
+// Thread pairs bounce separate futex words back and forth with wait/wake,
+// checking that no wake is lost when many futexes are busy at once.
+struct PingPong {
+    alignas(64) int state;
+    uint32_t iterations;
+};
+
+static int pinger_thread(void* arg) {
+    PingPong* pp = reinterpret_cast<PingPong*>(arg);
+    for (uint32_t i = 0; i < pp->iterations; ++i) {
+        __atomic_store_n(&pp->state, 1, __ATOMIC_SEQ_CST);
+        mx_futex_wake(&pp->state, 1);
+        while (__atomic_load_n(&pp->state, __ATOMIC_SEQ_CST) == 1)
+            mx_futex_wait(&pp->state, 1, MX_TIME_INFINITE);
+    }
+    return 0;
+}
+
+static int ponger_thread(void* arg) {
+    PingPong* pp = reinterpret_cast<PingPong*>(arg);
+    for (uint32_t i = 0; i < pp->iterations; ++i) {
+        while (__atomic_load_n(&pp->state, __ATOMIC_SEQ_CST) == 0)
+            mx_futex_wait(&pp->state, 0, MX_TIME_INFINITE);
+        __atomic_store_n(&pp->state, 0, __ATOMIC_SEQ_CST);
+        mx_futex_wake(&pp->state, 1);
+    }
+    return 0;
+}
+
+static constexpr uint32_t kMaxPingPongPairs = 16u;
+
+static bool futex_ping_pong(uint32_t num_pairs) {
+    BEGIN_HELPER;
+
+    static PingPong pps[kMaxPingPongPairs];
+    thrd_t threads[kMaxPingPongPairs * 2];
+
+    for (uint32_t i = 0; i < num_pairs; ++i) {
+        pps[i].state = 0;
+        pps[i].iterations = 200u;
+        ASSERT_EQ(thrd_create_with_name(&threads[2 * i], ponger_thread, &pps[i], "ponger"),
+                  thrd_success, "");
+        ASSERT_EQ(thrd_create_with_name(&threads[2 * i + 1], pinger_thread, &pps[i], "pinger"),
+                  thrd_success, "");
+    }
+
+    for (uint32_t i = 0; i < num_pairs; ++i) {
+        ASSERT_EQ(thrd_join(threads[2 * i], NULL), thrd_success, "");
+        ASSERT_EQ(thrd_join(threads[2 * i + 1], NULL), thrd_success, "");
+        EXPECT_EQ(pps[i].state, 0, "");
+    }
+
+    END_HELPER;
+}
+
+static bool test_futex_ping_pong() {
+    BEGIN_TEST;
+    EXPECT_TRUE(futex_ping_pong(1u), "");
+    EXPECT_TRUE(futex_ping_pong(kMaxPingPongPairs), "");
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(futex_tests)
 RUN_TEST(test_futex_wait_value_mismatch);
 RUN_TEST(test_futex_wait_timeout);
@@ -545,6 +607,7 @@ RUN_TEST(test_futex_thread_killed);
 RUN_TEST(test_futex_thread_suspended);
 RUN_TEST(test_futex_misaligned);
 RUN_TEST(test_event_signaling);
+RUN_TEST(test_futex_ping_pong);
 END_TEST_CASE(futex_tests)
 
 #ifndef BUILD_COMBINED_TESTS
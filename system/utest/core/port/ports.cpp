@@ -543,6 +543,106 @@ static bool threads_event_repeat() {
     return threads_event(MX_WAIT_ASYNC_REPEATING);
 }
 
+struct packet_context {
+    mx_handle_t port;
+    uint32_t packets;
+    uint64_t received;
+};
+
+static constexpr uint64_t kStopKey = ~0ull;
+
+static int packet_producer(void* arg) {
+    auto ctx = reinterpret_cast<packet_context*>(arg);
+    mx_port_packet_t in = {};
+    in.type = MX_PKT_TYPE_USER;
+    for (uint32_t ix = 0; ix != ctx->packets; ++ix) {
+        in.key = ix;
+        auto st = mx_port_queue(ctx->port, &in, 0u);
+        if (st < 0)
+            return st;
+    }
+    return 0;
+}
+
+static int packet_consumer(void* arg) {
+    auto ctx = reinterpret_cast<packet_context*>(arg);
+    mx_port_packet_t out = {};
+    while (true) {
+        auto st = mx_port_wait(ctx->port, MX_TIME_INFINITE, &out, 0u);
+        if (st < 0)
+            return st;
+        if (out.key == kStopKey)
+            return 0;
+        ++ctx->received;
+    }
+}
+
+// Queues user packets from |producers| threads and dequeues them from
+// |consumers| threads, checking that every packet arrives exactly once.
+static bool port_producers_consumers(uint32_t producers, uint32_t consumers) {
+    BEGIN_TEST;
+    constexpr uint32_t kPacketsPerProducer = 2000u;
+
+    mx_handle_t port;
+    ASSERT_EQ(mx_port_create(0, &port), MX_OK, "");
+
+    thrd_t producer_threads[4];
+    thrd_t consumer_threads[4];
+    packet_context producer_ctx[4];
+    packet_context consumer_ctx[4];
+    ASSERT_LE(producers, mxtl::count_of(producer_threads), "");
+    ASSERT_LE(consumers, mxtl::count_of(consumer_threads), "");
+
+    for (uint32_t ix = 0; ix != consumers; ++ix) {
+        consumer_ctx[ix] = { port, 0u, 0u };
+        ASSERT_EQ(thrd_create(&consumer_threads[ix], packet_consumer, &consumer_ctx[ix]),
+                  thrd_success, "");
+    }
+    for (uint32_t ix = 0; ix != producers; ++ix) {
+        producer_ctx[ix] = { port, kPacketsPerProducer, 0u };
+        ASSERT_EQ(thrd_create(&producer_threads[ix], packet_producer, &producer_ctx[ix]),
+                  thrd_success, "");
+    }
+
+    for (uint32_t ix = 0; ix != producers; ++ix) {
+        int res;
+        EXPECT_EQ(thrd_join(producer_threads[ix], &res), thrd_success, "");
+        EXPECT_EQ(res, 0, "");
+    }
+
+    // The stop packets queue behind every other packet.
+    mx_port_packet_t stop = {};
+    stop.key = kStopKey;
+    for (uint32_t ix = 0; ix != consumers; ++ix)
+        EXPECT_EQ(mx_port_queue(port, &stop, 0u), MX_OK, "");
+
+    uint64_t received = 0u;
+    for (uint32_t ix = 0; ix != consumers; ++ix) {
+        int res;
+        EXPECT_EQ(thrd_join(consumer_threads[ix], &res), thrd_success, "");
+        EXPECT_EQ(res, 0, "");
+        received += consumer_ctx[ix].received;
+    }
+
+    EXPECT_EQ(received, static_cast<uint64_t>(producers) * kPacketsPerProducer, "");
+    EXPECT_EQ(mx_handle_close(port), MX_OK, "");
+
+    END_TEST;
+}
+
+static bool producers_consumers_test() {
+    BEGIN_TEST;
+
+    static constexpr uint32_t kThreads[] = { 1u, 4u };
+    for (auto producers : kThreads) {
+        for (auto consumers : kThreads) {
+            EXPECT_TRUE(port_producers_consumers(producers, consumers), "");
+        }
+    }
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(port_tests)
 RUN_TEST(basic_test)
 RUN_TEST(queue_and_close_test)
@@ -563,6 +663,7 @@ RUN_TEST(cancel_event_key_once_after)
 RUN_TEST(cancel_event_key_repeat_after)
 RUN_TEST(threads_event_once)
 RUN_TEST(threads_event_repeat)
+RUN_TEST(producers_consumers_test)
 END_TEST_CASE(port_tests)
 
 #ifndef BUILD_COMBINED_TESTS
@@ -45,6 +45,15 @@ inline void time_end(const char *str, uint64_t start) {
     printf("Benchmark %s: [%10lu] msec\n", str, (end - start) / ticks_per_msec);
 }
 
+// Like time_end, but also reports the throughput of moving 'bytes'.
+inline void throughput_end(const char *str, uint64_t start, size_t bytes) {
+    uint64_t end = mx_ticks_get();
+    uint64_t ticks_per_msec = mx_ticks_per_second() / 1000;
+    uint64_t msec = (end - start) / ticks_per_msec;
+    printf("Benchmark %s: [%10lu] msec, [%10lu] MB/s\n", str, msec,
+           (msec == 0) ? 0 : (bytes * 1000) / (msec * MB));
+}
+
 constexpr int kWriteReadCycles = 3;
 
 // The goal of this benchmark is to get a basic idea of some large read / write
@@ -102,6 +111,50 @@ bool benchmark_write_read(void) {
     END_TEST;
 }
 
+// Sequential throughput with large requests, through a fresh file. This is the
+// case where the filesystem can lay the file out contiguously and transfer
+// long runs of blocks at once, so it should approach the speed of the device.
+template <size_t DataSize, size_t NumOps>
+bool benchmark_sequential_throughput(void) {
+    BEGIN_TEST;
+    int fd = open(MOUNT_POINT "/seqfile", O_CREAT | O_RDWR, 0644);
+    ASSERT_GT(fd, 0, "Cannot create file (FS benchmarks assume mounted FS exists at '/benchmark')");
+    const size_t size = DataSize * NumOps;
+    if (size / MB > 64 && benchmark_banned(fd, "memfs")) {
+        ASSERT_EQ(close(fd), 0, "");
+        ASSERT_EQ(unlink(MOUNT_POINT "/seqfile"), 0, "");
+        return true;
+    }
+    printf("\nBenchmarking Sequential Throughput (%lu MB, %lu KB requests)\n",
+           size / MB, DataSize / KB);
+
+    AllocChecker ac;
+    mxtl::unique_ptr<uint8_t[]> data(new (&ac) uint8_t[DataSize]);
+    ASSERT_EQ(ac.check(), true, "");
+    memset(data.get(), kMagicByte, DataSize);
+
+    uint64_t start = mx_ticks_get();
+    for (size_t i = 0; i < NumOps; i++) {
+        ASSERT_EQ(write(fd, data.get(), DataSize), DataSize, "");
+    }
+    ASSERT_EQ(fsync(fd), 0, "");
+    throughput_end("sequential write", start, size);
+    ASSERT_EQ(close(fd), 0, "");
+
+    fd = open(MOUNT_POINT "/seqfile", O_RDONLY);
+    ASSERT_GT(fd, 0, "Cannot reopen file");
+    start = mx_ticks_get();
+    for (size_t i = 0; i < NumOps; i++) {
+        ASSERT_EQ(read(fd, data.get(), DataSize), DataSize, "");
+        ASSERT_EQ(data[DataSize - 1], kMagicByte, "");
+    }
+    throughput_end("sequential read", start, size);
+
+    ASSERT_EQ(close(fd), 0, "");
+    ASSERT_EQ(unlink(MOUNT_POINT "/seqfile"), 0, "");
+    END_TEST;
+}
+
 #define START_STRING "/aaa"
 
 size_t constexpr kComponentLength = mxtl::constexpr_strlen(START_STRING);
@@ -194,6 +247,9 @@ RUN_TEST_PERFORMANCE((benchmark_write_read<16 * KB, 2048>))
 RUN_TEST_PERFORMANCE((benchmark_write_read<16 * KB, 4096>))
 RUN_TEST_PERFORMANCE((benchmark_write_read<16 * KB, 8192>))
 RUN_TEST_PERFORMANCE((benchmark_write_read<16 * KB, 16384>))
+RUN_TEST_PERFORMANCE((benchmark_sequential_throughput<128 * KB, 512>))
+RUN_TEST_PERFORMANCE((benchmark_sequential_throughput<1 * MB, 64>))
+RUN_TEST_PERFORMANCE((benchmark_sequential_throughput<1 * MB, 256>))
 RUN_TEST_PERFORMANCE((benchmark_path_walk<125>))
 RUN_TEST_PERFORMANCE((benchmark_path_walk<250>))
 RUN_TEST_PERFORMANCE((benchmark_path_walk<500>))
@@ -271,6 +271,122 @@ static bool mount_fsck(void) {
     END_TEST;
 }
 
+// The parts of the minfs on-disk format (system/uapp/minfs/minfs.h) needed to
+// hand-build a journal entry.
+#define MINFS_BLOCK_SIZE 8192
+#define MINFS_JOURNAL_ENTRY_MAGIC 0x79746e4553466e4dULL
+
+typedef struct {
+    uint64_t magic0;
+    uint64_t magic1;
+    uint32_t version;
+    uint32_t flags;
+    uint32_t block_size;
+    uint32_t inode_size;
+    uint32_t block_count;
+    uint32_t inode_count;
+    uint32_t alloc_block_count;
+    uint32_t alloc_inode_count;
+    uint32_t ibm_block;
+    uint32_t abm_block;
+    uint32_t ino_block;
+    uint32_t dat_block;
+    uint32_t jnl_block;
+    uint32_t jnl_blocks;
+} minfs_info_t;
+
+typedef struct {
+    uint64_t magic;
+    uint64_t seq;
+    uint32_t count;
+    uint32_t reserved;
+    uint64_t checksum;
+    uint64_t sum[1];
+    uint32_t bno[1];
+} minfs_journal_entry_t;
+
+static uint64_t fnv1a64(const void* ptr, size_t len) {
+    uint64_t n = 14695981039346656037ULL;
+    const uint8_t* data = ptr;
+    while (len-- > 0) {
+        n = (n ^ (*data++)) * 1099511628211ULL;
+    }
+    return n;
+}
+
+static bool minfs_blk(int fd, uint32_t bno, void* data, bool write) {
+    off_t off = (off_t)bno * MINFS_BLOCK_SIZE;
+    ssize_t r = write ? pwrite(fd, data, MINFS_BLOCK_SIZE, off) :
+                        pread(fd, data, MINFS_BLOCK_SIZE, off);
+    ASSERT_EQ(r, MINFS_BLOCK_SIZE, "");
+    return true;
+}
+
+// Logs a good superblock in the journal but leaves a stale one at home, so
+// the filesystem is only consistent once the journal has been replayed.
+static bool fsck_dirty_journal(void) {
+    char ramdisk_path[PATH_MAX];
+    const char* mount_path = "/tmp/fsck_dirty_journal";
+    static uint8_t good[MINFS_BLOCK_SIZE];
+    static uint8_t stale[MINFS_BLOCK_SIZE];
+    static uint8_t hdr[MINFS_BLOCK_SIZE];
+
+    BEGIN_TEST;
+    ASSERT_EQ(create_ramdisk(512, 1 << 16, ramdisk_path), 0, "");
+    ASSERT_EQ(mkfs(ramdisk_path, DISK_FORMAT_MINFS, launch_stdio_sync, &default_mkfs_options), MX_OK, "");
+
+    int fd = open(ramdisk_path, O_RDWR);
+    ASSERT_GE(fd, 0, "Could not open ramdisk device");
+    ASSERT_TRUE(minfs_blk(fd, 0, good, false), "");
+    minfs_info_t info;
+    memcpy(&info, good, sizeof(info));
+    ASSERT_TRUE(minfs_blk(fd, info.jnl_block, hdr, false), "");
+    uint64_t seq;
+    memcpy(&seq, hdr + sizeof(uint64_t), sizeof(seq));
+
+    memcpy(stale, good, sizeof(stale));
+    ((minfs_info_t*)stale)->alloc_inode_count++;
+    ASSERT_TRUE(minfs_blk(fd, 0, stale, true), "");
+
+    memset(hdr, 0, sizeof(hdr));
+    minfs_journal_entry_t* entry = (minfs_journal_entry_t*)hdr;
+    entry->magic = MINFS_JOURNAL_ENTRY_MAGIC;
+    entry->seq = seq;
+    entry->count = 1;
+    entry->sum[0] = fnv1a64(good, sizeof(good));
+    entry->bno[0] = 0;
+    entry->checksum = fnv1a64(hdr, sizeof(hdr));
+    ASSERT_TRUE(minfs_blk(fd, info.jnl_block + 1, hdr, true), "");
+
+    // A torn payload is not replayed, so the stale superblock is caught.
+    ASSERT_TRUE(minfs_blk(fd, info.jnl_block + 2, stale, true), "");
+    ASSERT_EQ(close(fd), 0, "");
+    ASSERT_NEQ(fsck(ramdisk_path, DISK_FORMAT_MINFS, &default_fsck_options, launch_stdio_sync),
+               MX_OK, "");
+
+    // Once the entry is intact, fsck replays it and finds nothing wrong.
+    fd = open(ramdisk_path, O_RDWR);
+    ASSERT_GE(fd, 0, "Could not open ramdisk device");
+    ASSERT_TRUE(minfs_blk(fd, info.jnl_block + 2, good, true), "");
+    ASSERT_EQ(close(fd), 0, "");
+    ASSERT_EQ(fsck(ramdisk_path, DISK_FORMAT_MINFS, &default_fsck_options, launch_stdio_sync),
+              MX_OK, "");
+
+    // The replay was checkpointed, and the filesystem still mounts.
+    ASSERT_EQ(fsck(ramdisk_path, DISK_FORMAT_MINFS, &default_fsck_options, launch_stdio_sync),
+              MX_OK, "");
+    ASSERT_EQ(mkdir(mount_path, 0666), 0, "");
+    fd = open(ramdisk_path, O_RDWR);
+    ASSERT_GE(fd, 0, "Could not open ramdisk device");
+    ASSERT_EQ(mount(fd, mount_path, DISK_FORMAT_MINFS, &default_mount_options,
+                    launch_stdio_async),
+              MX_OK, "");
+    ASSERT_EQ(umount(mount_path), MX_OK, "");
+    ASSERT_EQ(destroy_ramdisk(ramdisk_path), 0, "");
+    ASSERT_EQ(unlink(mount_path), 0, "");
+    END_TEST;
+}
+
 static bool umount_test_evil(void) {
     char ramdisk_path[PATH_MAX];
     const char* mount_path = "/tmp/umount_test_evil";
@@ -376,6 +492,7 @@ RUN_TEST_MEDIUM(mount_evil_minfs)
 RUN_TEST_MEDIUM(umount_test_evil)
 RUN_TEST_MEDIUM(mount_remount)
 RUN_TEST_MEDIUM(mount_fsck)
+RUN_TEST_MEDIUM(fsck_dirty_journal)
 RUN_TEST_MEDIUM(mount_get_device)
 END_TEST_CASE(fs_management_tests)
 
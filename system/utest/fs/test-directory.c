@@ -5,6 +5,7 @@
 #include <assert.h>
 #include <dirent.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -15,6 +16,7 @@
 #include <unistd.h>
 
 #include <magenta/compiler.h>
+#include <magenta/syscalls.h>
 
 #include "filesystems.h"
 #include "misc.h"
@@ -74,6 +76,55 @@ bool test_directory_large(void) {
     END_TEST;
 }
 
+// Reports how long lookups of present and absent names take as a directory
+// grows; with an indexed directory, neither should depend on its size.
+bool test_directory_lookup_latency(void) {
+    BEGIN_TEST;
+
+    const int sizes[] = {256, 1024, 4096, 16384};
+    const int num_lookups = 1024;
+    char path[PATH_MAX];
+    struct stat s;
+
+    ASSERT_EQ(mkdir("::lookup", 0755), 0, "");
+    int num_files = 0;
+    for (size_t i = 0; i < countof(sizes); i++) {
+        for (; num_files < sizes[i]; num_files++) {
+            snprintf(path, sizeof(path), "::lookup/%08d", num_files);
+            int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+            ASSERT_GT(fd, 0, "");
+            ASSERT_EQ(close(fd), 0, "");
+        }
+
+        mx_time_t start = mx_time_get(MX_CLOCK_MONOTONIC);
+        for (int j = 0; j < num_lookups; j++) {
+            // Spread the lookups across the whole directory
+            snprintf(path, sizeof(path), "::lookup/%08d", (j * 7919) % num_files);
+            ASSERT_EQ(stat(path, &s), 0, "");
+        }
+        mx_time_t hit = mx_time_get(MX_CLOCK_MONOTONIC) - start;
+
+        start = mx_time_get(MX_CLOCK_MONOTONIC);
+        for (int j = 0; j < num_lookups; j++) {
+            snprintf(path, sizeof(path), "::lookup/missing%08d", j);
+            ASSERT_EQ(stat(path, &s), -1, "");
+        }
+        mx_time_t miss = mx_time_get(MX_CLOCK_MONOTONIC) - start;
+
+        printf("\n    %6d entries: %8" PRIu64 " ns per hit, %8" PRIu64 " ns per miss",
+               num_files, hit / num_lookups, miss / num_lookups);
+    }
+    printf("\n");
+
+    for (int i = 0; i < num_files; i++) {
+        snprintf(path, sizeof(path), "::lookup/%08d", i);
+        ASSERT_EQ(unlink(path), 0, "");
+    }
+    ASSERT_EQ(rmdir("::lookup"), 0, "");
+
+    END_TEST;
+}
+
 bool test_directory_max(void) {
     BEGIN_TEST;
 
@@ -403,6 +454,7 @@ RUN_FOR_ALL_FILESYSTEMS(directory_tests,
     RUN_TEST_MEDIUM(test_directory_coalesce)
     RUN_TEST_MEDIUM(test_directory_filename_max)
     RUN_TEST_LARGE(test_directory_large)
+    RUN_TEST_LARGE(test_directory_lookup_latency)
     RUN_TEST_MEDIUM(test_directory_trailing_slash)
     RUN_TEST_MEDIUM(test_directory_readdir)
     RUN_TEST_MEDIUM(test_directory_readdir_rm_all)
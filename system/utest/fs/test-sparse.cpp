@@ -6,6 +6,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -78,6 +79,40 @@ bool test_sparse(void) {
 constexpr size_t kBlockSize = 8192;
 constexpr size_t kDirectBlocks = 16;
 
+// Write every other block, so that each one is a separate run, until there
+// are more runs than minfs can describe with extents; then fill the gaps.
+bool test_sparse_fragmented(void) {
+    BEGIN_TEST;
+
+    constexpr int kBlocks = 2048;
+    int fd = open("::my_file", O_RDWR | O_CREAT, 0644);
+    ASSERT_GT(fd, 0, "");
+    uint8_t data[kBlockSize];
+    memset(data, 0, sizeof(data));
+    for (int pass = 0; pass < 2; pass++) {
+        for (int n = pass; n < kBlocks; n += 2) {
+            memcpy(data, &n, sizeof(n));
+            ASSERT_EQ(pwrite(fd, data, sizeof(data), n * kBlockSize), (ssize_t)sizeof(data), "");
+        }
+    }
+
+    // Reopen file
+    ASSERT_EQ(close(fd), 0, "");
+    fd = open("::my_file", O_RDWR, 0644);
+    ASSERT_GT(fd, 0, "");
+    for (int n = 0; n < kBlocks; n++) {
+        int tag;
+        ASSERT_EQ(pread(fd, data, sizeof(data), n * kBlockSize), (ssize_t)sizeof(data), "");
+        memcpy(&tag, data, sizeof(tag));
+        ASSERT_EQ(tag, n, "");
+    }
+
+    // Clean up
+    ASSERT_EQ(close(fd), 0, "");
+    ASSERT_EQ(unlink("::my_file"), 0, "");
+    END_TEST;
+}
+
 RUN_FOR_ALL_FILESYSTEMS(sparse_tests,
     RUN_TEST_MEDIUM((test_sparse<0, 0, kBlockSize>))
     RUN_TEST_MEDIUM((test_sparse<kBlockSize / 2, 0, kBlockSize>))
@@ -97,4 +132,5 @@ RUN_FOR_ALL_FILESYSTEMS(sparse_tests,
     RUN_TEST_MEDIUM((test_sparse<kBlockSize * kDirectBlocks + kBlockSize,
                                  kBlockSize * kDirectBlocks + 2 * kBlockSize,
                                  kBlockSize * 32>))
+    RUN_TEST_MEDIUM(test_sparse_fragmented)
 )
@@ -5,9 +5,12 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <magenta/device/vfs.h>
+
 #include "filesystems.h"
 #include "misc.h"
 
@@ -39,6 +42,54 @@ bool test_sync(void) {
     END_TEST;
 }
 
+// Filesystems with a block cache should serve repeated reads from it, and
+// should have written back every dirty block once a sync completes. The
+// read-ahead counters are checked by the minfs host tests ("minfs test
+// cache"), since minfs on Fuchsia reads file data through vnode VMOs.
+bool test_sync_cache_stats(void) {
+    BEGIN_TEST;
+
+    int fd = open("::alpha", O_RDWR | O_CREAT | O_EXCL, 0644);
+    ASSERT_GT(fd, 0, "");
+    vfs_cache_stats_t stats;
+    if (ioctl_vfs_get_cache_stats(fd, &stats) < 0) {
+        // Not all filesystems cache blocks
+        ASSERT_EQ(close(fd), 0, "");
+        ASSERT_EQ(unlink("::alpha"), 0, "");
+        return true;
+    }
+    ASSERT_LE(stats.dirty_blocks, stats.capacity_blocks, "");
+
+    char buf[8192 * 3 + 17];
+    memset(buf, 'a', sizeof(buf));
+    ASSERT_STREAM_ALL(write, fd, buf, sizeof(buf));
+
+    // Written data is visible to a read before anything is flushed
+    char out[sizeof(buf)];
+    ASSERT_EQ(pread(fd, out, sizeof(out), 0), (ssize_t)sizeof(out), "");
+    ASSERT_EQ(memcmp(buf, out, sizeof(buf)), 0, "");
+
+    // Reading the same range again does not go back to the disk
+    vfs_cache_stats_t before;
+    ASSERT_EQ(ioctl_vfs_get_cache_stats(fd, &before), (ssize_t)sizeof(before), "");
+    ASSERT_EQ(pread(fd, out, sizeof(out), 0), (ssize_t)sizeof(out), "");
+    ASSERT_EQ(ioctl_vfs_get_cache_stats(fd, &stats), (ssize_t)sizeof(stats), "");
+    ASSERT_EQ(stats.misses, before.misses, "");
+    ASSERT_EQ(stats.readahead_blocks, before.readahead_blocks, "");
+
+    // Shrinking to a partial block rewrites the block it ends within
+    ASSERT_EQ(ftruncate(fd, 8192 + 100), 0, "");
+    ASSERT_EQ(fsync(fd), 0, "");
+    ASSERT_EQ(ioctl_vfs_get_cache_stats(fd, &stats), (ssize_t)sizeof(stats), "");
+    ASSERT_EQ(stats.dirty_blocks, 0u, "");
+
+    ASSERT_EQ(close(fd), 0, "");
+    ASSERT_EQ(unlink("::alpha"), 0, "");
+
+    END_TEST;
+}
+
 RUN_FOR_ALL_FILESYSTEMS(sync_tests,
     RUN_TEST_MEDIUM(test_sync)
+    RUN_TEST_MEDIUM(test_sync_cache_stats)
 )
@@ -86,6 +86,48 @@ bool test_truncate_small(void) {
     END_TEST;
 }
 
+// Test that a read-only descriptor keeps up with writes and truncates made
+// through another one, even once it reads without asking the filesystem
+bool test_truncate_readonly_view(void) {
+    BEGIN_TEST;
+
+    const char* str = "Hello, World!\n";
+    const char* filename = "::alpha";
+    char buf[32];
+
+    int fd = open(filename, O_RDWR | O_CREAT, 0644);
+    ASSERT_GT(fd, 0, "");
+    ASSERT_STREAM_ALL(write, fd, str, 5);
+    int rfd = open(filename, O_RDONLY, 0644);
+    ASSERT_GT(rfd, 0, "");
+    ASSERT_EQ(read(rfd, buf, sizeof(buf)), 5, "");
+    ASSERT_EQ(memcmp(buf, str, 5), 0, "");
+
+    // Growing the file is visible at the reader's offset
+    ASSERT_STREAM_ALL(write, fd, str + 5, strlen(str) - 5);
+    ASSERT_EQ(read(rfd, buf, sizeof(buf)), (ssize_t)(strlen(str) - 5), "");
+    ASSERT_EQ(memcmp(buf, str + 5, strlen(str) - 5), 0, "");
+    ASSERT_EQ(lseek(rfd, 0, SEEK_END), (off_t)strlen(str), "");
+
+    // Overwriting in place is visible without a size change
+    ASSERT_EQ(pwrite(fd, "J", 1, 0), 1, "");
+    ASSERT_EQ(pread(rfd, buf, 1, 0), 1, "");
+    ASSERT_EQ(buf[0], 'J', "");
+
+    // Shrinking the file cuts reads short
+    ASSERT_EQ(ftruncate(fd, 3), 0, "");
+    ASSERT_EQ(pread(rfd, buf, sizeof(buf), 0), 3, "");
+    ASSERT_EQ(lseek(rfd, 1, SEEK_SET), 1, "");
+    ASSERT_EQ(read(rfd, buf, sizeof(buf)), 2, "");
+    ASSERT_EQ(memcmp(buf, str + 1, 2), 0, "");
+
+    ASSERT_EQ(close(rfd), 0, "");
+    ASSERT_EQ(close(fd), 0, "");
+    ASSERT_EQ(unlink(filename), 0, "");
+
+    END_TEST;
+}
+
 template <bool Remount>
 bool checked_truncate(const char* filename, uint8_t* u8, ssize_t new_len) {
     // Acquire the old size
@@ -185,6 +227,7 @@ bool test_truncate_large(void) {
 
 RUN_FOR_ALL_FILESYSTEMS(truncate_tests,
     RUN_TEST_MEDIUM(test_truncate_small)
+    RUN_TEST_MEDIUM(test_truncate_readonly_view)
     RUN_TEST_MEDIUM((test_truncate_large<1 << 10, 100, false>))
     RUN_TEST_MEDIUM((test_truncate_large<1 << 15, 50, false>))
     RUN_TEST_LARGE((test_truncate_large<1 << 20, 50, false>))
@@ -138,6 +138,10 @@ public:
     static void RecordEraseRotation()           { ++op_counts_.erase_rotations_; }
     static void RecordEraseDoubleRotation()     { ++op_counts_.erase_double_rotations_; }
 
+    template <typename Iter> static void RecordInsertLinked(Iter node)            { }
+    template <typename Iter> static void RecordRotation(Iter lowered, Iter raised) { }
+    template <typename Iter> static void RecordEraseUnlinked(Iter node)           { }
+
     template <typename TreeType>
     static bool VerifyRankRule(const TreeType& tree, typename TreeType::RawPtrType node) {
         BEGIN_TEST;
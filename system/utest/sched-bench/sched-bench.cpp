@@ -0,0 +1,180 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <threads.h>
+
+#include <magenta/syscalls.h>
+#include <unittest/unittest.h>
+
+// Measures how quickly the scheduler wakes a blocked thread and how many
+// thread switches per second a set of ping-ponging thread pairs sustain.
+
+static constexpr int kWakeups = 2000;
+static constexpr int kRoundTrips = 20000;
+static constexpr uint32_t kMaxPairs = 16;
+
+static uint64_t ticks_to_ns(uint64_t ticks) {
+    return static_cast<uint64_t>(static_cast<double>(ticks) * 1e9 /
+                                 static_cast<double>(mx_ticks_per_second()));
+}
+
+struct wakeup_state {
+    mx_handle_t wake;
+    mx_handle_t ack;
+    uint64_t signal_ticks;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+};
+
+static int wakeup_thread(void* arg) {
+    wakeup_state* state = static_cast<wakeup_state*>(arg);
+
+    for (int i = 0; i < kWakeups; i++) {
+        if (mx_object_wait_one(state->wake, MX_USER_SIGNAL_0, MX_TIME_INFINITE, NULL) != MX_OK)
+            return -1;
+        uint64_t now = mx_ticks_get();
+        uint64_t latency = now - __atomic_load_n(&state->signal_ticks, __ATOMIC_ACQUIRE);
+
+        state->total += latency;
+        if (latency < state->min)
+            state->min = latency;
+        if (latency > state->max)
+            state->max = latency;
+
+        mx_object_signal(state->wake, MX_USER_SIGNAL_0, 0);
+        mx_object_signal(state->ack, 0, MX_USER_SIGNAL_0);
+    }
+
+    return 0;
+}
+
+static bool wakeup_latency() {
+    BEGIN_TEST;
+
+    wakeup_state state = {};
+    state.min = UINT64_MAX;
+    ASSERT_EQ(mx_event_create(0, &state.wake), MX_OK, "");
+    ASSERT_EQ(mx_event_create(0, &state.ack), MX_OK, "");
+
+    thrd_t thread;
+    ASSERT_EQ(thrd_create_with_name(&thread, wakeup_thread, &state, "wakeup"), thrd_success, "");
+
+    for (int i = 0; i < kWakeups; i++) {
+        // give the waiter time to block so each signal is a real wakeup
+        mx_nanosleep(mx_deadline_after(MX_USEC(100)));
+
+        __atomic_store_n(&state.signal_ticks, mx_ticks_get(), __ATOMIC_RELEASE);
+        ASSERT_EQ(mx_object_signal(state.wake, 0, MX_USER_SIGNAL_0), MX_OK, "");
+        ASSERT_EQ(mx_object_wait_one(state.ack, MX_USER_SIGNAL_0, MX_TIME_INFINITE, NULL),
+                  MX_OK, "");
+        ASSERT_EQ(mx_object_signal(state.ack, MX_USER_SIGNAL_0, 0), MX_OK, "");
+    }
+
+    int ret;
+    ASSERT_EQ(thrd_join(thread, &ret), thrd_success, "");
+    EXPECT_EQ(ret, 0, "");
+
+    printf("\nwakeup latency: avg %" PRIu64 " ns, min %" PRIu64 " ns, max %" PRIu64 " ns\n",
+           ticks_to_ns(state.total / kWakeups), ticks_to_ns(state.min), ticks_to_ns(state.max));
+
+    mx_handle_close(state.wake);
+    mx_handle_close(state.ack);
+
+    END_TEST;
+}
+
+struct pingpong_state {
+    mx_handle_t ping;
+    mx_handle_t pong;
+};
+
+static int pong_thread(void* arg) {
+    pingpong_state* state = static_cast<pingpong_state*>(arg);
+
+    for (int i = 0; i < kRoundTrips; i++) {
+        if (mx_object_wait_one(state->ping, MX_USER_SIGNAL_0, MX_TIME_INFINITE, NULL) != MX_OK)
+            return -1;
+        mx_object_signal(state->ping, MX_USER_SIGNAL_0, 0);
+        mx_object_signal(state->pong, 0, MX_USER_SIGNAL_0);
+    }
+
+    return 0;
+}
+
+static int ping_thread(void* arg) {
+    pingpong_state* state = static_cast<pingpong_state*>(arg);
+
+    for (int i = 0; i < kRoundTrips; i++) {
+        mx_object_signal(state->ping, 0, MX_USER_SIGNAL_0);
+        if (mx_object_wait_one(state->pong, MX_USER_SIGNAL_0, MX_TIME_INFINITE, NULL) != MX_OK)
+            return -1;
+        mx_object_signal(state->pong, MX_USER_SIGNAL_0, 0);
+    }
+
+    return 0;
+}
+
+// runs |pairs| ping-pong thread pairs at once, each round trip is two switches
+static bool run_pingpong(uint32_t pairs) {
+    BEGIN_HELPER;
+
+    pingpong_state states[kMaxPairs];
+    thrd_t threads[kMaxPairs * 2];
+
+    for (uint32_t i = 0; i < pairs; i++) {
+        ASSERT_EQ(mx_event_create(0, &states[i].ping), MX_OK, "");
+        ASSERT_EQ(mx_event_create(0, &states[i].pong), MX_OK, "");
+    }
+
+    uint64_t start = mx_ticks_get();
+    for (uint32_t i = 0; i < pairs; i++) {
+        ASSERT_EQ(thrd_create_with_name(&threads[2 * i], pong_thread, &states[i], "pong"),
+                  thrd_success, "");
+        ASSERT_EQ(thrd_create_with_name(&threads[2 * i + 1], ping_thread, &states[i], "ping"),
+                  thrd_success, "");
+    }
+    for (uint32_t i = 0; i < pairs * 2; i++) {
+        int ret;
+        ASSERT_EQ(thrd_join(threads[i], &ret), thrd_success, "");
+        EXPECT_EQ(ret, 0, "");
+    }
+    uint64_t ns = ticks_to_ns(mx_ticks_get() - start);
+
+    uint64_t switches = 2ull * kRoundTrips * pairs;
+    printf("%2u pairs: %8" PRIu64 " switches/s, %6" PRIu64 " ns per round trip\n",
+           pairs, ns ? switches * 1000000000ull / ns : 0, ns / kRoundTrips);
+
+    for (uint32_t i = 0; i < pairs; i++) {
+        mx_handle_close(states[i].ping);
+        mx_handle_close(states[i].pong);
+    }
+
+    END_HELPER;
+}
+
+static bool context_switch_throughput() {
+    BEGIN_TEST;
+
+    uint32_t cpus = mx_system_get_num_cpus();
+    printf("\n");
+    for (uint32_t pairs = 1; pairs <= kMaxPairs && pairs <= cpus; pairs *= 2)
+        ASSERT_TRUE(run_pingpong(pairs), "");
+    if (cpus > 1 && cpus < kMaxPairs)
+        ASSERT_TRUE(run_pingpong(cpus), "");
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(sched_bench)
+RUN_TEST(wakeup_latency)
+RUN_TEST(context_switch_throughput)
+END_TEST_CASE(sched_bench)
+
+int main(int argc, char** argv) {
+    bool success = unittest_run_all_tests(argc, argv);
+    return success ? 0 : -1;
+}
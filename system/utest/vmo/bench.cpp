@@ -7,12 +7,14 @@
 #include <inttypes.h>
 #include <sys/types.h>
 #include <stdlib.h>
+#include <threads.h>
 #include <unistd.h>
 
 #include <magenta/compiler.h>
 #include <magenta/process.h>
 #include <magenta/syscalls.h>
 #include <mxtl/algorithm.h>
+#include <mxtl/atomic.h>
 
 #include "bench.h"
 
@@ -33,6 +35,76 @@ inline mx_time_t time_it(T func) {
     return mx_time_get(MX_CLOCK_MONOTONIC) - t;
 }
 
+// state shared by the threads of the concurrent fault benchmark.  Each thread
+// write faults its own vmo, so the faults only contend on the address space.
+struct fault_thread_args {
+    uintptr_t ptr;
+    size_t size;
+    mxtl::atomic<uint32_t>* ready;
+    mxtl::atomic<int>* go;
+};
+
+static int fault_thread(void* arg) {
+    auto args = static_cast<fault_thread_args*>(arg);
+
+    args->ready->fetch_add(1);
+    while (!args->go->load())
+        ;
+
+    for (size_t i = 0; i < args->size; i += PAGE_SIZE) {
+        ((volatile char *)args->ptr)[i] = 99;
+    }
+    return 0;
+}
+
+static const uint32_t kMaxFaultThreads = 64;
+
+// fault in |size| bytes spread across |num_threads| threads of this process
+static mx_time_t concurrent_fault(uint32_t num_threads, size_t size) {
+    if (num_threads > kMaxFaultThreads) {
+        __builtin_trap();
+    }
+    const size_t per_thread = size / num_threads;
+    fault_thread_args args[kMaxFaultThreads];
+    thrd_t threads[kMaxFaultThreads];
+    mx_handle_t vmos[kMaxFaultThreads];
+    mxtl::atomic<uint32_t> ready(0);
+    mxtl::atomic<int> go(0);
+
+    for (uint32_t i = 0; i < num_threads; i++) {
+        if (mx_vmo_create(per_thread, 0, &vmos[i]) != MX_OK) {
+            __builtin_trap();
+        }
+        if (mx_vmar_map(mx_vmar_root_self(), 0, vmos[i], 0, per_thread,
+                        MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &args[i].ptr) != MX_OK) {
+            __builtin_trap();
+        }
+        args[i].size = per_thread;
+        args[i].ready = &ready;
+        args[i].go = &go;
+        if (thrd_create(&threads[i], fault_thread, &args[i]) != thrd_success) {
+            __builtin_trap();
+        }
+    }
+
+    while (ready.load() != num_threads)
+        thrd_yield();
+
+    mx_time_t t = time_it([&](){
+        go.store(1);
+        for (uint32_t i = 0; i < num_threads; i++) {
+            thrd_join(threads[i], nullptr);
+        }
+    });
+
+    for (uint32_t i = 0; i < num_threads; i++) {
+        mx_vmar_unmap(mx_vmar_root_self(), args[i].ptr, per_thread);
+        mx_handle_close(vmos[i]);
+    }
+
+    return t;
+}
+
 int vmo_run_benchmark() {
     mx_time_t t;
     //mx_handle_t vmo;
@@ -175,6 +247,15 @@ int vmo_run_benchmark() {
 
     mx_handle_close(vmo);
 
+    // write fault the same amount of memory from more and more threads at once
+    const uint32_t cpus = mx_system_get_num_cpus();
+    const uint32_t max_threads = mxtl::min(mxtl::max(cpus, 4u), kMaxFaultThreads);
+    for (uint32_t num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+        t = concurrent_fault(num_threads, size);
+        printf("\ttook %" PRIu64 " nsecs to write fault in %zu bytes of vmos from %u threads\n",
+               t, size, num_threads);
+    }
+
     printf("done with benchmark\n");
 
     return 0;
@@ -5,7 +5,6 @@ LOCAL_SRCS += \
     $(GET_LOCAL_DIR)/index.c \
     $(GET_LOCAL_DIR)/memccpy.c \
     $(GET_LOCAL_DIR)/memchr.c \
-    $(GET_LOCAL_DIR)/memcmp.c \
     $(GET_LOCAL_DIR)/memmem.c \
     $(GET_LOCAL_DIR)/memrchr.c \
     $(GET_LOCAL_DIR)/rindex.c \
@@ -23,7 +22,6 @@ LOCAL_SRCS += \
     $(GET_LOCAL_DIR)/strerror_r.c \
     $(GET_LOCAL_DIR)/strlcat.c \
     $(GET_LOCAL_DIR)/strlcpy.c \
-    $(GET_LOCAL_DIR)/strlen.c \
     $(GET_LOCAL_DIR)/strncasecmp.c \
     $(GET_LOCAL_DIR)/strncat.c \
     $(GET_LOCAL_DIR)/strncmp.c \
@@ -69,24 +67,30 @@ LOCAL_SRCS += \
 
 ifeq ($(ARCH),arm64)
 LOCAL_SRCS += \
+    $(GET_LOCAL_DIR)/memcmp.c \
     $(GET_LOCAL_DIR)/memcpy.c \
     $(GET_LOCAL_DIR)/memmove.c \
     $(GET_LOCAL_DIR)/mempcpy.c \
     $(GET_LOCAL_DIR)/memset.c \
+    $(GET_LOCAL_DIR)/strlen.c \
 
 else ifeq ($(SUBARCH),x86-64)
 LOCAL_SRCS += \
+    $(GET_LOCAL_DIR)/memcmp.c \
     $(GET_LOCAL_DIR)/x86_64/memcpy.S \
     $(GET_LOCAL_DIR)/x86_64/memmove.S \
     $(GET_LOCAL_DIR)/x86_64/mempcpy.S \
     $(GET_LOCAL_DIR)/x86_64/memset.S \
+    $(GET_LOCAL_DIR)/strlen.c \
 
 else ifeq ($(SUBARCH),riscv-rv64)
 LOCAL_SRCS += \
-    $(GET_LOCAL_DIR)/memcpy.c \
-    $(GET_LOCAL_DIR)/memmove.c \
     $(GET_LOCAL_DIR)/mempcpy.c \
     $(GET_LOCAL_DIR)/memset.c \
+    $(GET_LOCAL_DIR)/riscv-rv64/memcmp.S \
+    $(GET_LOCAL_DIR)/riscv-rv64/memcpy.S \
+    $(GET_LOCAL_DIR)/riscv-rv64/memmove.S \
+    $(GET_LOCAL_DIR)/riscv-rv64/strlen.S \
 
 else
 error Unsupported architecture for musl build!